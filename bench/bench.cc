@@ -0,0 +1,1204 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "blueprint.h"
+#include "chunk.h"
+#include "draw.h"
+#include "evaluate.h"
+#include "generate.h"
+#include "history.h"
+#include "layout.h"
+#include "machine.h"
+#include "morton.h"
+#include "occupancy.h"
+#include "pipe.h"
+#include "replay.h"
+#include "route.h"
+#include "state.h"
+#include "telemetry.h"
+
+// ALLOCATION COUNTER
+
+static std::atomic<uint64_t> g_allocations{0};
+
+// 置き換えた new と delete はすべてここを通し, 確保と解放の組を揃える
+static void* allocate(const std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* pointer = std::malloc(size == 0 ? 1 : size)) return pointer;
+  throw std::bad_alloc();
+}
+
+static void release(void* pointer) { std::free(pointer); }
+
+static void* allocate_aligned(const std::size_t size,
+                              const std::align_val_t alignment) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto align = static_cast<std::size_t>(alignment);
+#if defined(_MSC_VER)
+  void* pointer = _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+  // aligned_alloc は align の倍数の大きさしか受け付けない
+  const std::size_t rounded = std::max<std::size_t>(
+      (size + align - 1) / align * align, align);
+  void* pointer = std::aligned_alloc(align, rounded);
+#endif
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+static void release_aligned(void* pointer) {
+#if defined(_MSC_VER)
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+
+void* operator new(const std::size_t size) { return allocate(size); }
+
+void* operator new[](const std::size_t size) { return allocate(size); }
+
+void* operator new(const std::size_t size, const std::align_val_t alignment) {
+  return allocate_aligned(size, alignment);
+}
+
+void* operator new[](const std::size_t size,
+                     const std::align_val_t alignment) {
+  return allocate_aligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept { release(pointer); }
+
+void operator delete[](void* pointer) noexcept { release(pointer); }
+
+void operator delete(void* pointer, std::size_t) noexcept { release(pointer); }
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  release(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t,
+                       std::align_val_t) noexcept {
+  release_aligned(pointer);
+}
+
+namespace factory_game {
+
+// 端末へ出力されるはずのバイト数だけを数えて捨てる
+class CountingStreambuf : public std::streambuf {
+ public:
+  uint64_t count = 0;
+
+ protected:
+  int overflow(const int c) override {
+    count++;
+    return c;
+  }
+
+  std::streamsize xsputn(const char*, const std::streamsize n) override {
+    count += n;
+    return n;
+  }
+};
+
+static CountingStreambuf g_emitted;
+
+// RUNNER
+
+struct BenchmarkResult {
+  std::string name;
+  std::vector<std::pair<std::string, long>> params;
+  uint64_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+  // false : run_timed_benchmark の結果, allocs_per_op と bytes_per_op は無い
+  bool is_counted;
+};
+
+struct BenchmarkOptions {
+  std::string filter;
+  double min_time_ms = 200.0;
+};
+
+// op(n) は n 回分の処理を行う, 準備は op の外で済ませる
+// 初回だけの処理を除くため 1 回空回ししてから,
+// 経過時間が min_time_ms を超えるまで回数を倍にして測り直す
+static bool run_benchmark(
+    const BenchmarkOptions& options, const std::string& name,
+    std::vector<std::pair<std::string, long>> params,
+    const std::function<void(uint64_t)>& op,
+    std::vector<BenchmarkResult>* results) {
+  if (name.find(options.filter) == std::string::npos) return false;
+
+  op(1);
+  for (uint64_t iterations = 1;; iterations *= 2) {
+    const uint64_t allocations = g_allocations.load();
+    const uint64_t emitted = g_emitted.count;
+    const auto begin = std::chrono::steady_clock::now();
+    op(iterations);
+    const auto end = std::chrono::steady_clock::now();
+
+    const double elapsed_ns =
+        std::chrono::duration<double, std::nano>(end - begin).count();
+    if (elapsed_ns < options.min_time_ms * 1e6 && iterations < (1ull << 40))
+      continue;
+
+    results->push_back(BenchmarkResult{
+        name, std::move(params), iterations, elapsed_ns / iterations,
+        static_cast<double>(g_allocations.load() - allocations) / iterations,
+        static_cast<double>(g_emitted.count - emitted) / iterations, true});
+
+    std::cerr << name;
+    for (const auto& [key, value] : results->back().params) {
+      std::cerr << " " << key << "=" << value;
+    }
+    std::cerr << " : " << results->back().ns_per_op << " ns/op" << std::endl;
+    return true;
+  }
+}
+
+// 準備の重い処理用, op は 1 回分を行い計測した区間の ns を返す
+static void run_timed_benchmark(
+    const BenchmarkOptions& options, const std::string& name,
+    std::vector<std::pair<std::string, long>> params, const int repeat,
+    const std::function<double()>& op, std::vector<BenchmarkResult>* results) {
+  if (name.find(options.filter) == std::string::npos) return;
+
+  double elapsed_ns = 0;
+  for (int i = 0; i < repeat; ++i) elapsed_ns += op();
+
+  results->push_back(BenchmarkResult{name, std::move(params),
+                                     static_cast<uint64_t>(repeat),
+                                     elapsed_ns / repeat, 0, 0, false});
+  std::cerr << name;
+  for (const auto& [key, value] : results->back().params) {
+    std::cerr << " " << key << "=" << value;
+  }
+  std::cerr << " : " << results->back().ns_per_op << " ns/op" << std::endl;
+}
+
+static void write_json(std::ostream& stream,
+                       const BenchmarkOptions& options,
+                       const std::vector<BenchmarkResult>& results) {
+  stream << "{\n  \"min_time_ms\": " << options.min_time_ms
+         << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    stream << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+           << "\", \"params\": {";
+    for (size_t j = 0; j < result.params.size(); ++j) {
+      stream << (j == 0 ? "" : ", ") << "\"" << result.params[j].first
+             << "\": " << result.params[j].second;
+    }
+    stream << "}, \"iterations\": " << result.iterations
+           << ", \"ns_per_op\": " << result.ns_per_op;
+    if (result.is_counted) {
+      stream << ", \"allocs_per_op\": " << result.allocs_per_op
+             << ", \"bytes_per_op\": " << result.bytes_per_op;
+    }
+    stream << "}";
+  }
+  stream << "\n  ]\n}\n";
+}
+
+// LAYOUT
+
+// 生成レイアウト, density は区画のうち系統を置く割合 (%)
+static GeneratedLayout make_layout(const int count, const int density) {
+  GenerateOptions options;
+  options.machine_count = count;
+  options.density = density / 100.0f;
+  return generate_layout(options);
+}
+
+// 長さ length のパイプだけを並べる, L 字は 2 行を使い同じセル数を占める
+static std::vector<std::shared_ptr<Pipe>> make_pipes(const int count,
+                                                     const int length,
+                                                     const bool l_shape) {
+  const int columns = std::max(1, 4096 / (length + 1));
+
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  pipes.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    const auto point = glm::ivec2(i % columns * (length + 1), i / columns * 3);
+    if (l_shape) {
+      pipes.push_back(std::make_shared<Pipe>(
+          point, point + glm::ivec2(length - 2, 1)));
+    } else {
+      pipes.push_back(
+          std::make_shared<Pipe>(point, point + glm::ivec2(length - 1, 0)));
+    }
+  }
+  return pipes;
+}
+
+// 当たりと外れが混ざるよう, レイアウト全体から一様に選ぶ
+static std::vector<glm::ivec2> make_queries(const glm::ivec2 size) {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> x_dist(0, size.x - 1);
+  std::uniform_int_distribution<int> y_dist(0, size.y - 1);
+
+  std::vector<glm::ivec2> queries(4096);
+  for (auto& query : queries) query = glm::ivec2(x_dist(rng), y_dist(rng));
+  return queries;
+}
+
+// BENCHMARKS
+
+static void bench_present(const BenchmarkOptions& options,
+                          std::vector<BenchmarkResult>* results) {
+#if defined(__linux__)
+  DrawManagerLinux draw_manager;
+  const int width = draw_manager.get_width();
+  const int cells = width * draw_manager.get_height();
+
+  for (const int changed : {0, cells / 100, cells / 10, cells}) {
+    bool flip = false;
+    run_benchmark(options, "present", {{"changed_cells", changed}},
+                  [&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                      flip = !flip;
+                      for (int k = 0; k < changed; ++k) {
+                        draw_manager.draw_label(k % width, k / width,
+                                                flip ? "a" : "b");
+                      }
+                      draw_manager.present();
+                    }
+                  },
+                  results);
+  }
+#endif
+}
+
+static void bench_machine_manager(const BenchmarkOptions& options,
+                                  std::vector<BenchmarkResult>* results) {
+  for (const int count : {1000, 10000, 100000}) {
+    for (const int density : {20, 100}) {
+      const auto layout = make_layout(count, density);
+      MachineManager manager;
+      manager.add_machines(layout.machines);
+
+      run_benchmark(options, "machine_build_spatial_idx",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      for (uint64_t i = 0; i < n; ++i) {
+                        manager.build_spatial_idx();
+                      }
+                    },
+                    results);
+
+      const auto queries = make_queries(layout.size);
+      run_benchmark(options, "find_machine",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      size_t hits = 0;
+                      for (uint64_t i = 0; i < n; ++i) {
+                        hits += manager.find_machine(queries[i & 4095]) !=
+                                nullptr;
+                      }
+                      if (hits > n) std::abort();
+                    },
+                    results);
+
+      // 置く前の重なり判定, 空間インデックスを 1 セルずつ引く場合と比べる
+      PipeManager pipe_manager;
+      pipe_manager.add_pipes(layout.pipes);
+      run_benchmark(options, "place_check/hash",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      size_t hits = 0;
+                      for (uint64_t i = 0; i < n; ++i) {
+                        const auto point = queries[i & 4095];
+                        for (int x = 0; x < MACHINE_WIDTH; ++x) {
+                          const auto cell = point + glm::ivec2(x, 0);
+                          if (manager.find_machine(cell) != nullptr ||
+                              pipe_manager.find_pipe(cell) != nullptr) {
+                            hits++;
+                            break;
+                          }
+                        }
+                      }
+                      if (hits > n) std::abort();
+                    },
+                    results);
+
+      run_benchmark(options, "place_check/bitset",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      size_t hits = 0;
+                      for (uint64_t i = 0; i < n; ++i) {
+                        const auto point = queries[i & 4095];
+                        hits += manager.get_occupancy().test_span(
+                                    point.x, point.y, MACHINE_WIDTH) ||
+                                pipe_manager.get_occupancy().test_span(
+                                    point.x, point.y, MACHINE_WIDTH);
+                      }
+                      if (hits > n) std::abort();
+                    },
+                    results);
+
+      run_benchmark(options, "find_free_span",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      int64_t sum = 0;
+                      for (uint64_t i = 0; i < n; ++i) {
+                        const auto point = queries[i & 4095];
+                        int x = 0;
+                        find_free_span({&manager.get_occupancy(),
+                                        &pipe_manager.get_occupancy()},
+                                       point.x, point.y, MACHINE_WIDTH,
+                                       INT_MAX, &x);
+                        sum += x;
+                      }
+                      if (sum == INT64_MIN) std::abort();
+                    },
+                    results);
+
+      DrawManagerHeadless draw_manager(0, {});
+      run_benchmark(options, "machine_draw",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      for (uint64_t i = 0; i < n; ++i) {
+                        manager.draw(&draw_manager, glm::ivec2(0, 0));
+                      }
+                    },
+                    results);
+
+      // カメラをワールド全体に動かしながら描く
+      run_benchmark(options, "machine_draw_scroll",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      for (uint64_t i = 0; i < n; ++i) {
+                        const auto camera = glm::ivec2(
+                            static_cast<int>(i * 8 % layout.size.x),
+                            static_cast<int>(i * 4 % layout.size.y));
+                        manager.draw(&draw_manager, camera);
+                      }
+                    },
+                    results);
+    }
+  }
+}
+
+static void bench_pipe_manager(const BenchmarkOptions& options,
+                               std::vector<BenchmarkResult>* results) {
+  for (const int count : {1000, 10000, 100000}) {
+    for (const int length : {4, 32}) {
+      for (const bool l_shape : {false, true}) {
+        PipeManager manager;
+        manager.add_pipes(make_pipes(count, length, l_shape));
+
+        run_benchmark(options,
+                      l_shape ? "pipe_build_spatial_idx/l_shape"
+                              : "pipe_build_spatial_idx/straight",
+                      {{"pipes", count}, {"length", length}},
+                      [&](const uint64_t n) {
+                        for (uint64_t i = 0; i < n; ++i) {
+                          manager.build_spatial_idx();
+                        }
+                      },
+                      results);
+      }
+    }
+
+    // 長いパイプは複数のタイルに掛かる, 描く量も外す手間もパイプの数に依らない
+    for (const int length : {20, 40}) {
+      const auto pipes = make_pipes(count, length, false);
+      PipeManager manager;
+      manager.add_pipes(pipes);
+
+      DrawManagerHeadless draw_manager(0, {});
+      run_benchmark(options, "pipe_draw",
+                    {{"pipes", count}, {"length", length}},
+                    [&](const uint64_t n) {
+                      for (uint64_t i = 0; i < n; ++i) {
+                        manager.draw(&draw_manager, glm::ivec2(0, 0));
+                      }
+                    },
+                    results);
+
+      run_benchmark(options, "pipe_remove",
+                    {{"pipes", count}, {"length", length}},
+                    [&](const uint64_t n) {
+                      for (uint64_t i = 0; i < n; ++i) {
+                        const auto& pipe = pipes[i % pipes.size()];
+                        manager.remove_pipe(pipe);
+                        manager.add_pipe(pipe);
+                      }
+                    },
+                    results);
+    }
+
+    const auto layout = make_layout(count, 100);
+    PipeManager manager;
+    manager.add_pipes(layout.pipes);
+
+    const auto queries = make_queries(layout.size);
+    run_benchmark(options, "find_pipe",
+                  {{"machines", count}, {"density", 100}},
+                  [&](const uint64_t n) {
+                    size_t hits = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      hits += manager.find_pipe(queries[i & 4095]) != nullptr;
+                    }
+                    if (hits > n) std::abort();
+                  },
+                  results);
+  }
+}
+
+// 機械とパイプを避ける経路, 1000 x 1000 までの範囲で 2 点を選ぶ
+// corner は範囲の対角を結ぶ最も長い経路
+static void bench_pipe_route(const BenchmarkOptions& options,
+                             std::vector<BenchmarkResult>* results) {
+  for (const int count : {1000, 10000}) {
+    const auto layout = make_layout(count, 100);
+    MachineManager machine_manager;
+    PipeManager pipe_manager;
+    machine_manager.add_machines(layout.machines);
+    pipe_manager.add_pipes(layout.pipes);
+
+    const auto span = glm::ivec2(std::min(layout.size.x, 1000),
+                                 std::min(layout.size.y, 1000));
+    const auto queries = make_queries(span);
+    PipeRouter router;
+    std::vector<glm::ivec2> points;
+
+    run_benchmark(options, "pipe_route/random",
+                  {{"machines", count}, {"span", span.x}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      found += router.route({&machine_manager.get_occupancy(),
+                                             &pipe_manager.get_occupancy()},
+                                            queries[(i * 2) & 4095],
+                                            queries[(i * 2 + 1) & 4095],
+                                            points);
+                    }
+                    if (found > n) std::abort();
+                  },
+                  results);
+
+    run_benchmark(options, "pipe_route/corner",
+                  {{"machines", count}, {"span", span.x}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      found += router.route({&machine_manager.get_occupancy(),
+                                             &pipe_manager.get_occupancy()},
+                                            glm::ivec2(0, 0), span - 1,
+                                            points);
+                    }
+                    if (found > n) std::abort();
+                  },
+                  results);
+  }
+}
+
+// レイアウトの左上 64 x 32 を写し, レイアウトの下へ 16 回貼る
+// bulk は一括追加, each は 1 つずつ管理クラスと見積もりへ追加する
+static void bench_blueprint(const BenchmarkOptions& options,
+                            std::vector<BenchmarkResult>* results) {
+  constexpr int STAMPS = 16;
+
+  for (const int count : {1000, 10000}) {
+    const auto layout = make_layout(count, 100);
+    const auto corner = glm::ivec2(std::min(layout.size.x, 64),
+                                   std::min(layout.size.y, 32)) -
+                        1;
+
+    MachineManager machine_manager;
+    PipeManager pipe_manager;
+    machine_manager.add_machines(layout.machines);
+    pipe_manager.add_pipes(layout.pipes);
+
+    Blueprint blueprint;
+    run_benchmark(options, "blueprint_capture", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                      capture_blueprint(machine_manager, pipe_manager,
+                                        glm::ivec2(0, 0), corner, &blueprint);
+                    }
+                  },
+                  results);
+    if (!capture_blueprint(machine_manager, pipe_manager, glm::ivec2(0, 0),
+                           corner, &blueprint))
+      continue;
+
+    for (const bool bulk : {true, false}) {
+      run_timed_benchmark(
+          options, bulk ? "blueprint_paste/bulk" : "blueprint_paste/each",
+          {{"machines", count}, {"stamps", STAMPS}}, 4,
+          [&] {
+            MachineManager machines;
+            PipeManager pipes;
+            EvaluatePreview preview;
+            machines.add_machines(layout.machines);
+            pipes.add_pipes(layout.pipes);
+            preview.add_entities(layout.machines, layout.pipes);
+
+            const auto begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < STAMPS; ++i) {
+              const auto origin =
+                  glm::ivec2(0, layout.size.y + 2 + i * (blueprint.size.y + 2));
+              if (blueprint_overlaps(blueprint, origin, machines, pipes))
+                std::abort();
+
+              std::vector<std::shared_ptr<Machine>> new_machines;
+              std::vector<std::shared_ptr<Pipe>> new_pipes;
+              instantiate_blueprint(blueprint, origin, nullptr, new_machines,
+                                    new_pipes);
+              if (bulk) {
+                machines.add_machines(new_machines);
+                pipes.add_pipes(new_pipes);
+                preview.add_entities(new_machines, new_pipes);
+              } else {
+                for (const auto& machine : new_machines) {
+                  machines.add_machine(machine);
+                  preview.add_machine(machine);
+                }
+                for (const auto& pipe : new_pipes) {
+                  pipes.add_pipe(pipe);
+                  preview.add_pipe(pipe);
+                }
+              }
+            }
+            const auto end = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::nano>(end - begin)
+                .count();
+          },
+          results);
+    }
+  }
+}
+
+// 1 要素の編集を積む commit と, 直前の版へ戻る undo + redo
+// 版の数や世界の大きさに関わらず, 複製するのは辿った経路の節だけ
+static void bench_history(const BenchmarkOptions& options,
+                          std::vector<BenchmarkResult>* results) {
+  for (const int count : {1000, 10000, 100000}) {
+    const auto layout = make_layout(count, 100);
+    std::vector<WorldEntity> entities;
+    for (const auto& machine : layout.machines) {
+      entities.push_back({machine, nullptr});
+    }
+    for (const auto& pipe : layout.pipes) entities.push_back({nullptr, pipe});
+
+    WorldHistory history;
+    history.reset(entities);
+    const auto pipes = make_pipes(4096, 4, false);
+
+    // 残す版を全て 1 要素の編集で埋めたときの, 版あたりの増分
+    const auto& counter = get_memory_counter(MEMORY_HISTORY);
+    const int64_t bytes = counter.bytes.load();
+    for (size_t i = 1; i < WORLD_HISTORY_LIMIT; ++i) {
+      history.commit({{nullptr, pipes[i]}}, {});
+    }
+    const int64_t version_bytes =
+        (counter.bytes.load() - bytes) / (WORLD_HISTORY_LIMIT - 1);
+
+    // 追加と削除を交互に積み, 毎回新しい版を作る
+    if (run_benchmark(options, "history_commit", {{"entities", count}},
+                      [&](const uint64_t n) {
+                        for (uint64_t i = 0; i < n; ++i) {
+                          const WorldEntity pipe{nullptr, pipes[0]};
+                          if (i & 1)
+                            history.commit({}, {pipe});
+                          else
+                            history.commit({pipe}, {});
+                        }
+                      },
+                      results)) {
+      std::cerr << "history_commit entities=" << count << " : "
+                << version_bytes << " bytes/version" << std::endl;
+    }
+
+    std::vector<WorldEntity> removed, added;
+    run_benchmark(options, "history_undo_redo", {{"entities", count}},
+                  [&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                      removed.clear();
+                      added.clear();
+                      history.undo(removed, added);
+                      history.redo(removed, added);
+                    }
+                  },
+                  results);
+  }
+}
+
+// チャンクファイルの世界を予算 8 MiB で扱う
+// sweep は全チャンクをその場で読んで辿り, view は 1 フレームごとに
+// カメラを右へ動かして要求・反映・描画する (読み込みは待たない)
+static void bench_chunk_pager(const BenchmarkOptions& options,
+                              std::vector<BenchmarkResult>* results) {
+  const std::string path = "factory_bench.fgc";
+  constexpr int64_t BUDGET = 8 << 20;
+
+  for (const int count : {10000, 100000}) {
+    const auto layout = make_layout(count, 100);
+    {
+      MachineManager machine_manager;
+      PipeManager pipe_manager;
+      machine_manager.add_machines(layout.machines);
+      pipe_manager.add_pipes(layout.pipes);
+      if (!save_chunk_file(path, 1, machine_manager, pipe_manager)) return;
+    }
+
+    ChunkFile file;
+    if (!file.open(path)) return;
+    const DrawRect world{0, 0, layout.size.x, layout.size.y};
+
+    int64_t peak_bytes = 0;
+    run_timed_benchmark(
+        options, "chunk_sweep", {{"machines", count}}, 2,
+        [&] {
+          ChunkPager pager(&file, BUDGET);
+          size_t machines = 0;
+
+          const auto begin = std::chrono::steady_clock::now();
+          pager.visit(world, [&](const ChunkWorld& chunk) {
+            machines += chunk.machine_manager.get_machines().size();
+          });
+          const auto end = std::chrono::steady_clock::now();
+
+          if (machines != layout.machines.size()) std::abort();
+          peak_bytes = pager.get_stats().peak_bytes;
+          return std::chrono::duration<double, std::nano>(end - begin)
+              .count();
+        },
+        results);
+    if (peak_bytes > 0) {
+      std::cerr << "chunk_sweep machines=" << count << " : peak "
+                << (peak_bytes >> 10) << " KiB resident" << std::endl;
+    }
+
+    ChunkPager pager(&file, BUDGET);
+    DrawManagerHeadless draw_manager(0, {});
+    int camera_x = 0;
+    run_benchmark(options, "chunk_view_frame", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                      camera_x = (camera_x + 8) % layout.size.x;
+                      const auto camera = glm::ivec2(camera_x, 0);
+                      pager.request_view(DrawRect{camera.x, camera.y,
+                                                  camera.x + 119,
+                                                  camera.y + 39});
+                      pager.update();
+                      draw_manager.clear();
+                      pager.draw(&draw_manager, camera);
+                    }
+                  },
+                  results);
+  }
+
+  std::remove(path.c_str());
+}
+
+// 入力なしの 1 フレーム, 描画・プレビュー更新・HUD を含む
+static void bench_ingame_update(const BenchmarkOptions& options,
+                                std::vector<BenchmarkResult>* results) {
+  const std::string path = "factory_bench.fgl";
+
+  for (const int count : {100, 1000, 10000, 100000}) {
+    for (const int density : {20, 100}) {
+      const auto layout = make_layout(count, density);
+      {
+        MachineManager machine_manager;
+        PipeManager pipe_manager;
+        machine_manager.add_machines(layout.machines);
+        pipe_manager.add_pipes(layout.pipes);
+        if (!save_layout(path, 1, machine_manager, pipe_manager)) return;
+      }
+
+      InGameState state(1);
+      if (!state.load(path)) continue;
+      DrawManagerHeadless draw_manager(0, {});
+
+      run_benchmark(options, "ingame_update",
+                    {{"machines", count}, {"density", density}},
+                    [&](const uint64_t n) {
+                      for (uint64_t i = 0; i < n; ++i) {
+                        state.update(&draw_manager);
+                      }
+                    },
+                    results);
+    }
+  }
+
+  std::remove(path.c_str());
+}
+
+// 読み込み直後の見積もり, 最初のフレームの update と
+// 全ての成分の見積もりが出るまでのフレーム数・最も重いフレーム
+static void bench_preview(const BenchmarkOptions& options,
+                          std::vector<BenchmarkResult>* results) {
+  for (const int count : {1000, 10000, 100000}) {
+    const auto layout = make_layout(count, 100);
+
+    int frames = 0;
+    double worst_ns = 0.0, total_ns = 0.0;
+    run_timed_benchmark(
+        options, "preview_first_frame", {{"machines", count}}, 2,
+        [&] {
+          EvaluatePreview preview;
+          preview.add_entities(layout.machines, layout.pipes);
+
+          double first_ns = 0.0;
+          frames = 0;
+          worst_ns = total_ns = 0.0;
+          do {
+            const auto begin = std::chrono::steady_clock::now();
+            preview.update();
+            const auto end = std::chrono::steady_clock::now();
+            const double ns =
+                std::chrono::duration<double, std::nano>(end - begin).count();
+            if (frames++ == 0) first_ns = ns;
+            worst_ns = std::max(worst_ns, ns);
+            total_ns += ns;
+          } while (!preview.is_ready());
+          return first_ns;
+        },
+        results);
+    if (frames > 0) {
+      std::cerr << "preview_first_frame machines=" << count << " : "
+                << frames << " frames until ready, worst "
+                << worst_ns / 1e6 << " ms, total " << total_ns / 1e6
+                << " ms" << std::endl;
+    }
+  }
+}
+
+// 右クリックで外した機械を Z で戻し, Y で外し直す 2 フレーム
+// 入力から管理クラスと見積もりの更新, 描画までを通して測る
+static void bench_ingame_undo(const BenchmarkOptions& options,
+                              std::vector<BenchmarkResult>* results) {
+  const std::string path = "factory_bench.fgl";
+
+  for (const int count : {1000, 10000, 100000}) {
+    const auto layout = make_layout(count, 100);
+    {
+      MachineManager machine_manager;
+      PipeManager pipe_manager;
+      machine_manager.add_machines(layout.machines);
+      pipe_manager.add_pipes(layout.pipes);
+      if (!save_layout(path, 1, machine_manager, pipe_manager)) return;
+    }
+
+    InGameState state(1);
+    if (!state.load(path)) continue;
+
+    // 入力の座標は 16 bit なので, 原点に近い壊せる機械を選ぶ
+    std::shared_ptr<Machine> target;
+    for (const auto& machine : layout.machines) {
+      if (!machine->is_breakable() || machine->m_point.x > INT16_MAX ||
+          machine->m_point.y > INT16_MAX)
+        continue;
+      if (!target || machine->m_point.y < target->m_point.y) target = machine;
+    }
+    if (!target) continue;
+
+    // 読み込んだ世界の見積もりが出揃うまでフレームを進めてから外す
+    // 1 フレームの評価量から余裕を見たフレーム数
+    DrawManagerHeadless remove(
+        1, {{1, INPUT_RECORD_MOUSE, MOUSE_RCLICK,
+             static_cast<int16_t>(target->m_point.x),
+             static_cast<int16_t>(target->m_point.y)}});
+    DrawManagerHeadless idle(0, {});
+    for (int i = 0; i < count / 16 + 64; ++i) state.update(&idle);
+    state.update(&remove);
+    for (int i = 0; i < 64; ++i) state.update(&idle);
+
+    run_timed_benchmark(
+        options, "ingame_undo_redo", {{"machines", count}}, 16,
+        [&] {
+          DrawManagerHeadless draw_manager(
+              2, {{1, INPUT_RECORD_KEYCODE, KEYCODE_Z, 0, 0},
+                  {2, INPUT_RECORD_KEYCODE, KEYCODE_Y, 0, 0}});
+
+          const auto begin = std::chrono::steady_clock::now();
+          state.update(&draw_manager);
+          state.update(&draw_manager);
+          const auto end = std::chrono::steady_clock::now();
+          return std::chrono::duration<double, std::nano>(end - begin)
+              .count();
+        },
+        results);
+  }
+
+  std::remove(path.c_str());
+}
+
+// ステージを抜けるときの InGameState の破棄
+static void bench_stage_teardown(const BenchmarkOptions& options,
+                                 std::vector<BenchmarkResult>* results) {
+  const std::string path = "factory_bench.fgl";
+
+  for (const int count : {1000, 10000, 100000}) {
+    const auto layout = make_layout(count, 100);
+    {
+      MachineManager machine_manager;
+      PipeManager pipe_manager;
+      machine_manager.add_machines(layout.machines);
+      pipe_manager.add_pipes(layout.pipes);
+      if (!save_layout(path, 1, machine_manager, pipe_manager)) return;
+    }
+
+    run_timed_benchmark(options, "stage_teardown", {{"machines", count}}, 4,
+                        [&] {
+                          auto* state = new InGameState(1);
+                          state->load(path);
+
+                          const auto begin = std::chrono::steady_clock::now();
+                          delete state;
+                          const auto end = std::chrono::steady_clock::now();
+                          return std::chrono::duration<double, std::nano>(
+                                     end - begin)
+                              .count();
+                        },
+                        results);
+  }
+
+  std::remove(path.c_str());
+}
+
+// 水の入口から出口まで cells マスのパイプでつないだ流体網を networks 本並べる
+// blocked なら出口を水を使わない出口にし, 詰まって流れの止まる網を測る
+static void bench_fluid(const BenchmarkOptions& options,
+                        std::vector<BenchmarkResult>* results) {
+  constexpr int PIPE_LENGTH = 16;
+
+  for (const int cells : {64, 1024, 16384}) {
+    for (const int blocked : {0, 1}) {
+      const int networks = std::max(1, 16384 / cells);
+      std::vector<std::shared_ptr<Machine>> machines;
+      std::vector<std::shared_ptr<Pipe>> pipes;
+      for (int i = 0; i < networks; ++i) {
+        const auto point = glm::ivec2(0, i * 4);
+        const auto begin = point + glm::ivec2(5, 1);
+        const auto end = begin + glm::ivec2(cells - 1, 0);
+        machines.push_back(std::make_shared<InputDuct>(point, ITEM_WATER));
+        machines.push_back(std::make_shared<OutputDuct>(
+            end + glm::ivec2(-5, 1), blocked ? ITEM_HYDROGEN : ITEM_WATER));
+        for (int x = begin.x; x < end.x; x += PIPE_LENGTH - 1) {
+          pipes.push_back(std::make_shared<Pipe>(
+              glm::ivec2(x, begin.y),
+              glm::ivec2(std::min(x + PIPE_LENGTH - 1, end.x), begin.y)));
+        }
+      }
+
+      Evaluator evaluator(machines, pipes);
+      std::default_random_engine rng(1);
+      for (int tick = 0; tick < 600; ++tick) evaluator.step(rng);
+
+      if (!run_benchmark(options, "fluid_step",
+                         {{"cells", cells}, {"networks", networks},
+                          {"blocked", blocked}},
+                         [&](const uint64_t n) {
+                           for (uint64_t i = 0; i < n; ++i) evaluator.step(rng);
+                         },
+                         results))
+        continue;
+
+      // 入れた数 = 区間の量 + 吸い出し途中の量 + 渡した数, 差は丸めの誤差だけ
+      EvaluateFluidBalance balance;
+      evaluator.write_fluid_balance(&balance);
+      const double error = balance.stored + balance.pending +
+                           balance.delivered - balance.injected;
+      std::cerr << "fluid_balance cells=" << cells << " blocked=" << blocked
+                << " : injected " << balance.injected << ", delivered "
+                << balance.delivered << ", stored " << balance.stored
+                << ", pending " << balance.pending << ", error " << error
+                << std::endl;
+      // float の丸めは動かした量に比例して溜まる
+      if (std::abs(error) > FLUID_TOLERANCE + balance.injected * 1e-5)
+        std::abort();
+    }
+  }
+}
+
+// 呼んだスレッドが使った CPU 時間, 取れなければ 0
+static double get_thread_cpu_ns() {
+#if defined(__linux__)
+  timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+    return time.tv_sec * 1e9 + time.tv_nsec;
+#endif
+  return 0.0;
+}
+
+// 同じ乱数で TICKS tick 進める評価を, トレース無しと --trace,
+// --trace-compressed で比べる, 最後の書き出しを待つまでを測る
+// 揺れの少ない最速の回で, 経過時間 (書き出しのスレッドの分を含む) と
+// 評価のスレッドの CPU 時間を無しと比べる
+static void bench_evaluate_trace(const BenchmarkOptions& options,
+                                 std::vector<BenchmarkResult>* results) {
+  constexpr int TICKS = 1000;
+  const std::string path = "factory_bench.trace";
+
+  for (const int count : {1000, 10000}) {
+    const auto layout = make_layout(count, 100);
+    const Evaluator prototype(layout.machines, layout.pipes);
+    const int repeat = count >= 10000 ? 4 : 16;
+
+    double untraced_ns[2] = {};
+    std::ostringstream overheads;
+    uint64_t records = 0;
+    for (const int mode : {0, 1, 2}) {
+      TraceSink sink;
+      if (mode > 0 && !sink.open(path, mode == 2)) return;
+
+      double best_ns[2] = {};  // 経過時間, 評価のスレッドの CPU 時間
+      run_timed_benchmark(
+          options, "evaluate_trace",
+          {{"machines", count}, {"ticks", TICKS}, {"trace", mode}}, repeat,
+          [&] {
+            Evaluator evaluator = prototype;
+            TraceBuffer* trace = sink.acquire_buffer();
+            evaluator.set_trace(trace);
+            std::default_random_engine rng(1);
+
+            const auto begin = std::chrono::steady_clock::now();
+            const double cpu_begin = get_thread_cpu_ns();
+            for (int tick = 0; tick < TICKS; ++tick) evaluator.step(rng);
+            sink.release_buffer(trace);
+            const double cpu_ns = get_thread_cpu_ns() - cpu_begin;
+            const auto end = std::chrono::steady_clock::now();
+            const double ns =
+                std::chrono::duration<double, std::nano>(end - begin).count();
+            if (best_ns[0] == 0.0 || ns < best_ns[0]) best_ns[0] = ns;
+            if (best_ns[1] == 0.0 || cpu_ns < best_ns[1]) best_ns[1] = cpu_ns;
+            return ns;
+          },
+          results);
+      sink.close();
+      if (best_ns[0] == 0.0) return;
+
+      if (mode == 0) {
+        untraced_ns[0] = best_ns[0];
+        untraced_ns[1] = best_ns[1];
+        continue;
+      }
+      if (mode == 1) read_trace(path, [&](const TraceRecord&) { records++; });
+      overheads << std::fixed << std::setprecision(1)
+                << (mode == 1 ? ", raw " : ", compressed ")
+                << (best_ns[0] / untraced_ns[0] - 1.0) * 100.0 << "% wall "
+                << (best_ns[1] / std::max(untraced_ns[1], 1.0) - 1.0) * 100.0
+                << "% evaluator cpu";
+    }
+
+    std::cerr << "evaluate_trace machines=" << count << " : "
+              << records / (static_cast<uint64_t>(TICKS) * repeat)
+              << " records/tick" << overheads.str() << " (goal < 5%)"
+              << std::endl;
+  }
+
+  std::remove(path.c_str());
+}
+
+// 機械の空間インデックスを, 今のハッシュ表と Z 曲線の順の配列で比べる
+// point は半分が機械のあるセル, range は画面ほどの矩形
+// range/occupancy は find_machines と同じく占有ビットからハッシュ表を引く
+static void bench_spatial_index(const BenchmarkOptions& options,
+                                std::vector<BenchmarkResult>* results) {
+  using Entry = MortonEntry<std::shared_ptr<Machine>>;
+  const auto box = glm::ivec2(80, 24);
+
+  for (const int count : {1000, 10000, 100000}) {
+    const auto layout = make_layout(count, 100);
+    MachineSpatialMap hash(std::pmr::get_default_resource());
+    MachineShadowMap shadowed(std::pmr::get_default_resource());
+    OccupancyGrid occupancy(std::pmr::get_default_resource());
+    for (auto machine : layout.machines) {
+      machine->build_spatial_idx(
+          MachineSpatialIdx(hash, shadowed, occupancy, machine));
+    }
+
+    std::vector<Entry> entries;
+    entries.reserve(hash.size());
+    for (const auto& [point, machine] : hash) {
+      entries.push_back(Entry{morton_encode(point), machine});
+    }
+    MortonIndex<std::shared_ptr<Machine>> morton(
+        std::pmr::get_default_resource());
+    auto batch = entries;
+    morton.build(batch);
+
+    auto queries = make_queries(layout.size);
+    for (size_t i = 0; i < queries.size(); i += 2) {
+      queries[i] = morton_decode(entries[i * 7919 % entries.size()].code);
+    }
+    const auto origins =
+        make_queries(glm::max(layout.size - box, glm::ivec2(1)));
+
+    run_benchmark(options, "spatial_point/hash", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      found += hash.count(queries[i & 4095]);
+                    }
+                    if (found > n) std::abort();
+                  },
+                  results);
+
+    run_benchmark(options, "spatial_point/morton", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      found += morton.find(queries[i & 4095]) != nullptr;
+                    }
+                    if (found > n) std::abort();
+                  },
+                  results);
+
+    run_benchmark(options, "spatial_range/hash", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      const auto min = origins[i & 4095];
+                      for (int y = min.y; y < min.y + box.y; ++y) {
+                        for (int x = min.x; x < min.x + box.x; ++x) {
+                          found += hash.count(glm::ivec2(x, y));
+                        }
+                      }
+                    }
+                    if (found > n * box.x * box.y) std::abort();
+                  },
+                  results);
+
+    run_benchmark(options, "spatial_range/occupancy", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      const auto min = origins[i & 4095];
+                      const auto max = min + box - 1;
+                      occupancy.for_each_set(
+                          min.x, min.y, max.x, max.y, [&](int x, int y) {
+                            found += hash.count(glm::ivec2(x, y));
+                          });
+                    }
+                    if (found > n * box.x * box.y) std::abort();
+                  },
+                  results);
+
+    run_benchmark(options, "spatial_range/morton", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    size_t found = 0;
+                    for (uint64_t i = 0; i < n; ++i) {
+                      const auto min = origins[i & 4095];
+                      morton.for_each_in(
+                          min, min + box - 1,
+                          [&](glm::ivec2, const std::shared_ptr<Machine>&) {
+                            found++;
+                          });
+                    }
+                    if (found > n * box.x * box.y) std::abort();
+                  },
+                  results);
+
+    run_benchmark(options, "spatial_build/hash", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                      hash.clear();
+                      shadowed.clear();
+                      occupancy.clear();
+                      for (auto machine : layout.machines) {
+                        machine->build_spatial_idx(MachineSpatialIdx(
+                            hash, shadowed, occupancy, machine));
+                      }
+                    }
+                  },
+                  results);
+
+    run_benchmark(options, "spatial_build/morton", {{"machines", count}},
+                  [&](const uint64_t n) {
+                    for (uint64_t i = 0; i < n; ++i) {
+                      batch = entries;
+                      morton.build(batch);
+                    }
+                  },
+                  results);
+  }
+}
+
+int main(const int argc, char** argv) {
+  BenchmarkOptions options;
+  std::string out_path;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::strcmp(argv[i], "--filter") == 0)
+      options.filter = argv[++i];
+    else if (std::strcmp(argv[i], "--min-time") == 0)
+      options.min_time_ms = std::atof(argv[++i]);
+    else if (std::strcmp(argv[i], "--out") == 0)
+      out_path = argv[++i];
+  }
+
+  // 端末への描画は g_emitted へ流し, 結果は元の cout へ書く
+  const auto stdout_buffer = std::cout.rdbuf(&g_emitted);
+
+  std::vector<BenchmarkResult> results;
+  bench_present(options, &results);
+  bench_machine_manager(options, &results);
+  bench_pipe_manager(options, &results);
+  bench_pipe_route(options, &results);
+  bench_blueprint(options, &results);
+  bench_history(options, &results);
+  bench_chunk_pager(options, &results);
+  bench_ingame_update(options, &results);
+  bench_preview(options, &results);
+  bench_ingame_undo(options, &results);
+  bench_stage_teardown(options, &results);
+  bench_fluid(options, &results);
+  bench_evaluate_trace(options, &results);
+  bench_spatial_index(options, &results);
+
+  std::cout.rdbuf(stdout_buffer);
+
+  if (out_path.empty()) {
+    write_json(std::cout, options, results);
+  } else {
+    std::ofstream stream(out_path);
+    write_json(stream, options, results);
+    if (!stream) return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+}  // namespace factory_game
+
+int main(const int argc, char** argv) {
+  return factory_game::main(argc, argv);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+#include "footprint.h"
+
+namespace factory_game {
+
+// ステージ 1 つ分の世界状態 (エンティティ, 空間インデックス, 評価バッファ) を置く領域
+// 確保はプールのチャンク内で進め, 破棄時はチャンクごとまとめて解放する
+class StageArena {
+ public:
+  StageArena();
+  ~StageArena();
+
+  StageArena(const StageArena&) = delete;
+  StageArena& operator=(const StageArena&) = delete;
+
+  std::pmr::memory_resource* get_resource(MemoryCategory category);
+  // 全ての用途で確保している量
+  int64_t get_bytes() const;
+
+  // デストラクタを呼ばずに arena ごと捨てるオブジェクトを置く
+  // T とその中身はすべてこの arena から確保している必要がある
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    void* pointer = m_pool.allocate(sizeof(T), alignof(T));
+    return new (pointer) T(std::forward<Args>(args)...);
+  }
+
+ private:
+  // 評価スレッドからも確保するため synchronized
+  std::pmr::synchronized_pool_resource m_pool;
+  std::unique_ptr<CountingResource> m_resources[MEMORY_CATEGORY_COUNT];
+};
+
+// arena が nullptr ならヒープ
+std::pmr::memory_resource* get_resource(StageArena* arena,
+                                        MemoryCategory category);
+
+template <typename T, typename... Args>
+std::shared_ptr<T> make_entity(StageArena* arena, Args&&... args) {
+  return std::allocate_shared<T>(
+      std::pmr::polymorphic_allocator<T>(get_resource(arena, MEMORY_ENTITY)),
+      std::forward<Args>(args)...);
+}
+
+}  // namespace factory_game
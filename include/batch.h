@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "evaluate.h"
+
+namespace factory_game {
+
+// レイアウトファイルを端末なしでまとめて評価する
+// ファイルごとにワーカーへ割り当て, 同じレイアウトはキャッシュから返す
+struct BatchOptions {
+  int stage = 0;  // 0 ならレイアウトに書かれたステージ
+  int ticks = EVALUATE_TICKS;
+  int threads = 0;  // 0 ならハードウェアスレッド数
+  int seeds = 1;    // 乱数 1, 2, ..., seeds で 1 回ずつ評価する
+};
+
+struct BatchEvaluation {
+  unsigned int seed;
+  bool cached;
+  EvaluateContext stats;
+  EvaluateScore score;
+};
+
+struct BatchResult {
+  size_t index;  // 入力の何番目か
+  std::string path;
+  bool ok;
+  std::string error;  // ok でなければ理由
+  int stage;
+  uint64_t hash;
+  size_t machine_count;
+  size_t pipe_count;
+  std::vector<BatchEvaluation> evaluations;  // seed の順
+};
+
+struct BatchSummary {
+  int64_t layouts;
+  int64_t failures;
+  int64_t evaluations;  // キャッシュに当たった分を含む
+  int64_t cache_hits;
+  double seconds;
+};
+
+// 結果は入力の順に on_result へ渡す, 同時に呼ぶことはない
+// トレースのシンクが開いていれば, キャッシュを使わずに全ての評価を記録する
+BatchSummary evaluate_layouts(
+    const std::vector<std::string>& paths, const BatchOptions& options,
+    const std::function<void(const BatchResult&)>& on_result);
+
+// 1 行の JSON で書き出す, 改行は含まない
+void write_batch_result(std::ostream& stream, const BatchResult& result);
+
+}  // namespace factory_game
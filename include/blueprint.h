@@ -0,0 +1,39 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <memory>
+#include <vector>
+
+#include "layout.h"
+
+namespace factory_game {
+
+// 選択した機械とパイプの写し
+// 座標は写した要素全体を囲む矩形の左上からの相対座標で, どこへでも置ける
+struct Blueprint {
+  glm::ivec2 size;
+  std::vector<MachineRecord> machines;  // 壊せる機械だけ
+  std::vector<PipeRecord> pipes;
+};
+
+// corner0 と corner1 を対角とする矩形に掛かる要素を写す, 何も無ければ false
+bool capture_blueprint(const MachineManager& machine_manager,
+                       const PipeManager& pipe_manager, glm::ivec2 corner0,
+                       glm::ivec2 corner1, Blueprint* blueprint);
+
+// origin を左上にして置くと既存の機械やパイプと重なるなら true
+bool blueprint_overlaps(const Blueprint& blueprint, glm::ivec2 origin,
+                        const MachineManager& machine_manager,
+                        const PipeManager& pipe_manager);
+
+// origin を左上にした実体を作る, 管理クラスへは呼び出し側がまとめて追加する
+void instantiate_blueprint(const Blueprint& blueprint, glm::ivec2 origin,
+                           StageArena* arena,
+                           std::vector<std::shared_ptr<Machine>>& machines,
+                           std::vector<std::shared_ptr<Pipe>>& pipes);
+
+// origin を左上にした置き場所の目安を描く
+void draw_blueprint(const Blueprint& blueprint, glm::ivec2 origin,
+                    DrawManagerBase* draw_manager);
+
+}  // namespace factory_game
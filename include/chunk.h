@@ -0,0 +1,181 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+#include "draw_list.h"
+#include "layout.h"
+
+namespace factory_game {
+
+// チャンクファイル, 広い世界を固定サイズの区画に分けて置く
+// ヘッダ, ChunkEntry の目録 (y, x の順), チャンクごとの MachineRecord と
+// PipeRecord が固定長・リトルエンディアンで並ぶ
+// 要素は基点 (機械は m_point, パイプは両端の左上) が入るチャンクに属する
+constexpr uint32_t CHUNK_MAGIC = 0x4b434746;  // "FGCK"
+constexpr uint32_t CHUNK_VERSION = 1;
+constexpr int CHUNK_WIDTH = 256;
+constexpr int CHUNK_HEIGHT = 64;
+
+struct ChunkHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stage;
+  int32_t chunk_width;
+  int32_t chunk_height;
+  int32_t margin_x;  // 描画が基点からはみ出す最大の幅
+  int32_t margin_y;
+  uint32_t reserved;
+  uint64_t chunk_count;
+  uint64_t machine_count;
+  uint64_t pipe_count;
+};
+
+struct ChunkEntry {
+  int32_t x;  // チャンク座標
+  int32_t y;
+  uint32_t machine_count;
+  uint32_t pipe_count;
+  uint64_t offset;  // ファイル先頭からのレコードの位置
+};
+
+static_assert(sizeof(ChunkHeader) == 56);
+static_assert(sizeof(ChunkEntry) == 24);
+
+bool save_chunk_file(const std::string& path, int stage,
+                     const MachineManager& machine_manager,
+                     const PipeManager& pipe_manager);
+
+// 目録だけを読み, レコードはチャンクごとに写す
+// Linux では mmap し, 写した範囲のページは手放して常駐量を増やさない
+class ChunkFile {
+ public:
+  ChunkFile();
+  ~ChunkFile();
+
+  ChunkFile(const ChunkFile&) = delete;
+  ChunkFile& operator=(const ChunkFile&) = delete;
+
+  bool open(const std::string& path);
+  void close();
+
+  const ChunkHeader& get_header() const;
+  const std::vector<ChunkEntry>& get_entries() const;
+  // チャンク座標 (x, y) の目録の添字, 無ければ -1
+  int64_t find_chunk(int x, int y) const;
+  // 複数のスレッドから呼べる
+  bool read_chunk(size_t index, std::vector<MachineRecord>& machines,
+                  std::vector<PipeRecord>& pipes) const;
+
+ private:
+  ChunkHeader m_header;
+  std::vector<ChunkEntry> m_entries;
+  const char* m_data;
+  size_t m_size;
+  bool m_mapped;
+  mutable std::mutex m_stream_mutex;  // mmap できない環境用
+  mutable std::ifstream m_stream;
+};
+
+// 常駐しているチャンク 1 つ, 中身は arena に置いて arena ごと捨てる
+struct ChunkWorld {
+  explicit ChunkWorld(StageArena* arena);
+
+  MachineManager machine_manager;
+  PipeManager pipe_manager;
+};
+
+struct ResidentChunk {
+  ResidentChunk();
+
+  StageArena arena;
+  ChunkWorld* world;
+  int64_t bytes;  // arena から確保した量
+};
+
+struct ChunkPagerStats {
+  size_t resident_chunks;
+  size_t pending_chunks;  // 読み込み待ちと読み込み中
+  int64_t resident_bytes;
+  int64_t peak_bytes;
+  int64_t page_ins;
+  int64_t evictions;
+};
+
+// 先読みする表示範囲の外周のチャンク数
+constexpr int CHUNK_PREFETCH = 1;
+
+// チャンクの常駐を管理する, 呼び出しは全て更新のスレッドから行う
+// 読み込みと破棄は作業スレッドで行い, 描画は常駐しているチャンクだけを描く
+// 予算を超えたら使われていない順に手放す, ただし表示中のチャンクは残す
+class ChunkPager {
+ public:
+  ChunkPager(const ChunkFile* file, int64_t budget_bytes);
+  ~ChunkPager();
+
+  ChunkPager(const ChunkPager&) = delete;
+  ChunkPager& operator=(const ChunkPager&) = delete;
+
+  // 表示範囲 (ワールド座標) のチャンクを要求する, 読み込みは待たない
+  // 外周 CHUNK_PREFETCH 個分は表示範囲の後に先読みする
+  void request_view(const DrawRect& view);
+  // 読み終えたチャンクを常駐させ, 予算を超えた分を手放す
+  void update();
+  // camera は画面の左上に来るワールド座標
+  void draw(DrawManagerBase* draw_manager, glm::ivec2 camera) const;
+  // 評価などで範囲を全て辿る, 常駐していないチャンクはその場で読む
+  void visit(const DrawRect& area,
+             const std::function<void(const ChunkWorld& world)>& visitor);
+  ChunkPagerStats get_stats() const;
+
+ private:
+  struct Resident {
+    std::unique_ptr<ResidentChunk> chunk;
+    std::list<size_t>::iterator lru;  // 先頭が最近使ったもの
+    uint64_t frame;                   // 最後に表示範囲に入ったフレーム
+  };
+
+  void collect_chunks(const DrawRect& area, int margin,
+                      std::vector<size_t>& indices) const;
+  std::unique_ptr<ResidentChunk> load_chunk(size_t index) const;
+  Resident& make_resident(size_t index, std::unique_ptr<ResidentChunk> chunk);
+  void touch(Resident& resident);
+  void evict();
+  void run();
+
+  const ChunkFile* m_file;
+  int64_t m_budget_bytes;
+  std::unordered_map<size_t, Resident> m_resident;
+  std::list<size_t> m_lru;
+  std::vector<size_t> m_view;  // 今のフレームで表示範囲に掛かるチャンク
+  uint64_t m_frame;
+  int64_t m_resident_bytes;
+  int64_t m_peak_bytes;
+  int64_t m_page_ins;
+  int64_t m_evictions;
+
+  // 作業スレッドと共有する
+  mutable std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<size_t> m_queue;
+  std::vector<bool> m_pending;  // 待ち行列にあるか読み込み中
+  size_t m_pending_count;
+  std::vector<std::pair<size_t, std::unique_ptr<ResidentChunk>>> m_ready;
+  std::vector<std::unique_ptr<ResidentChunk>> m_retired;
+  bool m_stop;
+  std::thread m_thread;
+};
+
+}  // namespace factory_game
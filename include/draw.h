@@ -1,17 +1,62 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
+#include "footprint.h"
+
+#if defined(WIN32)
+#include "windows.h"
+#endif
+
+#if defined(__linux__)
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
 namespace factory_game {
 
+// get_heap_resource(MEMORY_DRAW_BUFFER) を渡して作る
+using DrawBuffer = std::pmr::vector<char>;
+
+enum DrawCommandKind {
+  DRAW_COMMAND_CLEAR,
+  DRAW_COMMAND_LABEL,
+  DRAW_COMMAND_LABEL_BOX,
+  DRAW_COMMAND_CLEAR_BOX,
+  DRAW_COMMAND_LINE_BOX,
+  DRAW_COMMAND_HV_LINE,
+};
+
+// 記録した描画呼び出し 1 回分
+// 箱は (x0, y0) と幅 x1・高さ y1, 線は (x0, y0) - (x1, y1)
+struct DrawCommand {
+  DrawCommandKind kind;
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+  uint32_t text_begin;  // 一緒に渡す文字列内の位置
+  uint32_t text_length;
+};
+
+class FrameExporter;  // for pointer reference
+
 class DrawManagerBase {
  public:
   DrawManagerBase();
   virtual ~DrawManagerBase();
 
+  // present した画面を exporter へも書き出す, nullptr で止める
+  // 画面を持つ DrawManager だけが書き出し, 委譲するものは何もしない
+  void set_frame_exporter(FrameExporter* exporter);
+
   virtual int get_width() = 0;
   virtual int get_height() = 0;
 
@@ -23,20 +68,45 @@ class DrawManagerBase {
   virtual void draw_hv_line(int x0, int y0, int x1, int y1) = 0;
   virtual void present() = 0;
 
+  // 記録済みの命令をまとめて描く, 既定では 1 つずつ上の関数を呼ぶ
+  virtual void draw_commands(const DrawCommand* commands, size_t count,
+                             std::string_view text);
+
   virtual void capture_input() = 0;
   virtual bool handle_input_keycode(int keycode) = 0;
   virtual bool handle_input_mouse(int state, int& x, int& y) = 0;
+  // 中ボタンのドラッグ, 前回の位置からの移動量
+  virtual bool handle_input_drag(int& dx, int& dy) = 0;
+  // マウスが動いたフレームだけ, その位置
+  virtual bool handle_input_hover(int& x, int& y) = 0;
+
+ protected:
+  // present の最後に, 画面に出した内容で呼ぶ
+  void export_frame(const DrawBuffer& buffer, int width, int height);
+
+ private:
+  FrameExporter* m_frame_exporter;
 };
 
 #if defined(WIN32)
 
-#include "windows.h"
-
 #define KEYCODE_RETURN VK_RETURN
 #define KEYCODE_ESCAPE VK_ESCAPE
 #define KEYCODE_TAB VK_TAB
 #define KEYCODE_SPACE VK_SPACE
 #define KEYCODE_R 'R'
+#define KEYCODE_F 'F'
+#define KEYCODE_S 'S'
+#define KEYCODE_L 'L'
+#define KEYCODE_P 'P'
+#define KEYCODE_M 'M'
+#define KEYCODE_D 'D'
+#define KEYCODE_Y 'Y'
+#define KEYCODE_Z 'Z'
+#define KEYCODE_UP VK_UP
+#define KEYCODE_DOWN VK_DOWN
+#define KEYCODE_LEFT VK_LEFT
+#define KEYCODE_RIGHT VK_RIGHT
 #define MOUSE_LCLICK FROM_LEFT_1ST_BUTTON_PRESSED
 #define MOUSE_RCLICK RIGHTMOST_BUTTON_PRESSED
 
@@ -59,34 +129,73 @@ class DrawManagerWindows : public DrawManagerBase {
   void capture_input() override;
   bool handle_input_keycode(int keycode) override;
   bool handle_input_mouse(int state, int& x, int& y) override;
+  bool handle_input_drag(int& dx, int& dy) override;
+  bool handle_input_hover(int& x, int& y) override;
 
  private:
+  void resize();
+
   int m_width;
   int m_height;
+  // get_width/get_height 用, 描画スレッドで変えた大きさを他のスレッドへ渡す
+  std::atomic<int> m_shared_width;
+  std::atomic<int> m_shared_height;
   HANDLE m_stdout_handle;
   HANDLE m_stdin_handle;
   DWORD m_out_mode;
   DWORD m_in_mode;
   CONSOLE_CURSOR_INFO m_cursor_info;
-  std::vector<char> m_current_buffer;
-  std::vector<char> m_back_buffer;
+  DrawBuffer m_current_buffer;
+  DrawBuffer m_back_buffer;
   INPUT_RECORD m_input;
+  int m_drag_x;  // 直前のドラッグ位置, -1 : ドラッグしていない
+  int m_drag_y;
+  int m_drag_dx;
+  int m_drag_dy;
+  int m_hover_x;  // -1 : このフレームでは動いていない
+  int m_hover_y;
 };
 #endif
 
 #if defined(__linux__)
 
-#include <termios.h>
-#include <unistd.h>
-
 #define KEYCODE_RETURN 0x0a
 #define KEYCODE_ESCAPE 0x1b
 #define KEYCODE_TAB 0x09
 #define KEYCODE_SPACE 0x20
 #define KEYCODE_R 0x72
+#define KEYCODE_F 0x66
+#define KEYCODE_S 0x73
+#define KEYCODE_L 0x6c
+#define KEYCODE_P 0x70
+#define KEYCODE_M 0x6d
+#define KEYCODE_D 0x64
+#define KEYCODE_Y 0x79
+#define KEYCODE_Z 0x7a
+// 矢印キーは "\x1b[" に続く 1 文字, 1 バイトのキーと重ならないよう 0x100 を足す
+#define KEYCODE_UP 0x141
+#define KEYCODE_DOWN 0x142
+#define KEYCODE_RIGHT 0x143
+#define KEYCODE_LEFT 0x144
 #define MOUSE_LCLICK 0
 #define MOUSE_RCLICK 2
 
+enum TerminalInputKind {
+  TERMINAL_INPUT_KEY,    // 1 バイトのキー, code はその文字
+  TERMINAL_INPUT_CSI,    // 引数の無い "\x1b[" 列, code は最後の文字
+  TERMINAL_INPUT_MOUSE,  // SGR のマウスイベント
+};
+
+// 1 フレームに読んだ入力を区切った 1 つ分
+struct TerminalInputEvent {
+  TerminalInputKind kind;
+  int code;
+  int button;  // マウスのみ, SGR の b
+  int x;       // マウスのみ, 画面の左上が 0
+  int y;
+  bool release;  // マウスのみ, 'm' で終わる
+};
+
 class DrawManagerLinux : public DrawManagerBase {
  public:
   DrawManagerLinux();
@@ -106,14 +215,31 @@ class DrawManagerLinux : public DrawManagerBase {
   void capture_input() override;
   bool handle_input_keycode(int keycode) override;
   bool handle_input_mouse(int state, int& x, int& y) override;
+  bool handle_input_drag(int& dx, int& dy) override;
+  bool handle_input_hover(int& x, int& y) override;
 
  private:
+  void resize();
+
   int m_width;
   int m_height;
+  // get_width/get_height 用, 描画スレッドで変えた大きさを他のスレッドへ渡す
+  std::atomic<int> m_shared_width;
+  std::atomic<int> m_shared_height;
   termios m_terminfo;
-  std::vector<char> m_current_buffer;
-  std::vector<char> m_back_buffer;
+  struct sigaction m_winch_action;  // 戻す用
+  DrawBuffer m_current_buffer;
+  DrawBuffer m_back_buffer;
+  // 読んだがまだ区切れていない列, 途中で切れた列は次のフレームへ残す
   std::vector<char> m_input_buffer;
+  std::vector<TerminalInputEvent> m_input_events;  // このフレームの入力
+  std::string m_output;  // present で書き出す列, 使い回す
+  int m_drag_x;          // 直前のドラッグ位置, -1 : ドラッグしていない
+  int m_drag_y;
+  int m_drag_dx;
+  int m_drag_dy;
+  int m_hover_x;  // -1 : このフレームでは動いていない
+  int m_hover_y;
 };
 #endif
 
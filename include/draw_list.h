@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "draw.h"
+
+namespace factory_game {
+
+// 両端を含む矩形
+struct DrawRect {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+
+  bool intersects(const DrawRect& other) const {
+    return x0 <= other.x1 && other.x0 <= x1 && y0 <= other.y1 &&
+           other.y0 <= y1;
+  }
+};
+
+// 描画呼び出しを命令として記録する, 入力は扱わない
+class DrawListRecorder : public DrawManagerBase {
+ public:
+  DrawListRecorder();
+  ~DrawListRecorder() override;
+
+  int get_width() override;
+  int get_height() override;
+
+  void clear() override;
+  void draw_label(int x, int y, std::string_view text) override;
+  void draw_label_box(int x, int y, std::string_view text) override;
+  void draw_clear_box(int x, int y, int width, int height) override;
+  void draw_line_box(int x, int y, int width, int height) override;
+  void draw_hv_line(int x0, int y0, int x1, int y1) override;
+  void present() override;
+
+  void capture_input() override;
+  bool handle_input_keycode(int keycode) override;
+  bool handle_input_mouse(int state, int& x, int& y) override;
+  bool handle_input_drag(int& dx, int& dy) override;
+  bool handle_input_hover(int& x, int& y) override;
+
+  void reset();
+  bool is_empty() const;
+  const std::vector<DrawCommand>& get_commands() const;
+  std::string_view get_text() const;
+  DrawRect get_bounds() const;
+
+ private:
+  void push(DrawCommandKind kind, int x0, int y0, int x1, int y1,
+            std::string_view label, DrawRect bounds);
+
+  std::vector<DrawCommand> m_commands;
+  std::string m_text;
+  DrawRect m_bounds;
+};
+
+// タイル 1 つに置かれたエンティティの命令
+struct DrawEntry {
+  const void* key;
+  DrawRect bounds;
+  uint32_t command_begin;
+  uint32_t command_count;
+};
+
+// コンテナに置くと確保先を引き継ぐ
+struct DrawTile {
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  explicit DrawTile(const allocator_type& allocator);
+  DrawTile(DrawTile&& other, const allocator_type& allocator);
+
+  std::pmr::vector<DrawEntry> entries;
+  std::pmr::vector<DrawCommand> commands;
+  std::pmr::string text;
+};
+
+// エンティティは矩形が掛かる全てのタイルに命令の写しを置く
+constexpr int DRAW_TILE_WIDTH = 32;
+constexpr int DRAW_TILE_HEIGHT = 16;
+
+// エンティティごとの描画命令を保持し, 変更されたものだけを記録し直す
+// 表示範囲に掛かるタイルだけを辿り, 矩形が範囲外のエンティティは描かない
+// 描く量は表示範囲の大きさで決まり, ワールドの広さには依らない
+class RetainedDrawList {
+ public:
+  explicit RetainedDrawList(std::pmr::memory_resource* resource);
+  ~RetainedDrawList();
+
+  // key の命令を draw が描いたものに置き換える
+  void set(const void* key,
+           const std::function<void(DrawManagerBase*)>& draw);
+  void remove(const void* key);
+  void clear();
+
+  // ワールド座標 (origin_x, origin_y) が画面の左上に来るよう描く
+  void draw(DrawManagerBase* draw_manager, int origin_x, int origin_y) const;
+  void write_footprint(const char* name,
+                       std::vector<FootprintEntry>& entries) const;
+
+ private:
+  std::pmr::unordered_map<int64_t, DrawTile> m_tiles;
+  // エンティティが掛かるタイルの範囲, タイルの番号で持つ
+  std::pmr::unordered_map<const void*, DrawRect> m_entity_tiles;
+};
+
+}  // namespace factory_game
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "foundation.h"
+#include "machine.h"
+#include "pipe.h"
+#include "telemetry.h"
+
+namespace factory_game {
+
+// 1 秒 = 60 tick
+constexpr int EVALUATE_TICKS_PER_SECOND = 60;
+constexpr int EVALUATE_TICKS = EVALUATE_TICKS_PER_SECOND * 60;
+constexpr int EVALUATE_SLOT_CAPACITY = 4;
+constexpr int EVALUATE_PREVIEW_TICKS = EVALUATE_TICKS_PER_SECOND * 10;
+// 見積もりを 1 フレームで進める量, 成分の要素数 x tick で数える
+// 時間で区切らないので, 記録した入力の再生でも同じフレームに結果が出る
+constexpr int64_t EVALUATE_PREVIEW_FRAME_WORK = 1 << 16;
+
+struct EvaluateSlot {
+  Item item;
+  int count;
+};
+
+struct EvaluatePort {
+  int slot;
+  bool is_input;
+};
+
+struct EvaluateNode {
+  Machines type;
+  glm::ivec2 point;
+  int recipe_begin;
+  int recipe_end;
+  int input_begin;
+  int input_end;
+  int output_begin;
+  int output_end;
+  int active_recipe;  // -1 : 待機中
+  int timer;
+  int count;  // レシピの完了回数
+};
+
+// 出力ポートから入力ポートまでパイプで繋がった経路
+struct EvaluateLink {
+  int src_slot;
+  int dst_slot;
+  int length;
+  // (到着 tick, アイテム)
+  std::pmr::deque<std::pair<int, Item>> transit;
+};
+
+// 流体だけを運ぶパイプ網は, 区間の量から圧力を解いて流す
+// パイプを FLUID_SEGMENT_CELLS セルごとの区間に分け, 隣り合う区間と
+// 端を共有するパイプの区間の間を圧力差に比例して流れる
+// 1 tick ごとに陰的な拡散の式を Jacobi 法で解き, 収束した網は飛ばす
+// 区間から出る量は中身までに抑えるので, 流体は増えも減りもしない
+constexpr int FLUID_SEGMENT_CELLS = 4;
+constexpr float FLUID_CELL_VOLUME = 1.0f;  // アイテム 1 個が 1
+constexpr float FLUID_CONDUCTANCE = 1.0f;  // 圧力差 1 で 1 tick に流れる量
+constexpr int FLUID_ITERATIONS = 2;        // 1 tick あたりの反復の上限
+constexpr float FLUID_TOLERANCE = 1e-3f;
+// 区間の配列は網ごとにこの数の倍数へ詰め, 内側のループを SIMD にする
+constexpr int FLUID_LANES = 8;
+
+// 網の区間 1 つに繋がるポート
+struct EvaluateFluidPort {
+  int slot;
+  int segment;
+  float pending;  // 入力ポートが吸い出して, まだ 1 個にならない量
+};
+
+// 別々のパイプの端の区間同士の接続
+struct EvaluateFluidJunction {
+  int a;
+  int b;
+};
+
+// 区間の値は Evaluator の SoA 配列の [segment_begin, segment_end) にあり,
+// 前後の要素は圧力 0 の番兵
+struct EvaluateFluidNetwork {
+  int segment_begin;
+  int segment_end;
+  int junction_begin;
+  int junction_end;
+  int source_begin;  // 出力ポート, m_fluid_ports の範囲
+  int source_end;
+  int sink_begin;  // 入力ポート
+  int sink_end;
+  int item;  // 中の流体, -1 : 空
+  float volume;
+  float capacity;
+  int injected;   // 出力ポートから入れた数
+  int delivered;  // 入力ポートへ渡した数
+  bool settled;   // 収束して出入りも無い
+};
+
+// 網ごとの集計
+struct EvaluateFluid {
+  int item;  // -1 : 空
+  float capacity;
+  float fill;  // 量 / 容量
+  float rate;  // 毎秒の搬入数
+};
+
+// 全ての網の流体の収支, 入れた数 = 区間の量 + 吸い出し途中の量 + 渡した数
+struct EvaluateFluidBalance {
+  int injected;
+  int delivered;
+  double stored;
+  double pending;
+};
+
+// 出力ダクト 1 つあたりの毎秒の搬入数
+struct EvaluateRate {
+  glm::ivec2 point;
+  Item item;
+  float rate;
+};
+
+class Evaluator {
+ public:
+  Evaluator(const std::vector<std::shared_ptr<Machine>>& machines,
+            const std::vector<std::shared_ptr<Pipe>>& pipes,
+            StageArena* arena = nullptr);
+  ~Evaluator();
+
+  int get_tick() const;
+  void set_trace(TraceBuffer* trace);
+  void step(std::default_random_engine& rng);
+  void write_stats(EvaluateContext* stats) const;
+  void write_rates(std::pmr::vector<EvaluateRate>& rates) const;
+  // 入力ダクト以外の機械が作ったアイテムの数, Item で引く
+  void write_produced(std::vector<int>& counts) const;
+  void write_fluids(std::vector<EvaluateFluid>& fluids) const;
+  void write_fluid_balance(EvaluateFluidBalance* balance) const;
+
+ private:
+  void mark_trace(int node) {
+    if (m_trace == nullptr || m_trace_marked[node]) return;
+    m_trace_marked[node] = 1;
+    m_trace_dirty.push_back(node);
+  }
+  void trace();
+  void build_fluid_network(
+      const std::vector<std::shared_ptr<Pipe>>& pipes,
+      const std::vector<int>& members,
+      const std::unordered_map<glm::ivec2, EvaluatePort>& ports);
+  void drain_fluids();
+  void fill_fluids();
+  void solve_fluid(EvaluateFluidNetwork& network);
+
+  int m_tick;
+  TraceBuffer* m_trace;  // nullptr ならトレースしない
+  std::pmr::vector<TraceRecord> m_trace_last;
+  std::pmr::vector<uint8_t> m_trace_marked;
+  // この tick に値が変わった可能性のある機械
+  std::pmr::vector<int> m_trace_dirty;
+  std::vector<Recipe> m_recipes;
+  std::pmr::vector<EvaluateSlot> m_slots;
+  std::pmr::vector<int> m_slot_nodes;
+  std::pmr::vector<EvaluateNode> m_nodes;
+  std::pmr::vector<EvaluateLink> m_links;
+  std::pmr::vector<int> m_output_nodes;
+  std::pmr::vector<int> m_produced;
+
+  std::pmr::vector<EvaluateFluidNetwork> m_fluid_networks;
+  std::pmr::vector<EvaluateFluidJunction> m_fluid_junctions;
+  std::pmr::vector<EvaluateFluidPort> m_fluid_ports;
+  // 区間ごとの値
+  std::pmr::vector<float> m_fluid_volume;
+  std::pmr::vector<float> m_fluid_capacity;
+  std::pmr::vector<float> m_fluid_pressure;
+  std::pmr::vector<float> m_fluid_scratch;
+  std::pmr::vector<float> m_fluid_prev_weight;  // 同じパイプの前の区間へ
+  std::pmr::vector<float> m_fluid_next_weight;
+  std::pmr::vector<float> m_fluid_inverse_diagonal;
+  std::pmr::vector<float> m_fluid_inverse_conductance;
+};
+
+// 描画ループが毎フレーム読み取る評価の途中経過
+struct EvaluateProgress {
+  int tick;
+  int total_ticks;
+  bool done;
+  std::vector<Item> items;
+  std::vector<int> counts;
+};
+
+enum Grades {
+  GRADE_BAD,      // どの出力ダクトにも届いていない
+  GRADE_GOOD,     // 一部の出力ダクトに届いた
+  GRADE_PERFECT,  // 全ての出力ダクトに届いた
+};
+
+struct EvaluateScore {
+  float value;
+  Grades grade;
+};
+
+// 結果画面の採点, 搬入数の合計を残りの設計時間で重み付けする
+EvaluateScore get_evaluate_score(const EvaluateContext& stats);
+
+// 評価をワーカースレッドで実行する
+// speed は 1 秒あたり EVALUATE_TICKS_PER_SECOND * speed tick, 0 で無制限
+class EvaluateWorker {
+ public:
+  EvaluateWorker();
+  ~EvaluateWorker();
+
+  void start(Evaluator evaluator, int total_ticks, unsigned int seed);
+  void stop();
+  void set_speed(int speed);
+  int get_speed() const;
+  EvaluateProgress get_progress() const;
+
+ private:
+  void run(Evaluator evaluator, int total_ticks, unsigned int seed);
+  void publish(const Evaluator& evaluator, int total_ticks, bool done);
+
+  std::thread m_thread;
+  std::atomic<bool> m_stop;
+  std::atomic<int> m_speed;
+  mutable std::mutex m_mutex;
+  EvaluateProgress m_progress;
+};
+
+// 評価結果のキャッシュ, 同じレイアウトの再評価を省く
+struct EvaluateKey {
+  uint64_t hash;  // MachineManager::get_hash() + PipeManager::get_hash()
+  int stage;
+  int ticks;
+  unsigned int seed;
+
+  bool operator==(const EvaluateKey& other) const;
+};
+
+struct EvaluateKeyHash {
+  size_t operator()(const EvaluateKey& key) const;
+};
+
+// 1 つのロックに集まらないようキーのハッシュでシャードに分け,
+// シャードごとに最も古く使われたものから捨てる
+constexpr int EVALUATE_CACHE_SHARDS = 16;
+
+class EvaluateCache {
+ public:
+  // capacity は全シャードの合計
+  explicit EvaluateCache(size_t capacity);
+  ~EvaluateCache();
+
+  // produced を求めたときは, それを持たない項目は無いものとして扱う
+  bool find(const EvaluateKey& key, EvaluateContext* stats,
+            std::vector<int>* produced = nullptr);
+  // produced は Evaluator::write_produced の値, 無ければ nullptr
+  void insert(const EvaluateKey& key, const EvaluateContext& stats,
+              const std::vector<int>* produced = nullptr);
+
+ private:
+  struct Value {
+    EvaluateContext stats;
+    std::vector<int> produced;
+    bool has_produced;
+  };
+  using Entry = std::pair<EvaluateKey, Value>;
+  using EntryList = std::pmr::list<Entry>;
+
+  struct Shard {
+    explicit Shard(std::pmr::memory_resource* resource);
+
+    std::mutex mutex;
+    EntryList entries;  // 先頭ほど最近使われた
+    std::pmr::unordered_map<EvaluateKey, EntryList::iterator, EvaluateKeyHash>
+        idx;
+  };
+
+  Shard& get_shard(const EvaluateKey& key);
+
+  size_t m_shard_capacity;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+// プロセス全体で共有するキャッシュ
+EvaluateCache& get_evaluate_cache();
+
+// 設計中のプレビュー評価
+// パイプで繋がった連結成分ごとに結果を保持し, 編集された成分だけを再評価する
+// コンテナに置くと確保先を引き継ぐ
+struct EvaluateComponent {
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  explicit EvaluateComponent(const allocator_type& allocator);
+  EvaluateComponent(EvaluateComponent&& other,
+                    const allocator_type& allocator);
+
+  std::pmr::vector<std::shared_ptr<Machine>> machines;
+  std::pmr::vector<std::shared_ptr<Pipe>> pipes;
+  bool dirty;
+  std::pmr::vector<EvaluateRate> rates;
+};
+
+class EvaluatePreview {
+ public:
+  explicit EvaluatePreview(StageArena* arena = nullptr);
+  ~EvaluatePreview();
+
+  void add_machine(const std::shared_ptr<Machine>& machine);
+  void remove_machine(const std::shared_ptr<Machine>& machine);
+  void add_pipe(const std::shared_ptr<Pipe>& pipe);
+  void remove_pipe(const std::shared_ptr<Pipe>& pipe);
+  // 一括追加, 接する成分の作り直しは 1 回で済ませる
+  void add_entities(const std::vector<std::shared_ptr<Machine>>& machines,
+                    const std::vector<std::shared_ptr<Pipe>>& pipes);
+  void clear();
+  // 途中の評価を捨てる, 成分はそのまま
+  void stop();
+
+  // 編集された成分を EVALUATE_PREVIEW_FRAME_WORK だけ評価し,
+  // 評価を終えた成分の見積もりを出す
+  void update();
+  // 全ての成分の見積もりが出ていれば true
+  bool is_ready() const;
+  const std::pmr::vector<EvaluateRate>& get_rates() const;
+  void write_footprint(std::vector<FootprintEntry>& entries) const;
+
+ private:
+  void rebuild(const std::vector<int>& ids,
+               std::vector<std::shared_ptr<Machine>> machines,
+               std::vector<std::shared_ptr<Pipe>> pipes);
+  void publish_rates(const std::vector<int>& finished);
+
+  StageArena* m_arena;
+  int m_next_id;
+  std::pmr::unordered_map<int, EvaluateComponent> m_components;
+  std::pmr::unordered_map<const Machine*, int> m_machine_components;
+  std::pmr::unordered_map<const Pipe*, int> m_pipe_components;
+  std::pmr::unordered_map<glm::ivec2, std::shared_ptr<Machine>, PointHash>
+      m_port_idx;
+  std::pmr::unordered_map<glm::ivec2, std::pmr::vector<std::shared_ptr<Pipe>>,
+                          PointHash>
+      m_pipe_end_idx;
+  std::pmr::deque<int> m_pending;  // 評価を待つ成分, 前から順に進める
+  // m_pending.front() の途中の評価, 無ければ nullptr
+  std::unique_ptr<Evaluator> m_evaluator;
+  std::default_random_engine m_rng;
+  std::pmr::vector<int> m_stale;  // 消した成分, 次の update で見積もりから外す
+  std::pmr::vector<EvaluateRate> m_rates;  // 画面の上から順
+  std::pmr::vector<int> m_rate_components;  // m_rates と同じ順の成分
+};
+
+}  // namespace factory_game
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <ostream>
+#include <vector>
+
+namespace factory_game {
+
+class DrawManagerBase;  // for pointer reference
+
+// 用途ごとのメモリ使用量
+// コンテナに CountingResource を渡すと, 確保・解放のたびに加算される
+enum MemoryCategory {
+  MEMORY_ENTITY,
+  MEMORY_MACHINE_SET,
+  MEMORY_MACHINE_INDEX,
+  MEMORY_PIPE_SET,
+  MEMORY_PIPE_INDEX,
+  MEMORY_DRAW_BUFFER,
+  MEMORY_DRAW_LIST,
+  MEMORY_OCCUPANCY,
+  MEMORY_EVALUATE,
+  MEMORY_PREVIEW,
+  MEMORY_CACHE,
+  MEMORY_HISTORY,
+  MEMORY_CATEGORY_COUNT,
+};
+
+const char* memory_category_to_string(MemoryCategory category);
+
+struct MemoryCounter {
+  std::atomic<int64_t> bytes;
+  std::atomic<int64_t> peak;
+  std::atomic<int64_t> allocations;  // 確保中のブロック数
+};
+
+MemoryCounter& get_memory_counter(MemoryCategory category);
+void count_allocation(MemoryCategory category, size_t bytes);
+void count_deallocation(MemoryCategory category, size_t bytes);
+
+// 確保・解放を集計しながら upstream へ委譲する
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  CountingResource(MemoryCategory category,
+                   std::pmr::memory_resource* upstream);
+
+  // 解放されずに残っている分を集計から除く, upstream ごと捨てるときに呼ぶ
+  void forget();
+  int64_t get_bytes() const;
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override;
+
+  MemoryCategory m_category;
+  std::pmr::memory_resource* m_upstream;
+  std::atomic<int64_t> m_bytes;
+  std::atomic<int64_t> m_blocks;
+};
+
+// ステージに属さないコンテナ用, ヒープから確保する
+std::pmr::memory_resource* get_heap_resource(MemoryCategory category);
+
+// ハッシュコンテナ 1 つ分の状態
+struct FootprintEntry {
+  const char* name;
+  MemoryCategory category;
+  size_t size;
+  size_t bucket_count;
+  float load_factor;
+};
+
+template <typename Container>
+FootprintEntry make_footprint_entry(const char* name,
+                                    const MemoryCategory category,
+                                    const Container& container) {
+  return FootprintEntry{name, category, container.size(),
+                        container.bucket_count(), container.load_factor()};
+}
+
+// 取得できない環境では 0
+int64_t get_resident_bytes();
+
+void write_footprint_report(std::ostream& stream,
+                            const std::vector<FootprintEntry>& entries);
+void draw_footprint_overlay(DrawManagerBase* draw_manager,
+                            const std::vector<FootprintEntry>& entries);
+
+}  // namespace factory_game
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
+#include <glm/vec2.hpp>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace factory_game {
@@ -19,7 +22,44 @@ enum Item {
   ITEM_CHIP,
 };
 
+enum Machines {
+  MACHINE_ELECTROLYZER,
+  MACHINE_CUTTER,
+  MACHINE_LAZER,
+  MACHINE_ASSEMBLER,
+  MACHINE_INPUT_DUCT,
+  MACHINE_OUTPUT_DUCT,
+};
+
 std::string item_to_string(Item item);
+bool string_to_item(std::string_view text, Item* item);
+// 流体はパイプ網の中を圧力で流れ, 他は 1 個ずつ運ばれる
+bool is_fluid(Item item);
+
+// レイアウトハッシュ用の要素ごとの乱数キー, 要素の追加で足し削除で引く
+// XOR と違い, 同じ要素が 2 つあっても打ち消し合わない
+uint64_t zobrist_key(uint64_t kind, int x0, int y0, int x1 = 0, int y1 = 0);
+
+// 空間インデックス用のハッシュ
+// glm の hash_combine は格子状の座標で衝突が多いため, 64 bit に詰めて混ぜる
+struct PointHash {
+  size_t operator()(const glm::ivec2& point) const {
+    uint64_t value = (static_cast<uint64_t>(static_cast<uint32_t>(point.x))
+                      << 32) |
+                     static_cast<uint32_t>(point.y);
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    return static_cast<size_t>(value);
+  }
+};
+
+// inputs[i] は i 番目の入力ポートに要求するアイテム
+struct Recipe {
+  std::vector<Item> inputs;
+  std::vector<Item> outputs;
+  int duration;
+};
 
 struct EvaluateContext {
   int stage;
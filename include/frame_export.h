@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace factory_game {
+
+// 画面の共有メモリ, 別のプロセスが写して読む
+// ヘッダの後に FRAME_EXPORT_SLOTS 個のスロットが輪になって並ぶ
+// スロットは FrameSlot の後に width * height 個のセル (1 バイト) を持つ
+// 書き手はフレーム番号 % スロット数に書き, 読み手を待たない
+// 読み手は sequence が前後で同じ偶数なら読んだセルを信じる (seqlock)
+constexpr uint32_t FRAME_EXPORT_MAGIC = 0x42464746;  // "FGFB"
+constexpr uint32_t FRAME_EXPORT_VERSION = 1;
+constexpr uint32_t FRAME_EXPORT_SLOTS = 4;
+constexpr int FRAME_EXPORT_MAX_WIDTH = 512;  // これを超える画面は書かない
+constexpr int FRAME_EXPORT_MAX_HEIGHT = 256;
+
+struct FrameExportHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t slot_size;  // FrameSlot を含むスロット 1 つのバイト数
+  uint32_t max_width;
+  uint32_t max_height;
+  std::atomic<uint64_t> latest;  // 最後に書き終えたフレーム番号, 0 は未公開
+  uint64_t reserved[4];
+};
+
+struct FrameSlot {
+  std::atomic<uint64_t> sequence;  // 奇数の間は書き込み中
+  uint64_t frame;
+  int64_t timestamp;  // steady_clock のナノ秒
+  int32_t width;
+  int32_t height;
+  uint64_t reserved[4];
+};
+
+// 共有メモリの上で使うので, アドレスに依らずロックの無い原子変数に限る
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(sizeof(FrameExportHeader) == 64);
+static_assert(sizeof(FrameSlot) == 64);
+
+// 読み出した 1 フレーム
+struct ExportedFrame {
+  uint64_t frame;
+  int64_t timestamp;
+  int width;
+  int height;
+  std::vector<char> cells;  // 行ごとに width 個ずつ
+};
+
+// 書き手, present を呼ぶスレッドから使う
+// 共有メモリは Linux の shm_open で作り, 他の環境では open が失敗する
+class FrameExporter {
+ public:
+  FrameExporter();
+  ~FrameExporter();
+
+  FrameExporter(const FrameExporter&) = delete;
+  FrameExporter& operator=(const FrameExporter&) = delete;
+
+  // name は "/factory_game" のような共有メモリの名前, '/' は省いてもよい
+  // 前回の同じ名前のものは作り直す
+  bool open(const std::string& name);
+  void close();
+
+  // 大きすぎる画面は書かずに false
+  bool publish(const char* cells, int width, int height);
+  uint64_t get_frame() const;
+
+ private:
+  std::string m_name;
+  char* m_data;
+  size_t m_size;
+  uint64_t m_frame;
+};
+
+// 読み手, 書き手とは別のプロセスで使う
+class FrameReader {
+ public:
+  FrameReader();
+  ~FrameReader();
+
+  FrameReader(const FrameReader&) = delete;
+  FrameReader& operator=(const FrameReader&) = delete;
+
+  bool open(const std::string& name);
+  void close();
+
+  // 書き手が公開した最新のフレーム番号, 0 は未公開
+  uint64_t get_latest() const;
+  // 最新のフレームを frame へ写す, after より新しいものが無ければ false
+  // 書き手に追い越され続けたときも false
+  bool read_latest(uint64_t after, ExportedFrame* frame) const;
+
+ private:
+  const char* m_data;
+  size_t m_size;
+};
+
+}  // namespace factory_game
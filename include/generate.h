@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "machine.h"
+#include "pipe.h"
+
+namespace factory_game {
+
+// 負荷試験用のレイアウト生成
+// 入力ダクト -> 加工機械 -> 出力ダクト の系統を縦に並べ, 区画の格子に配置する
+// 同じ設定とシードからは常に同じレイアウトができる
+constexpr int GENERATE_MAX_CHAIN_DEPTH = 3;
+
+struct GenerateOptions {
+  uint64_t seed = 1;
+  int machine_count = 1000;    // ダクトを含む機械の数の下限
+  float density = 0.5f;        // 区画のうち系統を置く割合 (0, 1]
+  int chain_depth = 3;         // 系統あたりの加工機械の数, 1 ~ 3
+  float l_shape_ratio = 0.5f;  // L 字パイプの割合の目安
+};
+
+struct GeneratedLayout {
+  std::vector<std::shared_ptr<Machine>> machines;
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  glm::ivec2 size;
+};
+
+GeneratedLayout generate_layout(const GenerateOptions& options);
+
+// 既存の内容を捨てて一括追加する
+void load_generated_layout(const GeneratedLayout& layout,
+                           MachineManager& machine_manager,
+                           PipeManager& pipe_manager);
+
+}  // namespace factory_game
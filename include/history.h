@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "arena.h"
+#include "footprint.h"
+#include "machine.h"
+#include "pipe.h"
+
+namespace factory_game {
+
+// 世界に置かれた要素, machine と pipe のどちらか一方だけを持つ
+struct WorldEntity {
+  std::shared_ptr<Machine> machine;
+  std::shared_ptr<Pipe> pipe;
+};
+
+struct WorldNode;
+
+// 要素の集合の 1 版, 永続 HAMT の根で nullptr は空
+// 節は作った後に変えず, 編集は辿った経路だけを複製して残りを前の版と共有する
+using WorldRoot = std::shared_ptr<const WorldNode>;
+
+// 複製した節は arena に置く, nullptr ならヒープ
+WorldRoot world_insert(const WorldRoot& root, const WorldEntity& entity,
+                       StageArena* arena = nullptr);
+WorldRoot world_erase(const WorldRoot& root, const WorldEntity& entity,
+                      StageArena* arena = nullptr);
+bool world_contains(const WorldRoot& root, const WorldEntity& entity);
+size_t world_size(const WorldRoot& root);
+// from から to への差分, 両方の版で共有している枝は辿らない
+void world_diff(const WorldRoot& from, const WorldRoot& to,
+                std::vector<WorldEntity>& removed,
+                std::vector<WorldEntity>& added);
+
+// 残す版の数, 超えたら古い版から捨てる
+constexpr size_t WORLD_HISTORY_LIMIT = 256;
+
+// 編集の履歴, 版ごとに根だけを持つ
+// undo と redo は根を差し替え, 管理クラスへ反映する差分を返す
+// 節と版の列は arena に置くので, arena ごと捨てれば節を 1 つずつ解放しない
+class WorldHistory {
+ public:
+  explicit WorldHistory(StageArena* arena = nullptr);
+  ~WorldHistory();
+
+  // entities だけの版から始め直す
+  void reset(const std::vector<WorldEntity>& entities);
+  // 今の版に編集を積み, redo できる版を捨てる
+  void commit(const std::vector<WorldEntity>& added,
+              const std::vector<WorldEntity>& removed);
+  // 戻れる版が無ければ false
+  bool undo(std::vector<WorldEntity>& removed,
+            std::vector<WorldEntity>& added);
+  bool redo(std::vector<WorldEntity>& removed,
+            std::vector<WorldEntity>& added);
+  const WorldRoot& get_root() const;
+  size_t get_undo_count() const;
+  size_t get_redo_count() const;
+  void write_footprint(std::vector<FootprintEntry>& entries) const;
+
+ private:
+  StageArena* m_arena;
+  std::pmr::deque<WorldRoot> m_versions;
+  size_t m_current;
+};
+
+}  // namespace factory_game
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "machine.h"
+#include "pipe.h"
+
+namespace factory_game {
+
+// レイアウトファイル
+// ヘッダの後に MachineRecord, PipeRecord が固定長・リトルエンディアンで並ぶ
+constexpr uint32_t LAYOUT_MAGIC = 0x594c4746;  // "FGLY"
+constexpr uint32_t LAYOUT_VERSION = 1;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool LAYOUT_NATIVE_ENDIAN = false;
+#else
+constexpr bool LAYOUT_NATIVE_ENDIAN = true;
+#endif
+
+struct LayoutHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stage;
+  uint32_t reserved;
+  uint64_t machine_count;
+  uint64_t pipe_count;
+  uint64_t hash;
+};
+
+struct MachineRecord {
+  uint32_t type;
+  uint32_t item;
+  int32_t x;
+  int32_t y;
+};
+
+struct PipeRecord {
+  int32_t begin_x;
+  int32_t begin_y;
+  int32_t end_x;
+  int32_t end_y;
+};
+
+static_assert(sizeof(LayoutHeader) == 40);
+static_assert(sizeof(MachineRecord) == 16);
+static_assert(sizeof(PipeRecord) == 16);
+
+MachineRecord make_machine_record(const std::shared_ptr<Machine>& machine);
+PipeRecord make_pipe_record(const std::shared_ptr<Pipe>& pipe);
+// 知らない種類やアイテムのレコードは nullptr
+std::shared_ptr<Machine> make_machine(const MachineRecord& record,
+                                      StageArena* arena = nullptr);
+std::shared_ptr<Pipe> make_pipe(const PipeRecord& record,
+                                StageArena* arena = nullptr);
+
+// ビッグエンディアン環境で 4 byte 単位のフィールドを入れ替える
+// 64 bit のフィールドは呼び出し側で上位と下位のワードを入れ替える
+void swap_layout_words(char* data, size_t size);
+
+bool save_layout(const std::string& path, int stage,
+                 const MachineManager& machine_manager,
+                 const PipeManager& pipe_manager);
+
+// ファイル全体を mmap し, レコードはコピーせずに参照する
+class LayoutFile {
+ public:
+  LayoutFile();
+  ~LayoutFile();
+
+  LayoutFile(const LayoutFile&) = delete;
+  LayoutFile& operator=(const LayoutFile&) = delete;
+
+  bool open(const std::string& path);
+  void close();
+
+  const LayoutHeader& get_header() const;
+  const MachineRecord* get_machines() const;
+  const PipeRecord* get_pipes() const;
+
+ private:
+  const char* m_data;
+  size_t m_size;
+  bool m_mapped;
+  std::vector<char> m_buffer;  // mmap できない環境用
+};
+
+// 管理クラスの中身を置き換える, 空間インデックスは 1 回の走査で書き込む
+void load_layout(const LayoutFile& file, MachineManager& machine_manager,
+                 PipeManager& pipe_manager);
+
+}  // namespace factory_game
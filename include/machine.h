@@ -5,28 +5,53 @@
 #include <glm/gtx/hash.hpp>
 #include <glm/vec2.hpp>
 #include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
+#include "arena.h"
 #include "draw.h"
+#include "draw_list.h"
 #include "foundation.h"
+#include "occupancy.h"
 
 namespace factory_game {
 
 class Machine;  // for pointer reference
 
+using MachineSpatialMap =
+    std::pmr::unordered_map<glm::ivec2, std::shared_ptr<Machine>, PointHash>;
+// 後から書いた機械に隠れたセル, 上の機械を外したときに索引へ戻す
+using MachineShadowMap =
+    std::pmr::unordered_multimap<glm::ivec2, std::shared_ptr<Machine>,
+                                 PointHash>;
+using MachineSet = std::pmr::unordered_set<std::shared_ptr<Machine>>;
+
+// is_erase なら Write は cursor のセルを索引から外す
 class MachineSpatialIdx {
  public:
-  MachineSpatialIdx(
-      std::unordered_map<glm::ivec2, std::shared_ptr<Machine>>& spatial_idx,
-      std::shared_ptr<Machine>& cursor);
+  MachineSpatialIdx(MachineSpatialMap& spatial_idx, MachineShadowMap& shadowed,
+                    OccupancyGrid& occupancy, std::shared_ptr<Machine>& cursor,
+                    bool is_erase = false);
   ~MachineSpatialIdx();
 
   void Write(glm::ivec2 point) const;
 
  private:
-  std::unordered_map<glm::ivec2, std::shared_ptr<Machine>>& m_spatial_idx;
+  MachineSpatialMap& m_spatial_idx;
+  MachineShadowMap& m_shadowed;
+  OccupancyGrid& m_occupancy;
   std::shared_ptr<Machine>& m_cursor;
+  bool m_is_erase;
+};
+
+// 壊せる機械が占有する幅, 高さは 1
+constexpr int MACHINE_WIDTH = 15;
+
+struct MachinePorts {
+  std::vector<glm::ivec2> inputs;
+  std::vector<glm::ivec2> outputs;
 };
 
 class Machine {
@@ -37,6 +62,11 @@ class Machine {
   virtual ~Machine();
 
   virtual bool is_breakable() = 0;
+  virtual Machines get_type() = 0;
+  virtual void build_ports(MachinePorts& ports) = 0;
+  virtual void build_recipes(std::vector<Recipe>& recipes) = 0;
+  // ダクトが運ぶアイテム, ダクト以外は ITEM_WATER
+  virtual Item get_item();
 
   virtual void draw(DrawManagerBase* draw_manager) = 0;
   virtual void build_spatial_idx(MachineSpatialIdx writer) = 0;
@@ -48,6 +78,10 @@ class InputDuct : public Machine {
   ~InputDuct() override;
 
   bool is_breakable() override;
+  Machines get_type() override;
+  void build_ports(MachinePorts& ports) override;
+  void build_recipes(std::vector<Recipe>& recipes) override;
+  Item get_item() override;
 
   void draw(DrawManagerBase* draw_manager) override;
   void build_spatial_idx(MachineSpatialIdx writer) override;
@@ -62,6 +96,10 @@ class OutputDuct : public Machine {
   ~OutputDuct() override;
 
   bool is_breakable() override;
+  Machines get_type() override;
+  void build_ports(MachinePorts& ports) override;
+  void build_recipes(std::vector<Recipe>& recipes) override;
+  Item get_item() override;
 
   void draw(DrawManagerBase* draw_manager) override;
   void build_spatial_idx(MachineSpatialIdx writer) override;
@@ -76,6 +114,9 @@ class Electrolyzer : public Machine {
   ~Electrolyzer() override;
 
   bool is_breakable() override;
+  Machines get_type() override;
+  void build_ports(MachinePorts& ports) override;
+  void build_recipes(std::vector<Recipe>& recipes) override;
 
   void draw(DrawManagerBase* draw_manager) override;
   void build_spatial_idx(MachineSpatialIdx writer) override;
@@ -87,6 +128,9 @@ class Cutter : public Machine {
   ~Cutter() override;
 
   bool is_breakable() override;
+  Machines get_type() override;
+  void build_ports(MachinePorts& ports) override;
+  void build_recipes(std::vector<Recipe>& recipes) override;
 
   void draw(DrawManagerBase* draw_manager) override;
   void build_spatial_idx(MachineSpatialIdx writer) override;
@@ -98,6 +142,9 @@ class Laser : public Machine {
   ~Laser() override;
 
   bool is_breakable() override;
+  Machines get_type() override;
+  void build_ports(MachinePorts& ports) override;
+  void build_recipes(std::vector<Recipe>& recipes) override;
 
   void draw(DrawManagerBase* draw_manager) override;
   void build_spatial_idx(MachineSpatialIdx writer) override;
@@ -109,25 +156,53 @@ class Assembler : public Machine {
   ~Assembler() override;
 
   bool is_breakable() override;
+  Machines get_type() override;
+  void build_ports(MachinePorts& ports) override;
+  void build_recipes(std::vector<Recipe>& recipes) override;
 
   void draw(DrawManagerBase* draw_manager) override;
   void build_spatial_idx(MachineSpatialIdx writer) override;
 };
 
+// レイアウトハッシュへ足す機械 1 つ分のキー, ダクトのアイテムも区別する
+uint64_t machine_zobrist_key(const std::shared_ptr<Machine>& machine);
+
+// arena が nullptr ならヒープに置く
+std::shared_ptr<Machine> make_machine(Machines type, glm::ivec2 point,
+                                      Item item, StageArena* arena = nullptr);
+
 class MachineManager {
  public:
-  MachineManager();
+  explicit MachineManager(StageArena* arena = nullptr);
   ~MachineManager();
 
   void build_spatial_idx();
   void add_machine(const std::shared_ptr<Machine>& machine);
+  void add_machines(const std::vector<std::shared_ptr<Machine>>& machines);
   void remove_machine(const std::shared_ptr<Machine>& machine);
+  // 外す要素のセルだけを索引から消す
+  void remove_machines(const std::vector<std::shared_ptr<Machine>>& machines);
+  void clear();
   std::shared_ptr<Machine> find_machine(glm::ivec2 point);
-  void draw(DrawManagerBase* draw_manager) const;
+  // min から max までの矩形に掛かる機械, 同じ機械は 1 回だけ入れる
+  void find_machines(glm::ivec2 min, glm::ivec2 max,
+                     std::vector<std::shared_ptr<Machine>>& machines) const;
+  const MachineSet& get_machines() const;
+  const OccupancyGrid& get_occupancy() const;
+  uint64_t get_hash() const;
+  StageArena* get_arena() const;
+  void write_footprint(std::vector<FootprintEntry>& entries) const;
+  // camera は画面の左上に来るワールド座標
+  void draw(DrawManagerBase* draw_manager, glm::ivec2 camera) const;
 
  private:
-  std::unordered_set<std::shared_ptr<Machine>> m_machines;
-  std::unordered_map<glm::ivec2, std::shared_ptr<Machine>> m_spatial_idx;
+  StageArena* m_arena;
+  uint64_t m_hash;
+  MachineSet m_machines;
+  MachineSpatialMap m_spatial_idx;
+  MachineShadowMap m_shadowed;
+  OccupancyGrid m_occupancy;  // m_spatial_idx と同じセル
+  RetainedDrawList m_draw_list;
 };
 
 }  // namespace factory_game
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace factory_game {
+
+// 座標のビットを x, y の順に交互に並べた 64 bit の値 (Z 曲線の順番)
+// 負の座標も並びが保たれるよう, 符号ビットを反転してから並べる
+// x は偶数ビット, y は奇数ビットに入る
+uint64_t morton_encode(glm::ivec2 point);
+glm::ivec2 morton_decode(uint64_t code);
+
+// min から max までの矩形の角の符号を low, high として,
+// code が矩形に入っていれば true
+bool morton_in_box(uint64_t code, uint64_t low, uint64_t high);
+
+// code より大きく矩形に入る最小の符号 (BIGMIN), 無ければ false
+// code は low 以上 high 以下で, 矩形に入っていないこと
+bool morton_next_in_box(uint64_t code, uint64_t low, uint64_t high,
+                        uint64_t* next);
+
+template <typename T>
+struct MortonEntry {
+  uint64_t code;
+  T value;
+};
+
+// 並べた符号 codes[begin, end) のうち code 以上の最初の位置
+// 比較の結果で分岐しないので, 予測の外れが起きない
+size_t morton_lower_bound(const uint64_t* codes, size_t begin, size_t end,
+                          uint64_t code);
+// begin から 1, 2, 4, ... 個先と比べて範囲を絞ってから探す
+// 近くにあると分かっている符号を探すときに使う
+size_t morton_gallop(const uint64_t* codes, size_t begin, size_t end,
+                     uint64_t code);
+
+// セルから値を引く, 符号の順に並べた配列
+// 近いセルが近いアドレスに並ぶので, 矩形の走査はまとまった範囲を読むだけで済む
+// 符号と値は別の配列に置き, 探索では符号だけを読む
+// 1 つずつの追加と削除は配列をずらすので, 多く変えるときは insert_batch を使う
+template <typename T>
+class MortonIndex {
+ public:
+  using Entry = MortonEntry<T>;
+
+  explicit MortonIndex(std::pmr::memory_resource* resource)
+      : m_codes(resource),
+        m_values(resource),
+        m_merged_codes(resource),
+        m_merged_values(resource) {}
+
+  size_t size() const { return m_codes.size(); }
+  const std::pmr::vector<uint64_t>& get_codes() const { return m_codes; }
+  const std::pmr::vector<T>& get_values() const { return m_values; }
+
+  // 容量は残して空にする
+  void clear() {
+    m_codes.clear();
+    m_values.clear();
+  }
+
+  // 全体を作り直す, 同じセルは後のものが勝つ
+  void build(std::vector<Entry>& entries) {
+    clear();
+    insert_batch(entries);
+  }
+
+  // entries を並べ替えてから今の配列と 1 回で混ぜる
+  // 同じセルは entries の後のものが勝つ
+  void insert_batch(std::vector<Entry>& entries) {
+    if (entries.empty()) return;
+
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry& a, const Entry& b) {
+                       return a.code < b.code;
+                     });
+    // 同じ符号が続けば最後のものだけを残す
+    auto last = entries.begin();
+    for (auto it = entries.begin() + 1; it != entries.end(); ++it) {
+      if (it->code == last->code)
+        *last = std::move(*it);
+      else if (++last != it)
+        *last = std::move(*it);
+    }
+    entries.erase(last + 1, entries.end());
+
+    m_merged_codes.clear();
+    m_merged_values.clear();
+    m_merged_codes.reserve(m_codes.size() + entries.size());
+    m_merged_values.reserve(m_codes.size() + entries.size());
+    size_t old_index = 0;
+    auto new_it = entries.begin();
+    while (old_index < m_codes.size() || new_it != entries.end()) {
+      if (new_it == entries.end() ||
+          (old_index < m_codes.size() && m_codes[old_index] < new_it->code)) {
+        m_merged_codes.push_back(m_codes[old_index]);
+        m_merged_values.push_back(std::move(m_values[old_index]));
+        old_index++;
+        continue;
+      }
+      if (old_index < m_codes.size() && m_codes[old_index] == new_it->code)
+        old_index++;
+      m_merged_codes.push_back(new_it->code);
+      m_merged_values.push_back(std::move(new_it->value));
+      ++new_it;
+    }
+    m_codes.swap(m_merged_codes);
+    m_values.swap(m_merged_values);
+  }
+
+  void insert(const glm::ivec2 point, T value) {
+    const uint64_t code = morton_encode(point);
+    const size_t index = lower_bound(code);
+    if (index < m_codes.size() && m_codes[index] == code) {
+      m_values[index] = std::move(value);
+      return;
+    }
+    m_codes.insert(m_codes.begin() + index, code);
+    m_values.insert(m_values.begin() + index, std::move(value));
+  }
+
+  void erase(const glm::ivec2 point) {
+    const uint64_t code = morton_encode(point);
+    const size_t index = lower_bound(code);
+    if (index == m_codes.size() || m_codes[index] != code) return;
+    m_codes.erase(m_codes.begin() + index);
+    m_values.erase(m_values.begin() + index);
+  }
+
+  // 無ければ nullptr
+  const T* find(const glm::ivec2 point) const {
+    const uint64_t code = morton_encode(point);
+    const size_t index = lower_bound(code);
+    if (index == m_codes.size() || m_codes[index] != code) return nullptr;
+    return &m_values[index];
+  }
+
+  // [min, max] のセルを符号の順に visit(point, value) へ渡す
+  // 矩形を外れたら, 次に矩形へ入る符号まで飛ぶ
+  template <typename Visit>
+  void for_each_in(const glm::ivec2 min, const glm::ivec2 max,
+                   Visit&& visit) const {
+    if (min.x > max.x || min.y > max.y) return;
+
+    const uint64_t low = morton_encode(min);
+    const uint64_t high = morton_encode(max);
+    const uint64_t* codes = m_codes.data();
+    const size_t count = m_codes.size();
+    size_t index = lower_bound(low);
+    while (index < count && codes[index] <= high) {
+      const uint64_t code = codes[index];
+      if (morton_in_box(code, low, high)) {
+        visit(morton_decode(code), m_values[index]);
+        index++;
+        continue;
+      }
+      uint64_t next;
+      if (!morton_next_in_box(code, low, high, &next)) break;
+      index = morton_gallop(codes, index + 1, count, next);
+    }
+  }
+
+ private:
+  size_t lower_bound(const uint64_t code) const {
+    return morton_lower_bound(m_codes.data(), 0, m_codes.size(), code);
+  }
+
+  std::pmr::vector<uint64_t> m_codes;  // 昇順, 重ならない
+  std::pmr::vector<T> m_values;        // m_codes と同じ順
+  // insert_batch の作業用
+  std::pmr::vector<uint64_t> m_merged_codes;
+  std::pmr::vector<T> m_merged_values;
+};
+
+}  // namespace factory_game
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "footprint.h"
+
+namespace factory_game {
+
+// 1 行分の占有ビット, first_word から連続した 64 セル単位のワード
+// ビット i はワード内で左から i 番目のセル
+struct OccupancyRow {
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  explicit OccupancyRow(const allocator_type& allocator);
+  OccupancyRow(OccupancyRow&& other, const allocator_type& allocator);
+
+  // 範囲外は空き
+  uint64_t get_word(int word) const;
+  // 範囲外なら行を広げる
+  uint64_t& touch_word(int word);
+
+  int first_word;
+  std::pmr::vector<uint64_t> words;
+};
+
+// セルごとの占有を行ごとのビット列で持つ
+// 矩形の重なり判定と空き区間の探索をワード単位の演算で行う
+class OccupancyGrid {
+ public:
+  explicit OccupancyGrid(std::pmr::memory_resource* resource);
+  ~OccupancyGrid();
+
+  void set(int x, int y);
+  // 行の確保は残す
+  void reset(int x, int y);
+  void set_span(int x, int y, int width);
+  // 行の確保は残したまま全て空きにする
+  void clear();
+
+  bool test(int x, int y) const;
+  // [x, x + width) に占有されたセルがあれば true
+  bool test_span(int x, int y, int width) const;
+
+  // 行が無ければ nullptr
+  const OccupancyRow* find_row(int y) const;
+  // [x0, x1] x [y0, y1] の占有されたセルを行ごとに左から辿る
+  void for_each_set(int x0, int y0, int x1, int y1,
+                    const std::function<void(int x, int y)>& visit) const;
+
+  void write_footprint(const char* name,
+                       std::vector<FootprintEntry>& entries) const;
+
+ private:
+  std::pmr::unordered_map<int, OccupancyRow> m_rows;
+};
+
+// 重ねられるグリッドの数
+constexpr size_t OCCUPANCY_MAX_LAYERS = 4;
+
+// grids を重ねた行 y で, 幅 width (1 - 64) の空き区間のうち左端が x に最も近い
+// ものを探す, 距離が max_distance を超えるなら false
+bool find_free_span(std::initializer_list<const OccupancyGrid*> grids, int x,
+                    int y, int width, int max_distance, int* result);
+
+}  // namespace factory_game
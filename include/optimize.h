@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "evaluate.h"
+#include "layout.h"
+#include "stage.h"
+
+namespace factory_game {
+
+// ステージの設計をオフラインで探す
+// 鎖ごとにスレッドを割り当てて焼きなましを回し, 区切りごとに
+// 悪い半分の鎖を良い半分の状態で置き換える
+struct OptimizeOptions {
+  uint64_t seed = 1;
+  int threads = 0;        // 0 ならハードウェアスレッド数
+  int epochs = 20;        // 鎖を入れ替える区切りの数
+  int iterations = 500;   // 1 区切りあたりの鎖ごとの試行数
+  int max_machines = 16;  // 置く壊せる機械の数の上限
+  int keep = 1;           // 残す上位レイアウトの数
+  float start_temperature = 0.5f;
+  float end_temperature = 0.01f;
+  unsigned int evaluate_seed = 1;  // 評価の乱数, 全ての候補で同じ
+};
+
+// 出力ポート src_port から入力ポート dst_port への接続
+// 機械は OptimizeLayout::machines の添字
+struct OptimizeLink {
+  int src;
+  int src_port;
+  int dst;
+  int dst_port;
+};
+
+// 先頭にステージのダクトが並び, その後ろが置いた機械
+// パイプは接続ごとに組み立て時に経路を探す
+struct OptimizeLayout {
+  std::vector<MachineRecord> machines;
+  std::vector<OptimizeLink> links;
+};
+
+struct OptimizeCandidate {
+  OptimizeLayout layout;
+  uint64_t hash;  // 組み立てたレイアウトのハッシュ
+  EvaluateContext stats;
+  EvaluateScore score;
+  double objective;
+};
+
+struct OptimizeProgress {
+  int epoch;
+  double best_objective;
+  EvaluateScore best_score;
+  int64_t evaluations;  // キャッシュに当たった分を含む
+  int64_t cache_hits;
+  double seconds;
+};
+
+struct OptimizeResult {
+  std::vector<OptimizeCandidate> best;  // 良い順, 同じレイアウトは 1 つ
+  int64_t evaluations;
+  int64_t cache_hits;
+  double seconds;
+};
+
+OptimizeResult optimize_stage(
+    const StageDefinition& stage, const OptimizeOptions& options,
+    const std::function<void(const OptimizeProgress&)>& on_epoch = {});
+
+// 既存の内容を捨てて layout を組み立てる, 経路が見つからない接続は省く
+void build_optimize_layout(const StageDefinition& stage,
+                           const OptimizeLayout& layout,
+                           MachineManager& machine_manager,
+                           PipeManager& pipe_manager);
+
+}  // namespace factory_game
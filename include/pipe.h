@@ -5,27 +5,45 @@
 #include <glm/gtx/hash.hpp>
 #include <glm/vec2.hpp>
 #include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
+#include "arena.h"
 #include "draw.h"
+#include "draw_list.h"
+#include "foundation.h"
+#include "occupancy.h"
 
 namespace factory_game {
 
 class Pipe;  // for pointer reference
 
+using PipeSpatialMap =
+    std::pmr::unordered_map<glm::ivec2, std::shared_ptr<Pipe>, PointHash>;
+// 後から書いたパイプに隠れたセル (つないだ端など), 上のパイプを外したときに
+// 索引へ戻す
+using PipeShadowMap =
+    std::pmr::unordered_multimap<glm::ivec2, std::shared_ptr<Pipe>, PointHash>;
+using PipeSet = std::pmr::unordered_set<std::shared_ptr<Pipe>>;
+
+// is_erase なら Write は cursor のセルを索引から外す
 class PipeSpatialIdx {
  public:
-  PipeSpatialIdx(
-      std::unordered_map<glm::ivec2, std::shared_ptr<Pipe>>& spatial_idx,
-      std::shared_ptr<Pipe>& cursor);
+  PipeSpatialIdx(PipeSpatialMap& spatial_idx, PipeShadowMap& shadowed,
+                 OccupancyGrid& occupancy, std::shared_ptr<Pipe>& cursor,
+                 bool is_erase = false);
   ~PipeSpatialIdx();
 
   void Write(glm::ivec2 point) const;
 
  private:
-  std::unordered_map<glm::ivec2, std::shared_ptr<Pipe>>& m_spatial_idx;
+  PipeSpatialMap& m_spatial_idx;
+  PipeShadowMap& m_shadowed;
+  OccupancyGrid& m_occupancy;
   std::shared_ptr<Pipe>& m_cursor;
+  bool m_is_erase;
 };
 
 class Pipe {
@@ -36,24 +54,50 @@ class Pipe {
   Pipe(glm::ivec2 begin, glm::ivec2 end);
   ~Pipe();
 
+  int get_length() const;
   void draw(DrawManagerBase* draw_manager) const;
   void build_spatial_idx(const PipeSpatialIdx& writer) const;
 };
 
+// レイアウトハッシュへ足すパイプ 1 つ分のキー
+uint64_t pipe_zobrist_key(const std::shared_ptr<Pipe>& pipe);
+
+// arena が nullptr ならヒープに置く
+std::shared_ptr<Pipe> make_pipe(glm::ivec2 begin, glm::ivec2 end,
+                                StageArena* arena = nullptr);
+
 class PipeManager {
  public:
-  PipeManager();
+  explicit PipeManager(StageArena* arena = nullptr);
   ~PipeManager();
 
   void build_spatial_idx();
-  void add_pipe(const std::shared_ptr<Pipe>& pipe);
+  void add_pipe(std::shared_ptr<Pipe> pipe);
+  void add_pipes(const std::vector<std::shared_ptr<Pipe>>& pipes);
   void remove_pipe(const std::shared_ptr<Pipe>& point);
+  // 外す要素のセルだけを索引から消す
+  void remove_pipes(const std::vector<std::shared_ptr<Pipe>>& pipes);
+  void clear();
   std::shared_ptr<Pipe> find_pipe(glm::ivec2 point);
-  void draw(DrawManagerBase* draw_manager) const;
+  // min から max までの矩形に掛かるパイプ, 同じパイプは 1 回だけ入れる
+  void find_pipes(glm::ivec2 min, glm::ivec2 max,
+                  std::vector<std::shared_ptr<Pipe>>& pipes) const;
+  const PipeSet& get_pipes() const;
+  const OccupancyGrid& get_occupancy() const;
+  uint64_t get_hash() const;
+  StageArena* get_arena() const;
+  void write_footprint(std::vector<FootprintEntry>& entries) const;
+  // camera は画面の左上に来るワールド座標
+  void draw(DrawManagerBase* draw_manager, glm::ivec2 camera) const;
 
  private:
-  std::unordered_set<std::shared_ptr<Pipe>> m_pipes;
-  std::unordered_map<glm::ivec2, std::shared_ptr<Pipe>> m_spatial_idx;
+  StageArena* m_arena;
+  uint64_t m_hash;
+  PipeSet m_pipes;
+  PipeSpatialMap m_spatial_idx;
+  PipeShadowMap m_shadowed;
+  OccupancyGrid m_occupancy;  // m_spatial_idx と同じセル
+  RetainedDrawList m_draw_list;
 };
 
 }  // namespace factory_game
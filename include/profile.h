@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "draw.h"
+
+namespace factory_game {
+
+// フレーム内の区間ごとの計測
+// スレッドごとのバッファへ書き込み, 直近の分布と Chrome trace 用の履歴を持つ
+enum ProfilePhase {
+  PROFILE_UPDATE,  // State::update 全体
+  PROFILE_CAPTURE_INPUT,
+  PROFILE_MACHINE_DRAW,
+  PROFILE_PIPE_DRAW,
+  PROFILE_ROUTE,
+  PROFILE_CHUNK_PAGE,
+  PROFILE_PRESENT,
+  PROFILE_PHASE_COUNT,
+};
+
+constexpr int PROFILE_WINDOW = 120;           // p50/p99 を取る直近のサンプル数
+constexpr size_t PROFILE_HISTORY = 1 << 16;  // スレッドごとに残すイベント数
+
+const char* profile_phase_to_string(ProfilePhase phase);
+
+struct ProfileEvent {
+  int64_t begin;  // ns, プロセス起動時から
+  int64_t duration;
+  ProfilePhase phase;
+};
+
+struct ProfileStats {
+  int64_t p50;  // ns
+  int64_t p99;
+  int count;
+};
+
+class ProfileBuffer {
+ public:
+  explicit ProfileBuffer(int thread_id);
+
+  void record(ProfilePhase phase, int64_t begin, int64_t end);
+
+ private:
+  friend class Profiler;
+
+  int m_thread_id;
+  // 窓は get_stats が他のスレッドから読むので, 書き込みもこれで守る
+  std::mutex m_window_mutex;
+  int64_t m_window[PROFILE_PHASE_COUNT][PROFILE_WINDOW];
+  int m_window_count[PROFILE_PHASE_COUNT];
+  std::vector<ProfileEvent> m_history;  // リングバッファ
+  size_t m_history_count;
+};
+
+class Profiler {
+ public:
+  Profiler();
+
+  // 呼び出したスレッドのバッファ, 初回に登録する
+  ProfileBuffer& get_buffer();
+  int64_t now() const;
+
+  // 全てのスレッドの直近の分布, 描画スレッドの present も入る
+  ProfileStats get_stats(ProfilePhase phase);
+
+  void toggle_overlay();
+  bool is_overlay_visible() const;
+
+  // 他のスレッドの計測が終わってから呼ぶ
+  bool write_chrome_trace(const std::string& path);
+
+ private:
+  std::chrono::steady_clock::time_point m_origin;
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<ProfileBuffer>> m_buffers;
+  bool m_overlay_visible;
+};
+
+Profiler& get_profiler();
+
+class ProfileScope {
+ public:
+  explicit ProfileScope(const ProfilePhase phase)
+      : m_phase(phase), m_begin(get_profiler().now()) {}
+  ~ProfileScope() {
+    auto& profiler = get_profiler();
+    profiler.get_buffer().record(m_phase, m_begin, profiler.now());
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+ private:
+  ProfilePhase m_phase;
+  int64_t m_begin;
+};
+
+// 区間ごとの p50/p99 を左上に表示する
+void draw_profile_overlay(DrawManagerBase* draw_manager);
+
+}  // namespace factory_game
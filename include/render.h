@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "draw.h"
+
+namespace factory_game {
+
+// 1 フレーム分の描画命令, 公開した後は書き換えない
+// clear しても容量は残るので, 使い回せば毎フレームの確保は起きない
+struct DrawSnapshot {
+  std::vector<DrawCommand> commands;
+  std::string text;  // ラベルの文字列をまとめて持つ
+
+  void clear();
+  void push(DrawCommandKind kind, int x0, int y0, int x1, int y1,
+            std::string_view label = {});
+  void append(const DrawCommand* source, size_t count, std::string_view label);
+  void replay(DrawManagerBase* draw_manager) const;
+};
+
+// 書き手 1 つ, 読み手 1 つのトリプルバッファ
+// 書き手は back に書いて middle と交換し, 読み手は新しいものがあれば
+// middle と front を交換する, どちらも相手を待たない
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() : m_back(0), m_middle(1), m_front(2) {}
+
+  T& get_back() { return m_slots[m_back]; }
+
+  void publish() {
+    const uint8_t previous =
+        m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+    m_back = previous & ~FRESH;
+  }
+
+  // 前回から新しく公開されていなければ false
+  bool acquire() {
+    if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) return false;
+    const uint8_t previous =
+        m_middle.exchange(m_front, std::memory_order_acq_rel);
+    m_front = previous & ~FRESH;
+    return true;
+  }
+
+  const T& get_front() const { return m_slots[m_front]; }
+
+ private:
+  static constexpr uint8_t FRESH = 0x4;
+
+  T m_slots[3];
+  uint8_t m_back;  // 書き手だけが触る
+  alignas(64) std::atomic<uint8_t> m_middle;
+  alignas(64) uint8_t m_front;  // 読み手だけが触る
+};
+
+// 描画命令を記録し, present でスナップショットとして公開する
+// 描画スレッドが最新のスナップショットを draw_manager へ描いて present する
+// 入力は呼び出し元のスレッドのまま draw_manager に委譲する
+class DrawManagerThreaded : public DrawManagerBase {
+ public:
+  explicit DrawManagerThreaded(DrawManagerBase* draw_manager);
+  ~DrawManagerThreaded() override;
+
+  int get_width() override;
+  int get_height() override;
+
+  void clear() override;
+  void draw_label(int x, int y, std::string_view text) override;
+  void draw_label_box(int x, int y, std::string_view text) override;
+  void draw_clear_box(int x, int y, int width, int height) override;
+  void draw_line_box(int x, int y, int width, int height) override;
+  void draw_hv_line(int x0, int y0, int x1, int y1) override;
+  void present() override;
+  void draw_commands(const DrawCommand* commands, size_t count,
+                     std::string_view text) override;
+
+  void capture_input() override;
+  bool handle_input_keycode(int keycode) override;
+  bool handle_input_mouse(int state, int& x, int& y) override;
+  bool handle_input_drag(int& dx, int& dy) override;
+  bool handle_input_hover(int& x, int& y) override;
+
+ private:
+  void run();
+
+  DrawManagerBase* m_draw_manager;
+  TripleBuffer<DrawSnapshot> m_snapshots;
+  std::atomic<bool> m_stop;
+  std::thread m_thread;
+};
+
+}  // namespace factory_game
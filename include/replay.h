@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "draw.h"
+
+namespace factory_game {
+
+// 入力ログ
+// ヘッダの後に InputRecord が固定長・リトルエンディアンで並ぶ
+constexpr uint32_t INPUT_LOG_MAGIC = 0x52494746;  // "FGIR"
+constexpr uint32_t INPUT_LOG_VERSION = 2;
+
+enum InputRecordKind {
+  INPUT_RECORD_KEYCODE,
+  INPUT_RECORD_MOUSE,
+  INPUT_RECORD_STATE,   // このフレームの後で State が切り替わった
+  INPUT_RECORD_DRAG,    // x, y は移動量
+  INPUT_RECORD_HOVER,   // x, y はカーソルの位置
+  INPUT_RECORD_RESIZE,  // x, y は変わった後の画面の幅と高さ
+};
+
+struct InputLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t frame_count;
+  uint32_t record_count;
+  // 記録を始めたときの画面の大きさ, 再生でも同じ大きさで描く
+  int32_t width;
+  int32_t height;
+};
+
+struct InputRecord {
+  uint32_t frame;
+  uint32_t kind;
+  int32_t code;
+  int16_t x;
+  int16_t y;
+};
+
+static_assert(sizeof(InputLogHeader) == 24);
+static_assert(sizeof(InputRecord) == 16);
+
+bool save_input_log(const std::string& path, uint32_t frame_count, int width,
+                    int height, const std::vector<InputRecord>& records);
+bool load_input_log(const std::string& path, uint32_t* frame_count,
+                    int* width, int* height,
+                    std::vector<InputRecord>* records);
+
+// 描画と入力を別の DrawManager に委譲しつつ, 入力の判定結果を記録する
+class DrawManagerRecorder : public DrawManagerBase {
+ public:
+  explicit DrawManagerRecorder(DrawManagerBase* draw_manager);
+  ~DrawManagerRecorder() override;
+
+  int get_width() override;
+  int get_height() override;
+
+  void clear() override;
+  void draw_label(int x, int y, std::string_view text) override;
+  void draw_label_box(int x, int y, std::string_view text) override;
+  void draw_clear_box(int x, int y, int width, int height) override;
+  void draw_line_box(int x, int y, int width, int height) override;
+  void draw_hv_line(int x0, int y0, int x1, int y1) override;
+  void present() override;
+  void draw_commands(const DrawCommand* commands, size_t count,
+                     std::string_view text) override;
+
+  void capture_input() override;
+  bool handle_input_keycode(int keycode) override;
+  bool handle_input_mouse(int state, int& x, int& y) override;
+  bool handle_input_drag(int& dx, int& dy) override;
+  bool handle_input_hover(int& x, int& y) override;
+
+  void mark_state_change();
+  bool save(const std::string& path) const;
+
+ private:
+  void record(InputRecord record);
+
+  DrawManagerBase* m_draw_manager;
+  uint32_t m_frame;
+  int m_width;  // 記録を始めたときの大きさ
+  int m_height;
+  int m_last_width;  // 最後に記録した大きさ
+  int m_last_height;
+  std::vector<InputRecord> m_records;
+};
+
+// 端末を使わずにメモリ上へ描画し, 入力ログを再生する
+// 画面は width x height で始め, ログの INPUT_RECORD_RESIZE で大きさを変える
+class DrawManagerHeadless : public DrawManagerBase {
+ public:
+  DrawManagerHeadless(uint32_t frame_count, std::vector<InputRecord> records,
+                      int width = 120, int height = 30);
+  ~DrawManagerHeadless() override;
+
+  int get_width() override;
+  int get_height() override;
+
+  void clear() override;
+  void draw_label(int x, int y, std::string_view text) override;
+  void draw_label_box(int x, int y, std::string_view text) override;
+  void draw_clear_box(int x, int y, int width, int height) override;
+  void draw_line_box(int x, int y, int width, int height) override;
+  void draw_hv_line(int x0, int y0, int x1, int y1) override;
+  void present() override;
+
+  void capture_input() override;
+  bool handle_input_keycode(int keycode) override;
+  bool handle_input_mouse(int state, int& x, int& y) override;
+  bool handle_input_drag(int& dx, int& dy) override;
+  bool handle_input_hover(int& x, int& y) override;
+
+  void mark_state_change();
+  bool is_finished() const;
+
+ private:
+  void resize(int width, int height);
+
+  int m_width;
+  int m_height;
+  DrawBuffer m_current_buffer;
+  DrawBuffer m_back_buffer;
+
+  uint32_t m_frame_count;
+  std::vector<InputRecord> m_records;
+  size_t m_cursor;        // 次に読む入力
+  size_t m_state_cursor;  // 次に待つ State の切り替え
+  uint32_t m_frame;
+  std::vector<InputRecord> m_inputs;  // 現在のフレームの入力
+};
+
+}  // namespace factory_game
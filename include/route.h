@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <initializer_list>
+#include <vector>
+
+#include "occupancy.h"
+
+namespace factory_game {
+
+// 探索する窓は始点と終点を囲む矩形をこれだけ広げたもの
+constexpr int ROUTE_MARGIN = 32;
+// 窓の 1 辺の上限
+constexpr int ROUTE_MAX_SIZE = 2048;
+// 1 回の探索で展開するセルの上限, 届かない終点でも 1 フレームに収めるため
+constexpr int ROUTE_MAX_EXPANSIONS = 8192;
+
+// 占有されたセルを避けるパイプの経路を A* で探す
+// 費用は長さを優先し, 同じ長さなら曲がる回数が少ないものを選ぶ
+// 見積もりに重みを付けているので, 長さは最短より最大 1 / 8 長くなる
+// バッファは探索ごとに使い回し, 世代番号で初期化を省く
+class PipeRouter {
+ public:
+  PipeRouter();
+  ~PipeRouter();
+
+  // 始点と終点は占有されていても通れる
+  // 見つかれば始点から終点までの折れ点を順に points に入れる
+  bool route(std::initializer_list<const OccupancyGrid*> grids,
+             glm::ivec2 start, glm::ivec2 goal,
+             std::vector<glm::ivec2>& points);
+
+  // 直前の探索で展開したセル数
+  int get_expansions() const;
+
+ private:
+  struct OpenNode {
+    uint32_t f;
+    uint32_t cost;
+    uint32_t index;
+    int16_t x;  // 窓内の座標
+    int16_t y;
+  };
+
+  // 隣のセルを見るたびに読むので 1 つにまとめ, キャッシュミスを 1 回にする
+  struct RouteCell {
+    uint32_t generation;  // m_generation と違えば未訪問
+    uint32_t cost;        // 費用 << 3 | そのセルへ入った向き
+  };
+
+  bool set_window(glm::ivec2 start, glm::ivec2 goal);
+  void build_blocked(std::initializer_list<const OccupancyGrid*> grids);
+  bool is_blocked(uint32_t index) const;
+
+  glm::ivec2 m_origin;  // 窓の左上, x は 64 の倍数
+  int m_width;          // 64 の倍数
+  int m_height;
+  std::vector<uint64_t> m_blocked;  // 窓内の占有, 1 行 m_width / 64 ワード
+  std::vector<RouteCell> m_cells;
+  std::vector<OpenNode> m_open;  // 二分ヒープ
+  uint32_t m_generation;
+  int m_expansions;
+};
+
+}  // namespace factory_game
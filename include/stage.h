@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <string>
+#include <vector>
+
+#include "layout.h"
+
+namespace factory_game {
+
+// ステージ定義
+// stages/*.stage のテキストを起動時にステージパックへコンパイルし,
+// 以降はパックをそのまま読み込む
+struct StageDefinition {
+  int stage;
+  int design_time;
+  glm::ivec2 grid_size;
+  std::vector<MachineRecord> machines;
+};
+
+constexpr uint32_t STAGE_PACK_MAGIC = 0x50534746;  // "FGSP"
+constexpr uint32_t STAGE_PACK_VERSION = 2;
+
+// ヘッダの後に StageSourceRecord が source_count 個,
+// 続けて StageRecord と MachineRecord がステージごとに並ぶ
+struct StagePackHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stage_count;
+  uint32_t source_count;
+};
+
+// パックを作ったときの .stage ファイル, name_hash の順
+// 消えたファイルや増えたファイルを見つけるのに使う
+struct StageSourceRecord {
+  uint32_t name_hash;
+  uint32_t size;
+};
+
+struct StageRecord {
+  uint32_t stage;
+  uint32_t design_time;
+  int32_t width;
+  int32_t height;
+  uint32_t machine_count;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(StagePackHeader) == 16);
+static_assert(sizeof(StageRecord) == 24);
+static_assert(sizeof(StageSourceRecord) == 8);
+
+bool parse_stage(const std::string& path, StageDefinition* stage);
+// 読めないファイルは標準エラーに出して飛ばし, false を返す
+bool compile_stages(const std::string& directory,
+                    std::vector<StageDefinition>* stages);
+bool save_stage_pack(const std::string& path,
+                     const std::vector<StageDefinition>& stages,
+                     const std::vector<StageSourceRecord>& sources);
+bool load_stage_pack(const std::string& path,
+                     std::vector<StageDefinition>* stages,
+                     std::vector<StageSourceRecord>* sources);
+
+// ステージのディレクトリ, get_stages の前に呼ぶ
+// 指定しなければ実行ファイルの隣の stages/, 無ければ作業ディレクトリの stages/
+void set_stage_directory(const std::string& directory);
+
+// 初回の呼び出しでステージのディレクトリを読み込む
+const std::vector<StageDefinition>& get_stages();
+const StageDefinition* find_stage(int stage);
+
+}  // namespace factory_game
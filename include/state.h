@@ -3,40 +3,46 @@
 #include <random>
 #include <string>
 
+#include "arena.h"
+#include "blueprint.h"
+#include "chunk.h"
 #include "draw.h"
+#include "evaluate.h"
+#include "history.h"
 #include "machine.h"
 #include "pipe.h"
+#include "route.h"
 
 namespace factory_game {
 
-enum Machines {
-  MACHINE_ELECTROLYZER,
-  MACHINE_CUTTER,
-  MACHINE_LAZER,
-  MACHINE_ASSEMBLER,
-};
-
 enum Modes {
   MODE_PLACE_PIPE,
   MODE_LINK_PIPE,
   MODE_PLACE_MACHINE,
   MODE_EVALUATE,
   MODE_RECIPE,
+  MODE_SELECT,
+  MODE_PASTE,
 };
 
 union ModeState {
   struct {
   } PlacePipe;
   struct {
-    int x;
+    int x;  // ワールド座標
     int y;
   } LinkPipe;
   struct {
     Machines machine;
   } PlaceMachine;
   struct {
-    int time_count;
+    int speed;
   } Evaluate;
+  struct {
+    int x;  // ワールド座標, 最初のクリックで決まる角
+    int y;
+    bool anchored;
+  } Select;
 };
 
 class State {
@@ -55,6 +61,16 @@ class TitleState : public State {
   State* update(DrawManagerBase* draw_manager) override;
 };
 
+// ステージの世界状態, StageArena に置いて破棄せずに arena ごと捨てる
+struct InGameWorld {
+  explicit InGameWorld(StageArena* arena);
+
+  PipeManager pipe_manager;
+  MachineManager machine_manager;
+  EvaluatePreview preview;
+  WorldHistory history;  // 壊せる機械とパイプの編集, Z で戻し Y でやり直す
+};
+
 class InGameState : public State {
  public:
   InGameState(int stage);
@@ -62,13 +78,64 @@ class InGameState : public State {
 
   State* update(DrawManagerBase* draw_manager) override;
 
+  bool load(const std::string& path);
+
  private:
-  PipeManager m_pipe_manager;
-  MachineManager m_machine_manager;
+  void add_machine(const std::shared_ptr<Machine>& machine);
+  void remove_machine(const std::shared_ptr<Machine>& machine);
+  void add_pipe(const std::shared_ptr<Pipe>& pipe);
+  void remove_pipe(const std::shared_ptr<Pipe>& pipe);
+  std::string get_layout_path() const;
+  void save();
+  EvaluateKey get_evaluate_key() const;
+  void start_evaluate();
+  std::vector<FootprintEntry> get_footprint() const;
+  void scroll(DrawManagerBase* draw_manager);
+  bool find_machine_slot(glm::ivec2 point, glm::ivec2* slot) const;
+  bool update_route(glm::ivec2 goal);
+  bool paste_blueprint(glm::ivec2 origin);
+  bool remove_entity(glm::ivec2 point);
+  void apply_world_diff(const std::vector<WorldEntity>& removed,
+                        const std::vector<WorldEntity>& added);
+  void undo();
+  void redo();
+
+  StageArena m_arena;  // 評価スレッドが使うため最後に破棄する
+  InGameWorld* m_world;
+  PipeManager& m_pipe_manager;
+  MachineManager& m_machine_manager;
+  EvaluatePreview& m_preview;
+  WorldHistory& m_history;
+  glm::ivec2 m_camera;  // 画面の左上に来るワールド座標
+  glm::ivec2 m_cursor;  // 最後に見たマウスの画面座標
+  PipeRouter m_router;
+  std::vector<glm::ivec2> m_route;  // LinkPipe の始点からの折れ点
+  glm::ivec2 m_route_goal;
+  bool m_route_found;
+  Blueprint m_blueprint;  // Select で写し, Paste で置く
   Modes m_mode;
   ModeState m_mode_state;
   std::default_random_engine m_rng;
+  unsigned int m_seed;
   EvaluateContext m_stats;
+  EvaluateWorker m_evaluate_worker;
+  bool m_footprint_visible;
+};
+
+// チャンクファイルの広い世界を眺める, 編集はしない
+// 常駐するチャンクは表示範囲の周りだけで, budget_bytes を超えたら手放す
+class ChunkViewState : public State {
+ public:
+  ChunkViewState(const std::string& path, int64_t budget_bytes);
+  ~ChunkViewState() override;
+
+  State* update(DrawManagerBase* draw_manager) override;
+
+ private:
+  ChunkFile m_file;
+  std::unique_ptr<ChunkPager> m_pager;  // 開けなければ nullptr
+  glm::ivec2 m_camera;
+  bool m_footprint_visible;
 };
 
 class ResultState : public State {
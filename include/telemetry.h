@@ -0,0 +1,138 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace factory_game {
+
+// tick ごとのシミュレーショントレース
+// 機械の値が変わった tick だけを記録する
+// ヘッダの後にブロックが並び, ブロック内は列ごとに値が連続する
+// 1 つのファイルに複数の評価が混ざるので, レコードは評価の番号 run を持つ
+constexpr uint32_t TRACE_MAGIC = 0x54524746;  // "FGTR"
+constexpr uint32_t TRACE_VERSION = 2;
+constexpr uint32_t TRACE_FLAG_COMPRESSED = 1;
+constexpr uint32_t TRACE_BLOCK_RECORDS = 4096;
+
+struct TraceHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+struct TraceBlockHeader {
+  uint32_t count;
+  uint32_t size;  // 続くペイロードのバイト数
+};
+
+// 1 tick・1 機械ぶんの値
+struct TraceRecord {
+  uint32_t tick;
+  uint32_t node;
+  uint16_t fill;       // ポートに溜まっているアイテム数
+  uint8_t busy;        // レシピを処理中なら 1
+  uint32_t delivered;  // レシピの完了回数, 出力ダクトでは搬入数
+  // 対話の評価では 0, --evaluate では 入力の番号 × seeds + (乱数 - 1)
+  uint32_t run;
+};
+
+struct TraceBlock {
+  uint32_t count;
+  uint32_t tick[TRACE_BLOCK_RECORDS];
+  uint32_t node[TRACE_BLOCK_RECORDS];
+  uint16_t fill[TRACE_BLOCK_RECORDS];
+  uint8_t busy[TRACE_BLOCK_RECORDS];
+  uint32_t delivered[TRACE_BLOCK_RECORDS];
+  uint32_t run[TRACE_BLOCK_RECORDS];
+};
+
+class TraceSink;
+
+// スレッドごとのダブルバッファ
+// 片方を書き込み中に, もう片方をライタースレッドがファイルへ書き出す
+class TraceBuffer {
+ public:
+  explicit TraceBuffer(TraceSink* sink);
+  ~TraceBuffer();
+
+  // 以降のレコードの run
+  void set_run(uint32_t run) { m_run = run; }
+
+  void record(uint32_t tick, uint32_t node, uint16_t fill, uint8_t busy,
+              uint32_t delivered) {
+    TraceBlock& block = *m_blocks[m_front];
+    const uint32_t i = block.count++;
+    block.tick[i] = tick;
+    block.node[i] = node;
+    block.fill[i] = fill;
+    block.busy[i] = busy;
+    block.delivered[i] = delivered;
+    block.run[i] = m_run;
+    if (block.count == TRACE_BLOCK_RECORDS) swap();
+  }
+
+ private:
+  friend class TraceSink;
+
+  void swap();
+
+  TraceSink* m_sink;
+  std::unique_ptr<TraceBlock> m_blocks[2];
+  bool m_pending[2];  // ライタースレッドへ渡して書き出し待ち, m_sink で保護
+  int m_front;
+  uint32_t m_run;
+};
+
+class TraceSink {
+ public:
+  TraceSink();
+  ~TraceSink();
+
+  bool open(const std::string& path, bool compress);
+  void close();
+  bool is_open() const;
+
+  // 評価スレッドごとに 1 つ取得する, 閉じている間は nullptr
+  TraceBuffer* acquire_buffer();
+  void release_buffer(TraceBuffer* buffer);
+
+ private:
+  friend class TraceBuffer;
+
+  struct Job {
+    TraceBuffer* buffer;
+    int index;
+  };
+
+  void submit(TraceBuffer* buffer, int index);
+  void wait(TraceBuffer* buffer, int index);
+  void run();
+  void write_block(const TraceBlock& block);
+
+  std::ofstream m_stream;
+  bool m_compress;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<Job> m_jobs;
+  bool m_stop;
+  std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+  std::vector<uint8_t> m_scratch;
+};
+
+// プロセス全体で共有するシンク, --trace で開く
+TraceSink& get_trace_sink();
+
+bool read_trace(const std::string& path,
+                const std::function<void(const TraceRecord&)>& callback);
+
+}  // namespace factory_game
@@ -0,0 +1,34 @@
+#include "arena.h"
+
+namespace factory_game {
+
+StageArena::StageArena() {
+  for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+    m_resources[i] = std::make_unique<CountingResource>(
+        static_cast<MemoryCategory>(i), &m_pool);
+  }
+}
+
+// 中身を 1 つずつ解放せず, 集計だけ戻してからプールを手放す
+StageArena::~StageArena() {
+  for (const auto& resource : m_resources) resource->forget();
+}
+
+std::pmr::memory_resource* StageArena::get_resource(
+    const MemoryCategory category) {
+  return m_resources[category].get();
+}
+
+int64_t StageArena::get_bytes() const {
+  int64_t bytes = 0;
+  for (const auto& resource : m_resources) bytes += resource->get_bytes();
+  return bytes;
+}
+
+std::pmr::memory_resource* get_resource(StageArena* arena,
+                                        const MemoryCategory category) {
+  if (arena == nullptr) return get_heap_resource(category);
+  return arena->get_resource(category);
+}
+
+}  // namespace factory_game
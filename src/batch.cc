@@ -0,0 +1,236 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+
+#include "arena.h"
+#include "layout.h"
+#include "machine.h"
+#include "pipe.h"
+#include "stage.h"
+#include "telemetry.h"
+
+namespace factory_game {
+
+// 1 ファイル分, 機械とパイプは使い捨ての arena ごと捨てる
+// trace があれば全ての乱数をキャッシュを使わずに評価して記録する
+static BatchResult evaluate_layout(const size_t index, const std::string& path,
+                                   const BatchOptions& options,
+                                   TraceBuffer* trace) {
+  BatchResult result;
+  result.index = index;
+  result.path = path;
+  result.ok = false;
+  result.stage = 0;
+  result.hash = 0;
+  result.machine_count = 0;
+  result.pipe_count = 0;
+
+  LayoutFile file;
+  if (!file.open(path)) {
+    result.error = "failed to load layout";
+    return result;
+  }
+
+  const auto& header = file.get_header();
+  result.stage = options.stage > 0 ? options.stage
+                                   : static_cast<int>(header.stage);
+
+  EvaluateContext base;
+  base.stage = result.stage;
+  base.design_time = 60 * 60;
+  const auto definition = find_stage(result.stage);
+  if (definition != nullptr) base.design_time = definition->design_time;
+
+  StageArena arena;
+  std::vector<std::shared_ptr<Machine>> machines;
+  machines.reserve(header.machine_count);
+  const auto machine_records = file.get_machines();
+  for (uint64_t i = 0; i < header.machine_count; ++i) {
+    const auto machine = make_machine(machine_records[i], &arena);
+    if (machine) machines.push_back(machine);
+  }
+
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  pipes.reserve(header.pipe_count);
+  const auto pipe_records = file.get_pipes();
+  for (uint64_t i = 0; i < header.pipe_count; ++i) {
+    pipes.push_back(make_pipe(pipe_records[i], &arena));
+  }
+  result.machine_count = machines.size();
+  result.pipe_count = pipes.size();
+
+  // キャッシュの鍵はヘッダのハッシュを信じず, 読んだレコードから作り直す
+  for (const auto& machine : machines) {
+    result.hash += machine_zobrist_key(machine);
+  }
+  for (const auto& pipe : pipes) result.hash += pipe_zobrist_key(pipe);
+
+  // 全ての乱数がキャッシュに当たれば組み立てない
+  // 乱数ごとに組み立てた直後の状態を写して進める
+  std::optional<Evaluator> prototype;
+  const int seeds = std::max(options.seeds, 1);
+  for (int i = 0; i < seeds; ++i) {
+    BatchEvaluation evaluation;
+    evaluation.seed = static_cast<unsigned int>(i + 1);
+    evaluation.stats = base;
+
+    const auto key = EvaluateKey{result.hash, result.stage, options.ticks,
+                                 evaluation.seed};
+    evaluation.cached = trace == nullptr &&
+                        get_evaluate_cache().find(key, &evaluation.stats);
+    if (!evaluation.cached) {
+      if (!prototype) prototype.emplace(machines, pipes, &arena);
+
+      Evaluator evaluator = *prototype;
+      if (trace != nullptr) {
+        trace->set_run(static_cast<uint32_t>(index * seeds + i));
+        evaluator.set_trace(trace);
+      }
+      std::default_random_engine rng(evaluation.seed);
+      for (int tick = 0; tick < options.ticks; ++tick) evaluator.step(rng);
+      evaluator.write_stats(&evaluation.stats);
+      get_evaluate_cache().insert(key, evaluation.stats);
+    }
+
+    evaluation.score = get_evaluate_score(evaluation.stats);
+    result.evaluations.push_back(std::move(evaluation));
+  }
+
+  // arena より先に評価器を捨てる
+  prototype.reset();
+  result.ok = true;
+  return result;
+}
+
+BatchSummary evaluate_layouts(
+    const std::vector<std::string>& paths, const BatchOptions& options,
+    const std::function<void(const BatchResult&)>& on_result) {
+  const auto start = std::chrono::steady_clock::now();
+  const int thread_count = std::min(
+      options.threads > 0
+          ? options.threads
+          : std::max(1, static_cast<int>(std::thread::hardware_concurrency())),
+      std::max(1, static_cast<int>(paths.size())));
+
+  BatchSummary summary;
+  summary.layouts = static_cast<int64_t>(paths.size());
+  summary.failures = 0;
+  summary.evaluations = 0;
+  summary.cache_hits = 0;
+  summary.seconds = 0.0;
+
+  // 終わった順に受け取り, 入力の順に並べ直して渡す
+  std::atomic<size_t> next_index(0);
+  std::mutex mutex;
+  std::map<size_t, BatchResult> pending;
+  size_t next_output = 0;
+
+  // --trace ならワーカーごとにトレースのバッファを持つ
+  const auto run = [&] {
+    TraceBuffer* trace = get_trace_sink().acquire_buffer();
+    while (true) {
+      const size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+      if (index >= paths.size()) break;
+
+      auto result = evaluate_layout(index, paths[index], options, trace);
+
+      std::lock_guard lock(mutex);
+      if (!result.ok) summary.failures++;
+      for (const auto& evaluation : result.evaluations) {
+        summary.evaluations++;
+        if (evaluation.cached) summary.cache_hits++;
+      }
+      pending.emplace(index, std::move(result));
+      for (auto it = pending.begin();
+           it != pending.end() && it->first == next_output;
+           it = pending.erase(it)) {
+        if (on_result) on_result(it->second);
+        next_output++;
+      }
+    }
+    get_trace_sink().release_buffer(trace);
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < thread_count; ++i) threads.emplace_back(run);
+  run();
+  for (auto& thread : threads) thread.join();
+
+  summary.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  return summary;
+}
+
+// パスに含まれる '"' と '\\' と制御文字を逃がす
+static void write_json_string(std::ostream& stream, const std::string& text) {
+  static const char HEX[] = "0123456789abcdef";
+  stream << '"';
+  for (const char c : text) {
+    const auto byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\')
+      stream << '\\' << c;
+    else if (byte < 0x20)
+      stream << "\\u00" << HEX[byte >> 4] << HEX[byte & 0xf];
+    else
+      stream << c;
+  }
+  stream << '"';
+}
+
+void write_batch_result(std::ostream& stream, const BatchResult& result) {
+  stream << "{\"index\":" << result.index << ",\"path\":";
+  write_json_string(stream, result.path);
+  if (!result.ok) {
+    stream << ",\"error\":";
+    write_json_string(stream, result.error);
+    stream << "}";
+    return;
+  }
+
+  float total = 0.0f;
+  for (const auto& evaluation : result.evaluations) {
+    total += evaluation.score.value;
+  }
+  const float mean =
+      result.evaluations.empty() ? 0.0f : total / result.evaluations.size();
+
+  // 64 bit のハッシュは JSON の数値では丸められるので 16 進の文字列にする
+  char hash[17];
+  std::snprintf(hash, sizeof(hash), "%016llx",
+                static_cast<unsigned long long>(result.hash));
+
+  stream << ",\"stage\":" << result.stage << ",\"hash\":\"" << hash
+         << "\",\"machines\":" << result.machine_count
+         << ",\"pipes\":" << result.pipe_count << ",\"mean_score\":" << mean
+         << ",\"seeds\":[";
+  for (size_t i = 0; i < result.evaluations.size(); ++i) {
+    const auto& evaluation = result.evaluations[i];
+    stream << (i == 0 ? "" : ",") << "{\"seed\":" << evaluation.seed
+           << ",\"score\":" << evaluation.score.value
+           << ",\"grade\":" << evaluation.score.grade
+           << ",\"cached\":" << (evaluation.cached ? "true" : "false")
+           << ",\"counts\":[";
+    const auto& stats = evaluation.stats;
+    for (size_t j = 0; j < stats.counts.size(); ++j) {
+      stream << (j == 0 ? "" : ",") << "{\"item\":";
+      write_json_string(stream, j < stats.items.size()
+                                    ? item_to_string(stats.items[j])
+                                    : std::string("Unknown"));
+      stream << ",\"count\":" << stats.counts[j] << "}";
+    }
+    stream << "]}";
+  }
+  stream << "]}";
+}
+
+}  // namespace factory_game
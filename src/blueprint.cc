@@ -0,0 +1,150 @@
+#include "blueprint.h"
+
+#include <algorithm>
+#include <climits>
+#include <string>
+
+namespace factory_game {
+
+bool capture_blueprint(const MachineManager& machine_manager,
+                       const PipeManager& pipe_manager,
+                       const glm::ivec2 corner0, const glm::ivec2 corner1,
+                       Blueprint* blueprint) {
+  const auto min = glm::ivec2(std::min(corner0.x, corner1.x),
+                              std::min(corner0.y, corner1.y));
+  const auto max = glm::ivec2(std::max(corner0.x, corner1.x),
+                              std::max(corner0.y, corner1.y));
+
+  std::vector<std::shared_ptr<Machine>> machines;
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  machine_manager.find_machines(min, max, machines);
+  pipe_manager.find_pipes(min, max, pipes);
+
+  // ダクトはステージに固定なので写さない
+  machines.erase(std::remove_if(machines.begin(), machines.end(),
+                                [](const std::shared_ptr<Machine>& machine) {
+                                  return !machine->is_breakable();
+                                }),
+                 machines.end());
+  if (machines.empty() && pipes.empty()) return false;
+
+  // 矩形からはみ出した部分も含めて囲む
+  auto low = glm::ivec2(INT_MAX, INT_MAX);
+  auto high = glm::ivec2(INT_MIN, INT_MIN);
+  const auto extend = [&](const int x, const int y) {
+    low = glm::ivec2(std::min(low.x, x), std::min(low.y, y));
+    high = glm::ivec2(std::max(high.x, x), std::max(high.y, y));
+  };
+  for (const auto& machine : machines) {
+    extend(machine->m_point.x, machine->m_point.y);
+    extend(machine->m_point.x + MACHINE_WIDTH - 1, machine->m_point.y);
+  }
+  for (const auto& pipe : pipes) {
+    extend(pipe->begin.x, pipe->begin.y);
+    extend(pipe->end.x, pipe->end.y);
+  }
+
+  blueprint->size = high - low + 1;
+  blueprint->machines.clear();
+  blueprint->pipes.clear();
+  for (const auto& machine : machines) {
+    auto record = make_machine_record(machine);
+    record.x -= low.x;
+    record.y -= low.y;
+    blueprint->machines.push_back(record);
+  }
+  for (const auto& pipe : pipes) {
+    auto record = make_pipe_record(pipe);
+    record.begin_x -= low.x;
+    record.begin_y -= low.y;
+    record.end_x -= low.x;
+    record.end_y -= low.y;
+    blueprint->pipes.push_back(record);
+  }
+
+  // 集めた順はポインタの順なので, 座標順に並べて毎回同じ写しにする
+  std::sort(blueprint->machines.begin(), blueprint->machines.end(),
+            [](const MachineRecord& a, const MachineRecord& b) {
+              if (a.y != b.y) return a.y < b.y;
+              return a.x < b.x;
+            });
+  std::sort(blueprint->pipes.begin(), blueprint->pipes.end(),
+            [](const PipeRecord& a, const PipeRecord& b) {
+              if (a.begin_y != b.begin_y) return a.begin_y < b.begin_y;
+              if (a.begin_x != b.begin_x) return a.begin_x < b.begin_x;
+              if (a.end_y != b.end_y) return a.end_y < b.end_y;
+              return a.end_x < b.end_x;
+            });
+  return true;
+}
+
+// パイプのセルは縦の部分を始点の列に, 横の部分を終点の行に置く
+bool blueprint_overlaps(const Blueprint& blueprint, const glm::ivec2 origin,
+                        const MachineManager& machine_manager,
+                        const PipeManager& pipe_manager) {
+  const auto& machines = machine_manager.get_occupancy();
+  const auto& pipes = pipe_manager.get_occupancy();
+  const auto is_occupied = [&](const int x, const int y, const int width) {
+    return machines.test_span(x, y, width) || pipes.test_span(x, y, width);
+  };
+
+  for (const auto& record : blueprint.machines) {
+    if (is_occupied(origin.x + record.x, origin.y + record.y, MACHINE_WIDTH))
+      return true;
+  }
+
+  for (const auto& record : blueprint.pipes) {
+    const auto begin = origin + glm::ivec2(record.begin_x, record.begin_y);
+    const auto end = origin + glm::ivec2(record.end_x, record.end_y);
+
+    const int y0 = std::min(begin.y, end.y), y1 = std::max(begin.y, end.y);
+    for (int y = y0; y <= y1; ++y) {
+      if (is_occupied(begin.x, y, 1)) return true;
+    }
+
+    const int x0 = std::min(begin.x, end.x), x1 = std::max(begin.x, end.x);
+    if (is_occupied(x0, end.y, x1 - x0 + 1)) return true;
+  }
+  return false;
+}
+
+void instantiate_blueprint(const Blueprint& blueprint, const glm::ivec2 origin,
+                           StageArena* arena,
+                           std::vector<std::shared_ptr<Machine>>& machines,
+                           std::vector<std::shared_ptr<Pipe>>& pipes) {
+  machines.reserve(machines.size() + blueprint.machines.size());
+  for (auto record : blueprint.machines) {
+    record.x += origin.x;
+    record.y += origin.y;
+    const auto machine = make_machine(record, arena);
+    if (machine) machines.push_back(machine);
+  }
+
+  pipes.reserve(pipes.size() + blueprint.pipes.size());
+  for (auto record : blueprint.pipes) {
+    record.begin_x += origin.x;
+    record.begin_y += origin.y;
+    record.end_x += origin.x;
+    record.end_y += origin.y;
+    pipes.push_back(make_pipe(record, arena));
+  }
+}
+
+void draw_blueprint(const Blueprint& blueprint, const glm::ivec2 origin,
+                    DrawManagerBase* draw_manager) {
+  draw_manager->draw_line_box(origin.x - 1, origin.y - 1, blueprint.size.x + 2,
+                              blueprint.size.y + 2);
+
+  const std::string body(MACHINE_WIDTH, '#');
+  for (const auto& record : blueprint.machines) {
+    draw_manager->draw_label(origin.x + record.x, origin.y + record.y, body);
+  }
+  for (const auto& record : blueprint.pipes) {
+    const auto begin = origin + glm::ivec2(record.begin_x, record.begin_y);
+    const auto end = origin + glm::ivec2(record.end_x, record.end_y);
+    draw_manager->draw_hv_line(begin.x, begin.y, begin.x, end.y);
+    draw_manager->draw_hv_line(begin.x, end.y, end.x, end.y);
+  }
+}
+
+}  // namespace factory_game
@@ -0,0 +1,584 @@
+#include "chunk.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <utility>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace factory_game {
+
+static int floor_div(const int value, const int divisor) {
+  return value >= 0 ? value / divisor : (value - divisor + 1) / divisor;
+}
+
+// 4 byte 単位で入れ替えた後, 64 bit のフィールドは上位と下位のワードも
+// 入れ替える, [begin, end) が 64 bit のフィールドの範囲
+static void swap_chunk_fields(char* data, const size_t size, const size_t begin,
+                              const size_t end) {
+  swap_layout_words(data, size);
+  for (size_t offset = begin; offset < end; offset += 8) {
+    std::swap_ranges(data + offset, data + offset + 4, data + offset + 4);
+  }
+}
+
+static void swap_chunk_header(ChunkHeader* header) {
+  swap_chunk_fields(reinterpret_cast<char*>(header), sizeof(ChunkHeader),
+                    offsetof(ChunkHeader, chunk_count), sizeof(ChunkHeader));
+}
+
+static void swap_chunk_entry(ChunkEntry* entry) {
+  swap_chunk_fields(reinterpret_cast<char*>(entry), sizeof(ChunkEntry),
+                    offsetof(ChunkEntry, offset), sizeof(ChunkEntry));
+}
+
+// SAVE
+
+struct ChunkContent {
+  std::vector<MachineRecord> machines;
+  std::vector<PipeRecord> pipes;
+};
+
+bool save_chunk_file(const std::string& path, const int stage,
+                     const MachineManager& machine_manager,
+                     const PipeManager& pipe_manager) {
+  ChunkHeader header = {};
+  header.magic = CHUNK_MAGIC;
+  header.version = CHUNK_VERSION;
+  header.stage = stage;
+  header.chunk_width = CHUNK_WIDTH;
+  header.chunk_height = CHUNK_HEIGHT;
+
+  // 描画の矩形が基点からどれだけはみ出すかを実際に描いて測る
+  DrawListRecorder recorder;
+  const auto extend_margin = [&](const glm::ivec2 anchor) {
+    if (recorder.is_empty()) return;
+    const auto bounds = recorder.get_bounds();
+    header.margin_x = std::max(
+        {header.margin_x, anchor.x - bounds.x0, bounds.x1 - anchor.x});
+    header.margin_y = std::max(
+        {header.margin_y, anchor.y - bounds.y0, bounds.y1 - anchor.y});
+  };
+
+  // (y, x) の順に並べる
+  std::map<std::pair<int, int>, ChunkContent> chunks;
+  for (const auto& machine : machine_manager.get_machines()) {
+    const auto anchor = machine->m_point;
+    chunks[{floor_div(anchor.y, CHUNK_HEIGHT),
+            floor_div(anchor.x, CHUNK_WIDTH)}]
+        .machines.push_back(make_machine_record(machine));
+
+    recorder.reset();
+    machine->draw(&recorder);
+    extend_margin(anchor);
+  }
+  for (const auto& pipe : pipe_manager.get_pipes()) {
+    const auto anchor = glm::ivec2(std::min(pipe->begin.x, pipe->end.x),
+                                   std::min(pipe->begin.y, pipe->end.y));
+    chunks[{floor_div(anchor.y, CHUNK_HEIGHT),
+            floor_div(anchor.x, CHUNK_WIDTH)}]
+        .pipes.push_back(make_pipe_record(pipe));
+
+    recorder.reset();
+    pipe->draw(&recorder);
+    extend_margin(anchor);
+  }
+
+  header.chunk_count = chunks.size();
+  header.machine_count = machine_manager.get_machines().size();
+  header.pipe_count = pipe_manager.get_pipes().size();
+
+  const size_t directory = sizeof(ChunkHeader) +
+                           chunks.size() * sizeof(ChunkEntry);
+  std::vector<char> buffer(directory +
+                           header.machine_count * sizeof(MachineRecord) +
+                           header.pipe_count * sizeof(PipeRecord));
+
+  auto* header_cursor = reinterpret_cast<ChunkHeader*>(buffer.data());
+  std::memcpy(header_cursor, &header, sizeof(header));
+  if (!LAYOUT_NATIVE_ENDIAN) swap_chunk_header(header_cursor);
+
+  auto* entry_cursor =
+      reinterpret_cast<ChunkEntry*>(buffer.data() + sizeof(ChunkHeader));
+  size_t offset = directory;
+  for (const auto& [key, content] : chunks) {
+    const ChunkEntry entry{key.second, key.first,
+                           static_cast<uint32_t>(content.machines.size()),
+                           static_cast<uint32_t>(content.pipes.size()),
+                           offset};
+    std::memcpy(entry_cursor, &entry, sizeof(entry));
+    if (!LAYOUT_NATIVE_ENDIAN) swap_chunk_entry(entry_cursor);
+    ++entry_cursor;
+
+    const size_t machine_bytes =
+        content.machines.size() * sizeof(MachineRecord);
+    const size_t pipe_bytes = content.pipes.size() * sizeof(PipeRecord);
+    std::memcpy(buffer.data() + offset, content.machines.data(), machine_bytes);
+    std::memcpy(buffer.data() + offset + machine_bytes, content.pipes.data(),
+                pipe_bytes);
+    if (!LAYOUT_NATIVE_ENDIAN)
+      swap_layout_words(buffer.data() + offset, machine_bytes + pipe_bytes);
+    offset += machine_bytes + pipe_bytes;
+  }
+
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream) return false;
+  stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return static_cast<bool>(stream);
+}
+
+// CHUNK FILE
+
+// 個数は掛ける前に残りの大きさで抑え, 桁あふれで検査をすり抜けさせない
+static bool is_table_in_file(const ChunkHeader& header,
+                             const size_t file_size) {
+  return file_size >= sizeof(ChunkHeader) &&
+         header.chunk_count <=
+             (file_size - sizeof(ChunkHeader)) / sizeof(ChunkEntry);
+}
+
+static bool is_entry_in_file(const ChunkEntry& entry, const size_t file_size) {
+  if (entry.offset > file_size) return false;
+  uint64_t remaining = file_size - entry.offset;
+  if (entry.machine_count > remaining / sizeof(MachineRecord)) return false;
+  remaining -= entry.machine_count * sizeof(MachineRecord);
+  return entry.pipe_count <= remaining / sizeof(PipeRecord);
+}
+
+ChunkFile::ChunkFile()
+    : m_header(), m_data(nullptr), m_size(0), m_mapped(false) {}
+
+ChunkFile::~ChunkFile() { close(); }
+
+bool ChunkFile::open(const std::string& path) {
+  close();
+
+  size_t file_size = 0;
+#if defined(__linux__)
+  if (LAYOUT_NATIVE_ENDIAN) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        m_data = static_cast<const char*>(data);
+        m_size = info.st_size;
+        m_mapped = true;
+        file_size = m_size;
+      }
+    }
+    ::close(fd);
+  }
+#endif
+
+  if (m_mapped) {
+    if (m_size < sizeof(ChunkHeader)) {
+      close();
+      return false;
+    }
+    std::memcpy(&m_header, m_data, sizeof(ChunkHeader));
+    if (m_header.magic == CHUNK_MAGIC && is_table_in_file(m_header, m_size)) {
+      const auto* entries =
+          reinterpret_cast<const ChunkEntry*>(m_data + sizeof(ChunkHeader));
+      m_entries.assign(entries, entries + m_header.chunk_count);
+    }
+  } else {
+    // 目録だけを読み, レコードは read_chunk で読む
+    m_stream.open(path, std::ios::binary);
+    if (!m_stream) return false;
+    m_stream.seekg(0, std::ios::end);
+    const auto end = m_stream.tellg();
+    if (end < 0) {
+      close();
+      return false;
+    }
+    file_size = static_cast<size_t>(end);
+    m_stream.seekg(0);
+
+    if (!m_stream.read(reinterpret_cast<char*>(&m_header),
+                       sizeof(ChunkHeader))) {
+      close();
+      return false;
+    }
+    if (!LAYOUT_NATIVE_ENDIAN) swap_chunk_header(&m_header);
+
+    if (m_header.magic == CHUNK_MAGIC &&
+        is_table_in_file(m_header, file_size)) {
+      m_entries.resize(m_header.chunk_count);
+      m_stream.read(reinterpret_cast<char*>(m_entries.data()),
+                    m_entries.size() * sizeof(ChunkEntry));
+      if (!LAYOUT_NATIVE_ENDIAN) {
+        for (auto& entry : m_entries) swap_chunk_entry(&entry);
+      }
+    }
+  }
+
+  // 破損したファイルは読まない
+  bool valid = m_header.magic == CHUNK_MAGIC &&
+               m_header.version == CHUNK_VERSION &&
+               m_header.chunk_width > 0 && m_header.chunk_height > 0 &&
+               m_entries.size() == m_header.chunk_count;
+  for (size_t i = 0; valid && i < m_entries.size(); ++i) {
+    const auto& entry = m_entries[i];
+    valid = is_entry_in_file(entry, file_size) &&
+            (i == 0 || std::make_pair(m_entries[i - 1].y, m_entries[i - 1].x) <
+                           std::make_pair(entry.y, entry.x));
+  }
+  if (!valid) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void ChunkFile::close() {
+#if defined(__linux__)
+  if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+  m_header = ChunkHeader();
+  m_entries.clear();
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+  if (m_stream.is_open()) m_stream.close();
+  m_stream.clear();
+}
+
+const ChunkHeader& ChunkFile::get_header() const { return m_header; }
+
+const std::vector<ChunkEntry>& ChunkFile::get_entries() const {
+  return m_entries;
+}
+
+int64_t ChunkFile::find_chunk(const int x, const int y) const {
+  const auto it = std::lower_bound(
+      m_entries.begin(), m_entries.end(), std::make_pair(y, x),
+      [](const ChunkEntry& entry, const std::pair<int, int>& key) {
+        return std::make_pair(entry.y, entry.x) < key;
+      });
+  if (it == m_entries.end() || it->x != x || it->y != y) return -1;
+  return it - m_entries.begin();
+}
+
+bool ChunkFile::read_chunk(const size_t index,
+                           std::vector<MachineRecord>& machines,
+                           std::vector<PipeRecord>& pipes) const {
+  const auto& entry = m_entries[index];
+  machines.resize(entry.machine_count);
+  pipes.resize(entry.pipe_count);
+  const size_t machine_bytes = machines.size() * sizeof(MachineRecord);
+  const size_t pipe_bytes = pipes.size() * sizeof(PipeRecord);
+
+  if (m_mapped) {
+    const char* data = m_data + entry.offset;
+    std::memcpy(machines.data(), data, machine_bytes);
+    std::memcpy(pipes.data(), data + machine_bytes, pipe_bytes);
+
+#if defined(__linux__)
+    // 写し終えたページは手放す, 次に触れたときにファイルから読み直される
+    const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto begin = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    const auto end = reinterpret_cast<uintptr_t>(data) + machine_bytes +
+                     pipe_bytes;
+    if (end > begin) {
+      madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+#endif
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_stream_mutex);
+  m_stream.clear();
+  m_stream.seekg(static_cast<std::streamoff>(entry.offset));
+  m_stream.read(reinterpret_cast<char*>(machines.data()), machine_bytes);
+  m_stream.read(reinterpret_cast<char*>(pipes.data()), pipe_bytes);
+  if (!m_stream) return false;
+
+  if (!LAYOUT_NATIVE_ENDIAN) {
+    swap_layout_words(reinterpret_cast<char*>(machines.data()), machine_bytes);
+    swap_layout_words(reinterpret_cast<char*>(pipes.data()), pipe_bytes);
+  }
+  return true;
+}
+
+// RESIDENT CHUNK
+
+ChunkWorld::ChunkWorld(StageArena* arena)
+    : machine_manager(arena), pipe_manager(arena) {}
+
+ResidentChunk::ResidentChunk()
+    : arena(), world(arena.create<ChunkWorld>(&arena)), bytes(0) {}
+
+// CHUNK PAGER
+
+ChunkPager::ChunkPager(const ChunkFile* file, const int64_t budget_bytes)
+    : m_file(file),
+      m_budget_bytes(budget_bytes),
+      m_frame(1),
+      m_resident_bytes(0),
+      m_peak_bytes(0),
+      m_page_ins(0),
+      m_evictions(0),
+      m_pending(file->get_entries().size(), false),
+      m_pending_count(0),
+      m_stop(false),
+      m_thread([this] { run(); }) {}
+
+ChunkPager::~ChunkPager() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_one();
+  m_thread.join();
+}
+
+// 基点が area を margin チャンク分広げた範囲に入るチャンク
+// 描画のはみ出しの分だけ area を広げてから探す
+void ChunkPager::collect_chunks(const DrawRect& area, const int margin,
+                                std::vector<size_t>& indices) const {
+  const auto& header = m_file->get_header();
+  const auto& entries = m_file->get_entries();
+  const int x0 =
+      floor_div(area.x0 - header.margin_x, header.chunk_width) - margin;
+  const int x1 =
+      floor_div(area.x1 + header.margin_x, header.chunk_width) + margin;
+  const int y0 =
+      floor_div(area.y0 - header.margin_y, header.chunk_height) - margin;
+  const int y1 =
+      floor_div(area.y1 + header.margin_y, header.chunk_height) + margin;
+
+  auto it = entries.begin();
+  for (int y = y0; y <= y1 && it != entries.end(); ++y) {
+    it = std::lower_bound(
+        it, entries.end(), std::make_pair(y, x0),
+        [](const ChunkEntry& entry, const std::pair<int, int>& key) {
+          return std::make_pair(entry.y, entry.x) < key;
+        });
+    for (; it != entries.end() && it->y == y && it->x <= x1; ++it) {
+      indices.push_back(it - entries.begin());
+    }
+  }
+}
+
+std::unique_ptr<ResidentChunk> ChunkPager::load_chunk(
+    const size_t index) const {
+  auto chunk = std::make_unique<ResidentChunk>();
+
+  std::vector<MachineRecord> machine_records;
+  std::vector<PipeRecord> pipe_records;
+  if (m_file->read_chunk(index, machine_records, pipe_records)) {
+    std::vector<std::shared_ptr<Machine>> machines;
+    machines.reserve(machine_records.size());
+    for (const auto& record : machine_records) {
+      const auto machine = make_machine(record, &chunk->arena);
+      if (machine) machines.push_back(machine);
+    }
+
+    std::vector<std::shared_ptr<Pipe>> pipes;
+    pipes.reserve(pipe_records.size());
+    for (const auto& record : pipe_records) {
+      pipes.push_back(make_pipe(record, &chunk->arena));
+    }
+
+    chunk->world->machine_manager.add_machines(machines);
+    chunk->world->pipe_manager.add_pipes(pipes);
+  }
+
+  chunk->bytes = chunk->arena.get_bytes();
+  return chunk;
+}
+
+ChunkPager::Resident& ChunkPager::make_resident(
+    const size_t index, std::unique_ptr<ResidentChunk> chunk) {
+  m_lru.push_front(index);
+  m_resident_bytes += chunk->bytes;
+  m_peak_bytes = std::max(m_peak_bytes, m_resident_bytes);
+  ++m_page_ins;
+
+  auto& resident = m_resident[index];
+  resident.chunk = std::move(chunk);
+  resident.lru = m_lru.begin();
+  resident.frame = 0;
+  return resident;
+}
+
+void ChunkPager::touch(Resident& resident) {
+  m_lru.splice(m_lru.begin(), m_lru, resident.lru);
+}
+
+// 古い順に手放す, 破棄は作業スレッドに任せる
+void ChunkPager::evict() {
+  std::vector<std::unique_ptr<ResidentChunk>> retired;
+  for (auto it = m_lru.end();
+       m_resident_bytes > m_budget_bytes && it != m_lru.begin();) {
+    --it;
+    const auto found = m_resident.find(*it);
+    if (found->second.frame == m_frame) continue;
+
+    m_resident_bytes -= found->second.chunk->bytes;
+    ++m_evictions;
+    retired.push_back(std::move(found->second.chunk));
+    m_resident.erase(found);
+    it = m_lru.erase(it);
+  }
+  if (retired.empty()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& chunk : retired) m_retired.push_back(std::move(chunk));
+  }
+  m_condition.notify_one();
+}
+
+void ChunkPager::request_view(const DrawRect& view) {
+  ++m_frame;
+  m_view.clear();
+  collect_chunks(view, 0, m_view);
+  std::vector<size_t> prefetch;
+  collect_chunks(view, CHUNK_PREFETCH, prefetch);
+
+  // 表示中のものが最も新しくなるよう, 外周から触れる
+  for (const size_t index : prefetch) {
+    const auto it = m_resident.find(index);
+    if (it != m_resident.end()) touch(it->second);
+  }
+  for (const size_t index : m_view) {
+    const auto it = m_resident.find(index);
+    if (it == m_resident.end()) continue;
+    it->second.frame = m_frame;
+    touch(it->second);
+  }
+
+  // 待ち行列は毎フレーム作り直し, 範囲から外れたチャンクは読まない
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const size_t index : m_queue) m_pending[index] = false;
+    m_pending_count -= m_queue.size();
+    m_queue.clear();
+
+    for (const auto* indices : {&m_view, &prefetch}) {
+      for (const size_t index : *indices) {
+        if (m_pending[index] || m_resident.count(index)) continue;
+        m_pending[index] = true;
+        ++m_pending_count;
+        m_queue.push_back(index);
+      }
+    }
+  }
+  m_condition.notify_one();
+}
+
+void ChunkPager::update() {
+  std::vector<std::pair<size_t, std::unique_ptr<ResidentChunk>>> ready;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ready.swap(m_ready);
+    for (const auto& [index, chunk] : ready) m_pending[index] = false;
+    m_pending_count -= ready.size();
+  }
+
+  std::vector<std::unique_ptr<ResidentChunk>> duplicates;
+  for (auto& [index, chunk] : ready) {
+    // visit がその場で読んだ後に届いたもの
+    if (m_resident.count(index)) {
+      duplicates.push_back(std::move(chunk));
+      continue;
+    }
+
+    auto& resident = make_resident(index, std::move(chunk));
+    if (std::find(m_view.begin(), m_view.end(), index) != m_view.end()) {
+      resident.frame = m_frame;
+    }
+  }
+  if (!duplicates.empty()) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& chunk : duplicates) m_retired.push_back(std::move(chunk));
+  }
+
+  evict();
+}
+
+void ChunkPager::draw(DrawManagerBase* draw_manager,
+                      const glm::ivec2 camera) const {
+  for (const size_t index : m_view) {
+    const auto it = m_resident.find(index);
+    if (it != m_resident.end()) {
+      it->second.chunk->world->pipe_manager.draw(draw_manager, camera);
+    }
+  }
+  for (const size_t index : m_view) {
+    const auto it = m_resident.find(index);
+    if (it != m_resident.end()) {
+      it->second.chunk->world->machine_manager.draw(draw_manager, camera);
+    }
+  }
+}
+
+void ChunkPager::visit(
+    const DrawRect& area,
+    const std::function<void(const ChunkWorld& world)>& visitor) {
+  std::vector<size_t> indices;
+  collect_chunks(area, 0, indices);
+
+  for (const size_t index : indices) {
+    auto it = m_resident.find(index);
+    if (it == m_resident.end()) {
+      make_resident(index, load_chunk(index));
+      it = m_resident.find(index);
+    } else {
+      touch(it->second);
+    }
+
+    visitor(*it->second.chunk->world);
+    evict();
+  }
+}
+
+ChunkPagerStats ChunkPager::get_stats() const {
+  size_t pending;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    pending = m_pending_count;
+  }
+  return ChunkPagerStats{m_resident.size(), pending,    m_resident_bytes,
+                         m_peak_bytes,      m_page_ins, m_evictions};
+}
+
+void ChunkPager::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_condition.wait(lock, [&] {
+      return m_stop || !m_queue.empty() || !m_retired.empty();
+    });
+    if (m_stop) break;
+
+    if (!m_retired.empty()) {
+      auto retired = std::move(m_retired);
+      m_retired.clear();
+      lock.unlock();
+      retired.clear();
+      lock.lock();
+      continue;
+    }
+
+    const size_t index = m_queue.front();
+    m_queue.pop_front();
+    lock.unlock();
+    auto chunk = load_chunk(index);
+    lock.lock();
+    m_ready.emplace_back(index, std::move(chunk));
+  }
+}
+
+}  // namespace factory_game
@@ -1,19 +1,73 @@
 #include "draw.h"
 
+#include "frame_export.h"
+#include "profile.h"
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#endif
+
 namespace factory_game {
 
-DrawManagerBase::DrawManagerBase() {}
+DrawManagerBase::DrawManagerBase() : m_frame_exporter(nullptr) {}
 
 DrawManagerBase::~DrawManagerBase() = default;
 
+void DrawManagerBase::set_frame_exporter(FrameExporter* exporter) {
+  m_frame_exporter = exporter;
+}
+
+void DrawManagerBase::export_frame(const DrawBuffer& buffer, const int width,
+                                   const int height) {
+  if (m_frame_exporter == nullptr) return;
+  m_frame_exporter->publish(buffer.data(), width, height);
+}
+
+void DrawManagerBase::draw_commands(const DrawCommand* commands,
+                                    const size_t count,
+                                    const std::string_view text) {
+  for (size_t i = 0; i < count; ++i) {
+    const auto& command = commands[i];
+    const auto label = text.substr(command.text_begin, command.text_length);
+
+    switch (command.kind) {
+      case DRAW_COMMAND_CLEAR:
+        clear();
+        break;
+      case DRAW_COMMAND_LABEL:
+        draw_label(command.x0, command.y0, label);
+        break;
+      case DRAW_COMMAND_LABEL_BOX:
+        draw_label_box(command.x0, command.y0, label);
+        break;
+      case DRAW_COMMAND_CLEAR_BOX:
+        draw_clear_box(command.x0, command.y0, command.x1, command.y1);
+        break;
+      case DRAW_COMMAND_LINE_BOX:
+        draw_line_box(command.x0, command.y0, command.x1, command.y1);
+        break;
+      case DRAW_COMMAND_HV_LINE:
+        draw_hv_line(command.x0, command.y0, command.x1, command.y1);
+        break;
+    }
+  }
+}
+
 // Windows
 
 #if defined(WIN32)
 
-DrawManagerWindows::DrawManagerWindows() {
-  m_width = 120;
-  m_height = 30;
-
+DrawManagerWindows::DrawManagerWindows()
+    : m_width(120),
+      m_height(30),
+      m_current_buffer(get_heap_resource(MEMORY_DRAW_BUFFER)),
+      m_back_buffer(get_heap_resource(MEMORY_DRAW_BUFFER)),
+      m_drag_x(-1),
+      m_drag_y(-1),
+      m_drag_dx(0),
+      m_drag_dy(0),
+      m_hover_x(-1),
+      m_hover_y(-1) {
   m_stdout_handle = GetStdHandle(STD_OUTPUT_HANDLE);
   GetConsoleMode(m_stdout_handle, &m_out_mode);
   auto out_mode = m_out_mode;
@@ -34,8 +88,16 @@ DrawManagerWindows::DrawManagerWindows() {
   cursor_info.bVisible = FALSE;
   SetConsoleCursorInfo(m_stdout_handle, &cursor_info);
 
-  m_current_buffer = std::vector(m_width * m_height, ' ');
-  m_back_buffer = std::vector(m_width * m_height, ' ');
+  CONSOLE_SCREEN_BUFFER_INFO info;
+  if (GetConsoleScreenBufferInfo(m_stdout_handle, &info)) {
+    m_width = info.srWindow.Right - info.srWindow.Left + 1;
+    m_height = info.srWindow.Bottom - info.srWindow.Top + 1;
+  }
+  m_shared_width = m_width;
+  m_shared_height = m_height;
+
+  m_current_buffer.assign(m_width * m_height, ' ');
+  m_back_buffer.assign(m_width * m_height, ' ');
 
   m_input = INPUT_RECORD();
 }
@@ -46,11 +108,13 @@ DrawManagerWindows::~DrawManagerWindows() {
   SetConsoleCursorInfo(m_stdout_handle, &m_cursor_info);
 }
 
-int DrawManagerWindows::get_width() { return m_width; }
+int DrawManagerWindows::get_width() { return m_shared_width; }
 
-int DrawManagerWindows::get_height() { return m_height; }
+int DrawManagerWindows::get_height() { return m_shared_height; }
 
+// フレームの始めに大きさの変化を見て, バッファを作り直す
 void DrawManagerWindows::clear() {
+  resize();
   std::fill(m_back_buffer.begin(), m_back_buffer.end(), ' ');
 }
 
@@ -116,7 +180,7 @@ void DrawManagerWindows::draw_hv_line(int x0, int y0, int x1, int y1) {
     if (x0 > x1) std::swap(x0, x1);
 
     for (int x = x0; x <= x1; ++x) {
-      if (x < 0 && x >= m_width) continue;
+      if (x < 0 || x >= m_width) continue;
 
       if (x == x0 || x == x1) {
         m_back_buffer[y0 * m_width + x] = '+';
@@ -128,30 +192,46 @@ void DrawManagerWindows::draw_hv_line(int x0, int y0, int x1, int y1) {
 }
 
 void DrawManagerWindows::present() {
-  // バックバッファとカレントバッファを比較し、変更点のみを描画
+  ProfileScope scope(PROFILE_PRESENT);
+
+  // バックバッファとカレントバッファを比較し、変更点の連続ごとに描画
   for (int y = 0; y < m_height; ++y) {
-    for (int x = 0; x < m_width; ++x) {
-      size_t index = y * m_width + x;
+    for (int x = 0; x < m_width;) {
+      const size_t begin = y * m_width + x;
+      if (m_back_buffer[begin] == m_current_buffer[begin]) {
+        ++x;
+        continue;
+      }
 
-      if (m_back_buffer[index] != m_current_buffer[index]) {
-        COORD coord;
-        coord.X = static_cast<SHORT>(x);
-        coord.Y = static_cast<SHORT>(y);
-        SetConsoleCursorPosition(m_stdout_handle, coord);
+      size_t end = begin;
+      while (x < m_width && m_back_buffer[end] != m_current_buffer[end]) {
+        m_current_buffer[end] = m_back_buffer[end];
+        ++end;
+        ++x;
+      }
 
-        DWORD written;
-        WriteConsole(m_stdout_handle, &m_back_buffer[index], 1, &written,
-                     nullptr);
+      COORD coord;
+      coord.X = static_cast<SHORT>(x - (end - begin));
+      coord.Y = static_cast<SHORT>(y);
+      SetConsoleCursorPosition(m_stdout_handle, coord);
 
-        m_current_buffer[index] = m_back_buffer[index];
-      }
+      DWORD written;
+      WriteConsole(m_stdout_handle, &m_back_buffer[begin],
+                   static_cast<DWORD>(end - begin), &written, nullptr);
     }
   }
 
-  Sleep(16);
+  export_frame(m_current_buffer, m_width, m_height);
 }
 
 void DrawManagerWindows::capture_input() {
+  ProfileScope scope(PROFILE_CAPTURE_INPUT);
+
+  m_drag_dx = 0;
+  m_drag_dy = 0;
+  m_hover_x = -1;
+  m_hover_y = -1;
+
   DWORD num_events;
   GetNumberOfConsoleInputEvents(m_stdin_handle, &num_events);
 
@@ -161,6 +241,28 @@ void DrawManagerWindows::capture_input() {
   }
 
   ReadConsoleInput(m_stdin_handle, &m_input, 1, &num_events);
+  if (m_input.EventType != MOUSE_EVENT) return;
+
+  const auto& mouse = m_input.Event.MouseEvent;
+  if (mouse.dwEventFlags == MOUSE_MOVED) {
+    m_hover_x = mouse.dwMousePosition.X;
+    m_hover_y = mouse.dwMousePosition.Y;
+  }
+
+  // 中ボタンを押している間の移動量
+  if (!(mouse.dwButtonState & FROM_LEFT_2ND_BUTTON_PRESSED)) {
+    m_drag_x = -1;
+    return;
+  }
+
+  const int x = mouse.dwMousePosition.X;
+  const int y = mouse.dwMousePosition.Y;
+  if (m_drag_x >= 0 && mouse.dwEventFlags == MOUSE_MOVED) {
+    m_drag_dx = x - m_drag_x;
+    m_drag_dy = y - m_drag_y;
+  }
+  m_drag_x = x;
+  m_drag_y = y;
 }
 
 bool DrawManagerWindows::handle_input_keycode(const int keycode) {
@@ -180,15 +282,81 @@ bool DrawManagerWindows::handle_input_mouse(const int state, int& x, int& y) {
   return false;
 }
 
+bool DrawManagerWindows::handle_input_drag(int& dx, int& dy) {
+  if (m_drag_dx == 0 && m_drag_dy == 0) return false;
+
+  dx = m_drag_dx;
+  dy = m_drag_dy;
+  return true;
+}
+
+bool DrawManagerWindows::handle_input_hover(int& x, int& y) {
+  if (m_hover_x < 0) return false;
+
+  x = m_hover_x;
+  y = m_hover_y;
+  return true;
+}
+
+void DrawManagerWindows::resize() {
+  CONSOLE_SCREEN_BUFFER_INFO info;
+  if (!GetConsoleScreenBufferInfo(m_stdout_handle, &info)) return;
+
+  const int width = info.srWindow.Right - info.srWindow.Left + 1;
+  const int height = info.srWindow.Bottom - info.srWindow.Top + 1;
+  if (width == m_width && height == m_height) return;
+
+  m_width = width;
+  m_height = height;
+  m_shared_width = width;
+  m_shared_height = height;
+
+  // カレントバッファを画面に無い文字で埋め, 次の present で全体を書き直す
+  m_current_buffer.assign(m_width * m_height, '\0');
+  m_back_buffer.assign(m_width * m_height, ' ');
+}
+
 #endif
 
 // Linux
 
 #if defined(__linux__)
 
-DrawManagerLinux::DrawManagerLinux() {
-  m_width = 120;
-  m_height = 30;
+// シグナルハンドラからは印を付けるだけにし, 作り直しは clear で行う
+static std::atomic<bool> window_resized(false);
+
+static void handle_winch(int) { window_resized = true; }
+
+static bool get_window_size(int& width, int& height) {
+  winsize size;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0) return false;
+  if (size.ws_col == 0 || size.ws_row == 0) return false;
+
+  width = size.ws_col;
+  height = size.ws_row;
+  return true;
+}
+
+DrawManagerLinux::DrawManagerLinux()
+    : m_width(120),
+      m_height(30),
+      m_current_buffer(get_heap_resource(MEMORY_DRAW_BUFFER)),
+      m_back_buffer(get_heap_resource(MEMORY_DRAW_BUFFER)),
+      m_drag_x(-1),
+      m_drag_y(-1),
+      m_drag_dx(0),
+      m_drag_dy(0),
+      m_hover_x(-1),
+      m_hover_y(-1) {
+  get_window_size(m_width, m_height);
+  m_shared_width = m_width;
+  m_shared_height = m_height;
+
+  struct sigaction action = {};
+  action.sa_handler = handle_winch;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGWINCH, &action, &m_winch_action);
 
   tcgetattr(STDIN_FILENO, &m_terminfo);
   auto terminfo = m_terminfo;
@@ -199,27 +367,32 @@ DrawManagerLinux::DrawManagerLinux() {
 
   std::cout << "\x1b[?1049h";
   std::cout << "\x1b[?25l";
+  std::cout << "\x1b[?1003h";  // ボタンを押していない間の移動も受け取る
   std::cout << "\x1b[?1006h";
   std::cout << std::flush;
 
-  m_current_buffer = std::vector(m_width * m_height, ' ');
-  m_back_buffer = std::vector(m_width * m_height, ' ');
+  m_current_buffer.assign(m_width * m_height, ' ');
+  m_back_buffer.assign(m_width * m_height, ' ');
 }
 
 DrawManagerLinux::~DrawManagerLinux() {
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &m_terminfo);
+  sigaction(SIGWINCH, &m_winch_action, nullptr);
 
   std::cout << "\x1b[?1049l";
   std::cout << "\x1b[?25h";
+  std::cout << "\x1b[?1003l";
   std::cout << "\x1b[?1006l";
   std::cout << std::flush;
 }
 
-int DrawManagerLinux::get_width() { return m_width; }
+int DrawManagerLinux::get_width() { return m_shared_width; }
 
-int DrawManagerLinux::get_height() { return m_height; }
+int DrawManagerLinux::get_height() { return m_shared_height; }
 
+// フレームの始めに大きさの変化を見て, バッファを作り直す
 void DrawManagerLinux::clear() {
+  if (window_resized.exchange(false)) resize();
   std::fill(m_back_buffer.begin(), m_back_buffer.end(), ' ');
 }
 
@@ -285,7 +458,7 @@ void DrawManagerLinux::draw_hv_line(int x0, int y0, int x1, int y1) {
     if (x0 > x1) std::swap(x0, x1);
 
     for (int x = x0; x <= x1; ++x) {
-      if (x < 0 && x >= m_width) continue;
+      if (x < 0 || x >= m_width) continue;
 
       if (x == x0 || x == x1) {
         m_back_buffer[y0 * m_width + x] = '+';
@@ -296,64 +469,197 @@ void DrawManagerLinux::draw_hv_line(int x0, int y0, int x1, int y1) {
   }
 }
 
+// カーソル移動の命令はこれより長い
+static constexpr int PRESENT_MAX_SKIP = 4;
+
 void DrawManagerLinux::present() {
+  ProfileScope scope(PROFILE_PRESENT);
+
+  // 変更点の連続の先頭でだけカーソルを動かす
+  // 間の変わっていないセルが短ければ, 移動せずに書き直した方が短い
+  m_output.clear();
   for (int y = 0; y < m_height; ++y) {
+    int cursor = -1;  // 直前に書いたセルの次の x
     for (int x = 0; x < m_width; ++x) {
-      size_t index = y * m_width + x;
-
-      if (m_back_buffer[index] != m_current_buffer[index]) {
-        std::cout << "\x1b[" << std::to_string(y + 1) << ";"
-                  << std::to_string(x + 1) << "H";
-        std::cout << m_back_buffer[index];
+      const size_t index = y * m_width + x;
+      if (m_back_buffer[index] == m_current_buffer[index]) continue;
 
-        m_current_buffer[index] = m_back_buffer[index];
+      if (cursor >= 0 && x - cursor <= PRESENT_MAX_SKIP) {
+        m_output.append(&m_back_buffer[y * m_width + cursor], x - cursor);
+      } else {
+        m_output += "\x1b[";
+        m_output += std::to_string(y + 1);
+        m_output += ';';
+        m_output += std::to_string(x + 1);
+        m_output += 'H';
       }
+      m_output += m_back_buffer[index];
+      m_current_buffer[index] = m_back_buffer[index];
+      cursor = x + 1;
     }
   }
+  // 変化が無いフレームも, 読み手が間隔を知れるよう書き出す
+  export_frame(m_current_buffer, m_width, m_height);
+  if (m_output.empty()) return;
+
+  std::cout.write(m_output.data(), m_output.size());
   std::cout << std::flush;
+}
+
+// 1 フレームに読む入力の上限, 流れ込み続けてもフレームを止めない
+static constexpr size_t INPUT_READ_LIMIT = 1 << 16;
+// これより長い "\x1b[" 列は壊れているものとして捨てる
+static constexpr size_t INPUT_SEQUENCE_LIMIT = 32;
+
+// SGR のマウスイベント "\x1b[<b;x;yM" の "<" と終わりの文字の間を読む
+static bool parse_mouse_params(const char* begin, const char* end,
+                               int values[3]) {
+  int count = 0;
+  for (const char* it = begin; count < 3; ++it) {
+    if (it == end || *it < '0' || *it > '9') return false;
+
+    int value = 0;
+    for (; it != end && *it >= '0' && *it <= '9'; ++it) {
+      value = value * 10 + (*it - '0');
+    }
+    values[count++] = value;
+    if (it == end) return count == 3;
+    if (*it != ';') return false;
+  }
+  return false;
+}
 
-  std::this_thread::sleep_for(std::chrono::milliseconds(16));
+// data から入力を 1 つ区切り, 使ったバイト数を返す
+// 列の途中でバッファが尽きたら 0, そのとき event は ESC のキー
+// 使わない列 (引数付きのキーなど) は has_event を false にして読み飛ばす
+static size_t parse_input_event(const char* data, const size_t size,
+                                TerminalInputEvent& event, bool& has_event) {
+  event = TerminalInputEvent{
+      TERMINAL_INPUT_KEY, static_cast<unsigned char>(data[0]), 0, 0, 0, false};
+  has_event = true;
+  if (data[0] != '\x1b') return 1;
+  if (size < 2) return 0;
+  // ESC のすぐ後に別のキーを押した
+  if (data[1] != '[') return 1;
+
+  // 引数 0x30-0x3f, 中間 0x20-0x2f, 終わり 0x40-0x7e
+  size_t index = 2;
+  while (index < size && data[index] >= 0x30 && data[index] <= 0x3f) index++;
+  const size_t params_end = index;
+  while (index < size && data[index] >= 0x20 && data[index] <= 0x2f) index++;
+  if (index == size) {
+    if (size < INPUT_SEQUENCE_LIMIT) return 0;
+    has_event = false;
+    return size;
+  }
+
+  const char last = data[index];
+  if (last < 0x40 || last > 0x7e) {
+    // 列として終わっていない, 壊れた所まで捨てる
+    has_event = false;
+    return index;
+  }
+
+  int values[3];
+  if (data[2] == '<' && (last == 'M' || last == 'm') &&
+      parse_mouse_params(data + 3, data + params_end, values)) {
+    event.kind = TERMINAL_INPUT_MOUSE;
+    event.button = values[0];
+    event.x = values[1] - 1;
+    event.y = values[2] - 1;
+    event.release = last == 'm';
+    return index + 1;
+  }
+
+  has_event = index == 2;
+  event.kind = TERMINAL_INPUT_CSI;
+  event.code = last;
+  return index + 1;
 }
 
+// 中ボタンの押下と, 押したままの移動
+static constexpr int MOUSE_MIDDLE = 1;
+static constexpr int MOUSE_MIDDLE_MOVE = 33;
+// 移動のイベントに足される
+static constexpr int MOUSE_MOVE = 32;
+
+// 読めるだけ読んでキー, "\x1b[" 列, マウスイベントに区切る
+// 移動のイベントとキーやクリックは同じ read に混ざって届く
 void DrawManagerLinux::capture_input() {
-  m_input_buffer.clear();
+  ProfileScope scope(PROFILE_CAPTURE_INPUT);
+
+  m_input_events.clear();
+  m_drag_dx = 0;
+  m_drag_dy = 0;
+  m_hover_x = -1;
+  m_hover_y = -1;
+
+  const size_t kept = m_input_buffer.size();
+  char buf[256];
+  while (m_input_buffer.size() < INPUT_READ_LIMIT) {
+    const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n <= 0) break;
+    m_input_buffer.insert(m_input_buffer.end(), buf, buf + n);
+  }
+  // 続きが来なかった途中の列は捨てる, ESC だけなら ESC のキー
+  const bool is_flush = m_input_buffer.size() == kept;
+
+  size_t offset = 0;
+  while (offset < m_input_buffer.size()) {
+    const size_t rest = m_input_buffer.size() - offset;
+    TerminalInputEvent event;
+    bool has_event;
+    size_t length = parse_input_event(m_input_buffer.data() + offset, rest,
+                                      event, has_event);
+    if (length == 0) {
+      if (!is_flush) break;
+      has_event = rest == 1;
+      length = rest;
+    }
+    offset += length;
+    if (!has_event) continue;
+
+    m_input_events.push_back(event);
+    if (event.kind != TERMINAL_INPUT_MOUSE) continue;
+
+    // ドラッグ中は 1 フレームに移動が複数入るので全て足す
+    if (event.button & MOUSE_MOVE) {
+      m_hover_x = event.x;
+      m_hover_y = event.y;
+    }
+
+    if ((event.button != MOUSE_MIDDLE && event.button != MOUSE_MIDDLE_MOVE) ||
+        event.release) {
+      m_drag_x = -1;
+      continue;
+    }
 
-  char buf[32];
-  ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
-  if (n > 0) {
-    m_input_buffer.assign(buf, buf + n);
+    if (m_drag_x >= 0 && event.button == MOUSE_MIDDLE_MOVE) {
+      m_drag_dx += event.x - m_drag_x;
+      m_drag_dy += event.y - m_drag_y;
+    }
+    m_drag_x = event.x;
+    m_drag_y = event.y;
   }
+  m_input_buffer.erase(m_input_buffer.begin(),
+                       m_input_buffer.begin() + offset);
 }
 
 bool DrawManagerLinux::handle_input_keycode(const int keycode) {
-  if (m_input_buffer.empty()) return false;
-
-  if (m_input_buffer.size() == 1 && m_input_buffer[0] == keycode) {
-    return true;
+  const auto kind = keycode & 0x100 ? TERMINAL_INPUT_CSI : TERMINAL_INPUT_KEY;
+  for (const auto& event : m_input_events) {
+    if (event.kind == kind && event.code == (keycode & 0xff)) return true;
   }
 
   return false;
 }
 
 bool DrawManagerLinux::handle_input_mouse(const int state, int& x, int& y) {
-  if (m_input_buffer.empty()) return false;
-
-  if (m_input_buffer.size() > 6 && m_input_buffer[0] == '\x1b' &&
-      m_input_buffer[1] == '[' && m_input_buffer[2] == '<') {
-    int cb, cx, cy;
-    char m;
-    int parsed =
-        sscanf(m_input_buffer.data(), "\x1b[<%d;%d;%d%c", &cb, &cx, &cy, &m);
-
-    std::cout << "\x1b[1;32H";
-    for (char c : m_input_buffer) {
-      std::cout << c;
-    }
-    std::cout << std::flush;
-
-    if (parsed == 3 && m == 'M' && cb == state) {
-      x = cx - 1;
-      y = cy - 1;
+  for (const auto& event : m_input_events) {
+    if (event.kind == TERMINAL_INPUT_MOUSE && !event.release &&
+        event.button == state) {
+      x = event.x;
+      y = event.y;
       return true;
     }
   }
@@ -361,6 +667,37 @@ bool DrawManagerLinux::handle_input_mouse(const int state, int& x, int& y) {
   return false;
 }
 
+bool DrawManagerLinux::handle_input_drag(int& dx, int& dy) {
+  if (m_drag_dx == 0 && m_drag_dy == 0) return false;
+
+  dx = m_drag_dx;
+  dy = m_drag_dy;
+  return true;
+}
+
+bool DrawManagerLinux::handle_input_hover(int& x, int& y) {
+  if (m_hover_x < 0) return false;
+
+  x = m_hover_x;
+  y = m_hover_y;
+  return true;
+}
+
+void DrawManagerLinux::resize() {
+  int width, height;
+  if (!get_window_size(width, height)) return;
+  if (width == m_width && height == m_height) return;
+
+  m_width = width;
+  m_height = height;
+  m_shared_width = width;
+  m_shared_height = height;
+
+  // カレントバッファを画面に無い文字で埋め, 次の present で全体を書き直す
+  m_current_buffer.assign(m_width * m_height, '\0');
+  m_back_buffer.assign(m_width * m_height, ' ');
+}
+
 #endif
 
 }  // namespace factory_game
@@ -0,0 +1,281 @@
+#include "draw_list.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace factory_game {
+
+// DRAW LIST RECORDER
+
+DrawListRecorder::DrawListRecorder()
+    : m_bounds{INT_MAX, INT_MAX, INT_MIN, INT_MIN} {}
+
+DrawListRecorder::~DrawListRecorder() = default;
+
+int DrawListRecorder::get_width() { return INT_MAX; }
+
+int DrawListRecorder::get_height() { return INT_MAX; }
+
+void DrawListRecorder::clear() {}
+
+void DrawListRecorder::draw_label(const int x, const int y,
+                                  const std::string_view text) {
+  const int length = static_cast<int>(text.length());
+  push(DRAW_COMMAND_LABEL, x, y, 0, 0, text,
+       DrawRect{x, y, x + std::max(length, 1) - 1, y});
+}
+
+void DrawListRecorder::draw_label_box(const int x, const int y,
+                                      const std::string_view text) {
+  const int length = static_cast<int>(text.length());
+  push(DRAW_COMMAND_LABEL_BOX, x, y, 0, 0, text,
+       DrawRect{x - 1, y - 1, x + length, y + 1});
+}
+
+void DrawListRecorder::draw_clear_box(const int x, const int y,
+                                      const int width, const int height) {
+  push(DRAW_COMMAND_CLEAR_BOX, x, y, width, height, {},
+       DrawRect{x, y, x + width - 1, y + height - 1});
+}
+
+void DrawListRecorder::draw_line_box(const int x, const int y,
+                                     const int width, const int height) {
+  push(DRAW_COMMAND_LINE_BOX, x, y, width, height, {},
+       DrawRect{x, y, x + width - 1, y + height - 1});
+}
+
+void DrawListRecorder::draw_hv_line(const int x0, const int y0, const int x1,
+                                    const int y1) {
+  push(DRAW_COMMAND_HV_LINE, x0, y0, x1, y1, {},
+       DrawRect{std::min(x0, x1), std::min(y0, y1), std::max(x0, x1),
+                std::max(y0, y1)});
+}
+
+void DrawListRecorder::present() {}
+
+void DrawListRecorder::capture_input() {}
+
+bool DrawListRecorder::handle_input_keycode(int) { return false; }
+
+bool DrawListRecorder::handle_input_mouse(int, int&, int&) { return false; }
+
+bool DrawListRecorder::handle_input_drag(int&, int&) { return false; }
+
+bool DrawListRecorder::handle_input_hover(int&, int&) { return false; }
+
+void DrawListRecorder::reset() {
+  m_commands.clear();
+  m_text.clear();
+  m_bounds = DrawRect{INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+}
+
+bool DrawListRecorder::is_empty() const { return m_commands.empty(); }
+
+const std::vector<DrawCommand>& DrawListRecorder::get_commands() const {
+  return m_commands;
+}
+
+std::string_view DrawListRecorder::get_text() const { return m_text; }
+
+DrawRect DrawListRecorder::get_bounds() const { return m_bounds; }
+
+void DrawListRecorder::push(const DrawCommandKind kind, const int x0,
+                            const int y0, const int x1, const int y1,
+                            const std::string_view label,
+                            const DrawRect bounds) {
+  m_commands.push_back(DrawCommand{kind, x0, y0, x1, y1,
+                                   static_cast<uint32_t>(m_text.size()),
+                                   static_cast<uint32_t>(label.size())});
+  m_text.append(label);
+
+  m_bounds.x0 = std::min(m_bounds.x0, bounds.x0);
+  m_bounds.y0 = std::min(m_bounds.y0, bounds.y0);
+  m_bounds.x1 = std::max(m_bounds.x1, bounds.x1);
+  m_bounds.y1 = std::max(m_bounds.y1, bounds.y1);
+}
+
+// DRAW TILE
+
+DrawTile::DrawTile(const allocator_type& allocator)
+    : entries(allocator), commands(allocator), text(allocator) {}
+
+DrawTile::DrawTile(DrawTile&& other, const allocator_type& allocator)
+    : entries(std::move(other.entries), allocator),
+      commands(std::move(other.commands), allocator),
+      text(std::move(other.text), allocator) {}
+
+// 後ろの命令を詰め, 文字列は残っている命令の分だけで作り直す
+static void erase_entry(DrawTile& tile, const void* key) {
+  const auto it =
+      std::find_if(tile.entries.begin(), tile.entries.end(),
+                   [&](const DrawEntry& entry) { return entry.key == key; });
+  if (it == tile.entries.end()) return;
+
+  const auto entry = *it;
+  tile.commands.erase(
+      tile.commands.begin() + entry.command_begin,
+      tile.commands.begin() + entry.command_begin + entry.command_count);
+  for (auto other = tile.entries.erase(it); other != tile.entries.end();
+       ++other) {
+    other->command_begin -= entry.command_count;
+  }
+
+  std::pmr::string text(tile.text.get_allocator());
+  for (auto& command : tile.commands) {
+    const auto begin = static_cast<uint32_t>(text.size());
+    text.append(tile.text, command.text_begin, command.text_length);
+    command.text_begin = begin;
+  }
+  tile.text.swap(text);
+}
+
+// RETAINED DRAW LIST
+
+static int floor_div(const int value, const int divisor) {
+  return value >= 0 ? value / divisor : (value - divisor + 1) / divisor;
+}
+
+static int64_t get_tile_key(const int tile_x, const int tile_y) {
+  return static_cast<int64_t>(
+      (static_cast<uint64_t>(static_cast<uint32_t>(tile_x)) << 32) |
+      static_cast<uint32_t>(tile_y));
+}
+
+// bounds が掛かるタイルの範囲
+static DrawRect get_tile_range(const DrawRect& bounds) {
+  return DrawRect{floor_div(bounds.x0, DRAW_TILE_WIDTH),
+                  floor_div(bounds.y0, DRAW_TILE_HEIGHT),
+                  floor_div(bounds.x1, DRAW_TILE_WIDTH),
+                  floor_div(bounds.y1, DRAW_TILE_HEIGHT)};
+}
+
+RetainedDrawList::RetainedDrawList(std::pmr::memory_resource* resource)
+    : m_tiles(resource), m_entity_tiles(resource) {}
+
+RetainedDrawList::~RetainedDrawList() = default;
+
+void RetainedDrawList::set(
+    const void* key, const std::function<void(DrawManagerBase*)>& draw) {
+  thread_local DrawListRecorder recorder;
+  recorder.reset();
+  draw(&recorder);
+
+  remove(key);
+  if (recorder.is_empty()) return;
+
+  const auto bounds = recorder.get_bounds();
+  const auto range = get_tile_range(bounds);
+  const auto& commands = recorder.get_commands();
+  for (int tile_y = range.y0; tile_y <= range.y1; ++tile_y) {
+    for (int tile_x = range.x0; tile_x <= range.x1; ++tile_x) {
+      auto& tile =
+          m_tiles.try_emplace(get_tile_key(tile_x, tile_y)).first->second;
+      const auto offset = static_cast<uint32_t>(tile.text.size());
+
+      tile.entries.push_back(
+          DrawEntry{key, bounds, static_cast<uint32_t>(tile.commands.size()),
+                    static_cast<uint32_t>(commands.size())});
+      for (const auto& command : commands) {
+        tile.commands.push_back(command);
+        tile.commands.back().text_begin += offset;
+      }
+      tile.text.append(recorder.get_text());
+    }
+  }
+
+  m_entity_tiles.insert_or_assign(key, range);
+}
+
+void RetainedDrawList::remove(const void* key) {
+  const auto it = m_entity_tiles.find(key);
+  if (it == m_entity_tiles.end()) return;
+
+  const auto range = it->second;
+  for (int tile_y = range.y0; tile_y <= range.y1; ++tile_y) {
+    for (int tile_x = range.x0; tile_x <= range.x1; ++tile_x) {
+      const auto tile = m_tiles.find(get_tile_key(tile_x, tile_y));
+      erase_entry(tile->second, key);
+      if (tile->second.entries.empty()) m_tiles.erase(tile);
+    }
+  }
+  m_entity_tiles.erase(it);
+}
+
+void RetainedDrawList::clear() {
+  m_tiles.clear();
+  m_entity_tiles.clear();
+}
+
+// 命令はワールド座標で持っているので, 画面座標へずらした写しを渡す
+static void translate_commands(const DrawCommand* commands, const size_t count,
+                               const int dx, const int dy,
+                               std::vector<DrawCommand>& result) {
+  result.assign(commands, commands + count);
+  if (dx == 0 && dy == 0) return;
+
+  for (auto& command : result) {
+    if (command.kind == DRAW_COMMAND_CLEAR) continue;
+
+    command.x0 += dx;
+    command.y0 += dy;
+    // 箱の x1, y1 は幅と高さ
+    if (command.kind == DRAW_COMMAND_HV_LINE) {
+      command.x1 += dx;
+      command.y1 += dy;
+    }
+  }
+}
+
+// 表示範囲内の連続したエンティティの命令はまとめて 1 回で渡す
+// 複数のタイルに掛かるエンティティは, 辿るタイルのうち最初に出会うもので描く
+void RetainedDrawList::draw(DrawManagerBase* draw_manager, const int origin_x,
+                            const int origin_y) const {
+  const auto clip =
+      DrawRect{origin_x, origin_y, origin_x + draw_manager->get_width() - 1,
+               origin_y + draw_manager->get_height() - 1};
+  const auto clip_range = get_tile_range(clip);
+
+  thread_local std::vector<DrawCommand> translated;
+  const auto draw_tile = [&](const DrawTile& tile, const int tile_x,
+                             const int tile_y) {
+    uint32_t begin = 0, end = 0;
+    const auto flush = [&] {
+      if (end == begin) return;
+      translate_commands(tile.commands.data() + begin, end - begin, -origin_x,
+                         -origin_y, translated);
+      draw_manager->draw_commands(translated.data(), translated.size(),
+                                  tile.text);
+    };
+
+    for (const auto& entry : tile.entries) {
+      if (!entry.bounds.intersects(clip)) continue;
+
+      const auto range = get_tile_range(entry.bounds);
+      if (std::max(range.x0, clip_range.x0) != tile_x ||
+          std::max(range.y0, clip_range.y0) != tile_y) {
+        continue;
+      }
+
+      if (entry.command_begin != end) {
+        flush();
+        begin = entry.command_begin;
+      }
+      end = entry.command_begin + entry.command_count;
+    }
+    flush();
+  };
+
+  for (int tile_y = clip_range.y0; tile_y <= clip_range.y1; ++tile_y) {
+    for (int tile_x = clip_range.x0; tile_x <= clip_range.x1; ++tile_x) {
+      const auto it = m_tiles.find(get_tile_key(tile_x, tile_y));
+      if (it != m_tiles.end()) draw_tile(it->second, tile_x, tile_y);
+    }
+  }
+}
+
+void RetainedDrawList::write_footprint(
+    const char* name, std::vector<FootprintEntry>& entries) const {
+  entries.push_back(make_footprint_entry(name, MEMORY_DRAW_LIST, m_tiles));
+}
+
+}  // namespace factory_game
@@ -0,0 +1,1323 @@
+#include "evaluate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace factory_game {
+
+// EVALUATOR
+
+static bool slot_can_accept(const EvaluateSlot& slot, const Item item) {
+  return slot.count == 0 ||
+         (slot.item == item && slot.count < EVALUATE_SLOT_CAPACITY);
+}
+
+static void slot_push(EvaluateSlot& slot, const Item item) {
+  slot.item = item;
+  slot.count++;
+}
+
+struct EvaluateRoute {
+  int src_slot;
+  int dst_slot;
+  int length;
+};
+
+Evaluator::Evaluator(const std::vector<std::shared_ptr<Machine>>& machines,
+                     const std::vector<std::shared_ptr<Pipe>>& pipes,
+                     StageArena* arena)
+    : m_tick(0),
+      m_trace(nullptr),
+      m_trace_last(get_resource(arena, MEMORY_EVALUATE)),
+      m_trace_marked(get_resource(arena, MEMORY_EVALUATE)),
+      m_trace_dirty(get_resource(arena, MEMORY_EVALUATE)),
+      m_slots(get_resource(arena, MEMORY_EVALUATE)),
+      m_slot_nodes(get_resource(arena, MEMORY_EVALUATE)),
+      m_nodes(get_resource(arena, MEMORY_EVALUATE)),
+      m_links(get_resource(arena, MEMORY_EVALUATE)),
+      m_output_nodes(get_resource(arena, MEMORY_EVALUATE)),
+      m_produced(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_networks(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_junctions(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_ports(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_volume(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_capacity(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_pressure(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_scratch(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_prev_weight(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_next_weight(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_inverse_diagonal(get_resource(arena, MEMORY_EVALUATE)),
+      m_fluid_inverse_conductance(get_resource(arena, MEMORY_EVALUATE)) {
+  // 乱数の消費順を固定するため座標順に並べる
+  auto sorted_machines = machines;
+  std::sort(sorted_machines.begin(), sorted_machines.end(),
+            [](const auto& a, const auto& b) {
+              if (a->m_point.y != b->m_point.y)
+                return a->m_point.y < b->m_point.y;
+              if (a->m_point.x != b->m_point.x)
+                return a->m_point.x < b->m_point.x;
+              return a->get_type() < b->get_type();
+            });
+
+  std::unordered_map<glm::ivec2, EvaluatePort> ports;
+  std::vector<glm::ivec2> output_points;
+
+  for (const auto& machine : sorted_machines) {
+    MachinePorts machine_ports;
+    machine->build_ports(machine_ports);
+
+    EvaluateNode node = {};
+    node.type = machine->get_type();
+    node.point = machine->m_point;
+    node.recipe_begin = static_cast<int>(m_recipes.size());
+    machine->build_recipes(m_recipes);
+    node.recipe_end = static_cast<int>(m_recipes.size());
+    node.active_recipe = -1;
+
+    node.input_begin = static_cast<int>(m_slots.size());
+    for (const auto point : machine_ports.inputs) {
+      ports.insert_or_assign(
+          point, EvaluatePort{static_cast<int>(m_slots.size()), true});
+      m_slots.push_back(EvaluateSlot{ITEM_WATER, 0});
+    }
+    node.input_end = static_cast<int>(m_slots.size());
+
+    node.output_begin = static_cast<int>(m_slots.size());
+    for (const auto point : machine_ports.outputs) {
+      ports.insert_or_assign(
+          point, EvaluatePort{static_cast<int>(m_slots.size()), false});
+      output_points.push_back(point);
+      m_slots.push_back(EvaluateSlot{ITEM_WATER, 0});
+    }
+    node.output_end = static_cast<int>(m_slots.size());
+    m_slot_nodes.resize(m_slots.size(), static_cast<int>(m_nodes.size()));
+
+    if (node.type == MACHINE_OUTPUT_DUCT) {
+      m_output_nodes.push_back(static_cast<int>(m_nodes.size()));
+    }
+    m_nodes.push_back(node);
+  }
+
+  // 網の区間と経路の並びを固定するため, パイプも座標順に辿る
+  std::vector<int> pipe_order(pipes.size());
+  for (size_t i = 0; i < pipe_order.size(); ++i) {
+    pipe_order[i] = static_cast<int>(i);
+  }
+  std::sort(pipe_order.begin(), pipe_order.end(), [&](const int a,
+                                                      const int b) {
+    const auto& pa = *pipes[a];
+    const auto& pb = *pipes[b];
+    if (pa.begin.y != pb.begin.y) return pa.begin.y < pb.begin.y;
+    if (pa.begin.x != pb.begin.x) return pa.begin.x < pb.begin.x;
+    if (pa.end.y != pb.end.y) return pa.end.y < pb.end.y;
+    return pa.end.x < pb.end.x;
+  });
+
+  std::unordered_map<glm::ivec2, std::vector<int>> pipe_ends;
+  for (const int i : pipe_order) {
+    const auto& pipe = *pipes[i];
+    pipe_ends[pipe.begin].push_back(i);
+    if (pipe.end != pipe.begin) pipe_ends[pipe.end].push_back(i);
+  }
+
+  // ポート以外の点で端を共有するパイプを 1 つの網にまとめる
+  std::vector<int> parents(pipes.size());
+  for (size_t i = 0; i < parents.size(); ++i) {
+    parents[i] = static_cast<int>(i);
+  }
+  const auto find_root = [&](int i) {
+    while (parents[i] != i) {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+    return i;
+  };
+  for (const auto& [point, ends] : pipe_ends) {
+    if (ports.count(point) != 0) continue;
+    for (size_t k = 1; k < ends.size(); ++k) {
+      parents[find_root(ends[k])] = find_root(ends[0]);
+    }
+  }
+
+  // 出力ポートが流体しか出さず, 入力ポートもある網を流体の網にする
+  const auto is_fluid_output = [&](const int slot) {
+    const auto& node = m_nodes[m_slot_nodes[slot]];
+    const size_t output = slot - node.output_begin;
+    for (int r = node.recipe_begin; r < node.recipe_end; ++r) {
+      const auto& outputs = m_recipes[r].outputs;
+      if (output < outputs.size() && !is_fluid(outputs[output])) return false;
+    }
+    return true;
+  };
+  std::vector<uint8_t> has_source(pipes.size(), 0);
+  std::vector<uint8_t> has_sink(pipes.size(), 0);
+  std::vector<uint8_t> only_fluid(pipes.size(), 1);
+  for (size_t i = 0; i < pipes.size(); ++i) {
+    const int root = find_root(static_cast<int>(i));
+    for (const auto point : {pipes[i]->begin, pipes[i]->end}) {
+      const auto port = ports.find(point);
+      if (port == ports.end()) continue;
+
+      if (port->second.is_input) {
+        has_sink[root] = 1;
+      } else {
+        has_source[root] = 1;
+        if (!is_fluid_output(port->second.slot)) only_fluid[root] = 0;
+      }
+    }
+  }
+
+  std::vector<uint8_t> fluid_roots(pipes.size(), 0);
+  std::vector<int> network_indices(pipes.size(), -1);
+  std::vector<std::vector<int>> networks;
+  for (const int i : pipe_order) {
+    const int root = find_root(i);
+    if (!has_source[root] || !has_sink[root] || !only_fluid[root]) continue;
+
+    fluid_roots[root] = 1;
+    if (network_indices[root] < 0) {
+      network_indices[root] = static_cast<int>(networks.size());
+      networks.emplace_back();
+    }
+    networks[network_indices[root]].push_back(i);
+  }
+  for (const auto& members : networks) {
+    build_fluid_network(pipes, members, ports);
+  }
+
+  // 残りのパイプの端点同士を辿り、出力ポートから到達できる入力ポートを探す
+  std::vector<EvaluateRoute> routes;
+  for (const auto src_point : output_points) {
+    const int src_slot = ports.at(src_point).slot;
+
+    std::unordered_set<glm::ivec2> visited = {src_point};
+    std::vector<std::pair<glm::ivec2, int>> stack = {{src_point, 0}};
+    while (!stack.empty()) {
+      const auto [point, length] = stack.back();
+      stack.pop_back();
+
+      const auto it = pipe_ends.find(point);
+      if (it == pipe_ends.end()) continue;
+
+      for (const int index : it->second) {
+        if (fluid_roots[find_root(index)]) continue;
+
+        const auto pipe = pipes[index].get();
+        const auto other = pipe->begin == point ? pipe->end : pipe->begin;
+        if (!visited.insert(other).second) continue;
+
+        const int other_length = length + pipe->get_length();
+        const auto port = ports.find(other);
+        if (port != ports.end()) {
+          if (port->second.is_input) {
+            routes.push_back(
+                EvaluateRoute{src_slot, port->second.slot, other_length});
+          }
+          continue;
+        }
+        stack.emplace_back(other, other_length);
+      }
+    }
+  }
+
+  // deque のムーブは noexcept でなく, 再確保でコピーされると確保先を失う
+  m_links.reserve(routes.size());
+  for (const auto& route : routes) {
+    m_links.push_back(EvaluateLink{
+        route.src_slot, route.dst_slot, route.length,
+        std::pmr::deque<std::pair<int, Item>>(m_links.get_allocator())});
+  }
+}
+
+Evaluator::~Evaluator() = default;
+
+int Evaluator::get_tick() const { return m_tick; }
+
+void Evaluator::set_trace(TraceBuffer* trace) {
+  m_trace = trace;
+  m_trace_last.assign(m_nodes.size(),
+                      TraceRecord{0, 0, 0, 0, UINT32_MAX, 0});
+  m_trace_marked.assign(m_nodes.size(), 0);
+  m_trace_dirty.clear();
+
+  // 最初の tick は全ての機械を記録する
+  for (size_t i = 0; i < m_nodes.size(); ++i) mark_trace(static_cast<int>(i));
+}
+
+void Evaluator::step(std::default_random_engine& rng) {
+  // 到着したアイテムを入力ポートへ
+  for (auto& link : m_links) {
+    while (!link.transit.empty() && link.transit.front().first <= m_tick) {
+      auto& slot = m_slots[link.dst_slot];
+      if (!slot_can_accept(slot, link.transit.front().second)) break;
+
+      slot_push(slot, link.transit.front().second);
+      link.transit.pop_front();
+      mark_trace(m_slot_nodes[link.dst_slot]);
+    }
+  }
+  drain_fluids();
+
+  // 機械の稼働
+  for (int index = 0; index < static_cast<int>(m_nodes.size()); ++index) {
+    auto& node = m_nodes[index];
+    if (node.active_recipe >= 0 && --node.timer <= 0) {
+      const auto& recipe = m_recipes[node.active_recipe];
+
+      bool can_output = true;
+      for (size_t i = 0; i < recipe.outputs.size(); ++i) {
+        can_output &= slot_can_accept(m_slots[node.output_begin + i],
+                                      recipe.outputs[i]);
+      }
+
+      if (can_output) {
+        for (size_t i = 0; i < recipe.outputs.size(); ++i) {
+          slot_push(m_slots[node.output_begin + i], recipe.outputs[i]);
+          if (node.type == MACHINE_INPUT_DUCT) continue;
+          if (m_produced.size() <= static_cast<size_t>(recipe.outputs[i]))
+            m_produced.resize(recipe.outputs[i] + 1, 0);
+          m_produced[recipe.outputs[i]]++;
+        }
+        node.active_recipe = -1;
+        node.count++;
+        mark_trace(index);
+      }
+    }
+
+    if (node.active_recipe >= 0) continue;
+
+    for (int r = node.recipe_begin; r < node.recipe_end; ++r) {
+      const auto& recipe = m_recipes[r];
+      if (static_cast<int>(recipe.inputs.size()) >
+              node.input_end - node.input_begin ||
+          static_cast<int>(recipe.outputs.size()) >
+              node.output_end - node.output_begin)
+        continue;
+
+      bool can_input = true;
+      for (size_t i = 0; i < recipe.inputs.size(); ++i) {
+        const auto& slot = m_slots[node.input_begin + i];
+        can_input &= (slot.count > 0 && slot.item == recipe.inputs[i]);
+      }
+      if (!can_input) continue;
+
+      for (size_t i = 0; i < recipe.inputs.size(); ++i) {
+        m_slots[node.input_begin + i].count--;
+      }
+
+      auto jitter = std::uniform_int_distribution(0, recipe.duration / 4);
+      node.active_recipe = r;
+      node.timer = recipe.duration + jitter(rng);
+      mark_trace(index);
+      break;
+    }
+  }
+
+  // 出力ポートからパイプへ, 1 tick に 1 個ずつ
+  for (auto& link : m_links) {
+    auto& slot = m_slots[link.src_slot];
+    if (slot.count == 0) continue;
+    if (static_cast<int>(link.transit.size()) >= link.length) continue;
+    if (!link.transit.empty() &&
+        link.transit.back().first >= m_tick + link.length)
+      continue;
+
+    slot.count--;
+    link.transit.emplace_back(m_tick + link.length, slot.item);
+    mark_trace(m_slot_nodes[link.src_slot]);
+  }
+  fill_fluids();
+
+  // 出入りがあったか, まだ流れている網だけを解く
+  for (auto& network : m_fluid_networks) {
+    if (!network.settled) solve_fluid(network);
+  }
+
+  if (m_trace != nullptr) trace();
+
+  m_tick++;
+}
+
+// 値が変わった機械だけを記録する, 読み出し側は直前の値を引き継ぐ
+void Evaluator::trace() {
+  for (const int i : m_trace_dirty) {
+    m_trace_marked[i] = 0;
+    const auto& node = m_nodes[i];
+
+    int fill = 0;
+    for (int slot = node.input_begin; slot < node.output_end; ++slot) {
+      fill += m_slots[slot].count;
+    }
+
+    auto& last = m_trace_last[i];
+    const uint8_t busy = node.active_recipe >= 0;
+    if (last.fill == fill && last.busy == busy &&
+        last.delivered == static_cast<uint32_t>(node.count))
+      continue;
+
+    last.fill = static_cast<uint16_t>(fill);
+    last.busy = busy;
+    last.delivered = node.count;
+    m_trace->record(m_tick, static_cast<uint32_t>(i), last.fill, busy,
+                    last.delivered);
+  }
+  m_trace_dirty.clear();
+}
+
+void Evaluator::write_stats(EvaluateContext* stats) const {
+  stats->items.clear();
+  stats->counts.clear();
+
+  for (const int index : m_output_nodes) {
+    const auto& node = m_nodes[index];
+    stats->items.push_back(m_recipes[node.recipe_begin].inputs[0]);
+    stats->counts.push_back(node.count);
+  }
+}
+
+void Evaluator::write_rates(std::pmr::vector<EvaluateRate>& rates) const {
+  const float seconds =
+      static_cast<float>(std::max(m_tick, 1)) / EVALUATE_TICKS_PER_SECOND;
+
+  for (const int index : m_output_nodes) {
+    const auto& node = m_nodes[index];
+    rates.push_back(EvaluateRate{node.point,
+                                 m_recipes[node.recipe_begin].inputs[0],
+                                 static_cast<float>(node.count) / seconds});
+  }
+}
+
+void Evaluator::write_produced(std::vector<int>& counts) const {
+  counts.assign(m_produced.begin(), m_produced.end());
+}
+
+// FLUID
+
+// 区間を 1 つ足す, パイプの外の番兵と詰め物は容量 1 で中身を持たない
+static void push_fluid_segment(std::pmr::vector<float>& volume,
+                               std::pmr::vector<float>& capacity,
+                               std::pmr::vector<float>& pressure,
+                               std::pmr::vector<float>& prev_weight,
+                               std::pmr::vector<float>& next_weight,
+                               const float segment_capacity,
+                               const float segment_prev_weight,
+                               const float segment_next_weight) {
+  volume.push_back(0.0f);
+  capacity.push_back(segment_capacity);
+  pressure.push_back(0.0f);
+  prev_weight.push_back(segment_prev_weight);
+  next_weight.push_back(segment_next_weight);
+}
+
+void Evaluator::build_fluid_network(
+    const std::vector<std::shared_ptr<Pipe>>& pipes,
+    const std::vector<int>& members,
+    const std::unordered_map<glm::ivec2, EvaluatePort>& ports) {
+  const auto push_segment = [&](const float capacity, const float prev_weight,
+                                const float next_weight) {
+    push_fluid_segment(m_fluid_volume, m_fluid_capacity, m_fluid_pressure,
+                       m_fluid_prev_weight, m_fluid_next_weight, capacity,
+                       prev_weight, next_weight);
+  };
+  if (m_fluid_volume.empty()) push_segment(1.0f, 0.0f, 0.0f);
+
+  EvaluateFluidNetwork network = {};
+  network.segment_begin = static_cast<int>(m_fluid_volume.size());
+  network.item = -1;
+  network.settled = true;
+
+  // 端点ごとに, そこに端を持つ区間を現れた順に集める
+  std::vector<std::pair<glm::ivec2, std::vector<int>>> ends;
+  std::unordered_map<glm::ivec2, int> end_indices;
+  const auto add_end = [&](const glm::ivec2 point, const int segment) {
+    const auto [it, inserted] =
+        end_indices.try_emplace(point, static_cast<int>(ends.size()));
+    if (inserted) ends.emplace_back(point, std::vector<int>());
+    ends[it->second].second.push_back(segment);
+  };
+
+  for (const int index : members) {
+    const auto& pipe = *pipes[index];
+    const int length = pipe.get_length();
+    const int count = (length + FLUID_SEGMENT_CELLS - 1) / FLUID_SEGMENT_CELLS;
+
+    const int first = static_cast<int>(m_fluid_volume.size());
+    for (int k = 0; k < count; ++k) {
+      const int cells =
+          std::min(FLUID_SEGMENT_CELLS, length - k * FLUID_SEGMENT_CELLS);
+      push_segment(cells * FLUID_CELL_VOLUME,
+                   k > 0 ? FLUID_CONDUCTANCE : 0.0f,
+                   k + 1 < count ? FLUID_CONDUCTANCE : 0.0f);
+    }
+    network.capacity += length * FLUID_CELL_VOLUME;
+
+    add_end(pipe.begin, first);
+    if (pipe.end != pipe.begin) add_end(pipe.end, first + count - 1);
+  }
+
+  while ((m_fluid_volume.size() - network.segment_begin) % FLUID_LANES != 0) {
+    push_segment(1.0f, 0.0f, 0.0f);
+  }
+  network.segment_end = static_cast<int>(m_fluid_volume.size());
+  push_segment(1.0f, 0.0f, 0.0f);
+
+  // ポートの点は出入り口, それ以外の点は端の区間同士を繋ぐ
+  std::vector<EvaluateFluidPort> sinks;
+  network.junction_begin = static_cast<int>(m_fluid_junctions.size());
+  network.source_begin = static_cast<int>(m_fluid_ports.size());
+  for (const auto& [point, segments] : ends) {
+    const auto port = ports.find(point);
+    if (port != ports.end()) {
+      for (const int segment : segments) {
+        const auto fluid_port =
+            EvaluateFluidPort{port->second.slot, segment, 0.0f};
+        if (port->second.is_input)
+          sinks.push_back(fluid_port);
+        else
+          m_fluid_ports.push_back(fluid_port);
+      }
+      continue;
+    }
+
+    for (size_t a = 0; a < segments.size(); ++a) {
+      for (size_t b = a + 1; b < segments.size(); ++b) {
+        m_fluid_junctions.push_back(
+            EvaluateFluidJunction{segments[a], segments[b]});
+      }
+    }
+  }
+  network.junction_end = static_cast<int>(m_fluid_junctions.size());
+  network.source_end = static_cast<int>(m_fluid_ports.size());
+  network.sink_begin = network.source_end;
+  m_fluid_ports.insert(m_fluid_ports.end(), sinks.begin(), sinks.end());
+  network.sink_end = static_cast<int>(m_fluid_ports.size());
+
+  // 繋がる区間への流れやすさの和と, 陰的な式の対角 (容量を足したもの) の逆数
+  // 何にも繋がらない区間は流れないので 0
+  m_fluid_inverse_diagonal.resize(m_fluid_volume.size(), 1.0f);
+  m_fluid_inverse_conductance.resize(m_fluid_volume.size(), 0.0f);
+  m_fluid_scratch.resize(m_fluid_volume.size(), 0.0f);
+  std::vector<float> conductance(m_fluid_volume.size() -
+                                 network.segment_begin);
+  for (int i = network.segment_begin; i < network.segment_end; ++i) {
+    conductance[i - network.segment_begin] =
+        m_fluid_prev_weight[i] + m_fluid_next_weight[i];
+  }
+  for (int j = network.junction_begin; j < network.junction_end; ++j) {
+    conductance[m_fluid_junctions[j].a - network.segment_begin] +=
+        FLUID_CONDUCTANCE;
+    conductance[m_fluid_junctions[j].b - network.segment_begin] +=
+        FLUID_CONDUCTANCE;
+  }
+  for (int i = network.segment_begin; i < network.segment_end; ++i) {
+    const float sum = conductance[i - network.segment_begin];
+    m_fluid_inverse_diagonal[i] = 1.0f / (m_fluid_capacity[i] + sum);
+    m_fluid_inverse_conductance[i] = sum > 0.0f ? 1.0f / sum : 0.0f;
+  }
+
+  m_fluid_networks.push_back(network);
+}
+
+// 以下の計算は区間の配列を FLUID_LANES 個ずつ回す
+// 回数が定数の内側のループはコンパイラが SIMD 命令にまとめる
+// count は FLUID_LANES の倍数, 前後の要素は番兵
+
+// 同じパイプの隣の区間から, 前回の圧力で流れ込む分を足す
+static void fluid_gather(const float* __restrict volume,
+                         const float* __restrict pressure,
+                         const float* __restrict prev_weight,
+                         const float* __restrict next_weight,
+                         float* __restrict out, const int count) {
+  for (int i = 0; i < count; i += FLUID_LANES) {
+    for (int lane = 0; lane < FLUID_LANES; ++lane) {
+      const int k = i + lane;
+      out[k] = volume[k] + prev_weight[k] * pressure[k - 1] +
+               next_weight[k] * pressure[k + 1];
+    }
+  }
+}
+
+// 空の区間へ広がる圧力の裾は非正規化数になって遅いので 0 に落とす
+static constexpr float FLUID_PRESSURE_FLOOR = 1e-20f;
+
+// 新しい圧力を書き, 前回との差の最大を返す
+static float fluid_scale(const float* __restrict inverse_diagonal,
+                         const float* __restrict out,
+                         float* __restrict pressure, const int count) {
+  float lane_max[FLUID_LANES] = {};
+  for (int i = 0; i < count; i += FLUID_LANES) {
+    for (int lane = 0; lane < FLUID_LANES; ++lane) {
+      const int k = i + lane;
+      const float scaled = out[k] * inverse_diagonal[k];
+      const float value = scaled < FLUID_PRESSURE_FLOOR ? 0.0f : scaled;
+      lane_max[lane] = std::max(lane_max[lane], std::abs(value - pressure[k]));
+      pressure[k] = value;
+    }
+  }
+  return *std::max_element(lane_max, lane_max + FLUID_LANES);
+}
+
+// 1 本の流れやすさあたりに出せる量, 区間から出る流れは
+// 流れやすさ × この値までに抑えるので, 合計しても中身を超えない
+static void fluid_share(const float* __restrict volume,
+                        const float* __restrict inverse_conductance,
+                        float* __restrict out, const int count) {
+  for (int i = 0; i < count; i += FLUID_LANES) {
+    for (int lane = 0; lane < FLUID_LANES; ++lane) {
+      const int k = i + lane;
+      out[k] = std::max(volume[k], 0.0f) * inverse_conductance[k];
+    }
+  }
+}
+
+// 同じパイプの隣の区間との間を流し, 流れた量の最大を change に混ぜる
+// 流れは出ていく側の区間の share で抑え, 両側で同じ量が増減する
+static void fluid_flow(const float* __restrict pressure,
+                       const float* __restrict prev_weight,
+                       const float* __restrict next_weight,
+                       const float* __restrict share,
+                       float* __restrict volume, const int count,
+                       float* total, float* change) {
+  float lane_max[FLUID_LANES] = {};
+  float lane_sum[FLUID_LANES] = {};
+  for (int i = 0; i < count; i += FLUID_LANES) {
+    for (int lane = 0; lane < FLUID_LANES; ++lane) {
+      const int k = i + lane;
+      const float from_prev = std::clamp(
+          prev_weight[k] * (pressure[k - 1] - pressure[k]),
+          -prev_weight[k] * share[k], prev_weight[k] * share[k - 1]);
+      const float from_next = std::clamp(
+          next_weight[k] * (pressure[k + 1] - pressure[k]),
+          -next_weight[k] * share[k], next_weight[k] * share[k + 1]);
+      const float delta = from_prev + from_next;
+      volume[k] += delta;
+      lane_max[lane] = std::max(lane_max[lane], std::abs(delta));
+      lane_sum[lane] += volume[k];
+    }
+  }
+
+  *total = 0.0f;
+  for (const float sum : lane_sum) *total += sum;
+  *change = std::max(*change,
+                     *std::max_element(lane_max, lane_max + FLUID_LANES));
+}
+
+void Evaluator::solve_fluid(EvaluateFluidNetwork& network) {
+  const int begin = network.segment_begin;
+  const int count = network.segment_end - begin;
+  float* volume = m_fluid_volume.data();
+  float* pressure = m_fluid_pressure.data();
+  float* out = m_fluid_scratch.data();
+
+  // c p' = v + Σ g (p'_j - p') を, 前の tick の圧力から反復して解く
+  for (int iteration = 0; iteration < FLUID_ITERATIONS; ++iteration) {
+    fluid_gather(volume + begin, pressure + begin,
+                 m_fluid_prev_weight.data() + begin,
+                 m_fluid_next_weight.data() + begin, out + begin, count);
+    for (int j = network.junction_begin; j < network.junction_end; ++j) {
+      const auto& junction = m_fluid_junctions[j];
+      out[junction.a] += FLUID_CONDUCTANCE * pressure[junction.b];
+      out[junction.b] += FLUID_CONDUCTANCE * pressure[junction.a];
+    }
+
+    const float residual =
+        fluid_scale(m_fluid_inverse_diagonal.data() + begin, out + begin,
+                    pressure + begin, count);
+    if (residual < FLUID_TOLERANCE) break;
+  }
+
+  // 解いた圧力の差で流す, 区間の間の流れは向きが逆で同じ量なので総量は保たれる
+  // 収束していれば抑える前に中身の範囲に収まるので, 抑えるのは反復の途中だけ
+  fluid_share(volume + begin, m_fluid_inverse_conductance.data() + begin,
+              out + begin, count);
+  float change = 0.0f;
+  for (int j = network.junction_begin; j < network.junction_end; ++j) {
+    const auto& junction = m_fluid_junctions[j];
+    const float flow = std::clamp(
+        FLUID_CONDUCTANCE * (pressure[junction.a] - pressure[junction.b]),
+        -FLUID_CONDUCTANCE * out[junction.b],
+        FLUID_CONDUCTANCE * out[junction.a]);
+    volume[junction.a] -= flow;
+    volume[junction.b] += flow;
+    change = std::max(change, std::abs(flow));
+  }
+  fluid_flow(pressure + begin, m_fluid_prev_weight.data() + begin,
+             m_fluid_next_weight.data() + begin, out + begin, volume + begin,
+             count, &network.volume, &change);
+  network.settled = change < FLUID_TOLERANCE;
+}
+
+// 入力ポートは 1 tick に 1 個分まで区間から吸い出し, 1 個分溜まったら受け取る
+void Evaluator::drain_fluids() {
+  for (auto& network : m_fluid_networks) {
+    if (network.item < 0) continue;
+
+    for (int i = network.sink_begin; i < network.sink_end; ++i) {
+      auto& port = m_fluid_ports[i];
+      auto& volume = m_fluid_volume[port.segment];
+      const float drawn = std::min(volume, FLUID_CELL_VOLUME - port.pending);
+      if (drawn > 0.0f) {
+        volume -= drawn;
+        network.volume -= drawn;
+        port.pending += drawn;
+        network.settled = false;
+      }
+    }
+
+    // 1 個に届かない残りは入力ポートが吸い切り, 別の流体を通せるようにする
+    // 網の中の量は 1 個分の整数倍なので, 先頭のポートから 1 個分ずつ
+    // 詰め直せば全て受け取れる, 入力ポートが無ければ残りは丸めの誤差だけ
+    const bool is_swept = network.volume < FLUID_CELL_VOLUME / 2;
+    if (is_swept) {
+      float rest = 0.0f;
+      for (int i = network.segment_begin; i < network.segment_end; ++i) {
+        rest += m_fluid_volume[i];
+      }
+      std::fill(m_fluid_volume.begin() + network.segment_begin,
+                m_fluid_volume.begin() + network.segment_end, 0.0f);
+      std::fill(m_fluid_pressure.begin() + network.segment_begin,
+                m_fluid_pressure.begin() + network.segment_end, 0.0f);
+      for (int i = network.sink_begin; i < network.sink_end; ++i) {
+        rest += m_fluid_ports[i].pending;
+      }
+      for (int i = network.sink_begin; i < network.sink_end; ++i) {
+        auto& pending = m_fluid_ports[i].pending;
+        pending = i + 1 < network.sink_end ? std::min(rest, FLUID_CELL_VOLUME)
+                                           : rest;
+        rest -= pending;
+      }
+      network.volume = 0.0f;
+      network.settled = true;
+    }
+
+    const auto item = static_cast<Item>(network.item);
+    for (int i = network.sink_begin; i < network.sink_end; ++i) {
+      auto& port = m_fluid_ports[i];
+      auto& slot = m_slots[port.slot];
+      if (port.pending < FLUID_CELL_VOLUME - FLUID_TOLERANCE) continue;
+      if (!slot_can_accept(slot, item)) continue;
+
+      // 誤差の分は次の 1 個へ持ち越す
+      port.pending -= FLUID_CELL_VOLUME;
+      network.delivered++;
+      slot_push(slot, item);
+      mark_trace(m_slot_nodes[port.slot]);
+    }
+
+    // 受け取り待ちの量が丸めの誤差だけになるまで流体を変えない
+    if (!is_swept) continue;
+    bool is_holding = false;
+    for (int i = network.sink_begin; i < network.sink_end; ++i) {
+      is_holding |= std::abs(m_fluid_ports[i].pending) >= FLUID_TOLERANCE;
+    }
+    if (is_holding) continue;
+    for (int i = network.sink_begin; i < network.sink_end; ++i) {
+      m_fluid_ports[i].pending = 0.0f;
+    }
+    network.item = -1;
+  }
+}
+
+// 出力ポートは区間が満ちていなければ 1 tick に 1 個流し込む
+// 網の中の流体と違うものは流し込めない
+void Evaluator::fill_fluids() {
+  for (auto& network : m_fluid_networks) {
+    for (int i = network.source_begin; i < network.source_end; ++i) {
+      const auto& port = m_fluid_ports[i];
+      auto& slot = m_slots[port.slot];
+      if (slot.count == 0) continue;
+      if (network.item >= 0 && network.item != slot.item) continue;
+      if (m_fluid_volume[port.segment] >= m_fluid_capacity[port.segment])
+        continue;
+
+      slot.count--;
+      m_fluid_volume[port.segment] += FLUID_CELL_VOLUME;
+      network.volume += FLUID_CELL_VOLUME;
+      network.injected++;
+      network.item = slot.item;
+      network.settled = false;
+      mark_trace(m_slot_nodes[port.slot]);
+    }
+  }
+}
+
+void Evaluator::write_fluids(std::vector<EvaluateFluid>& fluids) const {
+  const float seconds =
+      static_cast<float>(std::max(m_tick, 1)) / EVALUATE_TICKS_PER_SECOND;
+
+  for (const auto& network : m_fluid_networks) {
+    fluids.push_back(EvaluateFluid{
+        network.item, network.capacity,
+        network.capacity > 0.0f ? network.volume / network.capacity : 0.0f,
+        static_cast<float>(network.delivered) / seconds});
+  }
+}
+
+void Evaluator::write_fluid_balance(EvaluateFluidBalance* balance) const {
+  *balance = EvaluateFluidBalance{};
+  for (const auto& network : m_fluid_networks) {
+    balance->injected += network.injected;
+    balance->delivered += network.delivered;
+    for (int i = network.segment_begin; i < network.segment_end; ++i) {
+      balance->stored += m_fluid_volume[i];
+    }
+    for (int i = network.sink_begin; i < network.sink_end; ++i) {
+      balance->pending += m_fluid_ports[i].pending;
+    }
+  }
+}
+
+// EVALUATE SCORE
+
+EvaluateScore get_evaluate_score(const EvaluateContext& stats) {
+  bool is_perfect = true;
+  bool is_delivered = false;
+  float value = 0.0f;
+  for (const int count : stats.counts) {
+    is_perfect &= (count > 0);
+    is_delivered |= (count > 0);
+    value += static_cast<float>(count);
+  }
+  value *= static_cast<float>(stats.design_time) / 3600.0f;
+
+  if (!is_delivered) return EvaluateScore{value, GRADE_BAD};
+  if (!is_perfect) return EvaluateScore{value, GRADE_GOOD};
+  return EvaluateScore{value, GRADE_PERFECT};
+}
+
+// EVALUATE WORKER
+
+EvaluateWorker::EvaluateWorker() : m_stop(false), m_speed(0), m_progress() {}
+
+EvaluateWorker::~EvaluateWorker() { stop(); }
+
+void EvaluateWorker::start(Evaluator evaluator, const int total_ticks,
+                           const unsigned int seed) {
+  stop();
+
+  m_stop = false;
+  publish(evaluator, total_ticks, false);
+  m_thread = std::thread(&EvaluateWorker::run, this, std::move(evaluator),
+                         total_ticks, seed);
+}
+
+void EvaluateWorker::stop() {
+  m_stop = true;
+  if (m_thread.joinable()) m_thread.join();
+}
+
+void EvaluateWorker::set_speed(const int speed) { m_speed = speed; }
+
+int EvaluateWorker::get_speed() const { return m_speed; }
+
+EvaluateProgress EvaluateWorker::get_progress() const {
+  std::lock_guard lock(m_mutex);
+  return m_progress;
+}
+
+void EvaluateWorker::run(Evaluator evaluator, const int total_ticks,
+                         const unsigned int seed) {
+  using clock = std::chrono::steady_clock;
+
+  // 無制限時に途中経過を公開する間隔
+  constexpr int batch_ticks = 4096;
+
+  auto rng = std::default_random_engine(seed);
+  TraceBuffer* trace = get_trace_sink().acquire_buffer();
+  evaluator.set_trace(trace);
+
+  int speed = m_speed;
+  auto origin_time = clock::now();
+  int origin_tick = 0;
+
+  while (evaluator.get_tick() < total_ticks && !m_stop) {
+    if (speed != m_speed) {
+      speed = m_speed;
+      origin_time = clock::now();
+      origin_tick = evaluator.get_tick();
+    }
+
+    int target_tick;
+    if (speed == 0) {
+      target_tick = std::min(total_ticks, evaluator.get_tick() + batch_ticks);
+    } else {
+      const auto elapsed =
+          std::chrono::duration<double>(clock::now() - origin_time).count();
+      target_tick = std::min(
+          total_ticks,
+          origin_tick + static_cast<int>(elapsed * EVALUATE_TICKS_PER_SECOND *
+                                         speed));
+      if (target_tick <= evaluator.get_tick()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+    }
+
+    while (evaluator.get_tick() < target_tick) evaluator.step(rng);
+    publish(evaluator, total_ticks, false);
+  }
+
+  evaluator.set_trace(nullptr);
+  get_trace_sink().release_buffer(trace);
+
+  publish(evaluator, total_ticks, evaluator.get_tick() >= total_ticks);
+}
+
+void EvaluateWorker::publish(const Evaluator& evaluator, const int total_ticks,
+                             const bool done) {
+  EvaluateContext stats;
+  evaluator.write_stats(&stats);
+
+  std::lock_guard lock(m_mutex);
+  m_progress.tick = evaluator.get_tick();
+  m_progress.total_ticks = total_ticks;
+  m_progress.done = done;
+  m_progress.items = std::move(stats.items);
+  m_progress.counts = std::move(stats.counts);
+}
+
+// EVALUATE CACHE
+
+bool EvaluateKey::operator==(const EvaluateKey& other) const {
+  return hash == other.hash && stage == other.stage && ticks == other.ticks &&
+         seed == other.seed;
+}
+
+size_t EvaluateKeyHash::operator()(const EvaluateKey& key) const {
+  return static_cast<size_t>(
+      key.hash ^ zobrist_key(key.stage, key.ticks, static_cast<int>(key.seed)));
+}
+
+EvaluateCache::Shard::Shard(std::pmr::memory_resource* const resource)
+    : entries(resource), idx(resource) {}
+
+EvaluateCache::EvaluateCache(const size_t capacity)
+    : m_shard_capacity(
+          std::max<size_t>(1, capacity / EVALUATE_CACHE_SHARDS)) {
+  for (int i = 0; i < EVALUATE_CACHE_SHARDS; ++i) {
+    m_shards.push_back(
+        std::make_unique<Shard>(get_heap_resource(MEMORY_CACHE)));
+  }
+}
+
+EvaluateCache::~EvaluateCache() = default;
+
+// シャード内の表は下位のビットで引くので, レイアウトのハッシュの上位で選ぶ
+EvaluateCache::Shard& EvaluateCache::get_shard(const EvaluateKey& key) {
+  return *m_shards[(key.hash >> 32) % EVALUATE_CACHE_SHARDS];
+}
+
+bool EvaluateCache::find(const EvaluateKey& key, EvaluateContext* stats,
+                         std::vector<int>* produced) {
+  auto& shard = get_shard(key);
+  std::lock_guard lock(shard.mutex);
+
+  const auto it = shard.idx.find(key);
+  if (it == shard.idx.end()) return false;
+
+  const auto& value = it->second->second;
+  if (produced != nullptr && !value.has_produced) return false;
+
+  shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+  *stats = value.stats;
+  if (produced != nullptr) *produced = value.produced;
+  return true;
+}
+
+void EvaluateCache::insert(const EvaluateKey& key,
+                           const EvaluateContext& stats,
+                           const std::vector<int>* produced) {
+  auto value = Value{stats, {}, produced != nullptr};
+  if (produced != nullptr) value.produced = *produced;
+
+  auto& shard = get_shard(key);
+  std::lock_guard lock(shard.mutex);
+
+  const auto it = shard.idx.find(key);
+  if (it != shard.idx.end()) {
+    it->second->second = std::move(value);
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return;
+  }
+
+  shard.entries.emplace_front(key, std::move(value));
+  shard.idx.emplace(key, shard.entries.begin());
+
+  if (shard.entries.size() > m_shard_capacity) {
+    shard.idx.erase(shard.entries.back().first);
+    shard.entries.pop_back();
+  }
+}
+
+EvaluateCache& get_evaluate_cache() {
+  static EvaluateCache cache(4096);
+  return cache;
+}
+
+// EVALUATE PREVIEW
+
+EvaluateComponent::EvaluateComponent(const allocator_type& allocator)
+    : machines(allocator), pipes(allocator), dirty(false), rates(allocator) {}
+
+EvaluateComponent::EvaluateComponent(EvaluateComponent&& other,
+                                     const allocator_type& allocator)
+    : machines(std::move(other.machines), allocator),
+      pipes(std::move(other.pipes), allocator),
+      dirty(other.dirty),
+      rates(std::move(other.rates), allocator) {}
+
+EvaluatePreview::EvaluatePreview(StageArena* arena)
+    : m_arena(arena),
+      m_next_id(0),
+      m_components(get_resource(arena, MEMORY_PREVIEW)),
+      m_machine_components(get_resource(arena, MEMORY_PREVIEW)),
+      m_pipe_components(get_resource(arena, MEMORY_PREVIEW)),
+      m_port_idx(get_resource(arena, MEMORY_PREVIEW)),
+      m_pipe_end_idx(get_resource(arena, MEMORY_PREVIEW)),
+      m_pending(get_resource(arena, MEMORY_PREVIEW)),
+      m_evaluator(),
+      m_rng(),
+      m_stale(get_resource(arena, MEMORY_PREVIEW)),
+      m_rates(get_resource(arena, MEMORY_PREVIEW)),
+      m_rate_components(get_resource(arena, MEMORY_PREVIEW)) {}
+
+EvaluatePreview::~EvaluatePreview() = default;
+
+void EvaluatePreview::add_machine(const std::shared_ptr<Machine>& machine) {
+  MachinePorts ports;
+  machine->build_ports(ports);
+
+  // 新しいポートに接するパイプの成分と合流する
+  std::vector<int> ids;
+  for (const auto& points : {ports.inputs, ports.outputs}) {
+    for (const auto point : points) {
+      m_port_idx.insert_or_assign(point, machine);
+
+      const auto it = m_pipe_end_idx.find(point);
+      if (it == m_pipe_end_idx.end()) continue;
+      for (const auto& pipe : it->second) {
+        ids.push_back(m_pipe_components.at(pipe.get()));
+      }
+    }
+  }
+
+  rebuild(ids, {machine}, {});
+}
+
+void EvaluatePreview::remove_machine(const std::shared_ptr<Machine>& machine) {
+  const auto it = m_machine_components.find(machine.get());
+  if (it == m_machine_components.end()) return;
+  const int id = it->second;
+
+  MachinePorts ports;
+  machine->build_ports(ports);
+  for (const auto& points : {ports.inputs, ports.outputs}) {
+    for (const auto point : points) {
+      const auto port = m_port_idx.find(point);
+      if (port != m_port_idx.end() && port->second == machine) {
+        m_port_idx.erase(port);
+      }
+    }
+  }
+
+  auto& machines = m_components.at(id).machines;
+  machines.erase(std::find(machines.begin(), machines.end(), machine));
+  m_machine_components.erase(it);
+
+  rebuild({id}, {}, {});
+}
+
+void EvaluatePreview::add_pipe(const std::shared_ptr<Pipe>& pipe) {
+  // 端点に接する機械とパイプの成分と合流する
+  std::vector<int> ids;
+  for (const auto point : {pipe->begin, pipe->end}) {
+    const auto port = m_port_idx.find(point);
+    if (port != m_port_idx.end()) {
+      ids.push_back(m_machine_components.at(port->second.get()));
+    }
+
+    const auto it = m_pipe_end_idx.find(point);
+    if (it != m_pipe_end_idx.end()) {
+      for (const auto& other : it->second) {
+        ids.push_back(m_pipe_components.at(other.get()));
+      }
+    }
+  }
+
+  m_pipe_end_idx[pipe->begin].push_back(pipe);
+  if (pipe->end != pipe->begin) m_pipe_end_idx[pipe->end].push_back(pipe);
+
+  rebuild(ids, {}, {pipe});
+}
+
+void EvaluatePreview::remove_pipe(const std::shared_ptr<Pipe>& pipe) {
+  const auto it = m_pipe_components.find(pipe.get());
+  if (it == m_pipe_components.end()) return;
+  const int id = it->second;
+
+  for (const auto point : {pipe->begin, pipe->end}) {
+    const auto ends = m_pipe_end_idx.find(point);
+    if (ends == m_pipe_end_idx.end()) continue;
+
+    auto& pipes = ends->second;
+    pipes.erase(std::remove(pipes.begin(), pipes.end(), pipe), pipes.end());
+    if (pipes.empty()) m_pipe_end_idx.erase(ends);
+  }
+
+  auto& pipes = m_components.at(id).pipes;
+  pipes.erase(std::find(pipes.begin(), pipes.end(), pipe));
+  m_pipe_components.erase(it);
+
+  rebuild({id}, {}, {});
+}
+
+void EvaluatePreview::add_entities(
+    const std::vector<std::shared_ptr<Machine>>& machines,
+    const std::vector<std::shared_ptr<Pipe>>& pipes) {
+  // 既存の成分だけを集める, 追加する要素同士は rebuild で繋がる
+  std::vector<int> ids;
+  for (const auto& machine : machines) {
+    MachinePorts ports;
+    machine->build_ports(ports);
+    for (const auto& points : {ports.inputs, ports.outputs}) {
+      for (const auto point : points) {
+        m_port_idx.insert_or_assign(point, machine);
+
+        const auto it = m_pipe_end_idx.find(point);
+        if (it == m_pipe_end_idx.end()) continue;
+        for (const auto& pipe : it->second) {
+          ids.push_back(m_pipe_components.at(pipe.get()));
+        }
+      }
+    }
+  }
+
+  for (const auto& pipe : pipes) {
+    for (const auto point : {pipe->begin, pipe->end}) {
+      const auto port = m_port_idx.find(point);
+      if (port != m_port_idx.end()) {
+        const auto id = m_machine_components.find(port->second.get());
+        if (id != m_machine_components.end()) ids.push_back(id->second);
+      }
+
+      const auto it = m_pipe_end_idx.find(point);
+      if (it == m_pipe_end_idx.end()) continue;
+      for (const auto& other : it->second) {
+        const auto id = m_pipe_components.find(other.get());
+        if (id != m_pipe_components.end()) ids.push_back(id->second);
+      }
+    }
+
+    m_pipe_end_idx[pipe->begin].push_back(pipe);
+    if (pipe->end != pipe->begin) m_pipe_end_idx[pipe->end].push_back(pipe);
+  }
+
+  rebuild(ids, machines, pipes);
+}
+
+// 指定した成分を解体し, 含まれていた要素から連結成分を作り直す
+// 作った成分は評価の待ちに積み, 消した成分の見積もりは次の update で外す
+void EvaluatePreview::rebuild(const std::vector<int>& ids,
+                              std::vector<std::shared_ptr<Machine>> machines,
+                              std::vector<std::shared_ptr<Pipe>> pipes) {
+  for (const int id : ids) {
+    const auto it = m_components.find(id);
+    if (it == m_components.end()) continue;
+
+    if (m_evaluator && m_pending.front() == id) m_evaluator.reset();
+    m_stale.push_back(id);
+
+    for (auto& machine : it->second.machines) {
+      m_machine_components.erase(machine.get());
+      machines.push_back(std::move(machine));
+    }
+    for (auto& pipe : it->second.pipes) {
+      m_pipe_components.erase(pipe.get());
+      pipes.push_back(std::move(pipe));
+    }
+    m_components.erase(it);
+  }
+
+  std::vector<std::shared_ptr<Machine>> machine_stack;
+  std::vector<std::shared_ptr<Pipe>> pipe_stack;
+
+  const auto flood = [&](const int id) {
+    auto& component = m_components[id];
+    component.dirty = true;
+    m_pending.push_back(id);
+
+    while (!machine_stack.empty() || !pipe_stack.empty()) {
+      if (!machine_stack.empty()) {
+        const auto machine = std::move(machine_stack.back());
+        machine_stack.pop_back();
+        if (!m_machine_components.emplace(machine.get(), id).second) continue;
+        component.machines.push_back(machine);
+
+        MachinePorts ports;
+        machine->build_ports(ports);
+        for (const auto& points : {ports.inputs, ports.outputs}) {
+          for (const auto point : points) {
+            const auto it = m_pipe_end_idx.find(point);
+            if (it == m_pipe_end_idx.end()) continue;
+            for (const auto& pipe : it->second) pipe_stack.push_back(pipe);
+          }
+        }
+      } else {
+        const auto pipe = std::move(pipe_stack.back());
+        pipe_stack.pop_back();
+        if (!m_pipe_components.emplace(pipe.get(), id).second) continue;
+        component.pipes.push_back(pipe);
+
+        for (const auto point : {pipe->begin, pipe->end}) {
+          const auto port = m_port_idx.find(point);
+          if (port != m_port_idx.end()) machine_stack.push_back(port->second);
+
+          const auto it = m_pipe_end_idx.find(point);
+          if (it == m_pipe_end_idx.end()) continue;
+          for (const auto& other : it->second) pipe_stack.push_back(other);
+        }
+      }
+    }
+  };
+
+  for (const auto& machine : machines) {
+    if (m_machine_components.count(machine.get())) continue;
+    machine_stack.push_back(machine);
+    flood(m_next_id++);
+  }
+  for (const auto& pipe : pipes) {
+    if (m_pipe_components.count(pipe.get())) continue;
+    pipe_stack.push_back(pipe);
+    flood(m_next_id++);
+  }
+
+}
+
+void EvaluatePreview::clear() {
+  m_next_id = 0;
+  m_components.clear();
+  m_machine_components.clear();
+  m_pipe_components.clear();
+  m_port_idx.clear();
+  m_pipe_end_idx.clear();
+  m_pending.clear();
+  m_evaluator.reset();
+  m_stale.clear();
+  m_rates.clear();
+  m_rate_components.clear();
+}
+
+// 途中の評価は arena の外にも確保しているので, arena ごと捨てる前に呼ぶ
+void EvaluatePreview::stop() { m_evaluator.reset(); }
+
+// 待ちの前から順に, 成分ごとに EVALUATE_PREVIEW_TICKS まで進める
+// 大きな成分は数フレームに分け, 1 フレームに少なくとも 1 tick は進める
+void EvaluatePreview::update() {
+  int64_t work = EVALUATE_PREVIEW_FRAME_WORK;
+  std::vector<int> finished;
+  while (!m_pending.empty() && work > 0) {
+    const int id = m_pending.front();
+    const auto it = m_components.find(id);
+    if (it == m_components.end()) {
+      m_pending.pop_front();
+      continue;
+    }
+
+    auto& component = it->second;
+    const int64_t size = std::max<int64_t>(
+        static_cast<int64_t>(component.machines.size() +
+                             component.pipes.size()),
+        1);
+    if (!m_evaluator) {
+      m_evaluator = std::make_unique<Evaluator>(
+          std::vector<std::shared_ptr<Machine>>(component.machines.begin(),
+                                                component.machines.end()),
+          std::vector<std::shared_ptr<Pipe>>(component.pipes.begin(),
+                                             component.pipes.end()),
+          m_arena);
+      m_rng = std::default_random_engine();
+      work -= size;
+    }
+
+    const int64_t ticks = std::clamp<int64_t>(
+        work / size, 1, EVALUATE_PREVIEW_TICKS - m_evaluator->get_tick());
+    for (int64_t i = 0; i < ticks; ++i) m_evaluator->step(m_rng);
+    work -= ticks * size;
+    if (m_evaluator->get_tick() < EVALUATE_PREVIEW_TICKS) break;
+
+    component.rates.clear();
+    m_evaluator->write_rates(component.rates);
+    component.dirty = false;
+    m_evaluator.reset();
+    m_pending.pop_front();
+    finished.push_back(id);
+  }
+
+  if (!finished.empty() || !m_stale.empty()) publish_rates(finished);
+}
+
+// 消した成分の見積もりを外し, 評価を終えた成分の見積もりを並びを保って混ぜる
+// 全ての成分を並べ直さないので, 編集 1 回あたり見積もりの数に比例する
+void EvaluatePreview::publish_rates(const std::vector<int>& finished) {
+  const auto is_above = [](const EvaluateRate& a, const EvaluateRate& b) {
+    if (a.point.y != b.point.y) return a.point.y < b.point.y;
+    return a.point.x < b.point.x;
+  };
+
+  std::sort(m_stale.begin(), m_stale.end());
+  std::vector<std::pair<EvaluateRate, int>> added;
+  for (const int id : finished) {
+    for (const auto& rate : m_components.at(id).rates) {
+      added.emplace_back(rate, id);
+    }
+  }
+  std::sort(added.begin(), added.end(), [&](const auto& a, const auto& b) {
+    return is_above(a.first, b.first);
+  });
+
+  std::pmr::vector<EvaluateRate> rates(m_rates.get_allocator());
+  std::pmr::vector<int> rate_components(m_rate_components.get_allocator());
+  rates.reserve(m_rates.size() + added.size());
+  rate_components.reserve(m_rates.size() + added.size());
+  auto added_it = added.begin();
+  for (size_t i = 0; i <= m_rates.size(); ++i) {
+    // 今の見積もりより上に来る追加分を先に入れる
+    while (added_it != added.end() &&
+           (i == m_rates.size() || is_above(added_it->first, m_rates[i]))) {
+      rates.push_back(added_it->first);
+      rate_components.push_back(added_it->second);
+      ++added_it;
+    }
+    if (i == m_rates.size()) break;
+    if (std::binary_search(m_stale.begin(), m_stale.end(),
+                           m_rate_components[i]))
+      continue;
+    rates.push_back(m_rates[i]);
+    rate_components.push_back(m_rate_components[i]);
+  }
+
+  m_rates.swap(rates);
+  m_rate_components.swap(rate_components);
+  m_stale.clear();
+}
+
+bool EvaluatePreview::is_ready() const { return m_pending.empty(); }
+
+const std::pmr::vector<EvaluateRate>& EvaluatePreview::get_rates() const {
+  return m_rates;
+}
+
+void EvaluatePreview::write_footprint(
+    std::vector<FootprintEntry>& entries) const {
+  entries.push_back(
+      make_footprint_entry("components", MEMORY_PREVIEW, m_components));
+  entries.push_back(make_footprint_entry("port index", MEMORY_PREVIEW,
+                                         m_port_idx));
+  entries.push_back(make_footprint_entry("pipe ends", MEMORY_PREVIEW,
+                                         m_pipe_end_idx));
+}
+
+}  // namespace factory_game
\ No newline at end of file
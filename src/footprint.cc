@@ -0,0 +1,215 @@
+#include "footprint.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "draw.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace factory_game {
+
+const char* memory_category_to_string(const MemoryCategory category) {
+  switch (category) {
+    case MEMORY_ENTITY:
+      return "entities";
+    case MEMORY_MACHINE_SET:
+      return "machine set";
+    case MEMORY_MACHINE_INDEX:
+      return "machine index";
+    case MEMORY_PIPE_SET:
+      return "pipe set";
+    case MEMORY_PIPE_INDEX:
+      return "pipe index";
+    case MEMORY_DRAW_BUFFER:
+      return "draw buffer";
+    case MEMORY_DRAW_LIST:
+      return "draw list";
+    case MEMORY_OCCUPANCY:
+      return "occupancy";
+    case MEMORY_EVALUATE:
+      return "evaluate";
+    case MEMORY_PREVIEW:
+      return "preview";
+    case MEMORY_CACHE:
+      return "cache";
+    case MEMORY_HISTORY:
+      return "history";
+    default:
+      return "unknown";
+  }
+}
+
+MemoryCounter& get_memory_counter(const MemoryCategory category) {
+  static MemoryCounter counters[MEMORY_CATEGORY_COUNT];
+  return counters[category];
+}
+
+void count_allocation(const MemoryCategory category, const size_t bytes) {
+  auto& counter = get_memory_counter(category);
+  const int64_t current =
+      counter.bytes.fetch_add(static_cast<int64_t>(bytes),
+                              std::memory_order_relaxed) +
+      static_cast<int64_t>(bytes);
+  counter.allocations.fetch_add(1, std::memory_order_relaxed);
+
+  int64_t peak = counter.peak.load(std::memory_order_relaxed);
+  while (peak < current &&
+         !counter.peak.compare_exchange_weak(peak, current,
+                                             std::memory_order_relaxed)) {
+  }
+}
+
+void count_deallocation(const MemoryCategory category, const size_t bytes) {
+  auto& counter = get_memory_counter(category);
+  counter.bytes.fetch_sub(static_cast<int64_t>(bytes),
+                          std::memory_order_relaxed);
+  counter.allocations.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// COUNTING RESOURCE
+
+CountingResource::CountingResource(const MemoryCategory category,
+                                   std::pmr::memory_resource* upstream)
+    : m_category(category), m_upstream(upstream), m_bytes(0), m_blocks(0) {}
+
+void CountingResource::forget() {
+  auto& counter = get_memory_counter(m_category);
+  counter.bytes.fetch_sub(m_bytes.exchange(0), std::memory_order_relaxed);
+  counter.allocations.fetch_sub(m_blocks.exchange(0),
+                                std::memory_order_relaxed);
+}
+
+int64_t CountingResource::get_bytes() const {
+  return m_bytes.load(std::memory_order_relaxed);
+}
+
+void* CountingResource::do_allocate(const size_t bytes,
+                                    const size_t alignment) {
+  void* pointer = m_upstream->allocate(bytes, alignment);
+  m_bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+  m_blocks.fetch_add(1, std::memory_order_relaxed);
+  count_allocation(m_category, bytes);
+  return pointer;
+}
+
+void CountingResource::do_deallocate(void* pointer, const size_t bytes,
+                                     const size_t alignment) {
+  m_bytes.fetch_sub(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+  m_blocks.fetch_sub(1, std::memory_order_relaxed);
+  count_deallocation(m_category, bytes);
+  m_upstream->deallocate(pointer, bytes, alignment);
+}
+
+bool CountingResource::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+std::pmr::memory_resource* get_heap_resource(const MemoryCategory category) {
+  static const auto resources = [] {
+    std::vector<std::unique_ptr<CountingResource>> result;
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+      result.push_back(std::make_unique<CountingResource>(
+          static_cast<MemoryCategory>(i), std::pmr::new_delete_resource()));
+    }
+    return result;
+  }();
+  return resources[category].get();
+}
+
+int64_t get_resident_bytes() {
+#if defined(__linux__)
+  std::ifstream stream("/proc/self/statm");
+  int64_t size, resident;
+  if (stream >> size >> resident) return resident * sysconf(_SC_PAGESIZE);
+#endif
+  return 0;
+}
+
+// REPORT
+
+static std::string format_bytes(const int64_t bytes) {
+  std::ostringstream stream;
+  stream << std::fixed << std::setprecision(1);
+  if (bytes >= (1 << 20))
+    stream << bytes / static_cast<double>(1 << 20) << " MiB";
+  else
+    stream << bytes / 1024.0 << " KiB";
+  return stream.str();
+}
+
+template <typename A, typename B, typename C, typename D>
+static std::string format_row(const A& name, const B& a, const C& b,
+                              const D& c) {
+  std::ostringstream stream;
+  stream << std::left << std::setw(14) << name << std::right << std::setw(12)
+         << a << std::setw(12) << b << std::setw(10) << c;
+  return stream.str();
+}
+
+static std::string format_category_header() {
+  return format_row("category", "bytes", "peak", "blocks");
+}
+
+static std::string format_category(const MemoryCategory category) {
+  const auto& counter = get_memory_counter(category);
+  return format_row(memory_category_to_string(category),
+                    format_bytes(counter.bytes), format_bytes(counter.peak),
+                    counter.allocations.load());
+}
+
+static std::string format_entry_header() {
+  return format_row("container", "size", "buckets", "load");
+}
+
+static std::string format_entry(const FootprintEntry& entry) {
+  std::ostringstream load_factor;
+  load_factor << std::fixed << std::setprecision(2) << entry.load_factor;
+  return format_row(entry.name, entry.size, entry.bucket_count,
+                    load_factor.str());
+}
+
+void write_footprint_report(std::ostream& stream,
+                            const std::vector<FootprintEntry>& entries) {
+  stream << "resident " << format_bytes(get_resident_bytes()) << "\n\n";
+
+  stream << format_category_header() << "\n";
+  for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+    stream << format_category(static_cast<MemoryCategory>(i)) << "\n";
+  }
+
+  stream << "\n" << format_entry_header() << "\n";
+  for (const auto& entry : entries) stream << format_entry(entry) << "\n";
+}
+
+void draw_footprint_overlay(DrawManagerBase* draw_manager,
+                            const std::vector<FootprintEntry>& entries) {
+  const int height =
+      MEMORY_CATEGORY_COUNT + static_cast<int>(entries.size()) + 6;
+  const int x = draw_manager->get_width() - 52;
+  constexpr int y = 4;
+  draw_manager->draw_clear_box(x - 1, y - 1, 50, height);
+  draw_manager->draw_line_box(x - 1, y - 1, 50, height);
+
+  int line = y;
+  draw_manager->draw_label(x, line++,
+                           "resident " + format_bytes(get_resident_bytes()));
+  draw_manager->draw_label(x, line++, format_category_header());
+  for (int i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+    draw_manager->draw_label(x, line++,
+                             format_category(static_cast<MemoryCategory>(i)));
+  }
+
+  line++;
+  draw_manager->draw_label(x, line++, format_entry_header());
+  for (const auto& entry : entries) {
+    draw_manager->draw_label(x, line++, format_entry(entry));
+  }
+}
+
+}  // namespace factory_game
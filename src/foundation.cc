@@ -31,4 +31,37 @@ std::string item_to_string(const Item item) {
   }
 }
 
+bool string_to_item(const std::string_view text, Item* item) {
+  for (int i = ITEM_WATER; i <= ITEM_CHIP; ++i) {
+    if (item_to_string(static_cast<Item>(i)) == text) {
+      *item = static_cast<Item>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool is_fluid(const Item item) {
+  return item == ITEM_WATER || item == ITEM_HYDROGEN || item == ITEM_OXYGEN;
+}
+
+// splitmix64
+static uint64_t mix64(uint64_t value) {
+  value += 0x9e3779b97f4a7c15ull;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+  return value ^ (value >> 31);
+}
+
+// 座標が無制限なので表引きではなく要素から直接キーを生成する
+uint64_t zobrist_key(const uint64_t kind, const int x0, const int y0,
+                     const int x1, const int y1) {
+  uint64_t key = mix64(kind);
+  key = mix64(key ^ static_cast<uint32_t>(x0));
+  key = mix64(key ^ static_cast<uint32_t>(y0));
+  key = mix64(key ^ static_cast<uint32_t>(x1));
+  key = mix64(key ^ static_cast<uint32_t>(y1));
+  return key;
+}
+
 }  // namespace factory_game
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "frame_export.h"
+
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace factory_game {
+
+// 書き手に追い越されたときに読み直す回数
+static constexpr int FRAME_READ_RETRIES = 8;
+
+static std::string to_shm_name(const std::string& name) {
+  if (!name.empty() && name[0] == '/') return name;
+  return "/" + name;
+}
+
+// セルの先頭を 64 バイト境界に揃える
+static size_t get_slot_size() {
+  const size_t cells = static_cast<size_t>(FRAME_EXPORT_MAX_WIDTH) *
+                       FRAME_EXPORT_MAX_HEIGHT;
+  return sizeof(FrameSlot) + (cells + 63) / 64 * 64;
+}
+
+static FrameSlot* get_slot(char* data, const size_t slot_size,
+                           const uint64_t frame) {
+  return reinterpret_cast<FrameSlot*>(data + sizeof(FrameExportHeader) +
+                                      frame % FRAME_EXPORT_SLOTS * slot_size);
+}
+
+static const FrameSlot* get_slot(const char* data, const size_t slot_size,
+                                 const uint64_t frame) {
+  return get_slot(const_cast<char*>(data), slot_size, frame);
+}
+
+// EXPORTER
+
+FrameExporter::FrameExporter() : m_data(nullptr), m_size(0), m_frame(0) {}
+
+FrameExporter::~FrameExporter() { close(); }
+
+bool FrameExporter::open(const std::string& name) {
+  close();
+
+#if defined(__linux__)
+  // 前回異常終了して残ったものは, 写している読み手ごと切り離す
+  const auto shm_name = to_shm_name(name);
+  shm_unlink(shm_name.c_str());
+  const int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) return false;
+
+  const size_t slot_size = get_slot_size();
+  const size_t size =
+      sizeof(FrameExportHeader) + FRAME_EXPORT_SLOTS * slot_size;
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    shm_unlink(shm_name.c_str());
+    return false;
+  }
+
+  m_name = shm_name;
+  m_data = static_cast<char*>(data);
+  m_size = size;
+  m_frame = 0;
+
+  // 作りたての共有メモリは 0 で埋まっている, magic は最後に書く
+  auto* header = reinterpret_cast<FrameExportHeader*>(m_data);
+  header->version = FRAME_EXPORT_VERSION;
+  header->slot_count = FRAME_EXPORT_SLOTS;
+  header->slot_size = static_cast<uint32_t>(slot_size);
+  header->max_width = FRAME_EXPORT_MAX_WIDTH;
+  header->max_height = FRAME_EXPORT_MAX_HEIGHT;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = FRAME_EXPORT_MAGIC;
+  return true;
+#else
+  (void)name;
+  return false;
+#endif
+}
+
+void FrameExporter::close() {
+#if defined(__linux__)
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+    shm_unlink(m_name.c_str());
+  }
+#endif
+  m_name.clear();
+  m_data = nullptr;
+  m_size = 0;
+}
+
+bool FrameExporter::publish(const char* cells, const int width,
+                            const int height) {
+  if (m_data == nullptr) return false;
+  if (width <= 0 || height <= 0) return false;
+  if (width > FRAME_EXPORT_MAX_WIDTH || height > FRAME_EXPORT_MAX_HEIGHT)
+    return false;
+
+  auto* header = reinterpret_cast<FrameExportHeader*>(m_data);
+  const uint64_t frame = m_frame + 1;
+  auto* slot = get_slot(m_data, header->slot_size, frame);
+
+  // 奇数にしてから中身を書き, 偶数に戻して書き終えたことを示す
+  const uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->frame = frame;
+  slot->timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+  slot->width = width;
+  slot->height = height;
+  std::memcpy(reinterpret_cast<char*>(slot + 1), cells,
+              static_cast<size_t>(width) * height);
+
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  header->latest.store(frame, std::memory_order_release);
+  m_frame = frame;
+  return true;
+}
+
+uint64_t FrameExporter::get_frame() const { return m_frame; }
+
+// READER
+
+FrameReader::FrameReader() : m_data(nullptr), m_size(0) {}
+
+FrameReader::~FrameReader() { close(); }
+
+bool FrameReader::open(const std::string& name) {
+  close();
+
+#if defined(__linux__)
+  const int fd = shm_open(to_shm_name(name).c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+
+  struct stat info;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 &&
+      static_cast<size_t>(info.st_size) >= sizeof(FrameExportHeader))
+    data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) return false;
+
+  m_data = static_cast<const char*>(data);
+  m_size = info.st_size;
+
+  const auto* header = reinterpret_cast<const FrameExportHeader*>(m_data);
+  const bool valid =
+      header->magic == FRAME_EXPORT_MAGIC &&
+      header->version == FRAME_EXPORT_VERSION &&
+      header->slot_count == FRAME_EXPORT_SLOTS &&
+      header->slot_size >= sizeof(FrameSlot) +
+                               static_cast<size_t>(header->max_width) *
+                                   header->max_height &&
+      m_size >= sizeof(FrameExportHeader) +
+                    static_cast<size_t>(header->slot_count) *
+                        header->slot_size;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!valid) {
+    close();
+    return false;
+  }
+  return true;
+#else
+  (void)name;
+  return false;
+#endif
+}
+
+void FrameReader::close() {
+#if defined(__linux__)
+  if (m_data != nullptr) munmap(const_cast<char*>(m_data), m_size);
+#endif
+  m_data = nullptr;
+  m_size = 0;
+}
+
+uint64_t FrameReader::get_latest() const {
+  if (m_data == nullptr) return 0;
+
+  const auto* header = reinterpret_cast<const FrameExportHeader*>(m_data);
+  return header->latest.load(std::memory_order_acquire);
+}
+
+bool FrameReader::read_latest(const uint64_t after,
+                              ExportedFrame* frame) const {
+  if (m_data == nullptr) return false;
+
+  const auto* header = reinterpret_cast<const FrameExportHeader*>(m_data);
+  for (int i = 0; i < FRAME_READ_RETRIES; ++i) {
+    const uint64_t latest = header->latest.load(std::memory_order_acquire);
+    if (latest <= after) return false;
+
+    const auto* slot = get_slot(m_data, header->slot_size, latest);
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) continue;
+
+    // 書き換え中に読んだ値かもしれないので, 写す前に範囲だけ確かめる
+    const int width = slot->width;
+    const int height = slot->height;
+    if (width <= 0 || height <= 0 ||
+        width > static_cast<int>(header->max_width) ||
+        height > static_cast<int>(header->max_height))
+      continue;
+
+    frame->frame = slot->frame;
+    frame->timestamp = slot->timestamp;
+    frame->width = width;
+    frame->height = height;
+    frame->cells.resize(static_cast<size_t>(width) * height);
+    std::memcpy(frame->cells.data(), reinterpret_cast<const char*>(slot + 1),
+                frame->cells.size());
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->sequence.load(std::memory_order_relaxed) != sequence) continue;
+    // latest を読んだ後でスロットが次の周回に使われていれば読み直す
+    if (frame->frame != latest) continue;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace factory_game
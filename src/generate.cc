@@ -0,0 +1,202 @@
+#include "generate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+namespace factory_game {
+
+// 区画の幅, 機械 15 マス + 横方向のずらし幅 + 出力ダクト 2 つ分の余白
+constexpr int GENERATE_LANE_WIDTH = 26;
+constexpr int GENERATE_LANE_SLACK = 8;
+constexpr int GENERATE_ROW_PITCH = 4;  // 機械, 出力ポート, パイプ, 入力ポート
+
+enum GenerateChain {
+  GENERATE_CHAIN_ELECTROLYSIS,  // 水 -> 電解装置 -> 水素 + 酸素
+  GENERATE_CHAIN_SILICON,       // シリコン -> 切断 -> レーザー -> 切断
+};
+
+// 標準ライブラリの分布は実装ごとに結果が異なるため, 整数演算だけで引く
+class GenerateRandom {
+ public:
+  explicit GenerateRandom(const uint64_t seed) : m_engine(seed) {}
+
+  int next_int(const int bound) {
+    return static_cast<int>(m_engine() % static_cast<uint64_t>(bound));
+  }
+
+  bool next_bool(const float probability) {
+    return static_cast<double>(m_engine() >> 11) * 0x1.0p-53 < probability;
+  }
+
+ private:
+  std::mt19937_64 m_engine;
+};
+
+// 系統 1 つを区画の左上 origin から 1 段ずつ積み上げる
+// 機械は区画内で横に 0 ~ GENERATE_LANE_SLACK マスずらして置く
+class ChainBuilder {
+ public:
+  ChainBuilder(GeneratedLayout& layout, GenerateRandom& random,
+               const float l_shape_ratio, const glm::ivec2 origin)
+      : m_layout(layout),
+        m_random(random),
+        m_l_shape_ratio(l_shape_ratio),
+        m_origin(origin),
+        m_row(0) {}
+
+  glm::ivec2 place_first(const Machines type, const Item item) {
+    const int offset = m_random.next_int(GENERATE_LANE_SLACK + 1);
+    return place_at(type, item, get_point(offset, m_row++));
+  }
+
+  // 前の段の出力ポート output から, 入力ポートが input_x にある機械へつなぐ
+  // まっすぐつなげる位置に置くと直線, それ以外は L 字のパイプになる
+  glm::ivec2 place(const Machines type, const Item item,
+                   const glm::ivec2 output, const int input_x,
+                   const int max_offset = GENERATE_LANE_SLACK) {
+    const int straight = output.x - m_origin.x - input_x;
+
+    int offset;
+    if (!m_random.next_bool(m_l_shape_ratio) && straight >= 0 &&
+        straight <= max_offset) {
+      offset = straight;
+    } else {
+      offset = m_random.next_int(max_offset + 1);
+      if (offset == straight) offset = (offset + 1) % (max_offset + 1);
+    }
+
+    const auto point = place_at(type, item, get_point(offset, m_row++));
+    link(output, point + glm::ivec2(input_x, -1));
+    return point;
+  }
+
+  // 直前に置いた機械と同じ段に並べる
+  glm::ivec2 place_beside(const Machines type, const Item item,
+                          const glm::ivec2 output, const glm::ivec2 point,
+                          const int input_x) {
+    place_at(type, item, point);
+    link(output, point + glm::ivec2(input_x, -1));
+    return point;
+  }
+
+  int get_offset(const glm::ivec2 point) const { return point.x - m_origin.x; }
+
+ private:
+  glm::ivec2 get_point(const int offset, const int row) const {
+    return m_origin + glm::ivec2(offset, 1 + GENERATE_ROW_PITCH * row);
+  }
+
+  glm::ivec2 place_at(const Machines type, const Item item,
+                      const glm::ivec2 point) {
+    m_layout.machines.push_back(make_machine(type, point, item));
+    return point;
+  }
+
+  void link(const glm::ivec2 output, const glm::ivec2 input) {
+    m_layout.pipes.push_back(make_pipe(output, input));
+  }
+
+  GeneratedLayout& m_layout;
+  GenerateRandom& m_random;
+  float m_l_shape_ratio;
+  glm::ivec2 m_origin;
+  int m_row;
+};
+
+static void build_electrolysis_chain(ChainBuilder& builder) {
+  const auto input = builder.place_first(MACHINE_INPUT_DUCT, ITEM_WATER);
+  const auto electrolyzer = builder.place(
+      MACHINE_ELECTROLYZER, ITEM_WATER, input + glm::ivec2(5, 1), 7);
+
+  // 酸素のパイプは水素のパイプの右を通る, 交差しないよう水素側を左に寄せる
+  const int max_offset =
+      std::min(GENERATE_LANE_SLACK, builder.get_offset(electrolyzer) + 4);
+  const auto hydrogen =
+      builder.place(MACHINE_OUTPUT_DUCT, ITEM_HYDROGEN,
+                    electrolyzer + glm::ivec2(5, 1), 5, max_offset);
+  builder.place_beside(MACHINE_OUTPUT_DUCT, ITEM_OXYGEN,
+                       electrolyzer + glm::ivec2(10, 1),
+                       hydrogen + glm::ivec2(10, 0), 5);
+}
+
+static void build_silicon_chain(ChainBuilder& builder, const int depth) {
+  static const Machines machines[] = {MACHINE_CUTTER, MACHINE_LAZER,
+                                      MACHINE_CUTTER};
+  static const Item outputs[] = {ITEM_SILICON_WAFER, ITEM_CIRCUIT_WAFER,
+                                 ITEM_CIRCUIT};
+
+  auto point = builder.place_first(MACHINE_INPUT_DUCT, ITEM_SILICON);
+  for (int i = 0; i < depth; ++i) {
+    point = builder.place(machines[i], ITEM_SILICON, point + glm::ivec2(5, 1),
+                          5);
+  }
+  builder.place(MACHINE_OUTPUT_DUCT, outputs[depth - 1],
+                point + glm::ivec2(5, 1), 5);
+}
+
+GeneratedLayout generate_layout(const GenerateOptions& options) {
+  GenerateRandom random(options.seed);
+  const int depth =
+      std::clamp(options.chain_depth, 1, GENERATE_MAX_CHAIN_DEPTH);
+  const float density = std::clamp(options.density, 0.01f, 1.0f);
+
+  // 系統の種類を先に決める, 電解の系統は 4 つに 1 つ
+  std::vector<GenerateChain> chains;
+  for (int count = 0; count < options.machine_count;) {
+    if (random.next_int(4) == 0) {
+      chains.push_back(GENERATE_CHAIN_ELECTROLYSIS);
+      count += 4;
+    } else {
+      chains.push_back(GENERATE_CHAIN_SILICON);
+      count += depth + 2;
+    }
+  }
+
+  // 区画の格子は全体がおおよそ正方形になるように列数を決める
+  const int lane_height = GENERATE_ROW_PITCH * (depth + 2);
+  const auto slot_count = static_cast<int>(
+      std::ceil(static_cast<double>(chains.size()) / density));
+  const int columns = std::max(
+      1, static_cast<int>(std::ceil(std::sqrt(
+             static_cast<double>(slot_count) * lane_height /
+             GENERATE_LANE_WIDTH))));
+  const int rows = (slot_count + columns - 1) / columns;
+
+  std::vector<int> slots(columns * rows);
+  std::iota(slots.begin(), slots.end(), 0);
+  for (size_t i = 0; i < chains.size(); ++i) {
+    std::swap(slots[i], slots[i + random.next_int(slots.size() - i)]);
+  }
+
+  GeneratedLayout layout;
+  layout.size = glm::ivec2(columns * GENERATE_LANE_WIDTH, rows * lane_height);
+  layout.machines.reserve(chains.size() * (depth + 2));
+  layout.pipes.reserve(chains.size() * (depth + 1));
+
+  for (size_t i = 0; i < chains.size(); ++i) {
+    const auto origin = glm::ivec2(slots[i] % columns * GENERATE_LANE_WIDTH,
+                                   slots[i] / columns * lane_height);
+    ChainBuilder builder(layout, random, options.l_shape_ratio, origin);
+
+    if (chains[i] == GENERATE_CHAIN_ELECTROLYSIS) {
+      build_electrolysis_chain(builder);
+    } else {
+      build_silicon_chain(builder, depth);
+    }
+  }
+
+  return layout;
+}
+
+void load_generated_layout(const GeneratedLayout& layout,
+                           MachineManager& machine_manager,
+                           PipeManager& pipe_manager) {
+  machine_manager.clear();
+  pipe_manager.clear();
+  machine_manager.add_machines(layout.machines);
+  pipe_manager.add_pipes(layout.pipes);
+}
+
+}  // namespace factory_game
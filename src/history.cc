@@ -0,0 +1,378 @@
+#include "history.h"
+
+#include <memory_resource>
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace factory_game {
+
+// WORLD NODE
+
+// 1 段で使うハッシュのビット数, 13 段目は残りの 4 ビット
+constexpr int WORLD_NODE_BITS = 5;
+constexpr uint64_t WORLD_NODE_MASK = (1u << WORLD_NODE_BITS) - 1;
+
+// CHAMP 形式の節, 要素と子をそれぞれビットの順に詰めて持つ
+// 要素が 1 つだけの子は作らずに親へ置くので, 同じ集合は同じ形になる
+struct WorldNode {
+  explicit WorldNode(std::pmr::memory_resource* resource)
+      : entity_map(0),
+        node_map(0),
+        size(0),
+        entities(resource),
+        nodes(resource) {}
+
+  uint32_t entity_map;
+  uint32_t node_map;
+  size_t size;  // 部分木の要素数
+  std::pmr::vector<WorldEntity> entities;
+  std::pmr::vector<WorldRoot> nodes;
+};
+
+static const void* get_key(const WorldEntity& entity) {
+  if (entity.machine) return entity.machine.get();
+  return entity.pipe.get();
+}
+
+// splitmix64 の仕上げ, 全単射なのでアドレスが違えばハッシュも違う
+static uint64_t hash_key(const void* key) {
+  uint64_t value = reinterpret_cast<uintptr_t>(key);
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+  return value ^ (value >> 31);
+}
+
+static int count_bits(const uint32_t value) {
+#if defined(_MSC_VER)
+  return static_cast<int>(__popcnt(value));
+#else
+  return __builtin_popcount(value);
+#endif
+}
+
+static uint32_t get_bit(const uint64_t hash, const int shift) {
+  return 1u << ((hash >> shift) & WORLD_NODE_MASK);
+}
+
+// map の中で bit より下に立っているビットの数, 詰めた配列の添字
+static int get_index(const uint32_t map, const uint32_t bit) {
+  return count_bits(map & (bit - 1));
+}
+
+static std::shared_ptr<WorldNode> make_node(StageArena* arena) {
+  auto* resource = get_resource(arena, MEMORY_HISTORY);
+  return std::allocate_shared<WorldNode>(
+      std::pmr::polymorphic_allocator<WorldNode>(resource), resource);
+}
+
+static std::shared_ptr<WorldNode> copy_node(const WorldNode& node,
+                                            StageArena* arena) {
+  auto copy = make_node(arena);
+  copy->entity_map = node.entity_map;
+  copy->node_map = node.node_map;
+  copy->size = node.size;
+  copy->entities.assign(node.entities.begin(), node.entities.end());
+  copy->nodes.assign(node.nodes.begin(), node.nodes.end());
+  return copy;
+}
+
+// 同じ位置に来た 2 つの要素を, ビットが分かれる段まで下ろす
+static WorldRoot make_pair_node(const WorldEntity& a, const uint64_t a_hash,
+                                const WorldEntity& b, const uint64_t b_hash,
+                                const int shift, StageArena* arena) {
+  auto node = make_node(arena);
+  node->size = 2;
+
+  const uint32_t a_bit = get_bit(a_hash, shift);
+  const uint32_t b_bit = get_bit(b_hash, shift);
+  if (a_bit == b_bit) {
+    node->node_map = a_bit;
+    node->nodes.push_back(
+        make_pair_node(a, a_hash, b, b_hash, shift + WORLD_NODE_BITS, arena));
+  } else {
+    node->entity_map = a_bit | b_bit;
+    node->entities.push_back(a_bit < b_bit ? a : b);
+    node->entities.push_back(a_bit < b_bit ? b : a);
+  }
+  return node;
+}
+
+// 既にあれば node をそのまま返す
+static WorldRoot insert_node(const WorldRoot& node, const WorldEntity& entity,
+                             const uint64_t hash, const int shift,
+                             StageArena* arena) {
+  const uint32_t bit = get_bit(hash, shift);
+  if (!node) {
+    auto leaf = make_node(arena);
+    leaf->entity_map = bit;
+    leaf->size = 1;
+    leaf->entities.push_back(entity);
+    return leaf;
+  }
+
+  if (node->entity_map & bit) {
+    const int index = get_index(node->entity_map, bit);
+    const auto& other = node->entities[index];
+    if (get_key(other) == get_key(entity)) return node;
+
+    auto copy = copy_node(*node, arena);
+    copy->entity_map ^= bit;
+    copy->entities.erase(copy->entities.begin() + index);
+    copy->node_map |= bit;
+    copy->nodes.insert(
+        copy->nodes.begin() + get_index(copy->node_map, bit),
+        make_pair_node(other, hash_key(get_key(other)), entity, hash,
+                       shift + WORLD_NODE_BITS, arena));
+    copy->size += 1;
+    return copy;
+  }
+
+  if (node->node_map & bit) {
+    const int index = get_index(node->node_map, bit);
+    auto child = insert_node(node->nodes[index], entity, hash,
+                             shift + WORLD_NODE_BITS, arena);
+    if (child == node->nodes[index]) return node;
+
+    auto copy = copy_node(*node, arena);
+    copy->nodes[index] = std::move(child);
+    copy->size += 1;
+    return copy;
+  }
+
+  auto copy = copy_node(*node, arena);
+  copy->entity_map |= bit;
+  copy->entities.insert(
+      copy->entities.begin() + get_index(copy->entity_map, bit), entity);
+  copy->size += 1;
+  return copy;
+}
+
+// 無ければ node をそのまま返す
+static WorldRoot erase_node(const WorldRoot& node, const void* key,
+                            const uint64_t hash, const int shift,
+                            StageArena* arena) {
+  if (!node) return node;
+
+  const uint32_t bit = get_bit(hash, shift);
+  if (node->entity_map & bit) {
+    const int index = get_index(node->entity_map, bit);
+    if (get_key(node->entities[index]) != key) return node;
+    if (node->size == 1) return nullptr;
+
+    auto copy = copy_node(*node, arena);
+    copy->entity_map ^= bit;
+    copy->entities.erase(copy->entities.begin() + index);
+    copy->size -= 1;
+    return copy;
+  }
+
+  if (node->node_map & bit) {
+    const int index = get_index(node->node_map, bit);
+    const auto child = erase_node(node->nodes[index], key, hash,
+                                  shift + WORLD_NODE_BITS, arena);
+    if (child == node->nodes[index]) return node;
+
+    auto copy = copy_node(*node, arena);
+    copy->size -= 1;
+    if (child->size == 1) {
+      // 要素が 1 つになった子は親へ引き上げる
+      copy->node_map ^= bit;
+      copy->nodes.erase(copy->nodes.begin() + index);
+      copy->entity_map |= bit;
+      copy->entities.insert(
+          copy->entities.begin() + get_index(copy->entity_map, bit),
+          child->entities.front());
+    } else {
+      copy->nodes[index] = child;
+    }
+    return copy;
+  }
+  return node;
+}
+
+static void collect_entities(const WorldNode& node,
+                             std::vector<WorldEntity>& entities) {
+  entities.insert(entities.end(), node.entities.begin(), node.entities.end());
+  for (const auto& child : node.nodes) collect_entities(*child, entities);
+}
+
+// 片側では要素, もう片側では部分木になった位置
+// 要素が部分木に含まれていれば残ったものとして扱う
+static void diff_entity_node(const WorldEntity& entity, const WorldNode& node,
+                             std::vector<WorldEntity>& missing,
+                             std::vector<WorldEntity>& extra) {
+  std::vector<WorldEntity> entities;
+  collect_entities(node, entities);
+
+  bool found = false;
+  for (const auto& other : entities) {
+    if (get_key(other) == get_key(entity))
+      found = true;
+    else
+      extra.push_back(other);
+  }
+  if (!found) missing.push_back(entity);
+}
+
+static void diff_node(const WorldRoot& from, const WorldRoot& to,
+                      std::vector<WorldEntity>& removed,
+                      std::vector<WorldEntity>& added) {
+  if (from == to) return;
+  if (!from) {
+    collect_entities(*to, added);
+    return;
+  }
+  if (!to) {
+    collect_entities(*from, removed);
+    return;
+  }
+
+  uint32_t bits =
+      from->entity_map | from->node_map | to->entity_map | to->node_map;
+  while (bits != 0) {
+    const uint32_t bit = bits & (~bits + 1);
+    bits ^= bit;
+
+    const WorldEntity* from_entity =
+        (from->entity_map & bit)
+            ? &from->entities[get_index(from->entity_map, bit)]
+            : nullptr;
+    const WorldEntity* to_entity =
+        (to->entity_map & bit) ? &to->entities[get_index(to->entity_map, bit)]
+                               : nullptr;
+    const WorldRoot* from_node =
+        (from->node_map & bit) ? &from->nodes[get_index(from->node_map, bit)]
+                               : nullptr;
+    const WorldRoot* to_node =
+        (to->node_map & bit) ? &to->nodes[get_index(to->node_map, bit)]
+                             : nullptr;
+
+    if (from_node && to_node) {
+      diff_node(*from_node, *to_node, removed, added);
+    } else if (from_entity && to_entity) {
+      if (get_key(*from_entity) != get_key(*to_entity)) {
+        removed.push_back(*from_entity);
+        added.push_back(*to_entity);
+      }
+    } else if (from_entity && to_node) {
+      diff_entity_node(*from_entity, **to_node, removed, added);
+    } else if (from_node && to_entity) {
+      diff_entity_node(*to_entity, **from_node, added, removed);
+    } else if (from_entity) {
+      removed.push_back(*from_entity);
+    } else if (from_node) {
+      collect_entities(**from_node, removed);
+    } else if (to_entity) {
+      added.push_back(*to_entity);
+    } else {
+      collect_entities(**to_node, added);
+    }
+  }
+}
+
+WorldRoot world_insert(const WorldRoot& root, const WorldEntity& entity,
+                       StageArena* arena) {
+  return insert_node(root, entity, hash_key(get_key(entity)), 0, arena);
+}
+
+WorldRoot world_erase(const WorldRoot& root, const WorldEntity& entity,
+                      StageArena* arena) {
+  const auto key = get_key(entity);
+  return erase_node(root, key, hash_key(key), 0, arena);
+}
+
+bool world_contains(const WorldRoot& root, const WorldEntity& entity) {
+  const auto key = get_key(entity);
+  const uint64_t hash = hash_key(key);
+
+  const WorldNode* node = root.get();
+  for (int shift = 0; node != nullptr; shift += WORLD_NODE_BITS) {
+    const uint32_t bit = get_bit(hash, shift);
+    if (node->entity_map & bit) {
+      return get_key(node->entities[get_index(node->entity_map, bit)]) == key;
+    }
+    if (!(node->node_map & bit)) return false;
+    node = node->nodes[get_index(node->node_map, bit)].get();
+  }
+  return false;
+}
+
+size_t world_size(const WorldRoot& root) { return root ? root->size : 0; }
+
+void world_diff(const WorldRoot& from, const WorldRoot& to,
+                std::vector<WorldEntity>& removed,
+                std::vector<WorldEntity>& added) {
+  diff_node(from, to, removed, added);
+}
+
+// WORLD HISTORY
+
+WorldHistory::WorldHistory(StageArena* arena)
+    : m_arena(arena),
+      m_versions(1, get_resource(arena, MEMORY_HISTORY)),
+      m_current(0) {}
+
+WorldHistory::~WorldHistory() = default;
+
+void WorldHistory::reset(const std::vector<WorldEntity>& entities) {
+  WorldRoot root;
+  for (const auto& entity : entities) {
+    root = world_insert(root, entity, m_arena);
+  }
+
+  m_versions.clear();
+  m_versions.push_back(std::move(root));
+  m_current = 0;
+}
+
+void WorldHistory::commit(const std::vector<WorldEntity>& added,
+                          const std::vector<WorldEntity>& removed) {
+  auto root = m_versions[m_current];
+  for (const auto& entity : removed) root = world_erase(root, entity, m_arena);
+  for (const auto& entity : added) root = world_insert(root, entity, m_arena);
+  if (root == m_versions[m_current]) return;
+
+  m_versions.erase(m_versions.begin() + m_current + 1, m_versions.end());
+  m_versions.push_back(std::move(root));
+  if (m_versions.size() > WORLD_HISTORY_LIMIT) m_versions.pop_front();
+  m_current = m_versions.size() - 1;
+}
+
+bool WorldHistory::undo(std::vector<WorldEntity>& removed,
+                        std::vector<WorldEntity>& added) {
+  if (m_current == 0) return false;
+
+  world_diff(m_versions[m_current], m_versions[m_current - 1], removed, added);
+  --m_current;
+  return true;
+}
+
+bool WorldHistory::redo(std::vector<WorldEntity>& removed,
+                        std::vector<WorldEntity>& added) {
+  if (m_current + 1 >= m_versions.size()) return false;
+
+  world_diff(m_versions[m_current], m_versions[m_current + 1], removed, added);
+  ++m_current;
+  return true;
+}
+
+const WorldRoot& WorldHistory::get_root() const {
+  return m_versions[m_current];
+}
+
+size_t WorldHistory::get_undo_count() const { return m_current; }
+
+size_t WorldHistory::get_redo_count() const {
+  return m_versions.size() - 1 - m_current;
+}
+
+// 節の数は版どうしで共有されるので, 使用量は MEMORY_HISTORY の集計で見る
+void WorldHistory::write_footprint(std::vector<FootprintEntry>& entries) const {
+  entries.push_back(FootprintEntry{"history versions", MEMORY_HISTORY,
+                                   m_versions.size(), 0, 0.0f});
+}
+
+}  // namespace factory_game
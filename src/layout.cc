@@ -0,0 +1,218 @@
+#include "layout.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace factory_game {
+
+void swap_layout_words(char* data, const size_t size) {
+  for (size_t i = 0; i + 4 <= size; i += 4) {
+    std::swap(data[i], data[i + 3]);
+    std::swap(data[i + 1], data[i + 2]);
+  }
+}
+
+// ヘッダの 64 bit フィールドは上位と下位のワードも入れ替える
+static void swap_layout(char* data, const size_t size) {
+  swap_layout_words(data, size);
+  if (size < sizeof(LayoutHeader)) return;
+
+  for (size_t offset = offsetof(LayoutHeader, machine_count);
+       offset < sizeof(LayoutHeader); offset += 8) {
+    std::swap_ranges(data + offset, data + offset + 4, data + offset + 4);
+  }
+}
+
+// RECORD
+
+MachineRecord make_machine_record(const std::shared_ptr<Machine>& machine) {
+  return MachineRecord{static_cast<uint32_t>(machine->get_type()),
+                       static_cast<uint32_t>(machine->get_item()),
+                       machine->m_point.x, machine->m_point.y};
+}
+
+PipeRecord make_pipe_record(const std::shared_ptr<Pipe>& pipe) {
+  return PipeRecord{pipe->begin.x, pipe->begin.y, pipe->end.x, pipe->end.y};
+}
+
+std::shared_ptr<Machine> make_machine(const MachineRecord& record,
+                                      StageArena* arena) {
+  if (record.item > ITEM_CHIP) return nullptr;
+  return make_machine(static_cast<Machines>(record.type),
+                      glm::ivec2(record.x, record.y),
+                      static_cast<Item>(record.item), arena);
+}
+
+std::shared_ptr<Pipe> make_pipe(const PipeRecord& record, StageArena* arena) {
+  return make_pipe(glm::ivec2(record.begin_x, record.begin_y),
+                   glm::ivec2(record.end_x, record.end_y), arena);
+}
+
+// SAVE
+
+bool save_layout(const std::string& path, const int stage,
+                 const MachineManager& machine_manager,
+                 const PipeManager& pipe_manager) {
+  const auto& machines = machine_manager.get_machines();
+  const auto& pipes = pipe_manager.get_pipes();
+
+  LayoutHeader header = {};
+  header.magic = LAYOUT_MAGIC;
+  header.version = LAYOUT_VERSION;
+  header.stage = stage;
+  header.machine_count = machines.size();
+  header.pipe_count = pipes.size();
+  header.hash = machine_manager.get_hash() + pipe_manager.get_hash();
+
+  std::vector<char> buffer(sizeof(LayoutHeader) +
+                           machines.size() * sizeof(MachineRecord) +
+                           pipes.size() * sizeof(PipeRecord));
+  char* cursor = buffer.data();
+
+  std::memcpy(cursor, &header, sizeof(header));
+  cursor += sizeof(header);
+  for (const auto& machine : machines) {
+    const auto record = make_machine_record(machine);
+    std::memcpy(cursor, &record, sizeof(record));
+    cursor += sizeof(record);
+  }
+  for (const auto& pipe : pipes) {
+    const auto record = make_pipe_record(pipe);
+    std::memcpy(cursor, &record, sizeof(record));
+    cursor += sizeof(record);
+  }
+
+  if (!LAYOUT_NATIVE_ENDIAN) swap_layout(buffer.data(), buffer.size());
+
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream) return false;
+  stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return static_cast<bool>(stream);
+}
+
+// LAYOUT FILE
+
+LayoutFile::LayoutFile() : m_data(nullptr), m_size(0), m_mapped(false) {}
+
+LayoutFile::~LayoutFile() { close(); }
+
+bool LayoutFile::open(const std::string& path) {
+  close();
+
+#if defined(__linux__)
+  if (LAYOUT_NATIVE_ENDIAN) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        m_data = static_cast<const char*>(data);
+        m_size = info.st_size;
+        m_mapped = true;
+      }
+    }
+    ::close(fd);
+  }
+#endif
+
+  if (!m_mapped) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) return false;
+
+    m_buffer.assign(std::istreambuf_iterator<char>(stream),
+                    std::istreambuf_iterator<char>());
+    if (!LAYOUT_NATIVE_ENDIAN) swap_layout(m_buffer.data(), m_buffer.size());
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+  }
+
+  // 破損したファイルは読まない
+  if (m_size < sizeof(LayoutHeader)) {
+    close();
+    return false;
+  }
+
+  // 個数は掛ける前に残りの大きさで抑え, 桁あふれで検査をすり抜けさせない
+  const auto& header = get_header();
+  const uint64_t body = m_size - sizeof(LayoutHeader);
+  if (header.magic != LAYOUT_MAGIC || header.version != LAYOUT_VERSION ||
+      header.machine_count > body / sizeof(MachineRecord) ||
+      header.pipe_count >
+          (body - header.machine_count * sizeof(MachineRecord)) /
+              sizeof(PipeRecord) ||
+      body != header.machine_count * sizeof(MachineRecord) +
+                  header.pipe_count * sizeof(PipeRecord)) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void LayoutFile::close() {
+#if defined(__linux__)
+  if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+  m_buffer.clear();
+}
+
+const LayoutHeader& LayoutFile::get_header() const {
+  return *reinterpret_cast<const LayoutHeader*>(m_data);
+}
+
+const MachineRecord* LayoutFile::get_machines() const {
+  return reinterpret_cast<const MachineRecord*>(m_data +
+                                                sizeof(LayoutHeader));
+}
+
+const PipeRecord* LayoutFile::get_pipes() const {
+  return reinterpret_cast<const PipeRecord*>(
+      m_data + sizeof(LayoutHeader) +
+      get_header().machine_count * sizeof(MachineRecord));
+}
+
+// LOAD
+
+void load_layout(const LayoutFile& file, MachineManager& machine_manager,
+                 PipeManager& pipe_manager) {
+  const auto& header = file.get_header();
+
+  std::vector<std::shared_ptr<Machine>> machines;
+  machines.reserve(header.machine_count);
+  const auto machine_records = file.get_machines();
+  for (uint64_t i = 0; i < header.machine_count; ++i) {
+    const auto machine =
+        make_machine(machine_records[i], machine_manager.get_arena());
+    if (machine) machines.push_back(machine);
+  }
+
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  pipes.reserve(header.pipe_count);
+  const auto pipe_records = file.get_pipes();
+  for (uint64_t i = 0; i < header.pipe_count; ++i) {
+    pipes.push_back(make_pipe(pipe_records[i], pipe_manager.get_arena()));
+  }
+
+  machine_manager.clear();
+  machine_manager.add_machines(machines);
+  pipe_manager.clear();
+  pipe_manager.add_pipes(pipes);
+}
+
+}  // namespace factory_game
\ No newline at end of file
@@ -2,19 +2,58 @@
 
 #include <algorithm>
 
+#include "profile.h"
+
 namespace factory_game {
 
 // SPATIAL IDX
 
-MachineSpatialIdx::MachineSpatialIdx(
-    std::unordered_map<glm::ivec2, std::shared_ptr<Machine>>& spatial_idx,
-    std::shared_ptr<Machine>& cursor)
-    : m_spatial_idx(spatial_idx), m_cursor(cursor) {}
+MachineSpatialIdx::MachineSpatialIdx(MachineSpatialMap& spatial_idx,
+                                     MachineShadowMap& shadowed,
+                                     OccupancyGrid& occupancy,
+                                     std::shared_ptr<Machine>& cursor,
+                                     const bool is_erase)
+    : m_spatial_idx(spatial_idx),
+      m_shadowed(shadowed),
+      m_occupancy(occupancy),
+      m_cursor(cursor),
+      m_is_erase(is_erase) {}
 
 MachineSpatialIdx::~MachineSpatialIdx() = default;
 
+// 別の機械が書いたセルは, その機械を隠して上に書く
+// 外すときは隠れていた機械を戻し, 無ければセルを空ける
 void MachineSpatialIdx::Write(const glm::ivec2 point) const {
-  m_spatial_idx.insert_or_assign(point, m_cursor);
+  if (!m_is_erase) {
+    const auto [it, inserted] = m_spatial_idx.try_emplace(point, m_cursor);
+    if (!inserted && it->second != m_cursor) {
+      m_shadowed.emplace(point, std::move(it->second));
+      it->second = m_cursor;
+    }
+    m_occupancy.set(point.x, point.y);
+    return;
+  }
+
+  const auto it = m_spatial_idx.find(point);
+  if (it == m_spatial_idx.end()) return;
+  if (it->second != m_cursor) {
+    const auto range = m_shadowed.equal_range(point);
+    for (auto shadow = range.first; shadow != range.second; ++shadow) {
+      if (shadow->second != m_cursor) continue;
+      m_shadowed.erase(shadow);
+      break;
+    }
+    return;
+  }
+
+  const auto shadow = m_shadowed.find(point);
+  if (shadow != m_shadowed.end()) {
+    it->second = std::move(shadow->second);
+    m_shadowed.erase(shadow);
+    return;
+  }
+  m_spatial_idx.erase(it);
+  m_occupancy.reset(point.x, point.y);
 }
 
 // BASE MACHINE
@@ -23,6 +62,8 @@ Machine::Machine(const glm::ivec2 point) : m_point(point) {}
 
 Machine::~Machine() = default;
 
+Item Machine::get_item() { return ITEM_WATER; }
+
 // INPUT DUCT
 
 InputDuct::InputDuct(const glm::ivec2 point, const Item item)
@@ -32,6 +73,18 @@ InputDuct::~InputDuct() = default;
 
 bool InputDuct::is_breakable() { return false; }
 
+Machines InputDuct::get_type() { return MACHINE_INPUT_DUCT; }
+
+void InputDuct::build_ports(MachinePorts& ports) {
+  ports.outputs.push_back(m_point + glm::ivec2(5, 1));
+}
+
+void InputDuct::build_recipes(std::vector<Recipe>& recipes) {
+  recipes.push_back(Recipe{{}, {item}, 10});
+}
+
+Item InputDuct::get_item() { return item; }
+
 void InputDuct::draw(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(m_point.x + 2, m_point.y - 1, item_to_string(item));
   draw_manager->draw_label(m_point.x, m_point.y, "[[Input]]");
@@ -49,6 +102,18 @@ OutputDuct::~OutputDuct() = default;
 
 bool OutputDuct::is_breakable() { return false; }
 
+Machines OutputDuct::get_type() { return MACHINE_OUTPUT_DUCT; }
+
+void OutputDuct::build_ports(MachinePorts& ports) {
+  ports.inputs.push_back(m_point + glm::ivec2(5, -1));
+}
+
+void OutputDuct::build_recipes(std::vector<Recipe>& recipes) {
+  recipes.push_back(Recipe{{item}, {}, 1});
+}
+
+Item OutputDuct::get_item() { return item; }
+
 void OutputDuct::draw(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(m_point.x + 2, m_point.y + 1, item_to_string(item));
   draw_manager->draw_label(m_point.x, m_point.y, "[[Output]]");
@@ -65,6 +130,18 @@ Electrolyzer::~Electrolyzer() = default;
 
 bool Electrolyzer::is_breakable() { return true; }
 
+Machines Electrolyzer::get_type() { return MACHINE_ELECTROLYZER; }
+
+void Electrolyzer::build_ports(MachinePorts& ports) {
+  ports.inputs.push_back(m_point + glm::ivec2(7, -1));
+  ports.outputs.push_back(m_point + glm::ivec2(5, 1));
+  ports.outputs.push_back(m_point + glm::ivec2(10, 1));
+}
+
+void Electrolyzer::build_recipes(std::vector<Recipe>& recipes) {
+  recipes.push_back(Recipe{{ITEM_WATER}, {ITEM_HYDROGEN, ITEM_OXYGEN}, 30});
+}
+
 void Electrolyzer::draw(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(m_point.x, m_point.y, "[[Electrolyzer]]");
   draw_manager->draw_label(m_point.x + 7, m_point.y - 1, "I");
@@ -74,7 +151,7 @@ void Electrolyzer::draw(DrawManagerBase* draw_manager) {
 
 void Electrolyzer::build_spatial_idx(const MachineSpatialIdx writer) {
   for (int y = m_point.y; y < m_point.y + 1; ++y) {
-    for (int x = m_point.x; x < m_point.x + 15; ++x) {
+    for (int x = m_point.x; x < m_point.x + MACHINE_WIDTH; ++x) {
       writer.Write(glm::ivec2(x, y));
     }
   }
@@ -88,6 +165,18 @@ Cutter::~Cutter() = default;
 
 bool Cutter::is_breakable() { return true; }
 
+Machines Cutter::get_type() { return MACHINE_CUTTER; }
+
+void Cutter::build_ports(MachinePorts& ports) {
+  ports.inputs.push_back(m_point + glm::ivec2(5, -1));
+  ports.outputs.push_back(m_point + glm::ivec2(5, 1));
+}
+
+void Cutter::build_recipes(std::vector<Recipe>& recipes) {
+  recipes.push_back(Recipe{{ITEM_SILICON}, {ITEM_SILICON_WAFER}, 20});
+  recipes.push_back(Recipe{{ITEM_CIRCUIT_WAFER}, {ITEM_CIRCUIT}, 20});
+}
+
 void Cutter::draw(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(m_point.x, m_point.y, "[[Cutter]]");
   draw_manager->draw_label(m_point.x + 5, m_point.y - 1, "I");
@@ -96,7 +185,7 @@ void Cutter::draw(DrawManagerBase* draw_manager) {
 
 void Cutter::build_spatial_idx(const MachineSpatialIdx writer) {
   for (int y = m_point.y; y < m_point.y + 1; ++y) {
-    for (int x = m_point.x; x < m_point.x + 15; ++x) {
+    for (int x = m_point.x; x < m_point.x + MACHINE_WIDTH; ++x) {
       writer.Write(glm::ivec2(x, y));
     }
   }
@@ -110,6 +199,17 @@ Laser::~Laser() = default;
 
 bool Laser::is_breakable() { return true; }
 
+Machines Laser::get_type() { return MACHINE_LAZER; }
+
+void Laser::build_ports(MachinePorts& ports) {
+  ports.inputs.push_back(m_point + glm::ivec2(5, -1));
+  ports.outputs.push_back(m_point + glm::ivec2(5, 1));
+}
+
+void Laser::build_recipes(std::vector<Recipe>& recipes) {
+  recipes.push_back(Recipe{{ITEM_SILICON_WAFER}, {ITEM_CIRCUIT_WAFER}, 40});
+}
+
 void Laser::draw(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(m_point.x, m_point.y, "[[Laser]]");
   draw_manager->draw_label(m_point.x + 5, m_point.y - 1, "I");
@@ -118,7 +218,7 @@ void Laser::draw(DrawManagerBase* draw_manager) {
 
 void Laser::build_spatial_idx(const MachineSpatialIdx writer) {
   for (int y = m_point.y; y < m_point.y + 1; ++y) {
-    for (int x = m_point.x; x < m_point.x + 15; ++x) {
+    for (int x = m_point.x; x < m_point.x + MACHINE_WIDTH; ++x) {
       writer.Write(glm::ivec2(x, y));
     }
   }
@@ -132,6 +232,22 @@ Assembler::~Assembler() = default;
 
 bool Assembler::is_breakable() { return true; }
 
+Machines Assembler::get_type() { return MACHINE_ASSEMBLER; }
+
+void Assembler::build_ports(MachinePorts& ports) {
+  ports.inputs.push_back(m_point + glm::ivec2(2, -1));
+  ports.inputs.push_back(m_point + glm::ivec2(5, -1));
+  ports.inputs.push_back(m_point + glm::ivec2(8, -1));
+  ports.outputs.push_back(m_point + glm::ivec2(5, 1));
+}
+
+void Assembler::build_recipes(std::vector<Recipe>& recipes) {
+  recipes.push_back(
+      Recipe{{ITEM_CIRCUIT, ITEM_SOLDERING_IRON, ITEM_CIRCUIT_BOARD},
+             {ITEM_CHIP},
+             60});
+}
+
 void Assembler::draw(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(m_point.x, m_point.y, "[[Assembler]]");
   draw_manager->draw_label(m_point.x + 2, m_point.y - 1, "I1");
@@ -142,35 +258,126 @@ void Assembler::draw(DrawManagerBase* draw_manager) {
 
 void Assembler::build_spatial_idx(const MachineSpatialIdx writer) {
   for (int y = m_point.y; y < m_point.y + 1; ++y) {
-    for (int x = m_point.x; x < m_point.x + 15; ++x) {
+    for (int x = m_point.x; x < m_point.x + MACHINE_WIDTH; ++x) {
       writer.Write(glm::ivec2(x, y));
     }
   }
 }
 
+// FACTORY
+
+std::shared_ptr<Machine> make_machine(const Machines type,
+                                      const glm::ivec2 point, const Item item,
+                                      StageArena* arena) {
+  switch (type) {
+    case MACHINE_ELECTROLYZER:
+      return make_entity<Electrolyzer>(arena, point);
+    case MACHINE_CUTTER:
+      return make_entity<Cutter>(arena, point);
+    case MACHINE_LAZER:
+      return make_entity<Laser>(arena, point);
+    case MACHINE_ASSEMBLER:
+      return make_entity<Assembler>(arena, point);
+    case MACHINE_INPUT_DUCT:
+      return make_entity<InputDuct>(arena, point, item);
+    case MACHINE_OUTPUT_DUCT:
+      return make_entity<OutputDuct>(arena, point, item);
+    default:
+      return nullptr;
+  }
+}
+
 // MACHINE MANAGER
 
-MachineManager::MachineManager() {}
+MachineManager::MachineManager(StageArena* arena)
+    : m_arena(arena),
+      m_hash(0),
+      m_machines(get_resource(arena, MEMORY_MACHINE_SET)),
+      m_spatial_idx(get_resource(arena, MEMORY_MACHINE_INDEX)),
+      m_shadowed(get_resource(arena, MEMORY_MACHINE_INDEX)),
+      m_occupancy(get_resource(arena, MEMORY_OCCUPANCY)),
+      m_draw_list(get_resource(arena, MEMORY_DRAW_LIST)) {}
 
 MachineManager::~MachineManager() = default;
 
+uint64_t machine_zobrist_key(const std::shared_ptr<Machine>& machine) {
+  const uint64_t kind = static_cast<uint64_t>(machine->get_type()) |
+                        static_cast<uint64_t>(machine->get_item()) << 32;
+  return zobrist_key(kind, machine->m_point.x, machine->m_point.y);
+}
+
+// 機械は置いた後に変わらないので, 描画命令は追加時に 1 回だけ記録する
+static void record_machine(RetainedDrawList& draw_list,
+                           const std::shared_ptr<Machine>& machine) {
+  draw_list.set(machine.get(), [&](DrawManagerBase* draw_manager) {
+    machine->draw(draw_manager);
+  });
+}
+
+// 追加では他の機械のセルは変わらないので, 追加分だけを書き込む
 void MachineManager::add_machine(const std::shared_ptr<Machine>& machine) {
-  m_machines.insert(machine);
-  build_spatial_idx();
+  if (!m_machines.insert(machine).second) return;
+  m_hash += machine_zobrist_key(machine);
+  record_machine(m_draw_list, machine);
+
+  auto cursor = machine;
+  const auto writer =
+      MachineSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, cursor);
+  machine->build_spatial_idx(writer);
+}
+
+// 一括追加, 空間インデックスは追加分だけを 1 回ずつ書き込む
+void MachineManager::add_machines(
+    const std::vector<std::shared_ptr<Machine>>& machines) {
+  m_machines.reserve(m_machines.size() + machines.size());
+
+  for (auto machine : machines) {
+    if (!m_machines.insert(machine).second) continue;
+    m_hash += machine_zobrist_key(machine);
+    record_machine(m_draw_list, machine);
+
+    const auto writer =
+        MachineSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, machine);
+    machine->build_spatial_idx(writer);
+  }
+}
+
+void MachineManager::clear() {
+  m_machines.clear();
+  m_spatial_idx.clear();
+  m_shadowed.clear();
+  m_occupancy.clear();
+  m_draw_list.clear();
+  m_hash = 0;
 }
 
 void MachineManager::build_spatial_idx() {
   m_spatial_idx.clear();
+  m_shadowed.clear();
+  m_occupancy.clear();
 
   for (auto machine : m_machines) {
-    const auto writer = MachineSpatialIdx(m_spatial_idx, machine);
+    const auto writer =
+        MachineSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, machine);
     machine->build_spatial_idx(writer);
   }
 }
 
+// 他の機械のセルは変わらないので, 外す機械のセルだけを消す
 void MachineManager::remove_machine(const std::shared_ptr<Machine>& machine) {
-  m_machines.erase(machine);
-  build_spatial_idx();
+  if (!m_machines.erase(machine)) return;
+  m_hash -= machine_zobrist_key(machine);
+  m_draw_list.remove(machine.get());
+
+  auto cursor = machine;
+  const auto eraser = MachineSpatialIdx(m_spatial_idx, m_shadowed,
+                                        m_occupancy, cursor, true);
+  machine->build_spatial_idx(eraser);
+}
+
+void MachineManager::remove_machines(
+    const std::vector<std::shared_ptr<Machine>>& machines) {
+  for (const auto& machine : machines) remove_machine(machine);
 }
 
 std::shared_ptr<Machine> MachineManager::find_machine(const glm::ivec2 point) {
@@ -179,10 +386,51 @@ std::shared_ptr<Machine> MachineManager::find_machine(const glm::ivec2 point) {
   return it->second;
 }
 
-void MachineManager::draw(DrawManagerBase* draw_manager) const {
-  for (const auto machine : m_machines) {
-    machine->draw(draw_manager);
-  }
+// 占有ビットで空きのセルを飛ばし, 占有されたセルだけを索引で引く
+void MachineManager::find_machines(
+    const glm::ivec2 min, const glm::ivec2 max,
+    std::vector<std::shared_ptr<Machine>>& machines) const {
+  const size_t begin = machines.size();
+  m_occupancy.for_each_set(min.x, min.y, max.x, max.y, [&](int x, int y) {
+    const auto it = m_spatial_idx.find(glm::ivec2(x, y));
+    if (it == m_spatial_idx.end()) return;
+    // 機械のセルは行の中で連続する
+    if (machines.size() > begin && machines.back() == it->second) return;
+    machines.push_back(it->second);
+  });
+
+  std::sort(machines.begin() + begin, machines.end());
+  machines.erase(std::unique(machines.begin() + begin, machines.end()),
+                 machines.end());
+}
+
+const MachineSet& MachineManager::get_machines() const { return m_machines; }
+
+const OccupancyGrid& MachineManager::get_occupancy() const {
+  return m_occupancy;
+}
+
+uint64_t MachineManager::get_hash() const { return m_hash; }
+
+StageArena* MachineManager::get_arena() const { return m_arena; }
+
+void MachineManager::write_footprint(
+    std::vector<FootprintEntry>& entries) const {
+  entries.push_back(
+      make_footprint_entry("machine set", MEMORY_MACHINE_SET, m_machines));
+  entries.push_back(make_footprint_entry(
+      "machine index", MEMORY_MACHINE_INDEX, m_spatial_idx));
+  entries.push_back(make_footprint_entry(
+      "machine shadowed", MEMORY_MACHINE_INDEX, m_shadowed));
+  m_occupancy.write_footprint("machine occupancy", entries);
+  m_draw_list.write_footprint("machine tiles", entries);
+}
+
+void MachineManager::draw(DrawManagerBase* draw_manager,
+                          const glm::ivec2 camera) const {
+  ProfileScope scope(PROFILE_MACHINE_DRAW);
+
+  m_draw_list.draw(draw_manager, camera.x, camera.y);
 }
 
 }  // namespace factory_game
\ No newline at end of file
@@ -1,29 +1,241 @@
-﻿#include "draw.h"
+﻿#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "batch.h"
+#include "draw.h"
+#include "frame_export.h"
+#include "profile.h"
+#include "render.h"
+#include "replay.h"
+#include "stage.h"
 #include "state.h"
+#include "telemetry.h"
 
 namespace factory_game {
 
-int main() {
+// 入力ログを端末なしで最速で再生し, フレームごとの処理時間を報告する
+int replay(const std::string& log_path, const std::string& timings_path,
+           FrameExporter* frame_exporter) {
+  uint32_t frame_count;
+  int width, height;
+  std::vector<InputRecord> records;
+  if (!load_input_log(log_path, &frame_count, &width, &height, &records)) {
+    std::cerr << "failed to load input log: " << log_path << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // 記録したときの画面の大きさで再生する
+  auto* draw_manager =
+      new DrawManagerHeadless(frame_count, records, width, height);
+  draw_manager->set_frame_exporter(frame_exporter);
+  State* state = new TitleState();
+
+  std::vector<double> timings;
+  do {
+    const auto begin = std::chrono::steady_clock::now();
+    State* new_state;
+    {
+      ProfileScope scope(PROFILE_UPDATE);
+      new_state = state->update(draw_manager);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    timings.push_back(std::chrono::duration<double, std::micro>(end - begin)
+                          .count());
+
+    if (new_state != state) {
+      delete state;
+      state = new_state;
+      draw_manager->mark_state_change();
+    }
+  } while (state != nullptr && !draw_manager->is_finished());
+
+  delete state;
+  delete draw_manager;
+
+  if (!timings_path.empty()) {
+    std::ofstream stream(timings_path);
+    stream << "frame,us\n";
+    for (size_t i = 0; i < timings.size(); ++i) {
+      stream << i << "," << timings[i] << "\n";
+    }
+  }
+
+  auto sorted = timings;
+  std::sort(sorted.begin(), sorted.end());
+  double total = 0.0;
+  for (const double timing : sorted) total += timing;
+
+  const auto percentile = [&](const double p) {
+    if (sorted.empty()) return 0.0;
+    return sorted[std::min(sorted.size() - 1,
+                           static_cast<size_t>(p * sorted.size()))];
+  };
+  std::cout << "frames: " << sorted.size() << "\n"
+            << "total_ms: " << total / 1000.0 << "\n"
+            << "mean_us: " << (sorted.empty() ? 0.0 : total / sorted.size())
+            << "\n"
+            << "p50_us: " << percentile(0.50) << "\n"
+            << "p99_us: " << percentile(0.99) << "\n"
+            << "max_us: " << (sorted.empty() ? 0.0 : sorted.back())
+            << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+// レイアウトをまとめて評価し, 1 ファイル 1 行の JSON を標準出力へ流す
+// パスが無ければ標準入力から 1 行 1 つずつ読む
+// --trace を付ければ評価ごとに run を分けて 1 つのファイルへ記録する
+int evaluate(std::vector<std::string> paths, const BatchOptions& options) {
+  if (paths.empty()) {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      if (!line.empty()) paths.push_back(line);
+    }
+  }
+
+  std::ios::sync_with_stdio(false);
+  const auto summary =
+      evaluate_layouts(paths, options, [](const BatchResult& result) {
+        write_batch_result(std::cout, result);
+        std::cout << '\n';
+      });
+  std::cout << std::flush;
+
+  std::cerr << "layouts: " << summary.layouts << "\n"
+            << "failures: " << summary.failures << "\n"
+            << "evaluations: " << summary.evaluations << "\n"
+            << "cache_hits: " << summary.cache_hits << "\n"
+            << "seconds: " << summary.seconds << "\n"
+            << "layouts_per_second: "
+            << (summary.seconds > 0.0 ? summary.layouts / summary.seconds
+                                      : 0.0)
+            << std::endl;
+
+  return summary.failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(const int argc, char** argv) {
+  std::string record_path;
+  std::string replay_path;
+  std::string timings_path;
+  std::string profile_path;
+  std::string chunks_path;
+  std::string export_name;
+  int64_t chunk_budget_mb = 64;
+  bool sync_render = false;
+  bool evaluate_mode = false;
+  std::vector<std::string> evaluate_paths;
+  BatchOptions batch_options;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--sync-render") == 0)
+      sync_render = true;
+    else if (std::strcmp(argv[i], "--evaluate") == 0)
+      evaluate_mode = true;
+    else if (std::strncmp(argv[i], "--", 2) != 0)
+      evaluate_paths.push_back(argv[i]);  // --evaluate するレイアウト
+    else if (i + 1 == argc)
+      break;
+    else if (std::strcmp(argv[i], "--record") == 0)
+      record_path = argv[++i];
+    else if (std::strcmp(argv[i], "--replay") == 0)
+      replay_path = argv[++i];
+    else if (std::strcmp(argv[i], "--timings") == 0)
+      timings_path = argv[++i];
+    else if (std::strcmp(argv[i], "--trace") == 0)
+      get_trace_sink().open(argv[++i], false);
+    else if (std::strcmp(argv[i], "--trace-compressed") == 0)
+      get_trace_sink().open(argv[++i], true);
+    else if (std::strcmp(argv[i], "--profile") == 0)
+      profile_path = argv[++i];
+    else if (std::strcmp(argv[i], "--chunks") == 0)
+      chunks_path = argv[++i];
+    else if (std::strcmp(argv[i], "--chunk-budget-mb") == 0)
+      chunk_budget_mb = std::atoll(argv[++i]);
+    else if (std::strcmp(argv[i], "--export-frames") == 0)
+      export_name = argv[++i];
+    else if (std::strcmp(argv[i], "--stages") == 0)
+      set_stage_directory(argv[++i]);
+    else if (std::strcmp(argv[i], "--stage") == 0)
+      batch_options.stage = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--ticks") == 0)
+      batch_options.ticks = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--threads") == 0)
+      batch_options.threads = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--seeds") == 0)
+      batch_options.seeds = std::atoi(argv[++i]);
+  }
+
+  if (evaluate_mode) return evaluate(std::move(evaluate_paths), batch_options);
+
+  // 画面を共有メモリへ書き出し, 別のプロセスから写して読めるようにする
+  // 描画スレッドが書くので draw_manager より長く残す
+  FrameExporter frame_exporter;
+  FrameExporter* exporter = nullptr;
+  if (!export_name.empty()) {
+    if (frame_exporter.open(export_name))
+      exporter = &frame_exporter;
+    else
+      std::cerr << "failed to open frame export: " << export_name << std::endl;
+  }
+
+  if (!replay_path.empty()) {
+    const int result = replay(replay_path, timings_path, exporter);
+    if (!profile_path.empty()) get_profiler().write_chrome_trace(profile_path);
+    return result;
+  }
+
 #if defined(WIN32)
   DrawManagerBase* draw_manager = new DrawManagerWindows();
 #endif
 #if defined(__linux__)
   DrawManagerBase* draw_manager = new DrawManagerLinux();
 #endif
-  State* state = new TitleState();
+  draw_manager->set_frame_exporter(exporter);
+  // 端末への出力は描画スレッドで行い, 更新のループを待たせない
+  if (!sync_render) draw_manager = new DrawManagerThreaded(draw_manager);
+  DrawManagerRecorder* recorder = nullptr;
+  if (!record_path.empty()) {
+    recorder = new DrawManagerRecorder(draw_manager);
+    draw_manager = recorder;
+  }
+
+  // --chunks ならタイトルを経ずにチャンクファイルを眺める
+  State* state;
+  if (chunks_path.empty())
+    state = new TitleState();
+  else
+    state = new ChunkViewState(chunks_path, chunk_budget_mb << 20);
 
   do {
-    State* new_state = state->update(draw_manager);
+    State* new_state;
+    {
+      ProfileScope scope(PROFILE_UPDATE);
+      new_state = state->update(draw_manager);
+    }
 
     if (new_state != state) {
       delete state;
       state = new_state;
+      if (recorder != nullptr) recorder->mark_state_change();
     }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(16));
   } while (state != nullptr);
 
+  if (recorder != nullptr) recorder->save(record_path);
+  delete draw_manager;
+
+  if (!profile_path.empty()) get_profiler().write_chrome_trace(profile_path);
+
   return EXIT_SUCCESS;
 }
 
 }  // namespace factory_game
 
-int main() { return factory_game::main(); }
+int main(const int argc, char** argv) {
+  return factory_game::main(argc, argv);
+}
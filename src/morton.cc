@@ -0,0 +1,145 @@
+#include "morton.h"
+
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace factory_game {
+
+static constexpr uint64_t MORTON_X_BITS = 0x5555555555555555ull;
+static constexpr uint64_t MORTON_Y_BITS = 0xaaaaaaaaaaaaaaaaull;
+
+// value は 0 以外
+static int find_highest_bit(const uint64_t value) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<int>(index);
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+// CODE
+
+// 32 bit の値のビットを 1 つおきに広げる
+static uint64_t spread_bits(const uint32_t value) {
+  uint64_t bits = value;
+  bits = (bits | (bits << 16)) & 0x0000ffff0000ffffull;
+  bits = (bits | (bits << 8)) & 0x00ff00ff00ff00ffull;
+  bits = (bits | (bits << 4)) & 0x0f0f0f0f0f0f0f0full;
+  bits = (bits | (bits << 2)) & 0x3333333333333333ull;
+  bits = (bits | (bits << 1)) & 0x5555555555555555ull;
+  return bits;
+}
+
+static uint32_t compact_bits(uint64_t bits) {
+  bits &= 0x5555555555555555ull;
+  bits = (bits | (bits >> 1)) & 0x3333333333333333ull;
+  bits = (bits | (bits >> 2)) & 0x0f0f0f0f0f0f0f0full;
+  bits = (bits | (bits >> 4)) & 0x00ff00ff00ff00ffull;
+  bits = (bits | (bits >> 8)) & 0x0000ffff0000ffffull;
+  bits = (bits | (bits >> 16)) & 0x00000000ffffffffull;
+  return static_cast<uint32_t>(bits);
+}
+
+uint64_t morton_encode(const glm::ivec2 point) {
+  const uint32_t x = static_cast<uint32_t>(point.x) ^ 0x80000000u;
+  const uint32_t y = static_cast<uint32_t>(point.y) ^ 0x80000000u;
+  return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+glm::ivec2 morton_decode(const uint64_t code) {
+  const uint32_t x = compact_bits(code) ^ 0x80000000u;
+  const uint32_t y = compact_bits(code >> 1) ^ 0x80000000u;
+  return glm::ivec2(static_cast<int32_t>(x), static_cast<int32_t>(y));
+}
+
+// 片方の軸のビットだけを残しても大小は保たれる
+bool morton_in_box(const uint64_t code, const uint64_t low,
+                   const uint64_t high) {
+  const uint64_t x = code & MORTON_X_BITS;
+  const uint64_t y = code & MORTON_Y_BITS;
+  return x >= (low & MORTON_X_BITS) && x <= (high & MORTON_X_BITS) &&
+         y >= (low & MORTON_Y_BITS) && y <= (high & MORTON_Y_BITS);
+}
+
+// bit と同じ軸で bit より下のビット
+static uint64_t get_lower_axis_bits(const int bit) {
+  const uint64_t axis = bit % 2 == 0 ? MORTON_X_BITS : MORTON_Y_BITS;
+  return axis & ((1ull << bit) - 1);
+}
+
+// bit の軸を bit から下で 1000... にする
+static uint64_t load_ones_below(const uint64_t value, const int bit) {
+  return (value & ~(get_lower_axis_bits(bit) | (1ull << bit))) | (1ull << bit);
+}
+
+// bit の軸を bit から下で 0111... にする
+static uint64_t load_zeros_below(const uint64_t value, const int bit) {
+  const uint64_t lower = get_lower_axis_bits(bit);
+  return (value & ~(lower | (1ull << bit))) | lower;
+}
+
+// Tropf, Herzog の方法で, 上のビットから code と矩形の角を比べて絞る
+// 矩形が 2 つに割れる軸では, code の側の半分だけを残して進む
+// 角の符号が揃っている上のビットは code も同じなので, 違う所から始める
+bool morton_next_in_box(const uint64_t code, uint64_t low, uint64_t high,
+                        uint64_t* next) {
+  if (low == high) return false;
+
+  bool found = false;
+  uint64_t candidate = 0;
+  for (int bit = find_highest_bit(low ^ high); bit >= 0; --bit) {
+    const uint64_t mask = 1ull << bit;
+    const bool c = code & mask, l = low & mask, h = high & mask;
+    if (!c && !l && h) {
+      // 上の半分の最小が候補, 下の半分へ進む
+      candidate = load_ones_below(low, bit);
+      found = true;
+      high = load_zeros_below(high, bit);
+    } else if (!c && l && h) {
+      // 矩形は全て code より大きい
+      *next = low;
+      return true;
+    } else if (c && !l && !h) {
+      // 矩形は全て code より小さい
+      break;
+    } else if (c && !l && h) {
+      low = load_ones_below(low, bit);
+    }
+  }
+  if (found) *next = candidate;
+  return found;
+}
+
+// SEARCH
+
+size_t morton_lower_bound(const uint64_t* codes, const size_t begin,
+                          const size_t end, const uint64_t code) {
+  if (begin >= end) return end;
+
+  const uint64_t* base = codes + begin;
+  size_t count = end - begin;
+  while (count > 1) {
+    const size_t half = count / 2;
+    base = base[half] < code ? base + half : base;
+    count -= half;
+  }
+  return static_cast<size_t>(base - codes) + (*base < code);
+}
+
+size_t morton_gallop(const uint64_t* codes, const size_t begin,
+                     const size_t end, const uint64_t code) {
+  size_t lower = begin;
+  size_t step = 1;
+  while (lower + step < end && codes[lower + step - 1] < code) {
+    lower += step;
+    step *= 2;
+  }
+  return morton_lower_bound(codes, lower, std::min(lower + step, end), code);
+}
+
+}  // namespace factory_game
@@ -0,0 +1,246 @@
+#include "occupancy.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdlib>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace factory_game {
+
+static int floor_div(const int value, const int divisor) {
+  return value >= 0 ? value / divisor : (value - divisor + 1) / divisor;
+}
+
+// value は 0 以外
+static int find_lowest_bit(const uint64_t value) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+static int find_highest_bit(const uint64_t value) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<int>(index);
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+// [begin, end] のビットが立ったマスク, 0 <= begin <= end < 64
+static uint64_t get_bit_range(const int begin, const int end) {
+  return (~0ull << begin) & (~0ull >> (63 - end));
+}
+
+// OCCUPANCY ROW
+
+OccupancyRow::OccupancyRow(const allocator_type& allocator)
+    : first_word(0), words(allocator) {}
+
+OccupancyRow::OccupancyRow(OccupancyRow&& other,
+                           const allocator_type& allocator)
+    : first_word(other.first_word), words(std::move(other.words), allocator) {}
+
+uint64_t OccupancyRow::get_word(const int word) const {
+  const int index = word - first_word;
+  if (index < 0 || index >= static_cast<int>(words.size())) return 0;
+  return words[index];
+}
+
+uint64_t& OccupancyRow::touch_word(const int word) {
+  if (words.empty()) {
+    first_word = word;
+    words.push_back(0);
+  } else if (word < first_word) {
+    words.insert(words.begin(), first_word - word, 0);
+    first_word = word;
+  } else if (word - first_word >= static_cast<int>(words.size())) {
+    words.resize(word - first_word + 1, 0);
+  }
+  return words[word - first_word];
+}
+
+// OCCUPANCY GRID
+
+OccupancyGrid::OccupancyGrid(std::pmr::memory_resource* resource)
+    : m_rows(resource) {}
+
+OccupancyGrid::~OccupancyGrid() = default;
+
+void OccupancyGrid::set(const int x, const int y) {
+  auto& row = m_rows.try_emplace(y).first->second;
+  row.touch_word(floor_div(x, 64)) |= 1ull << (x & 63);
+}
+
+void OccupancyGrid::reset(const int x, const int y) {
+  const auto it = m_rows.find(y);
+  if (it == m_rows.end()) return;
+
+  auto& row = it->second;
+  const int index = floor_div(x, 64) - row.first_word;
+  if (index < 0 || index >= static_cast<int>(row.words.size())) return;
+  row.words[index] &= ~(1ull << (x & 63));
+}
+
+void OccupancyGrid::set_span(const int x, const int y, const int width) {
+  if (width <= 0) return;
+
+  auto& row = m_rows.try_emplace(y).first->second;
+  const int last = x + width - 1;
+  const int word0 = floor_div(x, 64), word1 = floor_div(last, 64);
+  for (int word = word0; word <= word1; ++word) {
+    const int begin = word == word0 ? (x & 63) : 0;
+    const int end = word == word1 ? (last & 63) : 63;
+    row.touch_word(word) |= get_bit_range(begin, end);
+  }
+}
+
+// 全体を作り直すときに行を確保し直さないよう, ワードだけを消す
+void OccupancyGrid::clear() {
+  for (auto& [y, row] : m_rows) {
+    std::fill(row.words.begin(), row.words.end(), 0);
+  }
+}
+
+bool OccupancyGrid::test(const int x, const int y) const {
+  const auto row = find_row(y);
+  if (row == nullptr) return false;
+  return (row->get_word(floor_div(x, 64)) >> (x & 63)) & 1;
+}
+
+bool OccupancyGrid::test_span(const int x, const int y, const int width) const {
+  const auto row = find_row(y);
+  if (row == nullptr || width <= 0) return false;
+
+  const int last = x + width - 1;
+  const int word0 = floor_div(x, 64), word1 = floor_div(last, 64);
+  for (int word = word0; word <= word1; ++word) {
+    const int begin = word == word0 ? (x & 63) : 0;
+    const int end = word == word1 ? (last & 63) : 63;
+    if (row->get_word(word) & get_bit_range(begin, end)) return true;
+  }
+  return false;
+}
+
+const OccupancyRow* OccupancyGrid::find_row(const int y) const {
+  const auto it = m_rows.find(y);
+  if (it == m_rows.end()) return nullptr;
+  return &it->second;
+}
+
+// 空きのワードは読み飛ばし, 立っているビットだけを取り出す
+void OccupancyGrid::for_each_set(
+    const int x0, const int y0, const int x1, const int y1,
+    const std::function<void(int x, int y)>& visit) const {
+  if (x0 > x1) return;
+
+  const int word0 = floor_div(x0, 64), word1 = floor_div(x1, 64);
+  for (int y = y0; y <= y1; ++y) {
+    const auto row = find_row(y);
+    if (row == nullptr) continue;
+
+    for (int word = word0; word <= word1; ++word) {
+      const int begin = word == word0 ? (x0 & 63) : 0;
+      const int end = word == word1 ? (x1 & 63) : 63;
+      uint64_t bits = row->get_word(word) & get_bit_range(begin, end);
+      while (bits) {
+        visit(word * 64 + find_lowest_bit(bits), y);
+        bits &= bits - 1;
+      }
+    }
+  }
+}
+
+void OccupancyGrid::write_footprint(
+    const char* name, std::vector<FootprintEntry>& entries) const {
+  entries.push_back(make_footprint_entry(name, MEMORY_OCCUPANCY, m_rows));
+}
+
+// FREE SPAN
+
+// 左端に置くと [i, i + width) が全て空きになるビット i
+// lo がそのワード, hi が右隣のワードの占有で, 占有ビットを左端側へ
+// width - 1 セル分だけ倍々に広げる (幅 15 なら 1, 2, 4, 7 の 4 回)
+static uint64_t get_free_starts(uint64_t lo, uint64_t hi, const int width) {
+  int covered = 1;
+  while (covered < width) {
+    const int shift = std::min(covered, width - covered);
+    lo |= (lo >> shift) | (hi << (64 - shift));
+    hi |= hi >> shift;
+    covered += shift;
+  }
+  return ~lo;
+}
+
+// 中心のワードから左右へ 1 ワードずつ広げ, それより近い候補が無くなったら止める
+// 行の外側は全て空きなので, 行のワード数 + 1 回以内で見つかる
+bool find_free_span(const std::initializer_list<const OccupancyGrid*> grids,
+                    const int x, const int y, const int width,
+                    const int max_distance, int* result) {
+  if (width <= 0 || width > 64) return false;
+
+  std::array<const OccupancyRow*, OCCUPANCY_MAX_LAYERS> rows;
+  size_t row_count = 0;
+  for (const auto grid : grids) {
+    if (row_count == rows.size()) break;
+    const auto row = grid->find_row(y);
+    if (row != nullptr) rows[row_count++] = row;
+  }
+
+  const auto get_free = [&](const int word) {
+    uint64_t lo = 0, hi = 0;
+    for (size_t i = 0; i < row_count; ++i) {
+      lo |= rows[i]->get_word(word);
+      hi |= rows[i]->get_word(word + 1);
+    }
+    return get_free_starts(lo, hi, width);
+  };
+
+  int64_t best_distance = INT64_MAX;
+  int best = 0;
+  const auto consider = [&](const int word, const int bit) {
+    const int candidate = word * 64 + bit;
+    const int64_t distance =
+        std::abs(static_cast<int64_t>(candidate) - static_cast<int64_t>(x));
+    if (distance < best_distance) {
+      best_distance = distance;
+      best = candidate;
+    }
+  };
+
+  const int center = floor_div(x, 64);
+  const int bit = x & 63;
+  const uint64_t center_free = get_free(center);
+  const uint64_t right = center_free & (~0ull << bit);
+  const uint64_t left = bit == 0 ? 0 : center_free & ((1ull << bit) - 1);
+  if (right) consider(center, find_lowest_bit(right));
+  if (left) consider(center, find_highest_bit(left));
+
+  const int64_t limit = std::min<int64_t>(max_distance, INT_MAX / 2);
+  for (int64_t step = 1; (step - 1) * 64 + 1 <= limit; ++step) {
+    // これより外側のワードは今の候補より遠い
+    if ((step - 1) * 64 + 1 > best_distance) break;
+
+    const int word_left = center - static_cast<int>(step);
+    const int word_right = center + static_cast<int>(step);
+    const uint64_t free_left = get_free(word_left);
+    const uint64_t free_right = get_free(word_right);
+    if (free_left) consider(word_left, find_highest_bit(free_left));
+    if (free_right) consider(word_right, find_lowest_bit(free_right));
+  }
+
+  if (best_distance > max_distance) return false;
+  *result = best;
+  return true;
+}
+
+}  // namespace factory_game
@@ -0,0 +1,668 @@
+#include "optimize.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "route.h"
+
+namespace factory_game {
+
+// 等級を最優先し, 次に得点を比べる
+// 中間品は出力ダクトまで繋がる前の探索に勾配を与えるためのもので,
+// 出力に近いほど重くするが, 1 個あたりは得点 1 よりずっと小さくする
+// 機械ごとの費用は経路を塞ぐだけの機械を減らす
+static constexpr double OPTIMIZE_GRADE_WEIGHT = 10.0;
+static constexpr double OPTIMIZE_PRODUCED_WEIGHT = 0.01;
+static constexpr double OPTIMIZE_MACHINE_COST = 0.05;
+
+static constexpr size_t OPTIMIZE_CACHE_CAPACITY = 1 << 16;  // 全シャードの合計
+static constexpr int OPTIMIZE_PLACE_ATTEMPTS = 16;
+static constexpr int OPTIMIZE_ITEM_COUNT = ITEM_CHIP + 1;
+
+// 出力ダクトのアイテムからレシピを遡った段数ごとに半分にする
+// 出力に繋がらないアイテムは 0
+static std::vector<double> get_item_weights(const StageDefinition& stage) {
+  std::vector<int> depth(OPTIMIZE_ITEM_COUNT, -1);
+  for (const auto& record : stage.machines) {
+    if (record.type == MACHINE_OUTPUT_DUCT) depth[record.item] = 0;
+  }
+
+  std::vector<Recipe> recipes;
+  for (int type = MACHINE_ELECTROLYZER; type <= MACHINE_ASSEMBLER; ++type) {
+    make_machine(static_cast<Machines>(type), glm::ivec2(0, 0), ITEM_WATER)
+        ->build_recipes(recipes);
+  }
+
+  // 段数はアイテムの数を超えない
+  for (int pass = 0; pass < OPTIMIZE_ITEM_COUNT; ++pass) {
+    for (const auto& recipe : recipes) {
+      int next = -1;
+      for (const auto item : recipe.outputs) {
+        if (depth[item] >= 0 && (next < 0 || depth[item] < next))
+          next = depth[item];
+      }
+      if (next < 0) continue;
+
+      for (const auto item : recipe.inputs) {
+        if (depth[item] < 0 || depth[item] > next + 1) depth[item] = next + 1;
+      }
+    }
+  }
+
+  std::vector<double> weights(OPTIMIZE_ITEM_COUNT, 0.0);
+  for (int item = 0; item < OPTIMIZE_ITEM_COUNT; ++item) {
+    if (depth[item] >= 0)
+      weights[item] = OPTIMIZE_PRODUCED_WEIGHT * std::pow(0.5, depth[item]);
+  }
+  return weights;
+}
+
+// PORTS
+
+// 機械の位置からの相対座標と, ポートごとに扱えるアイテムのビット集合
+struct OptimizePorts {
+  std::vector<glm::ivec2> inputs;
+  std::vector<glm::ivec2> outputs;
+  std::vector<uint32_t> input_items;
+  std::vector<uint32_t> output_items;
+};
+
+// 種類とアイテムの組ごとに 1 度だけ機械を作って調べる
+static const OptimizePorts& get_ports(const MachineRecord& record) {
+  static const std::vector<OptimizePorts> table = [] {
+    std::vector<OptimizePorts> result;
+    for (int type = 0; type <= MACHINE_OUTPUT_DUCT; ++type) {
+      for (int item = 0; item < OPTIMIZE_ITEM_COUNT; ++item) {
+        const auto machine =
+            make_machine(static_cast<Machines>(type), glm::ivec2(0, 0),
+                         static_cast<Item>(item));
+        MachinePorts ports;
+        std::vector<Recipe> recipes;
+        machine->build_ports(ports);
+        machine->build_recipes(recipes);
+
+        OptimizePorts entry;
+        entry.inputs = ports.inputs;
+        entry.outputs = ports.outputs;
+        entry.input_items.assign(ports.inputs.size(), 0);
+        entry.output_items.assign(ports.outputs.size(), 0);
+        for (const auto& recipe : recipes) {
+          for (size_t i = 0;
+               i < recipe.inputs.size() && i < entry.input_items.size(); ++i)
+            entry.input_items[i] |= 1u << recipe.inputs[i];
+          for (size_t i = 0;
+               i < recipe.outputs.size() && i < entry.output_items.size(); ++i)
+            entry.output_items[i] |= 1u << recipe.outputs[i];
+        }
+        result.push_back(std::move(entry));
+      }
+    }
+    return result;
+  }();
+  return table[record.type * OPTIMIZE_ITEM_COUNT + record.item];
+}
+
+static glm::ivec2 get_input_point(const MachineRecord& record,
+                                  const int port) {
+  return glm::ivec2(record.x, record.y) + get_ports(record).inputs[port];
+}
+
+static glm::ivec2 get_output_point(const MachineRecord& record,
+                                   const int port) {
+  return glm::ivec2(record.x, record.y) + get_ports(record).outputs[port];
+}
+
+// 機械の行と上下のポートの行を合わせた 3 行が重なれば true
+static bool machines_overlap(const MachineRecord& a, const MachineRecord& b) {
+  return std::abs(a.y - b.y) <= 2 && a.x < b.x + MACHINE_WIDTH &&
+         b.x < a.x + MACHINE_WIDTH;
+}
+
+// BUILDER
+
+// 接続ごとにパイプの経路を探し, 管理クラスへ書き込む
+class OptimizeBuilder {
+ public:
+  OptimizeBuilder();
+
+  void build(const StageDefinition& stage, const OptimizeLayout& layout,
+             MachineManager& machine_manager, PipeManager& pipe_manager);
+
+  // 直前に組み立てた要素, 評価器へ渡す順
+  const std::vector<std::shared_ptr<Machine>>& get_machines() const;
+  const std::vector<std::shared_ptr<Pipe>>& get_pipes() const;
+
+ private:
+  void reserve(const StageDefinition& stage, const OptimizeLayout& layout);
+
+  PipeRouter m_router;
+  OccupancyGrid m_reserved;  // 盤面の枠, ダクト, 全てのポート
+  std::vector<glm::ivec2> m_route;
+  std::vector<std::shared_ptr<Machine>> m_machines;
+  std::vector<std::shared_ptr<Pipe>> m_pipes;
+};
+
+OptimizeBuilder::OptimizeBuilder()
+    : m_reserved(std::pmr::get_default_resource()) {}
+
+const std::vector<std::shared_ptr<Machine>>& OptimizeBuilder::get_machines()
+    const {
+  return m_machines;
+}
+
+const std::vector<std::shared_ptr<Pipe>>& OptimizeBuilder::get_pipes() const {
+  return m_pipes;
+}
+
+// 経路が盤面の外へ出たり, 他の機械のポートを通って繋がったりしないようにする
+// 始点と終点のポートは塞がれていても通れる
+void OptimizeBuilder::reserve(const StageDefinition& stage,
+                              const OptimizeLayout& layout) {
+  const int width = stage.grid_size.x, height = stage.grid_size.y;
+  m_reserved.clear();
+  m_reserved.set_span(-1, -1, width + 2);
+  m_reserved.set_span(-1, height, width + 2);
+  for (int y = 0; y < height; ++y) {
+    m_reserved.set(-1, y);
+    m_reserved.set(width, y);
+  }
+
+  for (const auto& record : layout.machines) {
+    m_reserved.set_span(record.x, record.y, MACHINE_WIDTH);
+    const auto& ports = get_ports(record);
+    for (size_t i = 0; i < ports.inputs.size(); ++i) {
+      const auto point = get_input_point(record, static_cast<int>(i));
+      m_reserved.set(point.x, point.y);
+    }
+    for (size_t i = 0; i < ports.outputs.size(); ++i) {
+      const auto point = get_output_point(record, static_cast<int>(i));
+      m_reserved.set(point.x, point.y);
+    }
+  }
+}
+
+void OptimizeBuilder::build(const StageDefinition& stage,
+                            const OptimizeLayout& layout,
+                            MachineManager& machine_manager,
+                            PipeManager& pipe_manager) {
+  machine_manager.clear();
+  pipe_manager.clear();
+  m_machines.clear();
+  m_pipes.clear();
+
+  for (const auto& record : layout.machines) {
+    m_machines.push_back(make_machine(record));
+  }
+  machine_manager.add_machines(m_machines);
+  reserve(stage, layout);
+
+  for (const auto& link : layout.links) {
+    const auto src =
+        get_output_point(layout.machines[link.src], link.src_port);
+    const auto dst = get_input_point(layout.machines[link.dst], link.dst_port);
+    if (!m_router.route({&machine_manager.get_occupancy(),
+                         &pipe_manager.get_occupancy(), &m_reserved},
+                        src, dst, m_route))
+      continue;
+
+    for (size_t i = 1; i < m_route.size(); ++i) {
+      const auto pipe = make_pipe(m_route[i - 1], m_route[i]);
+      pipe_manager.add_pipe(pipe);
+      m_pipes.push_back(pipe);
+    }
+  }
+}
+
+void build_optimize_layout(const StageDefinition& stage,
+                           const OptimizeLayout& layout,
+                           MachineManager& machine_manager,
+                           PipeManager& pipe_manager) {
+  OptimizeBuilder builder;
+  builder.build(stage, layout, machine_manager, pipe_manager);
+}
+
+// CHAIN
+
+// 上位 keep 件を良い順に, 同じレイアウトは 1 つだけ残す
+static void remember(std::vector<OptimizeCandidate>& best,
+                     const OptimizeCandidate& candidate, const int keep) {
+  for (const auto& other : best) {
+    if (other.hash == candidate.hash) return;
+  }
+  if (static_cast<int>(best.size()) >= keep &&
+      best.back().objective >= candidate.objective)
+    return;
+
+  const auto it = std::find_if(best.begin(), best.end(), [&](const auto& o) {
+    return o.objective < candidate.objective;
+  });
+  best.insert(it, candidate);
+  if (static_cast<int>(best.size()) > keep) best.pop_back();
+}
+
+// 焼きなましの鎖 1 本, run は 1 つのスレッドからだけ呼ぶ
+class OptimizeChain {
+ public:
+  OptimizeChain(const StageDefinition& stage, const OptimizeOptions& options,
+                EvaluateCache& cache, uint64_t seed);
+
+  // 温度を begin から end まで下げながら iterations 回試す
+  void run(int iterations, double temperature_begin, double temperature_end);
+
+  const OptimizeCandidate& get_current() const;
+  void set_current(const OptimizeCandidate& candidate);
+  const std::vector<OptimizeCandidate>& get_best() const;
+  int64_t get_evaluations() const;
+  int64_t get_cache_hits() const;
+
+ private:
+  OptimizeCandidate evaluate(OptimizeLayout layout);
+
+  bool mutate(OptimizeLayout& layout);
+  bool move_machine(OptimizeLayout& layout);
+  bool add_machine(OptimizeLayout& layout);
+  bool remove_machine(OptimizeLayout& layout);
+  bool rewire_input(OptimizeLayout& layout);
+  bool add_link(OptimizeLayout& layout);
+
+  bool find_place(const OptimizeLayout& layout, int ignore, glm::ivec2 near,
+                  int spread, MachineRecord* record);
+  bool link_input(OptimizeLayout& layout, int machine, int port);
+  bool link_output(OptimizeLayout& layout, int machine, int port);
+  int random_int(int min, int max);
+
+  const StageDefinition& m_stage;
+  const OptimizeOptions& m_options;
+  EvaluateCache& m_cache;
+  std::vector<double> m_item_weights;
+  std::default_random_engine m_rng;
+  MachineManager m_machine_manager;
+  PipeManager m_pipe_manager;
+  OptimizeBuilder m_builder;
+  OptimizeCandidate m_current;
+  std::vector<OptimizeCandidate> m_best;
+  int64_t m_evaluations;
+  int64_t m_cache_hits;
+};
+
+OptimizeChain::OptimizeChain(const StageDefinition& stage,
+                             const OptimizeOptions& options,
+                             EvaluateCache& cache, const uint64_t seed)
+    : m_stage(stage),
+      m_options(options),
+      m_cache(cache),
+      m_item_weights(get_item_weights(stage)),
+      m_rng(static_cast<std::default_random_engine::result_type>(seed)),
+      m_current(),
+      m_evaluations(0),
+      m_cache_hits(0) {
+  // ダクトだけの盤面から始める
+  OptimizeLayout layout;
+  layout.machines = stage.machines;
+  m_current = evaluate(std::move(layout));
+  remember(m_best, m_current, m_options.keep);
+}
+
+const OptimizeCandidate& OptimizeChain::get_current() const {
+  return m_current;
+}
+
+void OptimizeChain::set_current(const OptimizeCandidate& candidate) {
+  m_current = candidate;
+}
+
+const std::vector<OptimizeCandidate>& OptimizeChain::get_best() const {
+  return m_best;
+}
+
+int64_t OptimizeChain::get_evaluations() const { return m_evaluations; }
+
+int64_t OptimizeChain::get_cache_hits() const { return m_cache_hits; }
+
+int OptimizeChain::random_int(const int min, const int max) {
+  return std::uniform_int_distribution(min, max)(m_rng);
+}
+
+OptimizeCandidate OptimizeChain::evaluate(OptimizeLayout layout) {
+  m_builder.build(m_stage, layout, m_machine_manager, m_pipe_manager);
+
+  OptimizeCandidate candidate;
+  candidate.hash = m_machine_manager.get_hash() + m_pipe_manager.get_hash();
+
+  const auto key = EvaluateKey{candidate.hash, m_stage.stage, EVALUATE_TICKS,
+                               m_options.evaluate_seed};
+  EvaluateContext stats;
+  std::vector<int> produced;
+  ++m_evaluations;
+  if (m_cache.find(key, &stats, &produced)) {
+    ++m_cache_hits;
+  } else {
+    Evaluator evaluator(m_builder.get_machines(), m_builder.get_pipes());
+    std::default_random_engine rng(m_options.evaluate_seed);
+    for (int tick = 0; tick < EVALUATE_TICKS; ++tick) evaluator.step(rng);
+
+    stats.stage = m_stage.stage;
+    stats.design_time = m_stage.design_time;
+    evaluator.write_stats(&stats);
+    evaluator.write_produced(produced);
+    m_cache.insert(key, stats, &produced);
+  }
+
+  candidate.score = get_evaluate_score(stats);
+  candidate.objective =
+      candidate.score.grade * OPTIMIZE_GRADE_WEIGHT + candidate.score.value;
+  for (size_t item = 0; item < produced.size(); ++item) {
+    candidate.objective += produced[item] * m_item_weights[item];
+  }
+  const auto placed = layout.machines.size() - m_stage.machines.size();
+  candidate.objective -= OPTIMIZE_MACHINE_COST * placed;
+
+  candidate.layout = std::move(layout);
+  candidate.stats = std::move(stats);
+  return candidate;
+}
+
+void OptimizeChain::run(const int iterations, const double temperature_begin,
+                        const double temperature_end) {
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  for (int i = 0; i < iterations; ++i) {
+    const double t = iterations > 1 ? static_cast<double>(i) / (iterations - 1)
+                                    : 0.0;
+    const double temperature =
+        temperature_begin * std::pow(temperature_end / temperature_begin, t);
+
+    auto layout = m_current.layout;
+    if (!mutate(layout)) continue;
+
+    auto candidate = evaluate(std::move(layout));
+    remember(m_best, candidate, m_options.keep);
+
+    const double delta = candidate.objective - m_current.objective;
+    if (delta >= 0.0 || uniform(m_rng) < std::exp(delta / temperature)) {
+      m_current = std::move(candidate);
+    }
+  }
+}
+
+bool OptimizeChain::mutate(OptimizeLayout& layout) {
+  const int roll = random_int(0, 99);
+  if (roll < 35) return move_machine(layout);
+  if (roll < 55) return add_machine(layout);
+  if (roll < 65) return remove_machine(layout);
+  if (roll < 90) return rewire_input(layout);
+  return add_link(layout);
+}
+
+// spread が負なら盤面全体から, そうでなければ near の周りから空きを探す
+bool OptimizeChain::find_place(const OptimizeLayout& layout, const int ignore,
+                               const glm::ivec2 near, const int spread,
+                               MachineRecord* record) {
+  const int max_x = m_stage.grid_size.x - MACHINE_WIDTH;
+  const int max_y = m_stage.grid_size.y - 2;
+  if (max_x < 0 || max_y < 1) return false;
+
+  for (int attempt = 0; attempt < OPTIMIZE_PLACE_ATTEMPTS; ++attempt) {
+    glm::ivec2 point;
+    if (spread < 0) {
+      point = glm::ivec2(random_int(0, max_x), random_int(1, max_y));
+    } else {
+      point = near + glm::ivec2(random_int(-spread, spread),
+                                random_int(-spread / 3, spread / 3));
+      point.x = std::clamp(point.x, 0, max_x);
+      point.y = std::clamp(point.y, 1, max_y);
+    }
+
+    record->x = point.x;
+    record->y = point.y;
+    bool is_free = true;
+    for (int i = 0; i < static_cast<int>(layout.machines.size()); ++i) {
+      if (i != ignore && machines_overlap(layout.machines[i], *record)) {
+        is_free = false;
+        break;
+      }
+    }
+    if (is_free) return true;
+  }
+  return false;
+}
+
+bool OptimizeChain::move_machine(OptimizeLayout& layout) {
+  const int fixed = static_cast<int>(m_stage.machines.size());
+  const int count = static_cast<int>(layout.machines.size());
+  if (count == fixed) return false;
+
+  const int index = random_int(fixed, count - 1);
+  auto record = layout.machines[index];
+  const auto point = glm::ivec2(record.x, record.y);
+  const int spread = random_int(0, 4) == 0 ? -1 : 12;
+  if (!find_place(layout, index, point, spread, &record)) return false;
+
+  layout.machines[index] = record;
+  return true;
+}
+
+// 入力と出力をそれぞれ扱えるアイテムが合うポートへ繋いで置く
+bool OptimizeChain::add_machine(OptimizeLayout& layout) {
+  const int fixed = static_cast<int>(m_stage.machines.size());
+  if (static_cast<int>(layout.machines.size()) - fixed >=
+      m_options.max_machines)
+    return false;
+
+  MachineRecord record = {};
+  record.type = static_cast<uint32_t>(
+      random_int(MACHINE_ELECTROLYZER, MACHINE_ASSEMBLER));
+  record.item = ITEM_WATER;
+  if (!find_place(layout, -1, glm::ivec2(0, 0), -1, &record)) return false;
+
+  layout.machines.push_back(record);
+  const int index = static_cast<int>(layout.machines.size()) - 1;
+  const auto& ports = get_ports(record);
+  for (int i = 0; i < static_cast<int>(ports.inputs.size()); ++i) {
+    link_input(layout, index, i);
+  }
+  for (int i = 0; i < static_cast<int>(ports.outputs.size()); ++i) {
+    link_output(layout, index, i);
+  }
+  return true;
+}
+
+bool OptimizeChain::remove_machine(OptimizeLayout& layout) {
+  const int fixed = static_cast<int>(m_stage.machines.size());
+  const int count = static_cast<int>(layout.machines.size());
+  if (count == fixed) return false;
+
+  const int index = random_int(fixed, count - 1);
+  layout.machines.erase(layout.machines.begin() + index);
+
+  auto& links = layout.links;
+  links.erase(std::remove_if(links.begin(), links.end(),
+                             [&](const OptimizeLink& link) {
+                               return link.src == index || link.dst == index;
+                             }),
+              links.end());
+  for (auto& link : links) {
+    if (link.src > index) --link.src;
+    if (link.dst > index) --link.dst;
+  }
+  return true;
+}
+
+// 入力ポートを 1 つ選んで繋ぎ直す, 一部は繋がないまま残す
+bool OptimizeChain::rewire_input(OptimizeLayout& layout) {
+  std::vector<std::pair<int, int>> inputs;
+  for (int i = 0; i < static_cast<int>(layout.machines.size()); ++i) {
+    const auto& ports = get_ports(layout.machines[i]);
+    for (int port = 0; port < static_cast<int>(ports.inputs.size()); ++port) {
+      inputs.emplace_back(i, port);
+    }
+  }
+  if (inputs.empty()) return false;
+
+  const auto [machine, port] =
+      inputs[random_int(0, static_cast<int>(inputs.size()) - 1)];
+  auto& links = layout.links;
+  const auto end = std::remove_if(
+      links.begin(), links.end(), [&](const OptimizeLink& link) {
+        return link.dst == machine && link.dst_port == port;
+      });
+  const bool removed = end != links.end();
+  links.erase(end, links.end());
+
+  if (random_int(0, 4) == 0) return removed;
+  return link_input(layout, machine, port) || removed;
+}
+
+bool OptimizeChain::add_link(OptimizeLayout& layout) {
+  std::vector<std::pair<int, int>> outputs;
+  for (int i = 0; i < static_cast<int>(layout.machines.size()); ++i) {
+    const auto& ports = get_ports(layout.machines[i]);
+    for (int port = 0; port < static_cast<int>(ports.outputs.size()); ++port) {
+      outputs.emplace_back(i, port);
+    }
+  }
+  if (outputs.empty()) return false;
+
+  const auto [machine, port] =
+      outputs[random_int(0, static_cast<int>(outputs.size()) - 1)];
+  return link_output(layout, machine, port);
+}
+
+// 扱えるアイテムが重なる出力ポートを 1 つ選んで繋ぐ
+bool OptimizeChain::link_input(OptimizeLayout& layout, const int machine,
+                               const int port) {
+  const uint32_t items = get_ports(layout.machines[machine]).input_items[port];
+
+  std::vector<std::pair<int, int>> sources;
+  for (int i = 0; i < static_cast<int>(layout.machines.size()); ++i) {
+    if (i == machine) continue;
+    const auto& ports = get_ports(layout.machines[i]);
+    for (int p = 0; p < static_cast<int>(ports.outputs.size()); ++p) {
+      if (ports.output_items[p] & items) sources.emplace_back(i, p);
+    }
+  }
+  if (sources.empty()) return false;
+
+  const auto [src, src_port] =
+      sources[random_int(0, static_cast<int>(sources.size()) - 1)];
+  for (const auto& link : layout.links) {
+    if (link.src == src && link.src_port == src_port && link.dst == machine &&
+        link.dst_port == port)
+      return false;
+  }
+  layout.links.push_back(OptimizeLink{src, src_port, machine, port});
+  return true;
+}
+
+bool OptimizeChain::link_output(OptimizeLayout& layout, const int machine,
+                                const int port) {
+  const uint32_t items =
+      get_ports(layout.machines[machine]).output_items[port];
+
+  std::vector<std::pair<int, int>> targets;
+  for (int i = 0; i < static_cast<int>(layout.machines.size()); ++i) {
+    if (i == machine) continue;
+    const auto& ports = get_ports(layout.machines[i]);
+    for (int p = 0; p < static_cast<int>(ports.inputs.size()); ++p) {
+      if (ports.input_items[p] & items) targets.emplace_back(i, p);
+    }
+  }
+  if (targets.empty()) return false;
+
+  const auto [dst, dst_port] =
+      targets[random_int(0, static_cast<int>(targets.size()) - 1)];
+  for (const auto& link : layout.links) {
+    if (link.src == machine && link.src_port == port && link.dst == dst &&
+        link.dst_port == dst_port)
+      return false;
+  }
+  layout.links.push_back(OptimizeLink{machine, port, dst, dst_port});
+  return true;
+}
+
+// OPTIMIZE
+
+OptimizeResult optimize_stage(
+    const StageDefinition& stage, const OptimizeOptions& options,
+    const std::function<void(const OptimizeProgress&)>& on_epoch) {
+  const auto start = std::chrono::steady_clock::now();
+  const int thread_count =
+      options.threads > 0
+          ? options.threads
+          : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  const int keep = std::max(options.keep, 1);
+  auto chain_options = options;
+  chain_options.keep = keep;
+
+  // 鎖ごとの乱数は seed から離れた値にする
+  // 全ての鎖で共有する評価結果, 目的関数に使う produced ごと入れる
+  EvaluateCache cache(OPTIMIZE_CACHE_CAPACITY);
+  std::vector<std::unique_ptr<OptimizeChain>> chains;
+  for (int i = 0; i < thread_count; ++i) {
+    chains.push_back(std::make_unique<OptimizeChain>(
+        stage, chain_options, cache,
+        options.seed + 0x9e3779b97f4a7c15ull * static_cast<uint64_t>(i + 1)));
+  }
+
+  OptimizeResult result;
+  result.evaluations = 0;
+  result.cache_hits = 0;
+  result.seconds = 0.0;
+
+  const int epochs = std::max(options.epochs, 1);
+  const double ratio = static_cast<double>(options.end_temperature) /
+                       options.start_temperature;
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    const double begin =
+        options.start_temperature *
+        std::pow(ratio, static_cast<double>(epoch) / epochs);
+    const double end = options.start_temperature *
+                       std::pow(ratio, static_cast<double>(epoch + 1) / epochs);
+
+    std::vector<std::thread> threads;
+    for (auto& chain : chains) {
+      threads.emplace_back([&, chain = chain.get()] {
+        chain->run(options.iterations, begin, end);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // 悪い半分の鎖を良い半分の現在の状態から続けさせる
+    std::vector<int> order(chains.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+      return chains[a]->get_current().objective >
+             chains[b]->get_current().objective;
+    });
+    for (size_t i = 0; i < order.size() / 2; ++i) {
+      chains[order[order.size() - 1 - i]]->set_current(
+          chains[order[i]]->get_current());
+    }
+
+    result.best.clear();
+    result.evaluations = 0;
+    result.cache_hits = 0;
+    for (const auto& chain : chains) {
+      for (const auto& candidate : chain->get_best()) {
+        remember(result.best, candidate, keep);
+      }
+      result.evaluations += chain->get_evaluations();
+      result.cache_hits += chain->get_cache_hits();
+    }
+    result.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    if (on_epoch) {
+      on_epoch(OptimizeProgress{epoch, result.best.front().objective,
+                                result.best.front().score, result.evaluations,
+                                result.cache_hits, result.seconds});
+    }
+  }
+  return result;
+}
+
+}  // namespace factory_game
@@ -1,20 +1,60 @@
 #include "pipe.h"
 
 #include <algorithm>
+#include <cstdlib>
+
+#include "profile.h"
 
 namespace factory_game {
 
 // SPATIAL IDX
 
-PipeSpatialIdx::PipeSpatialIdx(
-    std::unordered_map<glm::ivec2, std::shared_ptr<Pipe>>& spatial_idx,
-    std::shared_ptr<Pipe>& cursor)
-    : m_spatial_idx(spatial_idx), m_cursor(cursor) {}
+PipeSpatialIdx::PipeSpatialIdx(PipeSpatialMap& spatial_idx,
+                               PipeShadowMap& shadowed,
+                               OccupancyGrid& occupancy,
+                               std::shared_ptr<Pipe>& cursor,
+                               const bool is_erase)
+    : m_spatial_idx(spatial_idx),
+      m_shadowed(shadowed),
+      m_occupancy(occupancy),
+      m_cursor(cursor),
+      m_is_erase(is_erase) {}
 
 PipeSpatialIdx::~PipeSpatialIdx() = default;
 
+// 別のパイプが書いたセルは, そのパイプを隠して上に書く
+// 外すときは隠れていたパイプを戻し, 無ければセルを空ける
 void PipeSpatialIdx::Write(const glm::ivec2 point) const {
-  m_spatial_idx.insert_or_assign(point, m_cursor);
+  if (!m_is_erase) {
+    const auto [it, inserted] = m_spatial_idx.try_emplace(point, m_cursor);
+    if (!inserted && it->second != m_cursor) {
+      m_shadowed.emplace(point, std::move(it->second));
+      it->second = m_cursor;
+    }
+    m_occupancy.set(point.x, point.y);
+    return;
+  }
+
+  const auto it = m_spatial_idx.find(point);
+  if (it == m_spatial_idx.end()) return;
+  if (it->second != m_cursor) {
+    const auto range = m_shadowed.equal_range(point);
+    for (auto shadow = range.first; shadow != range.second; ++shadow) {
+      if (shadow->second != m_cursor) continue;
+      m_shadowed.erase(shadow);
+      break;
+    }
+    return;
+  }
+
+  const auto shadow = m_shadowed.find(point);
+  if (shadow != m_shadowed.end()) {
+    it->second = std::move(shadow->second);
+    m_shadowed.erase(shadow);
+    return;
+  }
+  m_spatial_idx.erase(it);
+  m_occupancy.reset(point.x, point.y);
 }
 
 // PIPE
@@ -24,6 +64,11 @@ Pipe::Pipe(const glm::ivec2 begin, const glm::ivec2 end)
 
 Pipe::~Pipe() = default;
 
+// 占有セル数
+int Pipe::get_length() const {
+  return std::abs(end.x - begin.x) + std::abs(end.y - begin.y) + 1;
+}
+
 void Pipe::draw(DrawManagerBase* draw_manager) const {
   if (begin.x == end.x || begin.y == end.y) {
     draw_manager->draw_hv_line(begin.x, begin.y, end.x, end.y);
@@ -70,29 +115,101 @@ void Pipe::build_spatial_idx(const PipeSpatialIdx& writer) const {
   }
 }
 
+std::shared_ptr<Pipe> make_pipe(const glm::ivec2 begin, const glm::ivec2 end,
+                                StageArena* arena) {
+  return make_entity<Pipe>(arena, begin, end);
+}
+
 // PIPE MANAGER
 
-PipeManager::PipeManager() {}
+PipeManager::PipeManager(StageArena* arena)
+    : m_arena(arena),
+      m_hash(0),
+      m_pipes(get_resource(arena, MEMORY_PIPE_SET)),
+      m_spatial_idx(get_resource(arena, MEMORY_PIPE_INDEX)),
+      m_shadowed(get_resource(arena, MEMORY_PIPE_INDEX)),
+      m_occupancy(get_resource(arena, MEMORY_OCCUPANCY)),
+      m_draw_list(get_resource(arena, MEMORY_DRAW_LIST)) {}
 
 PipeManager::~PipeManager() = default;
 
-void PipeManager::add_pipe(const std::shared_ptr<Pipe>& pipe) {
-  m_pipes.insert(pipe);
-  build_spatial_idx();
+// 機械の種類と重ならないキー空間を使う
+static constexpr uint64_t PIPE_ZOBRIST_KIND = 0x70697065;
+
+uint64_t pipe_zobrist_key(const std::shared_ptr<Pipe>& pipe) {
+  return zobrist_key(PIPE_ZOBRIST_KIND, pipe->begin.x, pipe->begin.y,
+                     pipe->end.x, pipe->end.y);
+}
+
+static void record_pipe(RetainedDrawList& draw_list,
+                        const std::shared_ptr<Pipe>& pipe) {
+  draw_list.set(pipe.get(), [&](DrawManagerBase* draw_manager) {
+    pipe->draw(draw_manager);
+  });
+}
+
+// 追加では他のパイプのセルは変わらないので, 追加分だけを書き込む
+void PipeManager::add_pipe(std::shared_ptr<Pipe> pipe) {
+  if (!m_pipes.insert(pipe).second) return;
+  m_hash += pipe_zobrist_key(pipe);
+  record_pipe(m_draw_list, pipe);
+
+  auto writer =
+      PipeSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, pipe);
+  pipe->build_spatial_idx(writer);
+}
+
+// 一括追加, 空間インデックスは追加分だけを 1 回ずつ書き込む
+void PipeManager::add_pipes(const std::vector<std::shared_ptr<Pipe>>& pipes) {
+  m_pipes.reserve(m_pipes.size() + pipes.size());
+
+  for (auto pipe : pipes) {
+    if (!m_pipes.insert(pipe).second) continue;
+    m_hash += pipe_zobrist_key(pipe);
+    record_pipe(m_draw_list, pipe);
+
+    auto writer =
+        PipeSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, pipe);
+    pipe->build_spatial_idx(writer);
+  }
+}
+
+void PipeManager::clear() {
+  m_pipes.clear();
+  m_spatial_idx.clear();
+  m_shadowed.clear();
+  m_occupancy.clear();
+  m_draw_list.clear();
+  m_hash = 0;
 }
 
 void PipeManager::build_spatial_idx() {
   m_spatial_idx.clear();
+  m_shadowed.clear();
+  m_occupancy.clear();
 
   for (auto pipe : m_pipes) {
-    auto writer = PipeSpatialIdx(m_spatial_idx, pipe);
+    auto writer =
+        PipeSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, pipe);
     pipe->build_spatial_idx(writer);
   }
 }
 
+// 他のパイプのセルは変わらないので, 外すパイプのセルだけを消す
 void PipeManager::remove_pipe(const std::shared_ptr<Pipe>& pipe) {
-  m_pipes.erase(pipe);
-  build_spatial_idx();
+  if (!m_pipes.erase(pipe)) return;
+  m_hash -= pipe_zobrist_key(pipe);
+  m_draw_list.remove(pipe.get());
+
+  auto cursor = pipe;
+  const auto eraser =
+      PipeSpatialIdx(m_spatial_idx, m_shadowed, m_occupancy, cursor, true);
+  pipe->build_spatial_idx(eraser);
+}
+
+void PipeManager::remove_pipes(
+    const std::vector<std::shared_ptr<Pipe>>& pipes) {
+  for (const auto& pipe : pipes) remove_pipe(pipe);
 }
 
 std::shared_ptr<Pipe> PipeManager::find_pipe(const glm::ivec2 point) {
@@ -101,10 +218,44 @@ std::shared_ptr<Pipe> PipeManager::find_pipe(const glm::ivec2 point) {
   return it->second;
 }
 
-void PipeManager::draw(DrawManagerBase* draw_manager) const {
-  for (const auto pipe : m_pipes) {
-    pipe->draw(draw_manager);
-  }
+// 占有ビットで空きのセルを飛ばし, 占有されたセルだけを索引で引く
+void PipeManager::find_pipes(const glm::ivec2 min, const glm::ivec2 max,
+                             std::vector<std::shared_ptr<Pipe>>& pipes) const {
+  const size_t begin = pipes.size();
+  m_occupancy.for_each_set(min.x, min.y, max.x, max.y, [&](int x, int y) {
+    const auto it = m_spatial_idx.find(glm::ivec2(x, y));
+    if (it == m_spatial_idx.end()) return;
+    if (pipes.size() > begin && pipes.back() == it->second) return;
+    pipes.push_back(it->second);
+  });
+
+  std::sort(pipes.begin() + begin, pipes.end());
+  pipes.erase(std::unique(pipes.begin() + begin, pipes.end()), pipes.end());
+}
+
+const PipeSet& PipeManager::get_pipes() const { return m_pipes; }
+
+const OccupancyGrid& PipeManager::get_occupancy() const { return m_occupancy; }
+
+uint64_t PipeManager::get_hash() const { return m_hash; }
+
+StageArena* PipeManager::get_arena() const { return m_arena; }
+
+void PipeManager::write_footprint(std::vector<FootprintEntry>& entries) const {
+  entries.push_back(make_footprint_entry("pipe set", MEMORY_PIPE_SET, m_pipes));
+  entries.push_back(
+      make_footprint_entry("pipe index", MEMORY_PIPE_INDEX, m_spatial_idx));
+  entries.push_back(
+      make_footprint_entry("pipe shadowed", MEMORY_PIPE_INDEX, m_shadowed));
+  m_occupancy.write_footprint("pipe occupancy", entries);
+  m_draw_list.write_footprint("pipe tiles", entries);
+}
+
+void PipeManager::draw(DrawManagerBase* draw_manager,
+                       const glm::ivec2 camera) const {
+  ProfileScope scope(PROFILE_PIPE_DRAW);
+
+  m_draw_list.draw(draw_manager, camera.x, camera.y);
 }
 
 }  // namespace factory_game
\ No newline at end of file
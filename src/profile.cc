@@ -0,0 +1,162 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace factory_game {
+
+const char* profile_phase_to_string(const ProfilePhase phase) {
+  switch (phase) {
+    case PROFILE_UPDATE:
+      return "update";
+    case PROFILE_CAPTURE_INPUT:
+      return "capture_input";
+    case PROFILE_MACHINE_DRAW:
+      return "machine_draw";
+    case PROFILE_PIPE_DRAW:
+      return "pipe_draw";
+    case PROFILE_ROUTE:
+      return "route";
+    case PROFILE_CHUNK_PAGE:
+      return "chunk_page";
+    case PROFILE_PRESENT:
+      return "present";
+    default:
+      return "unknown";
+  }
+}
+
+// PROFILE BUFFER
+
+ProfileBuffer::ProfileBuffer(const int thread_id)
+    : m_thread_id(thread_id),
+      m_window(),
+      m_window_count(),
+      m_history(PROFILE_HISTORY),
+      m_history_count(0) {}
+
+void ProfileBuffer::record(const ProfilePhase phase, const int64_t begin,
+                           const int64_t end) {
+  const int64_t duration = end - begin;
+
+  {
+    std::lock_guard lock(m_window_mutex);
+    m_window[phase][m_window_count[phase] % PROFILE_WINDOW] = duration;
+    m_window_count[phase]++;
+  }
+
+  m_history[m_history_count % PROFILE_HISTORY] =
+      ProfileEvent{begin, duration, phase};
+  m_history_count++;
+}
+
+// PROFILER
+
+Profiler::Profiler()
+    : m_origin(std::chrono::steady_clock::now()), m_overlay_visible(false) {}
+
+ProfileBuffer& Profiler::get_buffer() {
+  thread_local ProfileBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    std::lock_guard lock(m_mutex);
+    m_buffers.push_back(
+        std::make_unique<ProfileBuffer>(static_cast<int>(m_buffers.size())));
+    buffer = m_buffers.back().get();
+  }
+  return *buffer;
+}
+
+int64_t Profiler::now() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - m_origin)
+      .count();
+}
+
+ProfileStats Profiler::get_stats(const ProfilePhase phase) {
+  std::vector<int64_t> samples;
+  {
+    std::lock_guard lock(m_mutex);
+    samples.reserve(m_buffers.size() * PROFILE_WINDOW);
+    for (const auto& buffer : m_buffers) {
+      std::lock_guard window_lock(buffer->m_window_mutex);
+      const int count =
+          std::min(buffer->m_window_count[phase], PROFILE_WINDOW);
+      samples.insert(samples.end(), buffer->m_window[phase],
+                     buffer->m_window[phase] + count);
+    }
+  }
+
+  const int count = static_cast<int>(samples.size());
+  if (count == 0) return ProfileStats{0, 0, 0};
+
+  std::sort(samples.begin(), samples.end());
+  return ProfileStats{samples[count / 2], samples[count * 99 / 100], count};
+}
+
+void Profiler::toggle_overlay() { m_overlay_visible = !m_overlay_visible; }
+
+bool Profiler::is_overlay_visible() const { return m_overlay_visible; }
+
+// Chrome の about://tracing や Perfetto で読める Trace Event 形式
+bool Profiler::write_chrome_trace(const std::string& path) {
+  std::ofstream stream(path, std::ios::trunc);
+  if (!stream) return false;
+
+  stream << "{\"traceEvents\":[";
+  bool first = true;
+
+  std::lock_guard lock(m_mutex);
+  for (const auto& buffer : m_buffers) {
+    const size_t count = std::min(buffer->m_history_count, PROFILE_HISTORY);
+    const size_t start = buffer->m_history_count - count;
+
+    for (size_t i = start; i < buffer->m_history_count; ++i) {
+      const auto& event = buffer->m_history[i % PROFILE_HISTORY];
+      stream << (first ? "\n" : ",\n") << "{\"name\":\""
+             << profile_phase_to_string(event.phase)
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->m_thread_id
+             << ",\"ts\":" << event.begin / 1000 << "."
+             << std::setw(3) << std::setfill('0') << event.begin % 1000
+             << ",\"dur\":" << event.duration / 1000 << "." << std::setw(3)
+             << event.duration % 1000 << "}";
+      first = false;
+    }
+  }
+
+  stream << "\n]}\n";
+  return static_cast<bool>(stream);
+}
+
+Profiler& get_profiler() {
+  static Profiler profiler;
+  return profiler;
+}
+
+// OVERLAY
+
+void draw_profile_overlay(DrawManagerBase* draw_manager) {
+  auto& profiler = get_profiler();
+  if (!profiler.is_overlay_visible()) return;
+
+  constexpr int x = 2;
+  constexpr int y = 4;
+  draw_manager->draw_clear_box(x - 1, y - 1, 44, PROFILE_PHASE_COUNT + 3);
+  draw_manager->draw_line_box(x - 1, y - 1, 44, PROFILE_PHASE_COUNT + 3);
+  draw_manager->draw_label(x, y, "phase            p50 ms    p99 ms");
+
+  for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+    const auto phase = static_cast<ProfilePhase>(i);
+    const auto stats = profiler.get_stats(phase);
+
+    std::ostringstream stream;
+    stream << std::left << std::setw(15) << profile_phase_to_string(phase)
+           << std::right << std::fixed << std::setprecision(3)
+           << std::setw(8) << stats.p50 / 1e6 << "  " << std::setw(8)
+           << stats.p99 / 1e6;
+    draw_manager->draw_label(x, y + 1 + i, stream.str());
+  }
+}
+
+}  // namespace factory_game
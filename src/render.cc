@@ -0,0 +1,127 @@
+#include "render.h"
+
+#include <chrono>
+
+namespace factory_game {
+
+// DRAW SNAPSHOT
+
+void DrawSnapshot::clear() {
+  commands.clear();
+  text.clear();
+}
+
+void DrawSnapshot::push(const DrawCommandKind kind, const int x0, const int y0,
+                        const int x1, const int y1,
+                        const std::string_view label) {
+  commands.push_back(DrawCommand{kind, x0, y0, x1, y1,
+                                 static_cast<uint32_t>(text.size()),
+                                 static_cast<uint32_t>(label.size())});
+  text.append(label);
+}
+
+// text は source の text_begin が指す文字列
+void DrawSnapshot::append(const DrawCommand* source, const size_t count,
+                          const std::string_view label) {
+  const auto offset = static_cast<uint32_t>(text.size());
+  for (size_t i = 0; i < count; ++i) {
+    commands.push_back(source[i]);
+    commands.back().text_begin += offset;
+  }
+  text.append(label);
+}
+
+void DrawSnapshot::replay(DrawManagerBase* draw_manager) const {
+  draw_manager->draw_commands(commands.data(), commands.size(), text);
+}
+
+// THREADED
+
+DrawManagerThreaded::DrawManagerThreaded(DrawManagerBase* draw_manager)
+    : m_draw_manager(draw_manager), m_stop(false) {
+  m_thread = std::thread(&DrawManagerThreaded::run, this);
+}
+
+DrawManagerThreaded::~DrawManagerThreaded() {
+  m_stop = true;
+  m_thread.join();
+  delete m_draw_manager;
+}
+
+int DrawManagerThreaded::get_width() { return m_draw_manager->get_width(); }
+
+int DrawManagerThreaded::get_height() { return m_draw_manager->get_height(); }
+
+void DrawManagerThreaded::clear() {
+  m_snapshots.get_back().push(DRAW_COMMAND_CLEAR, 0, 0, 0, 0);
+}
+
+void DrawManagerThreaded::draw_label(const int x, const int y,
+                                     const std::string_view text) {
+  m_snapshots.get_back().push(DRAW_COMMAND_LABEL, x, y, 0, 0, text);
+}
+
+void DrawManagerThreaded::draw_label_box(const int x, const int y,
+                                         const std::string_view text) {
+  m_snapshots.get_back().push(DRAW_COMMAND_LABEL_BOX, x, y, 0, 0, text);
+}
+
+void DrawManagerThreaded::draw_clear_box(const int x, const int y,
+                                         const int width, const int height) {
+  m_snapshots.get_back().push(DRAW_COMMAND_CLEAR_BOX, x, y, width, height);
+}
+
+void DrawManagerThreaded::draw_line_box(const int x, const int y,
+                                        const int width, const int height) {
+  m_snapshots.get_back().push(DRAW_COMMAND_LINE_BOX, x, y, width, height);
+}
+
+void DrawManagerThreaded::draw_hv_line(const int x0, const int y0,
+                                       const int x1, const int y1) {
+  m_snapshots.get_back().push(DRAW_COMMAND_HV_LINE, x0, y0, x1, y1);
+}
+
+// 描画スレッドが読んでいる間も書けるよう, 公開後は別のスロットへ書く
+void DrawManagerThreaded::present() {
+  m_snapshots.publish();
+  m_snapshots.get_back().clear();
+}
+
+void DrawManagerThreaded::draw_commands(const DrawCommand* commands,
+                                        const size_t count,
+                                        const std::string_view text) {
+  m_snapshots.get_back().append(commands, count, text);
+}
+
+void DrawManagerThreaded::capture_input() { m_draw_manager->capture_input(); }
+
+bool DrawManagerThreaded::handle_input_keycode(const int keycode) {
+  return m_draw_manager->handle_input_keycode(keycode);
+}
+
+bool DrawManagerThreaded::handle_input_mouse(const int state, int& x, int& y) {
+  return m_draw_manager->handle_input_mouse(state, x, y);
+}
+
+bool DrawManagerThreaded::handle_input_drag(int& dx, int& dy) {
+  return m_draw_manager->handle_input_drag(dx, dy);
+}
+
+bool DrawManagerThreaded::handle_input_hover(int& x, int& y) {
+  return m_draw_manager->handle_input_hover(x, y);
+}
+
+// 端末が遅いときは間のスナップショットを飛ばして最新のものだけを描く
+void DrawManagerThreaded::run() {
+  while (!m_stop) {
+    if (!m_snapshots.acquire()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    m_snapshots.get_front().replay(m_draw_manager);
+    m_draw_manager->present();
+  }
+}
+
+}  // namespace factory_game
@@ -0,0 +1,404 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "layout.h"
+#include "profile.h"
+
+namespace factory_game {
+
+// INPUT LOG
+
+// 記録の座標は 16 bit なので, 大きさもその範囲に収まる
+static bool is_screen_size(const int width, const int height) {
+  return width > 0 && height > 0 && width <= INT16_MAX && height <= INT16_MAX;
+}
+
+bool save_input_log(const std::string& path, const uint32_t frame_count,
+                    const int width, const int height,
+                    const std::vector<InputRecord>& records) {
+  const InputLogHeader header = {INPUT_LOG_MAGIC,
+                                 INPUT_LOG_VERSION,
+                                 frame_count,
+                                 static_cast<uint32_t>(records.size()),
+                                 width,
+                                 height};
+
+  std::vector<char> buffer(sizeof(header) +
+                           records.size() * sizeof(InputRecord));
+  std::memcpy(buffer.data(), &header, sizeof(header));
+  std::memcpy(buffer.data() + sizeof(header), records.data(),
+              records.size() * sizeof(InputRecord));
+
+  // 2 byte のフィールドは 4 byte 単位の入れ替え後に並びを戻す
+  if (!LAYOUT_NATIVE_ENDIAN) {
+    swap_layout_words(buffer.data(), buffer.size());
+    for (size_t i = sizeof(header) + offsetof(InputRecord, x);
+         i < buffer.size(); i += sizeof(InputRecord)) {
+      std::swap_ranges(buffer.data() + i, buffer.data() + i + 2,
+                       buffer.data() + i + 2);
+    }
+  }
+
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream) return false;
+  stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return static_cast<bool>(stream);
+}
+
+bool load_input_log(const std::string& path, uint32_t* frame_count,
+                    int* width, int* height,
+                    std::vector<InputRecord>* records) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) return false;
+
+  std::vector<char> buffer((std::istreambuf_iterator<char>(stream)),
+                           std::istreambuf_iterator<char>());
+  if (buffer.size() < sizeof(InputLogHeader)) return false;
+
+  if (!LAYOUT_NATIVE_ENDIAN) {
+    swap_layout_words(buffer.data(), buffer.size());
+    for (size_t i = sizeof(InputLogHeader) + offsetof(InputRecord, x);
+         i < buffer.size(); i += sizeof(InputRecord)) {
+      std::swap_ranges(buffer.data() + i, buffer.data() + i + 2,
+                       buffer.data() + i + 2);
+    }
+  }
+
+  InputLogHeader header;
+  std::memcpy(&header, buffer.data(), sizeof(header));
+  if (header.magic != INPUT_LOG_MAGIC || header.version != INPUT_LOG_VERSION ||
+      buffer.size() !=
+          sizeof(header) + header.record_count * sizeof(InputRecord))
+    return false;
+  if (!is_screen_size(header.width, header.height)) return false;
+
+  *frame_count = header.frame_count;
+  *width = header.width;
+  *height = header.height;
+  records->resize(header.record_count);
+  std::memcpy(records->data(), buffer.data() + sizeof(header),
+              header.record_count * sizeof(InputRecord));
+  return true;
+}
+
+// RECORDER
+
+DrawManagerRecorder::DrawManagerRecorder(DrawManagerBase* draw_manager)
+    : m_draw_manager(draw_manager),
+      m_frame(0),
+      m_width(draw_manager->get_width()),
+      m_height(draw_manager->get_height()),
+      m_last_width(m_width),
+      m_last_height(m_height) {}
+
+DrawManagerRecorder::~DrawManagerRecorder() { delete m_draw_manager; }
+
+int DrawManagerRecorder::get_width() { return m_draw_manager->get_width(); }
+
+int DrawManagerRecorder::get_height() { return m_draw_manager->get_height(); }
+
+void DrawManagerRecorder::clear() { m_draw_manager->clear(); }
+
+void DrawManagerRecorder::draw_label(const int x, const int y,
+                                     const std::string_view text) {
+  m_draw_manager->draw_label(x, y, text);
+}
+
+void DrawManagerRecorder::draw_label_box(const int x, const int y,
+                                         const std::string_view text) {
+  m_draw_manager->draw_label_box(x, y, text);
+}
+
+void DrawManagerRecorder::draw_clear_box(const int x, const int y,
+                                         const int width, const int height) {
+  m_draw_manager->draw_clear_box(x, y, width, height);
+}
+
+void DrawManagerRecorder::draw_line_box(const int x, const int y,
+                                        const int width, const int height) {
+  m_draw_manager->draw_line_box(x, y, width, height);
+}
+
+void DrawManagerRecorder::draw_hv_line(const int x0, const int y0,
+                                       const int x1, const int y1) {
+  m_draw_manager->draw_hv_line(x0, y0, x1, y1);
+}
+
+void DrawManagerRecorder::present() { m_draw_manager->present(); }
+
+void DrawManagerRecorder::draw_commands(const DrawCommand* commands,
+                                        const size_t count,
+                                        const std::string_view text) {
+  m_draw_manager->draw_commands(commands, count, text);
+}
+
+// 画面の大きさでカメラの範囲や画面とワールドの対応が変わるので, 変化も残す
+void DrawManagerRecorder::capture_input() {
+  m_draw_manager->capture_input();
+  m_frame++;
+
+  const int width = m_draw_manager->get_width();
+  const int height = m_draw_manager->get_height();
+  if (width == m_last_width && height == m_last_height) return;
+  if (!is_screen_size(width, height)) return;
+
+  m_last_width = width;
+  m_last_height = height;
+  record(InputRecord{m_frame, INPUT_RECORD_RESIZE, 0,
+                     static_cast<int16_t>(width),
+                     static_cast<int16_t>(height)});
+}
+
+bool DrawManagerRecorder::handle_input_keycode(const int keycode) {
+  if (!m_draw_manager->handle_input_keycode(keycode)) return false;
+
+  record(InputRecord{m_frame, INPUT_RECORD_KEYCODE, keycode, 0, 0});
+  return true;
+}
+
+bool DrawManagerRecorder::handle_input_mouse(const int state, int& x, int& y) {
+  if (!m_draw_manager->handle_input_mouse(state, x, y)) return false;
+
+  record(InputRecord{m_frame, INPUT_RECORD_MOUSE, state,
+                     static_cast<int16_t>(x), static_cast<int16_t>(y)});
+  return true;
+}
+
+bool DrawManagerRecorder::handle_input_drag(int& dx, int& dy) {
+  if (!m_draw_manager->handle_input_drag(dx, dy)) return false;
+
+  record(InputRecord{m_frame, INPUT_RECORD_DRAG, 0, static_cast<int16_t>(dx),
+                     static_cast<int16_t>(dy)});
+  return true;
+}
+
+// Link Pipe の経路のプレビューはカーソルで決まるので, 再生でも同じ位置を通す
+bool DrawManagerRecorder::handle_input_hover(int& x, int& y) {
+  if (!m_draw_manager->handle_input_hover(x, y)) return false;
+
+  record(InputRecord{m_frame, INPUT_RECORD_HOVER, 0, static_cast<int16_t>(x),
+                     static_cast<int16_t>(y)});
+  return true;
+}
+
+void DrawManagerRecorder::mark_state_change() {
+  record(InputRecord{m_frame, INPUT_RECORD_STATE, 0, 0, 0});
+}
+
+bool DrawManagerRecorder::save(const std::string& path) const {
+  return save_input_log(path, m_frame, m_width, m_height, m_records);
+}
+
+// 同じフレームで同じ入力が複数回判定されても 1 件だけ残す
+void DrawManagerRecorder::record(const InputRecord record) {
+  for (auto it = m_records.rbegin();
+       it != m_records.rend() && it->frame == record.frame; ++it) {
+    if (it->kind == record.kind && it->code == record.code &&
+        it->x == record.x && it->y == record.y)
+      return;
+  }
+  m_records.push_back(record);
+}
+
+// HEADLESS
+
+DrawManagerHeadless::DrawManagerHeadless(const uint32_t frame_count,
+                                         std::vector<InputRecord> records,
+                                         const int width, const int height)
+    : m_width(width),
+      m_height(height),
+      m_current_buffer(get_heap_resource(MEMORY_DRAW_BUFFER)),
+      m_back_buffer(get_heap_resource(MEMORY_DRAW_BUFFER)),
+      m_frame_count(frame_count),
+      m_records(std::move(records)),
+      m_cursor(0),
+      m_state_cursor(0),
+      m_frame(0) {
+  m_current_buffer.assign(m_width * m_height, ' ');
+  m_back_buffer.assign(m_width * m_height, ' ');
+
+  std::stable_sort(
+      m_records.begin(), m_records.end(),
+      [](const auto& a, const auto& b) { return a.frame < b.frame; });
+}
+
+DrawManagerHeadless::~DrawManagerHeadless() = default;
+
+int DrawManagerHeadless::get_width() { return m_width; }
+
+int DrawManagerHeadless::get_height() { return m_height; }
+
+void DrawManagerHeadless::clear() {
+  std::fill(m_back_buffer.begin(), m_back_buffer.end(), ' ');
+}
+
+void DrawManagerHeadless::draw_label(const int x, const int y,
+                                     const std::string_view text) {
+  if (y < 0 || y >= m_height) return;
+
+  for (size_t i = 0; i < text.length(); ++i) {
+    const int current_x = x + i;
+    if (current_x < 0 || current_x >= m_width) continue;
+
+    m_back_buffer[y * m_width + current_x] = text[i];
+  }
+}
+
+void DrawManagerHeadless::draw_label_box(const int x, const int y,
+                                         const std::string_view text) {
+  draw_line_box(x - 1, y - 1, text.length() + 2, 3);
+  draw_label(x, y, text);
+}
+
+void DrawManagerHeadless::draw_clear_box(const int x, const int y,
+                                         const int width, const int height) {
+  for (int j = 0; j < height; ++j) {
+    const int current_y = y + j;
+    if (current_y < 0 || current_y >= m_height) continue;
+
+    for (int i = 0; i < width; ++i) {
+      const int current_x = x + i;
+      if (current_x < 0 || current_x >= m_width) continue;
+
+      m_back_buffer[current_y * m_width + current_x] = ' ';
+    }
+  }
+}
+
+void DrawManagerHeadless::draw_line_box(const int x, const int y,
+                                        const int width, const int height) {
+  draw_hv_line(x, y, x + width - 1, y);
+  draw_hv_line(x, y + height - 1, x + width - 1, y + height - 1);
+  draw_hv_line(x, y, x, y + height - 1);
+  draw_hv_line(x + width - 1, y, x + width - 1, y + height - 1);
+}
+
+void DrawManagerHeadless::draw_hv_line(int x0, int y0, int x1, int y1) {
+  // 垂直線
+  if (x0 == x1 && x0 >= 0 && x0 < m_width) {
+    if (y0 > y1) std::swap(y0, y1);
+
+    for (int y = y0; y <= y1; ++y) {
+      if (y < 0 || y >= m_height) continue;
+
+      m_back_buffer[y * m_width + x0] = (y == y0 || y == y1) ? '+' : '|';
+    }
+  }
+
+  // 水平線
+  if (y0 == y1 && y0 >= 0 && y0 < m_height) {
+    if (x0 > x1) std::swap(x0, x1);
+
+    for (int x = x0; x <= x1; ++x) {
+      if (x < 0 || x >= m_width) continue;
+
+      m_back_buffer[y0 * m_width + x] = (x == x0 || x == x1) ? '+' : '-';
+    }
+  }
+}
+
+void DrawManagerHeadless::present() {
+  ProfileScope scope(PROFILE_PRESENT);
+
+  m_current_buffer = m_back_buffer;
+  export_frame(m_current_buffer, m_width, m_height);
+}
+
+void DrawManagerHeadless::capture_input() {
+  ProfileScope scope(PROFILE_CAPTURE_INPUT);
+
+  m_inputs.clear();
+
+  // 記録時より State の切り替えが遅れている間は入力を進めずに待つ
+  while (m_state_cursor < m_records.size() &&
+         m_records[m_state_cursor].kind != INPUT_RECORD_STATE) {
+    m_state_cursor++;
+  }
+  if (m_state_cursor < m_records.size() &&
+      m_records[m_state_cursor].frame <= m_frame)
+    return;
+
+  m_frame++;
+
+  while (m_cursor < m_records.size() &&
+         m_records[m_cursor].frame <= m_frame) {
+    const auto& record = m_records[m_cursor++];
+    if (record.kind == INPUT_RECORD_RESIZE) {
+      resize(record.x, record.y);
+    } else if (record.frame == m_frame && record.kind != INPUT_RECORD_STATE) {
+      m_inputs.push_back(record);
+    }
+  }
+}
+
+bool DrawManagerHeadless::handle_input_keycode(const int keycode) {
+  for (const auto& input : m_inputs) {
+    if (input.kind == INPUT_RECORD_KEYCODE && input.code == keycode)
+      return true;
+  }
+  return false;
+}
+
+bool DrawManagerHeadless::handle_input_mouse(const int state, int& x, int& y) {
+  for (const auto& input : m_inputs) {
+    if (input.kind == INPUT_RECORD_MOUSE && input.code == state) {
+      x = input.x;
+      y = input.y;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DrawManagerHeadless::handle_input_drag(int& dx, int& dy) {
+  for (const auto& input : m_inputs) {
+    if (input.kind == INPUT_RECORD_DRAG) {
+      dx = input.x;
+      dy = input.y;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DrawManagerHeadless::handle_input_hover(int& x, int& y) {
+  for (const auto& input : m_inputs) {
+    if (input.kind == INPUT_RECORD_HOVER) {
+      x = input.x;
+      y = input.y;
+      return true;
+    }
+  }
+  return false;
+}
+
+// 記録より早く State が切り替わった場合は, 記録側の切り替えまで読み飛ばす
+void DrawManagerHeadless::mark_state_change() {
+  while (m_state_cursor < m_records.size() &&
+         m_records[m_state_cursor].kind != INPUT_RECORD_STATE) {
+    m_state_cursor++;
+  }
+  if (m_state_cursor >= m_records.size()) return;
+
+  m_frame = std::max(m_frame, m_records[m_state_cursor].frame);
+  m_state_cursor++;
+}
+
+void DrawManagerHeadless::resize(const int width, const int height) {
+  if (width == m_width && height == m_height) return;
+  if (!is_screen_size(width, height)) return;
+
+  m_width = width;
+  m_height = height;
+  m_current_buffer.assign(m_width * m_height, ' ');
+  m_back_buffer.assign(m_width * m_height, ' ');
+}
+
+bool DrawManagerHeadless::is_finished() const {
+  return m_frame >= m_frame_count && m_state_cursor >= m_records.size();
+}
+
+}  // namespace factory_game
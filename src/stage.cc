@@ -0,0 +1,309 @@
+#include "stage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace factory_game {
+
+constexpr const char* STAGE_DIRECTORY = "stages";
+constexpr const char* STAGE_EXTENSION = ".stage";
+constexpr const char* STAGE_PACK_NAME = "stages.pack";
+
+// TEXT
+
+// 1 行 1 命令, # 以降はコメント
+//   stage <id>
+//   design_time <tick>
+//   grid <width> <height>
+//   input <x> <y> <item>
+//   output <x> <y> <item>
+bool parse_stage(const std::string& path, StageDefinition* stage) {
+  std::ifstream stream(path);
+  if (!stream) return false;
+
+  *stage = StageDefinition{0, 60 * 60, glm::ivec2(120, 30), {}};
+
+  std::string line;
+  while (std::getline(stream, line)) {
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream line_stream(line);
+    std::string command;
+    if (!(line_stream >> command)) continue;
+
+    if (command == "stage") {
+      if (!(line_stream >> stage->stage)) return false;
+    } else if (command == "design_time") {
+      if (!(line_stream >> stage->design_time)) return false;
+    } else if (command == "grid") {
+      if (!(line_stream >> stage->grid_size.x >> stage->grid_size.y))
+        return false;
+    } else if (command == "input" || command == "output") {
+      MachineRecord record = {};
+      record.type = command == "input" ? MACHINE_INPUT_DUCT
+                                       : MACHINE_OUTPUT_DUCT;
+      if (!(line_stream >> record.x >> record.y)) return false;
+
+      std::string name;
+      std::getline(line_stream >> std::ws, name);
+      name.erase(name.find_last_not_of(" \t\r") + 1);
+
+      Item item;
+      if (!string_to_item(name, &item)) return false;
+      record.item = item;
+
+      stage->machines.push_back(record);
+    } else {
+      return false;
+    }
+  }
+
+  return stage->stage > 0;
+}
+
+bool compile_stages(const std::string& directory,
+                    std::vector<StageDefinition>* stages) {
+  stages->clear();
+
+  bool result = true;
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(directory, error)) {
+    if (entry.path().extension() != STAGE_EXTENSION) continue;
+
+    StageDefinition stage;
+    if (parse_stage(entry.path().string(), &stage)) {
+      stages->push_back(std::move(stage));
+    } else {
+      std::cerr << "failed to parse stage: " << entry.path().string()
+                << std::endl;
+      result = false;
+    }
+  }
+  if (error) {
+    std::cerr << "failed to read stage directory: " << directory << std::endl;
+    result = false;
+  }
+
+  std::sort(stages->begin(), stages->end(),
+            [](const auto& a, const auto& b) { return a.stage < b.stage; });
+  return result;
+}
+
+// 並べた .stage ファイルと, その中で一番新しい更新時刻
+static bool list_stage_sources(
+    const std::filesystem::path& directory,
+    std::vector<StageSourceRecord>* sources,
+    std::filesystem::file_time_type* newest) {
+  sources->clear();
+  *newest = std::filesystem::file_time_type::min();
+
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(directory, error)) {
+    if (entry.path().extension() != STAGE_EXTENSION) continue;
+
+    // FNV-1a
+    uint32_t name_hash = 2166136261u;
+    for (const char c : entry.path().filename().string()) {
+      name_hash = (name_hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    const auto size = entry.file_size(error);
+    const auto time = entry.last_write_time(error);
+    if (error) return false;
+
+    sources->push_back({name_hash, static_cast<uint32_t>(size)});
+    *newest = std::max(*newest, time);
+  }
+
+  std::sort(sources->begin(), sources->end(),
+            [](const auto& a, const auto& b) {
+              return a.name_hash < b.name_hash ||
+                     (a.name_hash == b.name_hash && a.size < b.size);
+            });
+  return !error;
+}
+
+static bool is_same_sources(const std::vector<StageSourceRecord>& a,
+                            const std::vector<StageSourceRecord>& b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                    [](const auto& x, const auto& y) {
+                      return x.name_hash == y.name_hash && x.size == y.size;
+                    });
+}
+
+// PACK
+
+bool save_stage_pack(const std::string& path,
+                     const std::vector<StageDefinition>& stages,
+                     const std::vector<StageSourceRecord>& sources) {
+  size_t size = sizeof(StagePackHeader) +
+                sources.size() * sizeof(StageSourceRecord);
+  for (const auto& stage : stages) {
+    size += sizeof(StageRecord) + stage.machines.size() * sizeof(MachineRecord);
+  }
+
+  std::vector<char> buffer(size);
+  char* cursor = buffer.data();
+
+  const StagePackHeader header = {STAGE_PACK_MAGIC, STAGE_PACK_VERSION,
+                                  static_cast<uint32_t>(stages.size()),
+                                  static_cast<uint32_t>(sources.size())};
+  std::memcpy(cursor, &header, sizeof(header));
+  cursor += sizeof(header);
+
+  const size_t sources_size = sources.size() * sizeof(StageSourceRecord);
+  std::memcpy(cursor, sources.data(), sources_size);
+  cursor += sources_size;
+
+  for (const auto& stage : stages) {
+    const StageRecord record = {
+        static_cast<uint32_t>(stage.stage),
+        static_cast<uint32_t>(stage.design_time),
+        stage.grid_size.x,
+        stage.grid_size.y,
+        static_cast<uint32_t>(stage.machines.size()),
+        0};
+    std::memcpy(cursor, &record, sizeof(record));
+    cursor += sizeof(record);
+
+    const size_t machines_size = stage.machines.size() * sizeof(MachineRecord);
+    std::memcpy(cursor, stage.machines.data(), machines_size);
+    cursor += machines_size;
+  }
+
+  if (!LAYOUT_NATIVE_ENDIAN) swap_layout_words(buffer.data(), buffer.size());
+
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream) return false;
+  stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  return static_cast<bool>(stream);
+}
+
+bool load_stage_pack(const std::string& path,
+                     std::vector<StageDefinition>* stages,
+                     std::vector<StageSourceRecord>* sources) {
+  stages->clear();
+  sources->clear();
+
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) return false;
+
+  std::vector<char> buffer((std::istreambuf_iterator<char>(stream)),
+                           std::istreambuf_iterator<char>());
+  if (!LAYOUT_NATIVE_ENDIAN) swap_layout_words(buffer.data(), buffer.size());
+
+  const char* cursor = buffer.data();
+  const char* end = buffer.data() + buffer.size();
+
+  StagePackHeader header;
+  if (end - cursor < static_cast<ptrdiff_t>(sizeof(header))) return false;
+  std::memcpy(&header, cursor, sizeof(header));
+  cursor += sizeof(header);
+  if (header.magic != STAGE_PACK_MAGIC || header.version != STAGE_PACK_VERSION)
+    return false;
+
+  const size_t sources_size = header.source_count * sizeof(StageSourceRecord);
+  if (static_cast<size_t>(end - cursor) < sources_size) return false;
+  sources->resize(header.source_count);
+  std::memcpy(sources->data(), cursor, sources_size);
+  cursor += sources_size;
+
+  for (uint32_t i = 0; i < header.stage_count; ++i) {
+    StageRecord record;
+    if (end - cursor < static_cast<ptrdiff_t>(sizeof(record))) return false;
+    std::memcpy(&record, cursor, sizeof(record));
+    cursor += sizeof(record);
+
+    const size_t machines_size = record.machine_count * sizeof(MachineRecord);
+    if (end - cursor < static_cast<ptrdiff_t>(machines_size)) return false;
+
+    StageDefinition stage;
+    stage.stage = static_cast<int>(record.stage);
+    stage.design_time = static_cast<int>(record.design_time);
+    stage.grid_size = glm::ivec2(record.width, record.height);
+    stage.machines.resize(record.machine_count);
+    std::memcpy(stage.machines.data(), cursor, machines_size);
+    cursor += machines_size;
+
+    stages->push_back(std::move(stage));
+  }
+
+  return true;
+}
+
+// DIRECTORY
+
+static std::string& get_stage_directory_override() {
+  static std::string directory;
+  return directory;
+}
+
+void set_stage_directory(const std::string& directory) {
+  get_stage_directory_override() = directory;
+}
+
+// 分からなければ空
+static std::filesystem::path get_executable_directory() {
+#if defined(__linux__)
+  std::error_code error;
+  const auto path = std::filesystem::read_symlink("/proc/self/exe", error);
+  if (!error) return path.parent_path();
+#endif
+  return {};
+}
+
+// ビルドでは stages/ を実行ファイルの隣へ写すので, 作業ディレクトリに依らない
+static std::filesystem::path get_stage_directory() {
+  if (!get_stage_directory_override().empty())
+    return get_stage_directory_override();
+
+  const auto executable_directory = get_executable_directory();
+  if (!executable_directory.empty()) {
+    std::error_code error;
+    const auto directory = executable_directory / STAGE_DIRECTORY;
+    if (std::filesystem::is_directory(directory, error)) return directory;
+  }
+  return STAGE_DIRECTORY;
+}
+
+// パックがどのテキストよりも新しく, 同じファイルから作られていればそのまま使う
+// 読めないファイルがあればパックを残さず, 次の起動でもまた知らせる
+const std::vector<StageDefinition>& get_stages() {
+  static const std::vector<StageDefinition> stages = [] {
+    const auto directory = get_stage_directory();
+    const std::string pack_path = (directory / STAGE_PACK_NAME).string();
+
+    std::vector<StageSourceRecord> sources;
+    std::filesystem::file_time_type newest;
+    const bool is_listed = list_stage_sources(directory, &sources, &newest);
+
+    std::vector<StageDefinition> result;
+    std::vector<StageSourceRecord> pack_sources;
+    std::error_code error;
+    const auto pack_time = std::filesystem::last_write_time(pack_path, error);
+    if (is_listed && !error && newest <= pack_time &&
+        load_stage_pack(pack_path, &result, &pack_sources) &&
+        is_same_sources(sources, pack_sources)) {
+      return result;
+    }
+
+    if (compile_stages(directory.string(), &result) && is_listed)
+      save_stage_pack(pack_path, result, sources);
+    return result;
+  }();
+  return stages;
+}
+
+const StageDefinition* find_stage(const int stage) {
+  for (const auto& definition : get_stages()) {
+    if (definition.stage == stage) return &definition;
+  }
+  return nullptr;
+}
+
+}  // namespace factory_game
@@ -1,7 +1,13 @@
 #include "state.h"
 
+#include <algorithm>
+#include <fstream>
 #include <iomanip>
 
+#include "layout.h"
+#include "profile.h"
+#include "stage.h"
+
 namespace factory_game {
 
 // STATE
@@ -10,6 +16,21 @@ State::State() {}
 
 State::~State() = default;
 
+// 矢印キーと中ボタンのドラッグでカメラを動かす
+static void scroll_camera(DrawManagerBase* draw_manager, glm::ivec2& camera) {
+  constexpr int SCROLL_X = 8;
+  constexpr int SCROLL_Y = 4;
+
+  if (draw_manager->handle_input_keycode(KEYCODE_LEFT)) camera.x -= SCROLL_X;
+  if (draw_manager->handle_input_keycode(KEYCODE_RIGHT)) camera.x += SCROLL_X;
+  if (draw_manager->handle_input_keycode(KEYCODE_UP)) camera.y -= SCROLL_Y;
+  if (draw_manager->handle_input_keycode(KEYCODE_DOWN)) camera.y += SCROLL_Y;
+
+  // 掴んだ位置がカーソルに付いてくるよう, 逆向きに動かす
+  int dx, dy;
+  if (draw_manager->handle_input_drag(dx, dy)) camera -= glm::ivec2(dx, dy);
+}
+
 // TITLE STATE
 
 TitleState::TitleState() {}
@@ -45,73 +66,268 @@ State* TitleState::update(DrawManagerBase* draw_manager) {
 
 // IN-GAME STATE
 
+InGameWorld::InGameWorld(StageArena* arena)
+    : pipe_manager(arena),
+      machine_manager(arena),
+      preview(arena),
+      history(arena) {}
+
 InGameState::InGameState(const int stage)
-    : m_mode(MODE_PLACE_PIPE),
+    : m_arena(),
+      m_world(m_arena.create<InGameWorld>(&m_arena)),
+      m_pipe_manager(m_world->pipe_manager),
+      m_machine_manager(m_world->machine_manager),
+      m_preview(m_world->preview),
+      m_history(m_world->history),
+      m_camera(0, 0),
+      m_cursor(0, 0),
+      m_route_goal(0, 0),
+      m_route_found(false),
+      m_blueprint(),
+      m_mode(MODE_PLACE_PIPE),
       m_mode_state({}),
       m_rng(std::random_device()()),
-      m_stats() {
+      m_seed(m_rng()),
+      m_stats(),
+      m_footprint_visible(false) {
   m_stats.stage = stage;
   m_stats.design_time = 60 * 60;
 
-  // Stage 1.
-  if (stage == 1) {
-    {
-      const auto machine =
-          std::make_shared<InputDuct>(InputDuct(glm::ivec2(50, 5), ITEM_WATER));
-      m_machine_manager.add_machine(machine);
-    }
-    {
-      const auto machine = std::make_shared<OutputDuct>(
-          OutputDuct(glm::ivec2(30, 25), ITEM_HYDROGEN));
-      m_machine_manager.add_machine(machine);
-    }
-    {
-      const auto machine = std::make_shared<OutputDuct>(
-          OutputDuct(glm::ivec2(70, 25), ITEM_OXYGEN));
-      m_machine_manager.add_machine(machine);
+  const auto definition = find_stage(stage);
+  if (definition != nullptr) {
+    m_stats.design_time = definition->design_time;
+
+    std::vector<std::shared_ptr<Machine>> machines;
+    machines.reserve(definition->machines.size());
+    for (const auto& record : definition->machines) {
+      const auto machine = make_machine(record, &m_arena);
+      if (machine) machines.push_back(machine);
     }
+
+    m_machine_manager.add_machines(machines);
+    m_preview.add_entities(machines, {});
   }
+}
 
-  // Stage 2.
-  if (stage == 2) {
-    {
-      const auto machine = std::make_shared<InputDuct>(
-          InputDuct(glm::ivec2(30, 5), ITEM_SILICON));
-      m_machine_manager.add_machine(machine);
-    }
-    {
-      const auto machine = std::make_shared<InputDuct>(
-          InputDuct(glm::ivec2(50, 5), ITEM_SOLDERING_IRON));
-      m_machine_manager.add_machine(machine);
-    }
-    {
-      const auto machine = std::make_shared<InputDuct>(
-          InputDuct(glm::ivec2(70, 5), ITEM_CIRCUIT_BOARD));
-      m_machine_manager.add_machine(machine);
-    }
-    {
-      const auto machine = std::make_shared<OutputDuct>(
-          OutputDuct(glm::ivec2(50, 25), ITEM_CHIP));
-      m_machine_manager.add_machine(machine);
-    }
+// 世界は arena ごと捨てるので, arena の外にある途中の見積もりだけを片付ける
+InGameState::~InGameState() { m_preview.stop(); }
+
+void InGameState::add_machine(const std::shared_ptr<Machine>& machine) {
+  m_machine_manager.add_machine(machine);
+  m_preview.add_machine(machine);
+}
+
+void InGameState::remove_machine(const std::shared_ptr<Machine>& machine) {
+  m_machine_manager.remove_machine(machine);
+  m_preview.remove_machine(machine);
+}
+
+void InGameState::add_pipe(const std::shared_ptr<Pipe>& pipe) {
+  m_pipe_manager.add_pipe(pipe);
+  m_preview.add_pipe(pipe);
+}
+
+void InGameState::remove_pipe(const std::shared_ptr<Pipe>& pipe) {
+  m_pipe_manager.remove_pipe(pipe);
+  m_preview.remove_pipe(pipe);
+}
+
+std::string InGameState::get_layout_path() const {
+  return "stage" + std::to_string(m_stats.stage) + ".fgl";
+}
+
+void InGameState::save() {
+  save_layout(get_layout_path(), m_stats.stage, m_machine_manager,
+              m_pipe_manager);
+}
+
+bool InGameState::load(const std::string& path) {
+  LayoutFile file;
+  if (!file.open(path)) return false;
+  if (static_cast<int>(file.get_header().stage) != m_stats.stage) return false;
+
+  load_layout(file, m_machine_manager, m_pipe_manager);
+
+  const auto& machine_set = m_machine_manager.get_machines();
+  const auto& pipe_set = m_pipe_manager.get_pipes();
+  m_preview.clear();
+  m_preview.add_entities(
+      std::vector<std::shared_ptr<Machine>>(machine_set.begin(),
+                                            machine_set.end()),
+      std::vector<std::shared_ptr<Pipe>>(pipe_set.begin(), pipe_set.end()));
+
+  // 読み込んだ版より前には戻さない
+  std::vector<WorldEntity> entities;
+  entities.reserve(machine_set.size() + pipe_set.size());
+  for (const auto& machine : machine_set) {
+    if (machine->is_breakable()) entities.push_back({machine, nullptr});
   }
+  for (const auto& pipe : pipe_set) entities.push_back({nullptr, pipe});
+  m_history.reset(entities);
+  return true;
 }
 
-InGameState::~InGameState() = default;
+// 同じステージ内では同じシードで評価し, 同じレイアウトはキャッシュから返す
+EvaluateKey InGameState::get_evaluate_key() const {
+  return EvaluateKey{m_machine_manager.get_hash() + m_pipe_manager.get_hash(),
+                     m_stats.stage, EVALUATE_TICKS, m_seed};
+}
+
+void InGameState::start_evaluate() {
+  const auto& machine_set = m_machine_manager.get_machines();
+  const auto& pipe_set = m_pipe_manager.get_pipes();
+  const auto machines = std::vector<std::shared_ptr<Machine>>(
+      machine_set.begin(), machine_set.end());
+  const auto pipes =
+      std::vector<std::shared_ptr<Pipe>>(pipe_set.begin(), pipe_set.end());
+
+  m_evaluate_worker.set_speed(m_mode_state.Evaluate.speed);
+  m_evaluate_worker.start(Evaluator(machines, pipes, &m_arena), EVALUATE_TICKS,
+                          m_seed);
+}
+
+std::vector<FootprintEntry> InGameState::get_footprint() const {
+  std::vector<FootprintEntry> entries;
+  m_machine_manager.write_footprint(entries);
+  m_pipe_manager.write_footprint(entries);
+  m_preview.write_footprint(entries);
+  m_history.write_footprint(entries);
+  return entries;
+}
+
+// 重なっていれば同じ行で最も近い空きへずらし, 1 台分より遠ければ置かない
+bool InGameState::find_machine_slot(const glm::ivec2 point,
+                                    glm::ivec2* slot) const {
+  int x;
+  if (!find_free_span({&m_machine_manager.get_occupancy(),
+                       &m_pipe_manager.get_occupancy()},
+                      point.x, point.y, MACHINE_WIDTH, MACHINE_WIDTH, &x)) {
+    return false;
+  }
+
+  *slot = glm::ivec2(x, point.y);
+  return true;
+}
+
+// LinkPipe の始点から goal への経路, 終点が変わったときだけ探し直す
+bool InGameState::update_route(const glm::ivec2 goal) {
+  const auto start =
+      glm::ivec2(m_mode_state.LinkPipe.x, m_mode_state.LinkPipe.y);
+  if (goal == m_route_goal && !m_route.empty() && m_route.front() == start) {
+    return m_route_found;
+  }
+
+  m_route_goal = goal;
+  m_route_found = m_router.route(
+      {&m_machine_manager.get_occupancy(), &m_pipe_manager.get_occupancy()},
+      start, goal, m_route);
+  if (!m_route_found) m_route.assign(1, start);
+  return m_route_found;
+}
+
+// 重なるなら何もしない, 置いた要素は管理クラスと見積もりへまとめて渡す
+bool InGameState::paste_blueprint(const glm::ivec2 origin) {
+  if (blueprint_overlaps(m_blueprint, origin, m_machine_manager,
+                         m_pipe_manager))
+    return false;
+
+  std::vector<std::shared_ptr<Machine>> machines;
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  instantiate_blueprint(m_blueprint, origin, &m_arena, machines, pipes);
+  m_machine_manager.add_machines(machines);
+  m_pipe_manager.add_pipes(pipes);
+  m_preview.add_entities(machines, pipes);
+
+  std::vector<WorldEntity> added;
+  added.reserve(machines.size() + pipes.size());
+  for (const auto& machine : machines) added.push_back({machine, nullptr});
+  for (const auto& pipe : pipes) added.push_back({nullptr, pipe});
+  m_history.commit(added, {});
+  return true;
+}
+
+// 壊せる機械を優先し, 無ければパイプを外す
+bool InGameState::remove_entity(const glm::ivec2 point) {
+  const auto machine = m_machine_manager.find_machine(point);
+  if (machine && machine->is_breakable()) {
+    remove_machine(machine);
+    m_history.commit({}, {{machine, nullptr}});
+    return true;
+  }
+
+  const auto pipe = m_pipe_manager.find_pipe(point);
+  if (pipe) {
+    remove_pipe(pipe);
+    m_history.commit({}, {{nullptr, pipe}});
+    return true;
+  }
+  return false;
+}
+
+// 版の差分を管理クラスと見積もりへまとめて反映する
+void InGameState::apply_world_diff(const std::vector<WorldEntity>& removed,
+                                   const std::vector<WorldEntity>& added) {
+  std::vector<std::shared_ptr<Machine>> machines;
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  for (const auto& entity : removed) {
+    if (entity.machine) machines.push_back(entity.machine);
+    if (entity.pipe) pipes.push_back(entity.pipe);
+  }
+  if (!machines.empty()) m_machine_manager.remove_machines(machines);
+  if (!pipes.empty()) m_pipe_manager.remove_pipes(pipes);
+  for (const auto& machine : machines) m_preview.remove_machine(machine);
+  for (const auto& pipe : pipes) m_preview.remove_pipe(pipe);
+
+  machines.clear();
+  pipes.clear();
+  for (const auto& entity : added) {
+    if (entity.machine) machines.push_back(entity.machine);
+    if (entity.pipe) pipes.push_back(entity.pipe);
+  }
+  m_machine_manager.add_machines(machines);
+  m_pipe_manager.add_pipes(pipes);
+  m_preview.add_entities(machines, pipes);
+
+  // 占有が変わったので経路は探し直す
+  m_route.clear();
+}
+
+void InGameState::undo() {
+  std::vector<WorldEntity> removed, added;
+  if (m_history.undo(removed, added)) apply_world_diff(removed, added);
+}
+
+void InGameState::redo() {
+  std::vector<WorldEntity> removed, added;
+  if (m_history.redo(removed, added)) apply_world_diff(removed, added);
+}
+
+void InGameState::scroll(DrawManagerBase* draw_manager) {
+  scroll_camera(draw_manager, m_camera);
+}
 
 State* InGameState::update(DrawManagerBase* draw_manager) {
   draw_manager->clear();
 
-  m_pipe_manager.draw(draw_manager);
-  m_machine_manager.draw(draw_manager);
+  m_pipe_manager.draw(draw_manager, m_camera);
+  m_machine_manager.draw(draw_manager, m_camera);
 
   draw_manager->capture_input();
 
+  scroll(draw_manager);
+  {
+    int x, y;
+    if (draw_manager->handle_input_hover(x, y)) m_cursor = glm::ivec2(x, y);
+  }
+
   if (draw_manager->handle_input_keycode(KEYCODE_TAB)) {
     if (m_mode == MODE_PLACE_PIPE || m_mode == MODE_LINK_PIPE) {
       m_mode = MODE_PLACE_MACHINE;
       m_mode_state.PlaceMachine = {MACHINE_ELECTROLYZER};
     } else if (m_mode == MODE_PLACE_MACHINE) {
+      m_mode = MODE_SELECT;
+      m_mode_state.Select = {0, 0, false};
+    } else if (m_mode == MODE_SELECT || m_mode == MODE_PASTE) {
       m_mode = MODE_PLACE_PIPE;
       m_mode_state.PlacePipe = {};
     }
@@ -119,11 +335,39 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
 
   if (draw_manager->handle_input_keycode(KEYCODE_RETURN)) {
     if (m_mode != MODE_EVALUATE) {
+      EvaluateContext cached;
+      if (get_evaluate_cache().find(get_evaluate_key(), &cached)) {
+        m_stats.items = cached.items;
+        m_stats.counts = cached.counts;
+        return new ResultState(m_stats);
+      }
+
       m_mode = MODE_EVALUATE;
       m_mode_state.Evaluate = {0};
+      start_evaluate();
     }
   }
 
+  if (draw_manager->handle_input_keycode(KEYCODE_P)) {
+    get_profiler().toggle_overlay();
+  }
+
+  // メモリ使用量 : M で表示切り替え, D でファイルへ書き出し
+  if (draw_manager->handle_input_keycode(KEYCODE_M)) {
+    m_footprint_visible = !m_footprint_visible;
+  }
+  if (draw_manager->handle_input_keycode(KEYCODE_D)) {
+    std::ofstream stream("footprint.txt", std::ios::trunc);
+    write_footprint_report(stream, get_footprint());
+  }
+
+  if (m_mode != MODE_EVALUATE) {
+    if (draw_manager->handle_input_keycode(KEYCODE_S)) save();
+    if (draw_manager->handle_input_keycode(KEYCODE_L)) load(get_layout_path());
+    if (draw_manager->handle_input_keycode(KEYCODE_Z)) undo();
+    if (draw_manager->handle_input_keycode(KEYCODE_Y)) redo();
+  }
+
   if (draw_manager->handle_input_keycode('R')) {
     if (m_mode != MODE_EVALUATE) {
       if (m_mode == MODE_RECIPE)
@@ -137,32 +381,59 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
     case MODE_PLACE_PIPE: {
       draw_manager->draw_label(1, draw_manager->get_height() - 2, "Place Pipe");
       draw_manager->draw_label(1, draw_manager->get_height() - 1,
-                               "LClick: Place, RClick: Remove, Tab: Change "
+                               "LClick: Start, RClick: Remove, Tab: Change "
                                "Mode, Enter: Submit, Esc: Quit, R: Recipe");
 
+      // 始点を決めて, 終点を選ぶモードへ
       int x, y;
       if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y)) {
-        const auto point = glm::ivec2(x, y);
+        const auto point = glm::ivec2(x, y) + m_camera;
 
-        // TODO
+        m_mode = MODE_LINK_PIPE;
+        m_mode_state.LinkPipe = {point.x, point.y};
+        m_route.clear();
       }
       break;
     }
     case MODE_LINK_PIPE: {
       draw_manager->draw_label(1, draw_manager->get_height() - 2, "Link Pipe");
       draw_manager->draw_label(1, draw_manager->get_height() - 1,
-                               "LClick: Place, RClick: Remove, Tab: Change "
+                               "LClick: Place, RClick: Cancel, Tab: Change "
                                "Mode, Enter: Submit, Esc: Quit, R: Recipe");
 
-      draw_manager->draw_label(m_mode_state.LinkPipe.x, m_mode_state.LinkPipe.y,
-                               "X");
-
+      // 終点で確定し, 折れ点ごとに直線のパイプを繋げて置く
       int x, y;
       if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y)) {
-        const auto point = glm::ivec2(x, y);
+        m_cursor = glm::ivec2(x, y);
+        if (update_route(m_cursor + m_camera)) {
+          std::vector<WorldEntity> added;
+          for (size_t i = 1; i < m_route.size(); ++i) {
+            const auto pipe = make_pipe(m_route[i - 1], m_route[i], &m_arena);
+            add_pipe(pipe);
+            added.push_back({nullptr, pipe});
+          }
+          m_history.commit(added, {});
+          m_mode = MODE_PLACE_PIPE;
+          m_mode_state.PlacePipe = {};
+          m_route.clear();
+          break;
+        }
+      }
 
-        // TODO
+      // マウスの位置までの経路を毎フレーム見せる
+      update_route(m_cursor + m_camera);
+      for (size_t i = 1; i < m_route.size(); ++i) {
+        const auto begin = m_route[i - 1] - m_camera;
+        const auto end = m_route[i] - m_camera;
+        draw_manager->draw_hv_line(begin.x, begin.y, end.x, end.y);
+      }
+      if (!m_route_found) {
+        draw_manager->draw_label(15, draw_manager->get_height() - 2,
+                                 "[No Route]");
       }
+
+      draw_manager->draw_label(m_mode_state.LinkPipe.x - m_camera.x,
+                               m_mode_state.LinkPipe.y - m_camera.y, "X");
       break;
     }
     case MODE_PLACE_MACHINE: {
@@ -199,27 +470,84 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
       }
 
       int x, y;
-      if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y)) {
-        const auto point = glm::ivec2(x, y);
-
+      glm::ivec2 point;
+      if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y) &&
+          find_machine_slot(glm::ivec2(x, y) + m_camera, &point)) {
+        std::shared_ptr<Machine> machine;
         if (m_mode_state.PlaceMachine.machine == MACHINE_ELECTROLYZER) {
-          const auto machine =
-              std::make_shared<Electrolyzer>(Electrolyzer(point));
-          m_machine_manager.add_machine(machine);
+          machine = make_entity<Electrolyzer>(&m_arena, point);
         } else if (m_mode_state.PlaceMachine.machine == MACHINE_CUTTER) {
-          const auto machine = std::make_shared<Cutter>(Cutter(point));
-          m_machine_manager.add_machine(machine);
+          machine = make_entity<Cutter>(&m_arena, point);
         } else if (m_mode_state.PlaceMachine.machine == MACHINE_LAZER) {
-          const auto machine = std::make_shared<Laser>(Laser(point));
-          m_machine_manager.add_machine(machine);
+          machine = make_entity<Laser>(&m_arena, point);
         } else if (m_mode_state.PlaceMachine.machine == MACHINE_ASSEMBLER) {
-          const auto machine = std::make_shared<Assembler>(Assembler(point));
-          m_machine_manager.add_machine(machine);
+          machine = make_entity<Assembler>(&m_arena, point);
+        }
+        if (machine) {
+          add_machine(machine);
+          m_history.commit({{machine, nullptr}}, {});
         }
       }
 
       break;
     }
+    case MODE_SELECT: {
+      draw_manager->draw_label(1, draw_manager->get_height() - 2, "Select");
+      draw_manager->draw_label(1, draw_manager->get_height() - 1,
+                               "LClick: Corner, RClick: Cancel, Tab: Change "
+                               "Mode, Enter: Submit, Esc: Quit, R: Recipe");
+
+      // 1 回目で角を決め, 2 回目で矩形の中身を写して貼り付けへ
+      int x, y;
+      if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y)) {
+        const auto point = glm::ivec2(x, y) + m_camera;
+        if (!m_mode_state.Select.anchored) {
+          m_mode_state.Select = {point.x, point.y, true};
+        } else if (capture_blueprint(
+                       m_machine_manager, m_pipe_manager,
+                       glm::ivec2(m_mode_state.Select.x,
+                                  m_mode_state.Select.y),
+                       point, &m_blueprint)) {
+          m_mode = MODE_PASTE;
+          break;
+        } else {
+          m_mode_state.Select = {0, 0, false};
+        }
+      }
+
+      if (m_mode_state.Select.anchored) {
+        const auto anchor =
+            glm::ivec2(m_mode_state.Select.x, m_mode_state.Select.y) -
+            m_camera;
+        const int x0 = std::min(anchor.x, m_cursor.x);
+        const int y0 = std::min(anchor.y, m_cursor.y);
+        const int x1 = std::max(anchor.x, m_cursor.x);
+        const int y1 = std::max(anchor.y, m_cursor.y);
+        draw_manager->draw_line_box(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+      }
+      break;
+    }
+    case MODE_PASTE: {
+      draw_manager->draw_label(1, draw_manager->get_height() - 2, "Paste");
+      draw_manager->draw_label(1, draw_manager->get_height() - 1,
+                               "LClick: Paste, RClick: Reselect, Tab: Change "
+                               "Mode, Enter: Submit, Esc: Quit, R: Recipe");
+
+      // 続けて何度でも貼れるようにモードは保つ
+      int x, y;
+      if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y)) {
+        m_cursor = glm::ivec2(x, y);
+        paste_blueprint(m_cursor + m_camera);
+      }
+
+      draw_blueprint(m_blueprint, m_cursor, draw_manager);
+      if (blueprint_overlaps(m_blueprint, m_cursor + m_camera,
+                             m_machine_manager, m_pipe_manager)) {
+        draw_manager->draw_label(15, draw_manager->get_height() - 2,
+                                 "[Blocked]");
+      }
+      break;
+    }
   }
 
   if (m_mode != MODE_EVALUATE && m_mode != MODE_RECIPE) {
@@ -228,26 +556,45 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
       if (m_mode == MODE_LINK_PIPE) {
         m_mode = MODE_PLACE_PIPE;
         m_mode_state.PlacePipe = {};
+      } else if (m_mode == MODE_SELECT || m_mode == MODE_PASTE) {
+        m_mode = MODE_SELECT;
+        m_mode_state.Select = {0, 0, false};
+      } else {
+        remove_entity(glm::ivec2(x, y) + m_camera);
       }
-
-      // TODO: delete machine or pipe
     }
   }
 
   if (m_mode == MODE_EVALUATE) {
+    // 速度倍率 : Max -> x1 -> x4 -> x16 -> Max
+    if (draw_manager->handle_input_keycode(KEYCODE_F)) {
+      int& speed = m_mode_state.Evaluate.speed;
+      speed = speed == 0 ? 1 : (speed >= 16 ? 0 : speed * 4);
+      m_evaluate_worker.set_speed(speed);
+    }
+
+    const auto progress = m_evaluate_worker.get_progress();
+
     std::ostringstream status_stream;
     status_stream << "Evaluating... : " << std::setprecision(2) << std::fixed
-                  << (static_cast<float>(m_mode_state.Evaluate.time_count) /
-                      60.0f)
-                  << " / 3.00";
+                  << (static_cast<float>(progress.tick) /
+                      EVALUATE_TICKS_PER_SECOND)
+                  << " / "
+                  << (static_cast<float>(progress.total_ticks) /
+                      EVALUATE_TICKS_PER_SECOND);
+    if (m_mode_state.Evaluate.speed == 0)
+      status_stream << " [Max]";
+    else
+      status_stream << " [x" << m_mode_state.Evaluate.speed << "]";
+    status_stream << " F: Speed";
     std::string status = status_stream.str();
 
-    draw_manager->draw_label_box(50, 1, status);
+    draw_manager->draw_label_box(40, 1, status);
 
-    m_mode_state.Evaluate.time_count++;
-    if (m_mode_state.Evaluate.time_count <= 60 * 3) {
-      // m_machine_manager.evaluate(&m_stats, m_rng);
-    } else {
+    if (progress.done) {
+      m_stats.items = progress.items;
+      m_stats.counts = progress.counts;
+      get_evaluate_cache().insert(get_evaluate_key(), m_stats);
       return new ResultState(m_stats);
     }
   }
@@ -281,6 +628,26 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
     draw_manager->draw_label(52, 16, "Output : Chip");
   }
 
+  // throughput preview
+  if (m_mode != MODE_EVALUATE && m_mode != MODE_RECIPE) {
+    m_preview.update();
+
+    // 画面に入る行だけ文字列にする
+    const auto& rates = m_preview.get_rates();
+    const auto rows = static_cast<size_t>(
+        std::max(draw_manager->get_height() - 6, 0));
+    for (size_t i = 0; i < rates.size() && i < rows; ++i) {
+      std::ostringstream rate_stream;
+      rate_stream << item_to_string(rates[i].item) << " : "
+                  << std::setprecision(2) << std::fixed << rates[i].rate
+                  << " /s";
+      std::string rate = rate_stream.str();
+      draw_manager->draw_label(
+          draw_manager->get_width() - 2 - static_cast<int>(rate.size()),
+          1 + static_cast<int>(i), rate);
+    }
+  }
+
   // timer
   std::ostringstream time_stream;
   time_stream << "Time : " << (m_stats.design_time / 60) << ":" << std::setw(2)
@@ -294,6 +661,16 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
                               draw_manager->get_height() - 2);
   draw_manager->draw_label_box(1, 1, "IN-GAME");
 
+  std::ostringstream camera_stream;
+  camera_stream << "Camera : " << m_camera.x << ", " << m_camera.y
+                << "  Arrows/MDrag: Scroll, Z/Y: Undo/Redo";
+  draw_manager->draw_label(11, 1, camera_stream.str());
+
+  draw_profile_overlay(draw_manager);
+  if (m_footprint_visible) {
+    draw_footprint_overlay(draw_manager, get_footprint());
+  }
+
   draw_manager->present();
 
   if (draw_manager->handle_input_keycode(KEYCODE_ESCAPE)) {
@@ -303,6 +680,75 @@ State* InGameState::update(DrawManagerBase* draw_manager) {
   return this;
 }
 
+// CHUNK VIEW STATE
+
+ChunkViewState::ChunkViewState(const std::string& path,
+                               const int64_t budget_bytes)
+    : m_file(), m_pager(), m_camera(0, 0), m_footprint_visible(false) {
+  if (m_file.open(path)) {
+    m_pager = std::make_unique<ChunkPager>(&m_file, budget_bytes);
+  }
+}
+
+ChunkViewState::~ChunkViewState() = default;
+
+State* ChunkViewState::update(DrawManagerBase* draw_manager) {
+  draw_manager->clear();
+
+  // 表示範囲は HUD の枠の内側
+  const DrawRect view{m_camera.x, m_camera.y,
+                      m_camera.x + draw_manager->get_width() - 1,
+                      m_camera.y + draw_manager->get_height() - 3};
+  if (m_pager) {
+    ProfileScope scope(PROFILE_CHUNK_PAGE);
+    m_pager->request_view(view);
+    m_pager->update();
+    m_pager->draw(draw_manager, m_camera);
+  }
+
+  draw_manager->capture_input();
+  scroll_camera(draw_manager, m_camera);
+
+  if (draw_manager->handle_input_keycode(KEYCODE_P)) {
+    get_profiler().toggle_overlay();
+  }
+  if (draw_manager->handle_input_keycode(KEYCODE_M)) {
+    m_footprint_visible = !m_footprint_visible;
+  }
+
+  draw_manager->draw_line_box(0, 0, draw_manager->get_width(),
+                              draw_manager->get_height() - 2);
+  draw_manager->draw_label_box(1, 1, "CHUNKS");
+
+  std::ostringstream camera_stream;
+  camera_stream << "Camera : " << m_camera.x << ", " << m_camera.y
+                << "  Arrows/MDrag: Scroll, Esc: Quit";
+  draw_manager->draw_label(10, 1, camera_stream.str());
+
+  std::ostringstream status_stream;
+  if (m_pager) {
+    const auto stats = m_pager->get_stats();
+    status_stream << "Resident : " << stats.resident_chunks << " chunks, "
+                  << std::fixed << std::setprecision(1)
+                  << stats.resident_bytes / (1024.0 * 1024.0) << " MiB"
+                  << "  Loading : " << stats.pending_chunks
+                  << "  Page-ins : " << stats.page_ins
+                  << "  Evictions : " << stats.evictions;
+  } else {
+    status_stream << "[Failed to open chunk file]";
+  }
+  draw_manager->draw_label(1, draw_manager->get_height() - 1,
+                           status_stream.str());
+
+  draw_profile_overlay(draw_manager);
+  if (m_footprint_visible) draw_footprint_overlay(draw_manager, {});
+
+  draw_manager->present();
+
+  if (draw_manager->handle_input_keycode(KEYCODE_ESCAPE)) return nullptr;
+  return this;
+}
+
 // RESULT STATE
 
 ResultState::ResultState(const EvaluateContext stats) : m_stats(stats) {}
@@ -323,32 +769,24 @@ State* ResultState::update(DrawManagerBase* draw_manager) {
   draw_manager->draw_label(30, 14, time);
 
   // score
-  bool is_perfect = true;
-  bool is_bad_inv = false;
-  float score_value = 0.0f;
   for (size_t i = 0; i < m_stats.items.size(); ++i) {
     std::ostringstream line_stream;
     line_stream << item_to_string(m_stats.items[i]) << " : "
                 << m_stats.counts[i] << " unit.";
     std::string line = line_stream.str();
     draw_manager->draw_label(30, 16 + static_cast<int>(i), line);
-
-    is_perfect &= (m_stats.counts[i] > 0);
-    is_bad_inv |= (m_stats.counts[i] > 0);
-
-    score_value += static_cast<float>(m_stats.counts[i]);
   }
-  score_value *= (static_cast<float>(m_stats.design_time) / 3600.0f);
+  const auto score = get_evaluate_score(m_stats);
+  const bool is_bad_inv = score.grade != GRADE_BAD;
   std::ostringstream score_stream;
   score_stream << "Score : " << std::setprecision(2) << std::fixed
-               << score_value;
-  std::string score = score_stream.str();
-  draw_manager->draw_label(30, 12, score);
+               << score.value;
+  draw_manager->draw_label(30, 12, score_stream.str());
 
   // grade
-  if (!is_bad_inv)
+  if (score.grade == GRADE_BAD)
     draw_manager->draw_label(43, 10, "Bad...");
-  else if (!is_perfect)
+  else if (score.grade == GRADE_GOOD)
     draw_manager->draw_label(43, 10, "Good!");
   else
     draw_manager->draw_label(43, 10, "Perfect!!!");
@@ -363,8 +801,8 @@ State* ResultState::update(DrawManagerBase* draw_manager) {
   draw_manager->capture_input();
 
   if (draw_manager->handle_input_keycode(KEYCODE_RETURN)) {
-    if (m_stats.stage == 1 && is_bad_inv)
-      return new InGameState(2);
+    if (is_bad_inv && find_stage(m_stats.stage + 1) != nullptr)
+      return new InGameState(m_stats.stage + 1);
     else
       return nullptr;
   }
@@ -375,8 +813,8 @@ State* ResultState::update(DrawManagerBase* draw_manager) {
 
   int x, y;
   if (draw_manager->handle_input_mouse(MOUSE_LCLICK, x, y)) {
-    if (m_stats.stage == 1 && is_bad_inv)
-      return new InGameState(2);
+    if (is_bad_inv && find_stage(m_stats.stage + 1) != nullptr)
+      return new InGameState(m_stats.stage + 1);
     else
       return nullptr;
   }
@@ -0,0 +1,286 @@
+#include "telemetry.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace factory_game {
+
+// 圧縮は列ごとの差分を zigzag 符号化した可変長整数で表す
+static void put_varint(std::vector<uint8_t>& out, const int64_t value) {
+  uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^
+                    static_cast<uint64_t>(value >> 63);
+  while (zigzag >= 0x80) {
+    out.push_back(static_cast<uint8_t>(zigzag) | 0x80);
+    zigzag >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(zigzag));
+}
+
+static bool get_varint(const uint8_t*& cursor, const uint8_t* end,
+                       int64_t* value) {
+  uint64_t zigzag = 0;
+  for (int shift = 0; cursor < end && shift < 64; shift += 7) {
+    const uint8_t byte = *cursor++;
+    zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = static_cast<int64_t>(zigzag >> 1) ^
+               -static_cast<int64_t>(zigzag & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+static void put_column(std::vector<uint8_t>& out, const T* values,
+                       const uint32_t count) {
+  int64_t previous = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    put_varint(out, static_cast<int64_t>(values[i]) - previous);
+    previous = values[i];
+  }
+}
+
+template <typename T>
+static bool get_column(const uint8_t*& cursor, const uint8_t* end, T* values,
+                       const uint32_t count) {
+  int64_t previous = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    int64_t delta;
+    if (!get_varint(cursor, end, &delta)) return false;
+    previous += delta;
+    values[i] = static_cast<T>(previous);
+  }
+  return true;
+}
+
+template <typename T>
+static void put_raw_column(std::vector<uint8_t>& out, const T* values,
+                           const uint32_t count) {
+  const auto bytes = reinterpret_cast<const uint8_t*>(values);
+  out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template <typename T>
+static bool get_raw_column(const uint8_t*& cursor, const uint8_t* end,
+                           T* values, const uint32_t count) {
+  const size_t size = count * sizeof(T);
+  if (static_cast<size_t>(end - cursor) < size) return false;
+  std::memcpy(values, cursor, size);
+  cursor += size;
+  return true;
+}
+
+// TRACE BUFFER
+
+TraceBuffer::TraceBuffer(TraceSink* sink)
+    : m_sink(sink),
+      m_blocks{std::make_unique<TraceBlock>(), std::make_unique<TraceBlock>()},
+      m_pending{false, false},
+      m_front(0),
+      m_run(0) {
+  m_blocks[0]->count = 0;
+  m_blocks[1]->count = 0;
+}
+
+TraceBuffer::~TraceBuffer() = default;
+
+// 書き込み中のブロックを渡し, 書き出しの済んだもう片方へ切り替える
+void TraceBuffer::swap() {
+  m_sink->submit(this, m_front);
+  m_front ^= 1;
+  m_sink->wait(this, m_front);
+}
+
+// TRACE SINK
+
+TraceSink::TraceSink() : m_compress(false), m_stop(false) {}
+
+TraceSink::~TraceSink() { close(); }
+
+bool TraceSink::open(const std::string& path, const bool compress) {
+  close();
+
+  m_stream.open(path, std::ios::binary | std::ios::trunc);
+  if (!m_stream) return false;
+
+  const TraceHeader header = {TRACE_MAGIC, TRACE_VERSION,
+                              compress ? TRACE_FLAG_COMPRESSED : 0, 0};
+  m_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  m_compress = compress;
+  m_stop = false;
+  m_thread = std::thread(&TraceSink::run, this);
+  return true;
+}
+
+void TraceSink::close() {
+  if (!m_thread.joinable()) return;
+
+  for (const auto& buffer : m_buffers) {
+    if (buffer->m_blocks[buffer->m_front]->count > 0) {
+      submit(buffer.get(), buffer->m_front);
+    }
+  }
+
+  {
+    std::lock_guard lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+  m_thread.join();
+
+  m_buffers.clear();
+  m_stream.close();
+}
+
+bool TraceSink::is_open() const { return m_thread.joinable(); }
+
+TraceBuffer* TraceSink::acquire_buffer() {
+  if (!is_open()) return nullptr;
+
+  std::lock_guard lock(m_mutex);
+  m_buffers.push_back(std::make_unique<TraceBuffer>(this));
+  return m_buffers.back().get();
+}
+
+// 残りを書き出してから手放す
+void TraceSink::release_buffer(TraceBuffer* buffer) {
+  if (buffer == nullptr) return;
+
+  if (buffer->m_blocks[buffer->m_front]->count > 0) {
+    submit(buffer, buffer->m_front);
+  }
+  wait(buffer, 0);
+  wait(buffer, 1);
+
+  std::lock_guard lock(m_mutex);
+  m_buffers.erase(
+      std::find_if(m_buffers.begin(), m_buffers.end(),
+                   [&](const auto& other) { return other.get() == buffer; }));
+}
+
+void TraceSink::submit(TraceBuffer* buffer, const int index) {
+  {
+    std::lock_guard lock(m_mutex);
+    buffer->m_pending[index] = true;
+    m_jobs.push_back(Job{buffer, index});
+  }
+  m_condition.notify_all();
+}
+
+void TraceSink::wait(TraceBuffer* buffer, const int index) {
+  std::unique_lock lock(m_mutex);
+  m_condition.wait(lock, [&] { return !buffer->m_pending[index]; });
+}
+
+void TraceSink::run() {
+  std::unique_lock lock(m_mutex);
+  while (true) {
+    m_condition.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+    if (m_jobs.empty()) break;
+
+    const auto job = m_jobs.front();
+    m_jobs.pop_front();
+
+    lock.unlock();
+    auto& block = *job.buffer->m_blocks[job.index];
+    write_block(block);
+    block.count = 0;
+    lock.lock();
+
+    job.buffer->m_pending[job.index] = false;
+    m_condition.notify_all();
+  }
+}
+
+void TraceSink::write_block(const TraceBlock& block) {
+  m_scratch.clear();
+
+  if (m_compress) {
+    put_column(m_scratch, block.tick, block.count);
+    put_column(m_scratch, block.node, block.count);
+    put_column(m_scratch, block.fill, block.count);
+    put_column(m_scratch, block.busy, block.count);
+    put_column(m_scratch, block.delivered, block.count);
+    put_column(m_scratch, block.run, block.count);
+  } else {
+    put_raw_column(m_scratch, block.tick, block.count);
+    put_raw_column(m_scratch, block.node, block.count);
+    put_raw_column(m_scratch, block.fill, block.count);
+    put_raw_column(m_scratch, block.busy, block.count);
+    put_raw_column(m_scratch, block.delivered, block.count);
+    put_raw_column(m_scratch, block.run, block.count);
+  }
+
+  const TraceBlockHeader header = {block.count,
+                                   static_cast<uint32_t>(m_scratch.size())};
+  m_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  m_stream.write(reinterpret_cast<const char*>(m_scratch.data()),
+                 static_cast<std::streamsize>(m_scratch.size()));
+}
+
+TraceSink& get_trace_sink() {
+  static TraceSink sink;
+  return sink;
+}
+
+// READER
+
+bool read_trace(const std::string& path,
+                const std::function<void(const TraceRecord&)>& callback) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) return false;
+
+  TraceHeader header;
+  if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != TRACE_MAGIC || header.version != TRACE_VERSION)
+    return false;
+
+  const bool compressed = header.flags & TRACE_FLAG_COMPRESSED;
+  auto block = std::make_unique<TraceBlock>();
+  std::vector<uint8_t> payload;
+
+  TraceBlockHeader block_header;
+  while (stream.read(reinterpret_cast<char*>(&block_header),
+                     sizeof(block_header))) {
+    if (block_header.count > TRACE_BLOCK_RECORDS) return false;
+
+    payload.resize(block_header.size);
+    if (!stream.read(reinterpret_cast<char*>(payload.data()),
+                     block_header.size))
+      return false;
+
+    const uint8_t* cursor = payload.data();
+    const uint8_t* end = payload.data() + payload.size();
+    const uint32_t count = block_header.count;
+
+    bool ok;
+    if (compressed) {
+      ok = get_column(cursor, end, block->tick, count) &&
+           get_column(cursor, end, block->node, count) &&
+           get_column(cursor, end, block->fill, count) &&
+           get_column(cursor, end, block->busy, count) &&
+           get_column(cursor, end, block->delivered, count) &&
+           get_column(cursor, end, block->run, count);
+    } else {
+      ok = get_raw_column(cursor, end, block->tick, count) &&
+           get_raw_column(cursor, end, block->node, count) &&
+           get_raw_column(cursor, end, block->fill, count) &&
+           get_raw_column(cursor, end, block->busy, count) &&
+           get_raw_column(cursor, end, block->delivered, count) &&
+           get_raw_column(cursor, end, block->run, count);
+    }
+    if (!ok) return false;
+
+    for (uint32_t i = 0; i < count; ++i) {
+      callback(TraceRecord{block->tick[i], block->node[i], block->fill[i],
+                           block->busy[i], block->delivered[i],
+                           block->run[i]});
+    }
+  }
+
+  return true;
+}
+
+}  // namespace factory_game
\ No newline at end of file
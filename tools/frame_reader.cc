@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "frame_export.h"
+
+// --export-frames で書き出した画面を読む見本
+// 既定では新しいフレームを count 枚, 見出しの行に続けて書き出す
+// --mirror なら端末の左上から描き直し続ける
+int main(const int argc, char** argv) {
+  std::string name;
+  int count = 1;
+  bool mirror = false;
+  int timeout_ms = 5000;  // 新しいフレームが来ない間, 待つ時間
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--mirror") == 0)
+      mirror = true;
+    else if (std::strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+      count = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--timeout-ms") == 0 && i + 1 < argc)
+      timeout_ms = std::atoi(argv[++i]);
+    else
+      name = argv[i];
+  }
+  if (name.empty()) {
+    std::cerr << "usage: factory_frame_reader <name> [--count N] [--mirror] "
+                 "[--timeout-ms T]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (mirror && count == 1) count = 0;  // 0 : 止めるまで読む
+
+  using clock = std::chrono::steady_clock;
+  const auto timeout = std::chrono::milliseconds(timeout_ms);
+
+  // 書き手より先に起動してもよいよう, 作られるまで待つ
+  factory_game::FrameReader reader;
+  auto waited = clock::now();
+  while (!reader.open(name)) {
+    if (clock::now() - waited > timeout) {
+      std::cerr << "failed to open frame export: " << name << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  factory_game::ExportedFrame frame;
+  uint64_t last = reader.get_latest();  // 起動前のフレームは読まない
+  int read = 0;
+  uint64_t dropped = 0;
+  waited = clock::now();
+  while (count == 0 || read < count) {
+    if (!reader.read_latest(last, &frame)) {
+      if (clock::now() - waited > timeout) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      continue;
+    }
+    if (read > 0) dropped += frame.frame - last - 1;
+    last = frame.frame;
+    read++;
+    waited = clock::now();
+
+    if (mirror)
+      std::cout << "\x1b[H";
+    else
+      std::cout << "# frame " << frame.frame << " " << frame.width << "x"
+                << frame.height << " " << frame.timestamp << "\n";
+    for (int y = 0; y < frame.height; ++y) {
+      std::cout.write(&frame.cells[y * frame.width], frame.width);
+      if (!mirror || y + 1 < frame.height) std::cout << "\n";
+    }
+    std::cout << std::flush;
+  }
+
+  std::cerr << "frames: " << read << " dropped: " << dropped << std::endl;
+  return read > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,56 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "chunk.h"
+#include "generate.h"
+#include "layout.h"
+
+// 生成したレイアウトを L キーや InGameState::load で読めるファイルへ書き出す
+int main(const int argc, char** argv) {
+  factory_game::GenerateOptions options;
+  int stage = 1;
+  std::string out_path = "stage1.fgl";
+  bool chunked = false;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::strcmp(argv[i], "--seed") == 0)
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    else if (std::strcmp(argv[i], "--machines") == 0)
+      options.machine_count = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--density") == 0)
+      options.density = static_cast<float>(std::atof(argv[++i]));
+    else if (std::strcmp(argv[i], "--depth") == 0)
+      options.chain_depth = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--l-shape") == 0)
+      options.l_shape_ratio = static_cast<float>(std::atof(argv[++i]));
+    else if (std::strcmp(argv[i], "--stage") == 0)
+      stage = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--out") == 0)
+      out_path = argv[++i];
+    else if (std::strcmp(argv[i], "--chunks") == 0)
+      chunked = std::atoi(argv[++i]) != 0;
+  }
+
+  const auto layout = factory_game::generate_layout(options);
+
+  factory_game::MachineManager machine_manager;
+  factory_game::PipeManager pipe_manager;
+  factory_game::load_generated_layout(layout, machine_manager, pipe_manager);
+
+  // --chunks 1 なら factory_game --chunks で眺めるチャンクファイルにする
+  const bool saved =
+      chunked ? factory_game::save_chunk_file(out_path, stage, machine_manager,
+                                              pipe_manager)
+              : factory_game::save_layout(out_path, stage, machine_manager,
+                                          pipe_manager);
+  if (!saved) {
+    std::cerr << "failed to write layout: " << out_path << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << out_path << ": " << layout.machines.size() << " machines, "
+            << layout.pipes.size() << " pipes, " << layout.size.x << "x"
+            << layout.size.y << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "layout.h"
+#include "optimize.h"
+#include "stage.h"
+
+// 上位 i 番目のレイアウトの書き出し先, 最良は out_path そのもの
+static std::string get_rank_path(const std::string& out_path, const int rank) {
+  if (rank == 0) return out_path;
+
+  const auto dot = out_path.rfind('.');
+  if (dot == std::string::npos) return out_path + "." + std::to_string(rank);
+  return out_path.substr(0, dot) + "." + std::to_string(rank) +
+         out_path.substr(dot);
+}
+
+// ステージの設計を探し, 上位のレイアウトを L キーや InGameState::load で
+// 読めるファイルへ書き出す
+int main(const int argc, char** argv) {
+  factory_game::OptimizeOptions options;
+  int stage_id = 2;
+  std::string out_path;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::strcmp(argv[i], "--stage") == 0)
+      stage_id = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--seed") == 0)
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    else if (std::strcmp(argv[i], "--threads") == 0)
+      options.threads = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--epochs") == 0)
+      options.epochs = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--iterations") == 0)
+      options.iterations = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--machines") == 0)
+      options.max_machines = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--keep") == 0)
+      options.keep = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "--out") == 0)
+      out_path = argv[++i];
+  }
+  if (out_path.empty()) out_path = "stage" + std::to_string(stage_id) + ".fgl";
+
+  const auto stage = factory_game::find_stage(stage_id);
+  if (stage == nullptr) {
+    std::cerr << "unknown stage: " << stage_id << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const auto result = factory_game::optimize_stage(
+      *stage, options, [](const factory_game::OptimizeProgress& progress) {
+        std::cout << "epoch " << progress.epoch << ": score " << std::fixed
+                  << std::setprecision(2) << progress.best_score.value
+                  << " (grade " << progress.best_score.grade << ", objective "
+                  << progress.best_objective << "), " << progress.evaluations
+                  << " evaluations, "
+                  << progress.cache_hits << " cached, "
+                  << static_cast<int64_t>(progress.evaluations /
+                                          progress.seconds)
+                  << "/s" << std::endl;
+      });
+
+  for (size_t i = 0; i < result.best.size(); ++i) {
+    const auto& candidate = result.best[i];
+    const auto path = get_rank_path(out_path, static_cast<int>(i));
+
+    factory_game::MachineManager machine_manager;
+    factory_game::PipeManager pipe_manager;
+    factory_game::build_optimize_layout(*stage, candidate.layout,
+                                        machine_manager, pipe_manager);
+    if (!factory_game::save_layout(path, stage_id, machine_manager,
+                                   pipe_manager)) {
+      std::cerr << "failed to write layout: " << path << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::cout << path << ": score " << std::fixed << std::setprecision(2)
+              << candidate.score.value << ", "
+              << machine_manager.get_machines().size() << " machines, "
+              << pipe_manager.get_pipes().size() << " pipes" << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
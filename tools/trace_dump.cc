@@ -0,0 +1,27 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "telemetry.h"
+
+// トレースファイルを CSV として標準出力へ書き出す
+int main(const int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "usage: factory_trace_dump <trace>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "run,tick,node,fill,busy,delivered\n";
+  const bool ok =
+      factory_game::read_trace(argv[1], [](const auto& record) {
+        std::cout << record.run << "," << record.tick << "," << record.node
+                  << "," << record.fill << ","
+                  << static_cast<int>(record.busy) << "," << record.delivered
+                  << "\n";
+      });
+
+  if (!ok) {
+    std::cerr << "failed to read trace: " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
\ No newline at end of file